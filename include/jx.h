@@ -62,9 +62,44 @@ typedef struct jx_s {
 /* In arrays, we use the 4 bytes before JX_END_POINTER to store the length */
 #define JX_ARRAY_LENGTH(j)	(((__uint32_t *)&JX_END_POINTER(j))[-1])
 
-/* These are used to stuff a binary double or int into a JX_NUMBER*/
+/* These are used to stuff a binary double or int into a JX_NUMBER.  Binary
+ * integers are 64 bits, so the two share the same last 8 bytes of the jx_t.
+ */
 #define JX_DOUBLE(j)	(((double *)((j) + 1))[-1])
-#define JX_INT(j)	(((int *)((j) + 1))[-1])
+#define JX_INT(j)	(((long long *)((j) + 1))[-1])
+
+/* JX_NUMBER nodes that store their value as text also have a bit of extra
+ * space after the text, where jx_double() and jx_int() cache the binary
+ * value so the digits only need to be parsed once.  The byte after the
+ * text's terminating '\0' is 0 until the value is cached, and then 'i' for
+ * an integer or 'd' for a double.  The value is at the next 8-byte boundary.
+ * These macros take the text's length as a parameter because the caller
+ * usually knows it already.
+ */
+#define JX_NUMBER_CACHE_OFFSET(len) ((sizeof(jx_t) - sizeof(((jx_t *)0)->text) + (len) + 2 + 7) & ~(size_t)7)
+#define JX_NUMBER_CACHE_FLAG(j, len)	((j)->text[(len) + 1])
+#define JX_NUMBER_CACHE_INT(j, len)	(*(long long *)((char *)(j) + JX_NUMBER_CACHE_OFFSET(len)))
+#define JX_NUMBER_CACHE_DOUBLE(j, len)	(*(double *)((char *)(j) + JX_NUMBER_CACHE_OFFSET(len)))
+
+/* JX_STRING nodes use the same trick to cache whether the string is a date,
+ * time, datetime, or period.  The byte after the '\0' is a jxstrclass_t,
+ * with JX_STRING_CACHE_PARSED added once the parsed value has been stored
+ * too.  Only strings whose length satisfies JX_STRING_CACHE_ROOM() have
+ * room for the parsed value, within the padding that jx_simple() adds.
+ */
+typedef enum {
+	JX_STRCLASS_UNKNOWN,	/* not classified yet */
+	JX_STRCLASS_OTHER,	/* not a date, time, datetime, or period */
+	JX_STRCLASS_DATE,
+	JX_STRCLASS_TIME,
+	JX_STRCLASS_DATETIME,
+	JX_STRCLASS_PERIOD
+} jxstrclass_t;
+#define JX_STRING_CACHE_FLAG(j, len)	((j)->text[(len) + 1])
+#define JX_STRING_CACHE_PARSED	0x10
+#define JX_STRING_CACHE_ROOM(len)	(JX_NUMBER_CACHE_OFFSET(len) + sizeof(long long) <= (((sizeof(jx_t) - sizeof(((jx_t *)0)->text) + (len) + 1) | 0x1f) + 1))
+#define JX_STRING_CACHE_VALUE(j, len)	(*(long long *)((char *)(j) + JX_NUMBER_CACHE_OFFSET(len)))
+
 /* This stores info about formatting -- mostly output formatting, since for
  * input we take whatever we're given.
  */
@@ -96,6 +131,7 @@ typedef struct {
         int expr;       /* Output information about simple expressions */
         int calc;       /* Output information about complex expressions */
         int trace;      /* Trace commands as they're run */
+        int profile;    /* Collect profiling data for jx_calc()/jx_cmd_run() */
 } jx_debug_t;
 
 extern jx_debug_t jx_debug_flags;
@@ -113,6 +149,7 @@ typedef struct jxfile_s {
 	struct jxfile_s *other;/* Used to for a linked list */
 	int		fd;	/* File descriptor of the open file */
 	int		isfile;	/* Boolean: is this a regular file (not pipe, etc) */
+	int		partial;/* Boolean: pipe has more data to read */
 	int		refs;	/* Reference count */
 	size_t		size;	/* Size of the file, in bytes */
 	const char	*base;	/* Contents of the file, as a giant string */
@@ -134,6 +171,9 @@ typedef struct {
 	void	(*free)(jx_t *array_or_elem);	/* Only if special needs */
 	jx_t	*(*byindex)(jx_t *array, int index);
 	jx_t	*(*bykeyvalue)(jx_t *array, const char *key, jx_t *value);
+	void	(*copy)(jx_t *array);		/* Only if special needs */
+	jx_t	*(*undefer)(jx_t *array);	/* Only if it can avoid copying */
+	int	(*append)(jx_t *array, jx_t *more); /* Only if it can avoid undeferring */
 } jxdeffns_t;
 
 /* This is the generic part of a JX_DEFER node.  It starts with plain jx_t,
@@ -147,6 +187,26 @@ typedef struct {
 	jxfile_t *file; /* if non-NULL, it indicates which file to read */
 } jxdef_t;
 
+/* This is the state of a scan that splits streamed text into the elements of
+ * a JSON array or of NDJSON, as the text arrives.  It is used for pipes, and
+ * plugins can use it for other streams.  The owner supplies a "fill" function
+ * which adds text via jx_stream_room() and returns 1, or returns 0 at the end.
+ * The owner's own state generally follows this in a larger struct.
+ */
+typedef struct jxstreamscan_s {
+	char	*buf;		/* Unparsed text */
+	size_t	size;		/* Allocated size of buf */
+	size_t	used;		/* Bytes of text in buf */
+	size_t	start;		/* Offset in buffer of the current element */
+	size_t	scanned;	/* Offset in buffer of the next unscanned byte */
+	int	depth;		/* Nesting depth of [] and {} */
+	int	instring;	/* Inside a quoted string? */
+	int	escape;		/* Previous byte was a backslash in a string? */
+	int	ended;		/* Seen the "]" of a JSON array? */
+	char	format;		/* '[' for a JSON array, 'n' for NDJSON, or 0 */
+	int	(*fill)(struct jxstreamscan_s *scan); /* Add text, or return 0 */
+} jxstreamscan_t;
+
 /* This is a list of token types.  Nearly all of them are operators.
  * IF YOU MAKE ANY CHANGES HERE, THEN YOU MUST ALSO UPDATE THE operators[]
  * ARRAY IN calcparse.c
@@ -246,7 +306,7 @@ typedef struct jxcalc_s{
                         size_t agoffset;                /* If aggregate, this is the offset of its agdata */
                 } func;
                 struct {
-			void	*preg;
+			void	*preg;	/* really a jxregex_t */
 			int	global;
                 } regex;
                 struct jxag_s *ag;
@@ -284,10 +344,25 @@ char jx_file_new_type;
 void jx_file_defer(jxfile_t *jf, jx_t *array);
 void jx_file_defer_free(jx_t *array);
 jxfile_t *jx_file_load(const char *filename);
+jxfile_t *jx_file_load_partial(const char *filename, size_t limit);
+void jx_file_load_rest(jxfile_t *jf);
 void jx_file_unload(jxfile_t *jf);
 jxfile_t *jx_file_containing(const char *where, int *refline);
 FILE *jx_file_update(const char *filename);
+FILE *jx_file_update_atomic(const char *filename);
+int jx_file_update_close(FILE *fp);
+int jx_file_lock(const char *filename);
+void jx_file_unlock(int fd);
+int jx_journal_replay(const char *filename, jx_t **refdata);
+int jx_journal_append(const char *filename, const char *op, jx_t *path, jx_t *value);
+int jx_journal_sync(const char *filename);
+long jx_journal_size(const char *filename);
+void jx_journal_remove(const char *filename);
 char *jx_file_path(const char *prefix, const char *name, const char *suffix);
+int jx_stream_test(const char *str, size_t len);
+jx_t *jx_stream(jxfile_t *jf);
+char *jx_stream_room(jxstreamscan_t *scan, size_t len);
+jx_t *jx_stream_element(jxstreamscan_t *scan);
 
 /* Error handling */
 extern char *jx_debug(char *flags);
@@ -304,15 +379,20 @@ extern jx_t *jx_number(const char *str, size_t len);
 extern jx_t *jx_boolean(int boolean);
 extern jx_t *jx_null(void);
 extern jx_t *jx_error_null(const char *where, const char *fmt, ...);
-extern jx_t *jx_from_int(int i);
+extern jx_t *jx_from_int(long long i);
 extern jx_t *jx_from_double(double f);
 extern jx_t *jx_key(const char *key, jx_t *value);
 extern jx_t *jx_object();
 extern jx_t *jx_array();
 extern jx_t *jx_defer(jxdeffns_t *fns);
 extern jx_t *jx_defer_ellipsis(int from, int to);
+extern jx_t *jx_defer_share(jx_t *array);
+extern jx_t *jx_defer_spill(jx_t *array, int minlength);
+#define JX_SPILL_MIN	1000	/* usual minlength for jx_defer_spill() */
 extern char *jx_append(jx_t *container, jx_t *more);
 extern size_t jx_sizeof(jx_t *json);
+extern size_t jx_memory_used;
+extern int jx_memory_over_budget(void);
 extern char *jx_typeof(jx_t *json, int extended);
 extern char *jx_mix_types(char *oldtype, char *newtype);
 extern void jx_sort(jx_t *array, jx_t *orderby, int grouping);
@@ -353,6 +433,13 @@ extern jx_t *jx_parse_file(const char *filename);
 
 /* Serialization / Output */
 extern jx_t *jx_explain(jx_t *stats, jx_t *row, int depth);
+typedef struct jxexplain_s jxexplain_t;
+extern jxexplain_t *jx_explain_start(int depth);
+extern void jx_explain_row(jxexplain_t *ex, jx_t *row);
+extern void jx_explain_merge(jxexplain_t *ex, jxexplain_t *other);
+extern jx_t *jx_explain_finish(jxexplain_t *ex);
+extern void jx_explain_free(jxexplain_t *ex);
+extern jx_t *jx_explain_table(jx_t *table, int depth, int sample);
 extern char *jx_serialize(jx_t *json, jxformat_t *format);
 extern void jx_print_table_hook(char *name, void (*fn)(jx_t *json, jxformat_t *format));
 extern int jx_print_incomplete_line;
@@ -368,7 +455,26 @@ extern jx_t *jx_by_index(jx_t *array, int idx);
 extern jx_t *jx_by_key_value(jx_t *array, const char *key, jx_t *value);
 extern jx_t *jx_by_expr(jx_t *container, const char *expr, const char **after);
 #ifdef REG_ICASE /* skip this if <regex.h> not included */
-extern jx_t *jx_find_regex(jx_t *haystack, regex_t *regex, char *needkey);
+/* A compiled regular expression.  These are cached and shared, so always use
+ * jx_regex() and jx_regex_free() instead of allocating them yourself.
+ */
+typedef struct jxregex_s {
+	struct jxregex_s *other;/* used for a linked list */
+	regex_t	preg;		/* compiled pattern */
+	regex_t	nosub;		/* compiled with REG_NOSUB, if hasnosub */
+	int	hasnosub;	/* non-zero if nosub is compiled */
+	int	cflags;		/* flags passed to regcomp() */
+	int	refs;		/* reference count */
+	char	*source;	/* the pattern's source text */
+	char	*prefix;	/* literal text every match must contain, or NULL */
+	size_t	prefixlen;	/* length of prefix */
+	int	anchored;	/* if non-zero, prefix must be at the start */
+} jxregex_t;
+extern jxregex_t *jx_regex(const char *source, int ignorecase, char *errbuf, size_t errsize);
+extern void jx_regex_free(jxregex_t *re);
+extern int jx_regex_test(jxregex_t *re, const char *str);
+extern int jx_regex_exec(jxregex_t *re, const char *str, size_t nmatch, regmatch_t *matches);
+extern jx_t *jx_find_regex(jx_t *haystack, jxregex_t *regex, char *needkey);
 #endif
 extern jx_t *jx_find_calc(jx_t *haystack, jxcalc_t *calc, jxcontext_t *context);
 extern char *jx_default_text(char *newdefault);
@@ -384,6 +490,7 @@ extern int jx_is_last(const jx_t *elem);
 extern int jx_length(jx_t *container);
 extern int jx_is_true(jx_t *json);
 extern int jx_is_null(jx_t *json);
+extern int jx_is_integer(jx_t *json, long long *refint);
 extern int jx_is_error(jx_t *json);
 extern int jx_is_table(jx_t *json);
 extern int jx_is_short(jx_t *json, size_t oneline);
@@ -391,6 +498,7 @@ extern int jx_is_date(jx_t *json);
 extern int jx_is_time(jx_t *json);
 extern int jx_is_datetime(jx_t *json);
 extern int jx_is_period(jx_t *json);
+extern jxstrclass_t jx_string_class(jx_t *json);
 extern int jx_is_deferred_array(const jx_t *arr);
 extern int jx_is_deferred_element(const jx_t *elem);
 extern int jx_equal(jx_t *j1, jx_t *j2);
@@ -436,6 +544,8 @@ int jx_datetime(char *result, const char *str, const char *tz);
 int jx_datetime_add(char *result, const char *str, const char *period);
 int jx_datetime_subtract(char *result, const char *str, const char *period);
 int jx_datetime_diff(char *result, const char *str1, const char *str2);
+jx_t *jx_datetime_calc(jx_t *left, int op, jx_t *right);
+int jx_datetime_compare(jx_t *left, jx_t *right);
 jx_t *jx_datetime_fn(jx_t *args, char *type);
 
 /* Bigger analysis functions */
@@ -466,6 +576,28 @@ jx_t *jx_config_parse(jx_t *config, const char *settings, const char **refend);
  */
 #define jx_config_get_text(section, key) jx_text(jx_config_get(section, key))
 #define jx_config_get_boolean(section, key) jx_is_true(jx_config_get(section, key))
+/* Frequently-used settings are also available in binary form, via
+ * jx_config_snapshot().  The snapshot is only recomputed when the config's
+ * version changes, so it's cheap to call in a loop.  Code that modifies
+ * jx_config directly instead of via jx_config_set() or jx_config_parse()
+ * should call jx_config_changed() afterward.  Plugins can compare
+ * jx_config_version to a saved value to decide when to refresh their own
+ * cached settings.
+ */
+typedef struct {
+	unsigned version;	/* jx_config_version when this was computed */
+	char	emptyobject;	/* 'o'bject, 'a'rray, or 's'tring */
+	int	defersize;	/* files this large or larger may be deferred */
+	int	deferexplain;	/* rows to scan when explaining deferred arrays */
+	int	diffstyle;	/* default style for diff() */
+	int	journal;	/* boolean: journal -u changes instead of rewriting */
+	int	journallimit;	/* compact when journal exceeds this % of file */
+	int	sharesize;	/* arrays this long or longer may be shared */
+	size_t	memorylimit;	/* bytes of jx_t's before spilling, or 0 */
+} jxconfigsnap_t;
+extern unsigned jx_config_version;
+void jx_config_changed(void);
+const jxconfigsnap_t *jx_config_snapshot(void);
 
 /* Plugins */
 jx_t *jx_plugins;
@@ -495,18 +627,22 @@ typedef struct jxfunc_s {
         void   (*agfn)(jx_t *args, void *agdata);
         size_t  agsize;
         int	jfoptions;
+        void   (*merge)(void *agdata, void *other);
         struct jxcmd_s *user;
         jx_t	*userparams;
 } jxfunc_t;
 #define JXFUNC_JXFREE 1		/* Call jx_free() on the agdata afterward */
 #define JXFUNC_FREE 2		/* Call free() on the agdata afterward */
+#define JXFUNC_PERROW 4		/* fn() returns a different value for each row */
+#define JXFUNC_PURE 8		/* fn() depends only on its arguments */
+#define JXFUNC_EXFREE 16	/* Call jx_explain_free() on the agdata afterward */
 
 /* For non-aggregate functions, this is used to pass other information that
  * they might need.
  */
 typedef struct {
 	jxcontext_t *context;
-	jxcalc_t    *regex; /* The regex_t is at regex->u.regex.preg */
+	jxcalc_t    *regex; /* The jxregex_t is at regex->u.regex.preg */
 } jxfuncextra_t;
 
 
@@ -596,6 +732,9 @@ void jx_calc_aggregate_hook(
         void   (*agfn)(jx_t *args, void *agdata),
         size_t  agsize,
         int	jfoptions);
+int jx_calc_aggregate_merge_hook(
+	const char	*name,
+	void	(*merge)(void *agdata, void *other));
 void jx_calc_function_hook(
 	const char	*name,
 	const char	*args,
@@ -614,6 +753,8 @@ jxcalc_t *jx_calc_parse(const char *str, const char **refend, const char **refer
 jxcalc_t *jx_calc_list(jxcalc_t *list, jxcalc_t *item);
 void jx_calc_free(jxcalc_t *calc);
 void *jx_calc_ag(jxcalc_t *calc, void *agdata);
+int jx_calc_ag_mergeable(jxcalc_t *calc);
+int jx_calc_ag_merge(void *agdata, void *other);
 jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata);
 
 void jx_context_hook(jxcontext_t *(*addcontext)(jxcontext_t *context));
@@ -659,11 +800,23 @@ jxcmdout_t *jx_cmd_run(jxcmd_t *cmd, jxcontext_t **refcontext);
 jx_t *jx_cmd_fncall(jx_t *args, jxfunc_t *fn, jxcontext_t *context);
 jxcmd_t *jx_cmd_append(jxcmd_t *existing, jxcmd_t *added, jxcontext_t *context);
 
+/* Profiling.  When jx_debug_flags.profile is set, jx_calc() and jx_cmd_run()
+ * collect timing and allocation counts for each expression node and command.
+ */
+typedef struct jxprofile_s jxprofile_t;
+jxprofile_t *jx_profile_enter(const jxcalc_t *calc, const jxcmd_t *cmd);
+void jx_profile_exit(jxprofile_t *node, jx_t *result);
+void jx_profile_input(jx_t *left, jx_t *right);
+jxprofile_t *jx_profile_begin(void);
+jx_t *jx_profile_end(jxprofile_t *root);
+jx_t *jx_profile(void);
+
 
 /* The following are for debugging memory leaks.  They're only used if your
  * program defined JX_DEBUG_MEMORY.
  */
 extern int jx_debug_count;
+extern long jx_debug_allocs;
 extern void jx_debug_free(const char *file, int line, jx_t *json);
 extern jx_t *jx_debug_simple(const char *file, int line, const char *str, size_t len, jxtype_t type);
 extern jx_t *jx_debug_string(const char *file, int line, const char *str, size_t len);
@@ -671,7 +824,7 @@ extern jx_t *jx_debug_number(const char *file, int line, const char *str, size_t
 extern jx_t *jx_debug_boolean(const char *file, int line, int boolean);
 extern jx_t *jx_debug_null(const char *file, int line);
 extern jx_t *jx_debug_error_null(const char *file, int line, char *fmt, ...);
-extern jx_t *jx_debug_from_int(const char *file, int line, int i);
+extern jx_t *jx_debug_from_int(const char *file, int line, long long i);
 extern jx_t *jx_debug_from_double(const char *file, int line, double f);
 extern jx_t *jx_debug_key(const char *file, int line, const char *key, jx_t *value);
 extern jx_t *jx_debug_object(const char *file, int line);
@@ -0,0 +1,560 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <locale.h>
+#include <jx.h>
+#include <version.h>
+
+/* This program runs a series of benchmarks on the library's hot paths,
+ * and writes the results to stdout as JSON so they can be compared across
+ * commits.  All data is generated from a fixed seed, so every run measures
+ * exactly the same work.
+ */
+
+int quick = 0;		/* -q: use smaller datasets */
+int repeat = 3;		/* -r: times to run each benchmark, keeping best */
+char **only;		/* names given on the command line */
+int nonly;
+jx_t *results;		/* array of result objects */
+
+/* Output a usage message and then exit */
+void usage()
+{
+	puts("bench [flags] [name...]");
+	puts("Flags: -q      Quick. Use smaller datasets.");
+	puts("       -r N    Run each benchmark N times and report the best. Default 3.");
+	puts("Runs benchmarks on the jx library and writes the results as JSON.  If");
+	puts("names are given, then only benchmarks whose names start with one of those");
+	puts("names are run, so \"parse\" runs all parsing benchmarks.  Each result");
+	puts("reports ops, seconds, ns_per_op, ops_per_sec, allocs_per_op (jx_t nodes");
+	puts("allocated), and for parsing or output also mb_per_sec.");
+	exit(0);
+}
+
+/******************************************************************************/
+/* Deterministic data generation                                              */
+
+static unsigned long long seed;
+
+/* Return a pseudo-random number in the range 0 to limit-1 */
+static unsigned rnd(unsigned limit)
+{
+	seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (unsigned)(seed >> 33) % limit;
+}
+
+/* Return a pseudo-random lowercase word, in a static buffer */
+static char *word(int minlen, int maxlen)
+{
+	static char buf[40];
+	int	i, len;
+
+	len = minlen + rnd(maxlen - minlen + 1);
+	for (i = 0; i < len; i++)
+		buf[i] = 'a' + rnd(26);
+	buf[i] = '\0';
+	return buf;
+}
+
+/* A growable text buffer */
+typedef struct {
+	char	*text;
+	size_t	len, size;
+} text_t;
+
+static void add(text_t *t, const char *fmt, ...)
+{
+	va_list	ap;
+	int	need;
+
+	for (;;) {
+		va_start(ap, fmt);
+		need = vsnprintf(t->text + t->len, t->size - t->len, fmt, ap);
+		va_end(ap);
+		if (t->len + need < t->size)
+			break;
+		t->size = (t->size + need) * 2;
+		t->text = (char *)realloc(t->text, t->size);
+	}
+	t->len += need;
+}
+
+/* Generate a narrow table: a few columns of mixed types.  The order in
+ * which function arguments are evaluated is unspecified, so random values
+ * are always stored in variables before they're passed to add().
+ */
+static char *gennarrow(int rows)
+{
+	text_t	t = {NULL, 0, 0};
+	int	i, grp, whole, frac, active, note, yy, mm, dd;
+
+	seed = 1;
+	add(&t, "[");
+	for (i = 0; i < rows; i++) {
+		add(&t, "%s{\"id\":%d,\"name\":\"%s\",", i ? ",\n" : "", i, word(3, 12));
+		grp = rnd(20);
+		whole = rnd(1000);
+		frac = rnd(10);
+		add(&t, "\"grp\":\"g%d\",\"score\":%d.%d,", grp, whole, frac);
+		active = rnd(2);
+		note = rnd(4);
+		add(&t, "\"active\":%s,\"note\":%s,", active ? "true" : "false", note ? "null" : "\"x\"");
+		yy = rnd(30);
+		mm = 1 + rnd(12);
+		dd = 1 + rnd(28);
+		add(&t, "\"date\":\"20%02d-%02d-%02d\"}", yy, mm, dd);
+	}
+	add(&t, "]");
+	return t.text;
+}
+
+/* Generate a wide table: many numeric columns */
+static char *genwide(int rows, int cols)
+{
+	text_t	t = {NULL, 0, 0};
+	int	i, c;
+
+	seed = 2;
+	add(&t, "[");
+	for (i = 0; i < rows; i++) {
+		add(&t, "%s{", i ? ",\n" : "");
+		for (c = 0; c < cols; c++)
+			add(&t, "%s\"col%d\":%d", c ? "," : "", c, rnd(100000));
+		add(&t, "}");
+	}
+	add(&t, "]");
+	return t.text;
+}
+
+/* Generate a table with embedded objects and arrays */
+static char *gennested(int rows)
+{
+	text_t	t = {NULL, 0, 0};
+	int	i, j, n, qty;
+	char	*sku, tag[40];
+
+	seed = 3;
+	add(&t, "[");
+	for (i = 0; i < rows; i++) {
+		add(&t, "%s{\"id\":%d,\"owner\":{\"name\":\"%s\",", i ? ",\n" : "", i, word(3, 10));
+		add(&t, "\"email\":\"%s@example.com\"},\"items\":[", word(3, 8));
+		for (j = 0, n = 1 + rnd(6); j < n; j++) {
+			sku = word(6, 6);
+			qty = 1 + rnd(9);
+			add(&t, "%s{\"sku\":\"%s\",\"qty\":%d}", j ? "," : "", sku, qty);
+		}
+
+		/* word() uses a static buffer, so copy the first tag */
+		strcpy(tag, word(2, 6));
+		add(&t, "],\"tags\":[\"%s\",\"%s\"]}", tag, word(2, 6));
+	}
+	add(&t, "]");
+	return t.text;
+}
+
+/* Generate two tables to join on "id" */
+static char *genjoin(int users, int actions)
+{
+	text_t	t = {NULL, 0, 0};
+	static char *verbs[] = {"add", "change", "delete", "view"};
+	int	i, id, verb;
+
+	seed = 7;
+	add(&t, "{\"users\":[");
+	for (i = 0; i < users; i++)
+		add(&t, "%s{\"id\":%d,\"name\":\"%s\"}", i ? "," : "", i, word(3, 10));
+	add(&t, "],\"actions\":[");
+	for (i = 0; i < actions; i++) {
+		id = rnd(users + users / 5);
+		verb = rnd(4);
+		add(&t, "%s{\"id\":%d,\"action\":\"%s\"}", i ? "," : "", id, verbs[verb]);
+	}
+	add(&t, "]}");
+	return t.text;
+}
+
+/* Generate CSV text, with the same columns as gennarrow() */
+static char *gencsv(int rows)
+{
+	text_t	t = {NULL, 0, 0};
+	int	i, grp, whole, frac, active, yy, mm, dd;
+	char	*name;
+
+	seed = 4;
+	add(&t, "id,name,grp,score,active,date\n");
+	for (i = 0; i < rows; i++) {
+		name = word(3, 12);
+		grp = rnd(20);
+		add(&t, "%d,%s,g%d,", i, name, grp);
+		whole = rnd(1000);
+		frac = rnd(10);
+		active = rnd(2);
+		add(&t, "%d.%d,%s,", whole, frac, active ? "true" : "false");
+		yy = rnd(30);
+		mm = 1 + rnd(12);
+		dd = 1 + rnd(28);
+		add(&t, "20%02d-%02d-%02d\n", yy, mm, dd);
+	}
+	return t.text;
+}
+
+/* Generate XML text */
+static char *genxml(int rows)
+{
+	text_t	t = {NULL, 0, 0};
+	int	i, grp, score;
+
+	seed = 5;
+	add(&t, "<?xml version=\"1.0\"?>\n<rows>\n");
+	for (i = 0; i < rows; i++) {
+		add(&t, "<row id=\"%d\"><name>%s</name>", i, word(3, 12));
+		grp = rnd(20);
+		score = rnd(1000);
+		add(&t, "<grp>g%d</grp><score>%d</score></row>\n", grp, score);
+	}
+	add(&t, "</rows>\n");
+	return t.text;
+}
+
+/******************************************************************************/
+/* Timing and reporting                                                       */
+
+typedef struct {
+	struct timespec start;
+	long	allocs;
+	double	seconds;	/* accumulated time */
+	long	nallocs;	/* accumulated allocations */
+} timer_t_;
+
+static void timer_start(timer_t_ *t)
+{
+	t->allocs = jx_debug_allocs;
+	clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+static void timer_stop(timer_t_ *t)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	t->seconds += (now.tv_sec - t->start.tv_sec) + (now.tv_nsec - t->start.tv_nsec) / 1e9;
+	t->nallocs += jx_debug_allocs - t->allocs;
+}
+
+/* Return 1 if the named benchmark should be run */
+static int wanted(const char *name)
+{
+	int	i;
+
+	if (nonly == 0)
+		return 1;
+	for (i = 0; i < nonly; i++)
+		if (!strncmp(name, only[i], strlen(only[i])))
+			return 1;
+	return 0;
+}
+
+/* Add a result to the results array.  "bytes" is the amount of text
+ * processed per op, or 0 if not meaningful.
+ */
+static void report(const char *name, long ops, timer_t_ *t, double bytes)
+{
+	jx_t	*result;
+
+	result = jx_object();
+	jx_append(result, jx_key("name", jx_string(name, -1)));
+	jx_append(result, jx_key("ops", jx_from_int(ops)));
+	jx_append(result, jx_key("seconds", jx_from_double(t->seconds)));
+	jx_append(result, jx_key("ns_per_op", jx_from_double(t->seconds * 1e9 / ops)));
+	jx_append(result, jx_key("ops_per_sec", jx_from_double(ops / t->seconds)));
+	if (bytes > 0)
+		jx_append(result, jx_key("mb_per_sec", jx_from_double(bytes * ops / t->seconds / 1e6)));
+	jx_append(result, jx_key("allocs_per_op", jx_from_double((double)t->nallocs / ops)));
+	jx_append(results, result);
+
+	/* Also show progress on stderr, if it's a terminal */
+	if (isatty(2))
+		fprintf(stderr, "%-20s %12.1f ns/op\n", name, t->seconds * 1e9 / ops);
+}
+
+/* Run a benchmark "repeat" times and keep the fastest.  Each run calls
+ * fn(arg, &timer), which should start and stop the timer around the work
+ * being measured, and return the number of ops performed.
+ */
+static void run(const char *name, long (*fn)(void *arg, timer_t_ *t), void *arg, double bytes)
+{
+	timer_t_ best, t;
+	long	ops = 0;
+	int	i;
+
+	if (!wanted(name))
+		return;
+	for (i = 0; i < repeat; i++) {
+		memset(&t, 0, sizeof t);
+		ops = (*fn)(arg, &t);
+		if (i == 0 || t.seconds < best.seconds)
+			best = t;
+	}
+	if (ops > 0)
+		report(name, ops, &best, bytes);
+}
+
+/******************************************************************************/
+/* The benchmarks themselves                                                  */
+
+/* Parse a JSON (or CSV/XML) document.  One op is one parse. */
+static long b_parse(void *arg, timer_t_ *t)
+{
+	jx_t	*json;
+
+	timer_start(t);
+	json = jx_parse_string((char *)arg);
+	timer_stop(t);
+	jx_free(json);
+	return 1;
+}
+
+/* Look up members of a wide object. One op is one lookup. */
+static long b_bykey(void *arg, timer_t_ *t)
+{
+	jx_t	*obj = (jx_t *)arg;
+	char	key[20];
+	long	i, n = quick ? 100000 : 1000000;
+	int	found = 0;
+
+	seed = 6;
+	timer_start(t);
+	for (i = 0; i < n; i++) {
+		snprintf(key, sizeof key, "col%u", rnd(1000));
+		if (jx_by_key(obj, key))
+			found++;
+	}
+	timer_stop(t);
+	return found == n ? n : 0;
+}
+
+/* Evaluate an expression over the context.  One op is one evaluation. */
+typedef struct {
+	jxcalc_t *calc;
+	jxcontext_t *context;
+} calcarg_t;
+
+static long b_calc(void *arg, timer_t_ *t)
+{
+	calcarg_t *ca = (calcarg_t *)arg;
+	jx_t	*result;
+
+	timer_start(t);
+	result = jx_calc(ca->calc, ca->context, NULL);
+	timer_stop(t);
+	jx_free(result);
+	return 1;
+}
+
+/* Sort a copy of a table.  One op is one sort. */
+static long b_sort(void *arg, timer_t_ *t)
+{
+	jx_t	*copy, *orderby;
+
+	orderby = jx_parse_string("[\"grp\",true,\"score\"]");
+	copy = jx_copy((jx_t *)arg);
+	timer_start(t);
+	jx_sort(copy, orderby, 0);
+	timer_stop(t);
+	jx_free(copy);
+	jx_free(orderby);
+	return 1;
+}
+
+/* Serialize a table to a string.  One op is one serialization. */
+static long b_serialize(void *arg, timer_t_ *t)
+{
+	char	*str;
+
+	timer_start(t);
+	str = jx_serialize((jx_t *)arg, NULL);
+	timer_stop(t);
+	free(str);
+	return 1;
+}
+
+/* Print a table, as jx would.  One op is one table. */
+static long b_print(void *arg, timer_t_ *t)
+{
+	jxformat_t format = jx_format_default;
+
+	format.fp = fopen("/dev/null", "w");
+	format.color = 0;
+	timer_start(t);
+	jx_print((jx_t *)arg, &format);
+	fflush(format.fp);
+	timer_stop(t);
+	fclose(format.fp);
+	return 1;
+}
+
+/* Scan a deferred array from a file.  One op is one row. */
+static long b_defer(void *arg, timer_t_ *t)
+{
+	jx_t	*json, *row;
+	long	rows = 0;
+
+	timer_start(t);
+	json = jx_parse_file((char *)arg);
+	for (row = jx_first(json); row; row = jx_next(row))
+		rows++;
+	timer_stop(t);
+	jx_free(json);
+	return rows;
+}
+
+/* Return the size of a file, in bytes */
+static double filesize(const char *filename)
+{
+	FILE	*fp = fopen(filename, "r");
+	long	size;
+
+	if (!fp)
+		return 0;
+	fseek(fp, 0L, SEEK_END);
+	size = ftell(fp);
+	fclose(fp);
+	return (double)size;
+}
+
+int main(int argc, char **argv)
+{
+	int	opt, rows;
+	char	*narrow, *wide, *nested, *csv, *xml, *join;
+	jx_t	*table, *obj, *names, *info;
+	jxcontext_t *context;
+	calcarg_t ca;
+	const char *end, *err;
+	char	tmpname[] = "/tmp/jxbenchXXXXXX";
+	FILE	*fp;
+	int	fd;
+	static struct {
+		char	*name;
+		char	*expr;
+	} calcs[] = {
+		{"calc.where",		"select * from data where score > 500 and active"},
+		{"calc.select",		"select id, name, score * 2 as double from data"},
+		{"calc.groupby",	"select grp, count(*) as n, sum(score) as total from data group by grp"},
+		{"calc.join",		"select * from users #= actions"},
+		{"calc.orderby",	"select id, grp, score from data order by grp, score descending"},
+		{NULL}
+	};
+
+	/* Parse command-line flags */
+	while ((opt = getopt(argc, argv, "qr:")) >= 0) {
+		switch (opt) {
+		  case 'q':
+			quick = 1;
+			break;
+		  case 'r':
+			repeat = atoi(optarg);
+			if (repeat < 1)
+				repeat = 1;
+			break;
+		  default:
+			usage();
+		}
+	}
+	only = &argv[optind];
+	nonly = argc - optind;
+
+	/* Initialize the library without user settings, and load plugins
+	 * for the CSV and XML benchmarks.  If they can't be loaded, then
+	 * those benchmarks are skipped.
+	 */
+	setlocale(LC_ALL, "");
+	jx_config_load("bench");
+	jx_config_set(NULL, "defersize", jx_from_int(1));
+	results = jx_array();
+	info = jx_object();
+	jx_append(info, jx_key("version", jx_string(JX_VERSION, -1)));
+	jx_append(info, jx_key("quick", jx_boolean(quick)));
+	jx_append(info, jx_key("repeat", jx_from_int(repeat)));
+
+	/* Generate the data */
+	rows = quick ? 2000 : 20000;
+	narrow = gennarrow(rows);
+	wide = genwide(rows / 20, 200);
+	nested = gennested(rows / 4);
+	csv = gencsv(rows);
+	xml = genxml(rows);
+
+	/* Parsing */
+	run("parse.narrow", b_parse, narrow, strlen(narrow));
+	run("parse.wide", b_parse, wide, strlen(wide));
+	run("parse.nested", b_parse, nested, strlen(nested));
+	if (!jx_plugin_load("csv"))
+		run("parse.csv", b_parse, csv, strlen(csv));
+	if (!jx_plugin_load("xml"))
+		run("parse.xml", b_parse, xml, strlen(xml));
+
+	/* Member lookup in a wide object */
+	obj = jx_parse_string(genwide(1, 1000));
+	run("bykey.wide", b_bykey, obj->first, 0);
+	jx_free(obj);
+
+	/* Queries */
+	table = jx_parse_string(narrow);
+	names = jx_object();
+	jx_append(names, jx_key("data", jx_copy(table)));
+	join = genjoin(rows / 20, rows / 4);
+	obj = jx_parse_string(join);
+	jx_append(names, jx_key("users", jx_copy(jx_by_key(obj, "users"))));
+	jx_append(names, jx_key("actions", jx_copy(jx_by_key(obj, "actions"))));
+	jx_free(obj);
+	free(join);
+	context = jx_context_std(names);
+	for (opt = 0; calcs[opt].name; opt++) {
+		if (!wanted(calcs[opt].name))
+			continue;
+		ca.calc = jx_calc_parse(calcs[opt].expr, &end, &err, 0);
+		if (!ca.calc || err) {
+			fprintf(stderr, "%s: %s\n", calcs[opt].name, err ? err : "parse error");
+			continue;
+		}
+		ca.context = context;
+		run(calcs[opt].name, b_calc, &ca, 0);
+		jx_calc_free(ca.calc);
+	}
+	while (context)
+		context = jx_context_free(context);
+
+	/* Sorting and output */
+	run("sort.table", b_sort, table, 0);
+	run("serialize.table", b_serialize, table, strlen(narrow));
+	run("print.table", b_print, table, strlen(narrow));
+	jx_free(table);
+
+	/* Scanning a deferred array */
+	if (wanted("defer.scan")) {
+		fd = mkstemp(tmpname);
+		if (fd >= 0 && (fp = fdopen(fd, "w")) != NULL) {
+			fputs(narrow, fp);
+			fclose(fp);
+			run("defer.scan", b_defer, tmpname, filesize(tmpname) / rows);
+			unlink(tmpname);
+		}
+	}
+
+	/* Output the results */
+	jx_append(info, jx_key("benchmarks", results));
+	jx_print(info, NULL);
+	putchar('\n');
+
+	/* Clean up */
+	jx_free(info);
+	free(narrow);
+	free(wide);
+	free(nested);
+	free(csv);
+	free(xml);
+	return 0;
+}
@@ -1,8 +1,301 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
 #include <jx.h>
 #include "jxprog.h"
 
+/* In parallel batch mode (-P), the files are processed by worker processes.
+ * Each worker is forked after the context is set up, so it inherits the
+ * commands, settings and file list.  The parent sends file indexes to idle
+ * workers over a "request" pipe; a worker loads that file, runs the commands
+ * with stdout redirected to a temp file, and replies with a "done" message
+ * giving the file's index and the temp file's name.  The parent then copies
+ * the temp file to stdout -- in file order unless "unordered" was given --
+ * or, if there's a -R reduce command, collects its values instead.
+ */
+
+/* The reply message from a worker.  This is small enough to be written
+ * atomically to a pipe.
+ */
+typedef struct {
+	int	index;		/* index of the file in the "files" array */
+	char	tmpname[256];	/* temp file containing its output */
+} done_t;
+
+/* A worker, from the parent's point of view */
+typedef struct {
+	pid_t	pid;		/* process ID, or 0 if it's finished */
+	int	request;	/* pipe for sending file indexes to it */
+	int	reply;		/* pipe for receiving done_t from it */
+	int	busy;		/* index of the file it's working on, or -1 */
+} worker_t;
+
+/* Output from each file, from the parent's point of view */
+typedef struct {
+	char	*tmpname;	/* temp file, or NULL if not done yet */
+	int	done;		/* 1 if the worker is finished with it */
+} output_t;
+
+
+/* This is the main loop of a worker process.  It never returns. */
+static void worker(jxcontext_t **refcontext, jxcmd_t *initcmds, int request, int reply)
+{
+	int	i, fd, saved;
+	done_t	msg;
+	const char *tmpdir;
+
+	/* If reducing, make sure each value is written as a single line of
+	 * JSON so the parent can parse it.
+	 */
+	if (reducecmd) {
+		strcpy(jx_format_default.table, "json");
+		jx_format_default.string = 0;
+		jx_format_default.elem = 0;
+		jx_format_default.pretty = 0;
+		jx_format_default.sh = 0;
+		jx_format_default.color = 0;
+	}
+
+	/* Temp files go in $TMPDIR, or /tmp */
+	tmpdir = getenv("TMPDIR");
+	if (!tmpdir || !*tmpdir)
+		tmpdir = "/tmp";
+
+	/* For each file index we're sent... */
+	saved = dup(1);
+	while (read(request, &i, sizeof i) == sizeof i) {
+		/* Redirect stdout to a new temp file */
+		memset(&msg, 0, sizeof msg);
+		msg.index = i;
+		snprintf(msg.tmpname, sizeof msg.tmpname, "%s/jxP%d.XXXXXX", tmpdir, (int)getpid());
+		fflush(stdout);
+		fd = mkstemp(msg.tmpname);
+		if (fd < 0) {
+			jx_user_printf(NULL, "error", "%s: %s\n", msg.tmpname, strerror(errno));
+			*msg.tmpname = '\0';
+		} else {
+			dup2(fd, 1);
+			close(fd);
+
+			/* Load the file and run the commands on it */
+			jx_context_file(*refcontext, NULL, 0, &i);
+			run(initcmds, refcontext);
+			fflush(stdout);
+			dup2(saved, 1);
+		}
+
+		/* Tell the parent we're done with it */
+		if (write(reply, &msg, sizeof msg) != sizeof msg)
+			break;
+	}
+
+	/* Write back the last file, if -u and it was modified */
+	if (allow_update) {
+		i = JX_CONTEXT_FILE_PREVIOUS;
+		jx_context_file(*refcontext, NULL, 0, &i);
+	}
+	fflush(stdout);
+	fflush(stderr);
+	_exit(0);
+}
+
+/* Copy a file's output to stdout, or if reducing then parse each line and
+ * append the values to the "results" array.  Either way, delete the file.
+ */
+static void emit(output_t *out, jx_t *results)
+{
+	FILE	*fp;
+	char	*line, buf[4096];
+	size_t	size, len;
+
+	if (!out->tmpname)
+		return;
+	fp = fopen(out->tmpname, "r");
+	if (fp) {
+		if (results) {
+			line = NULL;
+			size = 0;
+			while (getline(&line, &size, fp) > 0) {
+				if (*line != '\n')
+					jx_append(results, jx_parse_string(line));
+			}
+			free(line);
+		} else {
+			while ((len = fread(buf, 1, sizeof buf, fp)) > 0)
+				fwrite(buf, 1, len, stdout);
+			fflush(stdout);
+		}
+		fclose(fp);
+	}
+	unlink(out->tmpname);
+	free(out->tmpname);
+	out->tmpname = NULL;
+}
+
+/* Send the next file index to a worker, or if there are no more files
+ * then close its request pipe so it'll finish up and exit.
+ */
+static void dispatch(worker_t *w, int *refnext, int nfiles)
+{
+	if (*refnext < nfiles && write(w->request, refnext, sizeof *refnext) == sizeof *refnext) {
+		w->busy = (*refnext)++;
+	} else {
+		w->busy = -1;
+		if (w->request >= 0)
+			close(w->request);
+		w->request = -1;
+	}
+}
+
+/* Process the files in parallel worker processes */
+static void parallelbatch(jxcontext_t **refcontext, jxcmd_t *initcmds, int nfiles)
+{
+	worker_t *workers;
+	output_t *outs;
+	struct pollfd *polls;
+	jx_t	*results;
+	jxcontext_t *layer;
+	done_t	msg;
+	int	nworkers, w, j, next, ordered, finished, fds[4];
+	pid_t	pid;
+
+	/* Never use more workers than files */
+	nworkers = parallel < nfiles ? parallel : nfiles;
+	if (nworkers < 1)
+		nworkers = 1;
+	workers = (worker_t *)calloc(nworkers, sizeof(worker_t));
+	outs = (output_t *)calloc(nfiles, sizeof(output_t));
+	polls = (struct pollfd *)calloc(nworkers, sizeof(struct pollfd));
+
+	/* Start the workers.  Anything buffered for stdout must be flushed
+	 * first or it'd be output by each worker too.
+	 */
+	fflush(stdout);
+	fflush(stderr);
+	for (w = 0; w < nworkers; w++) {
+		workers[w].request = workers[w].reply = -1;
+		if (pipe(fds) < 0 || pipe(fds + 2) < 0 || (pid = fork()) < 0) {
+			jx_user_printf(NULL, "error", "Can't start worker: %s\n", strerror(errno));
+			break;
+		}
+		if (pid == 0) {
+			/* Close the parent's end of this worker's pipes, and
+			 * all pipes of earlier workers.
+			 */
+			close(fds[1]);
+			close(fds[2]);
+			for (j = 0; j < w; j++) {
+				if (workers[j].request >= 0)
+					close(workers[j].request);
+				close(workers[j].reply);
+			}
+			worker(refcontext, initcmds, fds[0], fds[3]);
+		}
+		close(fds[0]);
+		close(fds[3]);
+		workers[w].pid = pid;
+		workers[w].request = fds[1];
+		workers[w].reply = fds[2];
+		workers[w].busy = -1;
+	}
+	nworkers = w;
+
+	/* If there's a reduce command, collect the results in an array */
+	results = reducecmd ? jx_array() : NULL;
+
+	/* Give each worker its first file */
+	next = 0;
+	for (w = 0; w < nworkers; w++)
+		dispatch(&workers[w], &next, nfiles);
+
+	/* Wait for workers to finish files.  Output each file's results as
+	 * soon as it and all files before it are done, or immediately if
+	 * "unordered".
+	 */
+	ordered = 0;
+	finished = 0;
+	while (finished < nworkers) {
+		for (w = 0; w < nworkers; w++) {
+			polls[w].fd = workers[w].reply;
+			polls[w].events = POLLIN;
+			polls[w].revents = 0;
+		}
+		if (poll(polls, nworkers, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		for (w = 0; w < nworkers; w++) {
+			if (!polls[w].revents)
+				continue;
+
+			/* If the worker exited, we're done with it.  If it
+			 * was working on a file, that file has no output.
+			 */
+			if (read(workers[w].reply, &msg, sizeof msg) != sizeof msg) {
+				if (workers[w].busy >= 0) {
+					jx_user_printf(NULL, "error", "Worker for file #%d failed\n", workers[w].busy);
+					outs[workers[w].busy].done = 1;
+				}
+				close(workers[w].reply);
+				workers[w].reply = -1;
+				if (workers[w].request >= 0)
+					close(workers[w].request);
+				workers[w].request = -1;
+				workers[w].busy = -1;
+				finished++;
+				continue;
+			}
+
+			/* Note the output, and give the worker another file */
+			if (msg.index >= 0 && msg.index < nfiles) {
+				if (*msg.tmpname)
+					outs[msg.index].tmpname = strdup(msg.tmpname);
+				outs[msg.index].done = 1;
+				if (unordered)
+					emit(&outs[msg.index], results);
+			}
+			dispatch(&workers[w], &next, nfiles);
+		}
+
+		/* Output everything that's ready, in order */
+		while (!unordered && ordered < nfiles && outs[ordered].done)
+			emit(&outs[ordered++], results);
+	}
+
+	/* Reap the workers, and clean up any leftover temp files */
+	for (w = 0; w < nworkers; w++)
+		waitpid(workers[w].pid, NULL, 0);
+	for (j = 0; j < nfiles; j++)
+		emit(&outs[j], results);
+
+	/* The workers wrote back any updated files.  The parent's copy of the
+	 * data is stale, so it must not be written back at exit.
+	 */
+	allow_update = 0;
+
+	/* If there's a reduce command, then run it with the combined results
+	 * as "data".
+	 */
+	if (results) {
+		for (layer = *refcontext; layer && !(layer->flags & JX_CONTEXT_DATA); layer = layer->older) {
+		}
+		if (layer) {
+			jx_append(layer->data, jx_key("data", results));
+			run(reducecmd, refcontext);
+		} else
+			jx_free(results);
+	}
+
+	free(workers);
+	free(outs);
+	free(polls);
+}
 
 void batch(jxcontext_t **refcontext, jxcmd_t *initcmds)
 {
@@ -18,6 +311,12 @@ void batch(jxcontext_t **refcontext, jxcmd_t *initcmds)
 		return;
 	}
 
+	/* If -P or -R was given, use worker processes */
+	if (parallel > 1 || reducecmd) {
+		parallelbatch(refcontext, initcmds, jx_length(files));
+		return;
+	}
+
 	/* For each file... */
 	for (i = 0; i < jx_length(files); i++) {
 
@@ -18,7 +18,7 @@
 /* getopt() variables not declared in <unistd.h> */
 extern char *optarg;
 extern int optind, opterr, optopt;
-#define OPTFLAGS "c:f:F:ioaus:S:pl:L:d:D:j:r?"
+#define OPTFLAGS "c:f:F:ioaus:S:pl:L:d:D:j:rP:R:?"
 
 /* -i -- Force interactive mode */
 int interactive = 0;
@@ -39,6 +39,15 @@ jxcontext_t *context;
 jxcmd_t *autocmd = NULL; /* Once, from -Fscript */
 jxcmd_t *initcmd = NULL; /* For each data file, from -ccommand or -fscript */
 
+/* -P -- Number of worker processes for batch mode, and whether their output
+ * may be interleaved in whatever order the files finish.
+ */
+int parallel = 1;
+int unordered = 0;
+
+/* -R -- Command to run on the combined per-file results, in batch mode */
+jxcmd_t *reducecmd = NULL;
+
 
 /* Output a debugging flag usage message */
 void debug_usage()
@@ -49,6 +58,8 @@ void debug_usage()
 	puts("  e  Output info about jx_by_expr() calls.");
 	puts("  c  Output info about jx_calc() calls.");
 	puts("  t  Trace each command as it is run.");
+	puts("  p  Profile expressions and commands, and write the profile to stderr");
+	puts("     as JSON when jx exits.  See also \"explain analyze expr\".");
 	puts("");
 	puts("You may also put a + or - or = between -j and the flags to alter the way the new");
 	puts("flags are combined with existing flags.  The means are:");
@@ -72,6 +83,8 @@ static void usage(char *fmt, char *data)
 	puts("       -l/-L plugin,set  Load & adjust a plugin, this session or persistently.");
 	puts("       -d/-D directory   Autoload from directory, this session or persistently.");
 	puts("       -j debugflags     Debugging settings, use -j? for details.");
+	puts("       -P N[,unordered]  Process files in N parallel worker processes.");
+	puts("       -R command        Reduce - Run command on all files' results as data.");
 	puts("This program manipulates JSON data. Without one of -ccalc or -ffile, it will");
 	puts("assume -c\"this\" or -c\"select\" if -sconfig is given, or -i if no -sconfig.");
 	puts("Any name=value parameters on the command line will be added to the context");
@@ -353,6 +366,7 @@ int main(int argc, char **argv)
 	section = jx_by_key(jx_config, "autoplugin");
 	if (!section || section->type != JX_ARRAY)
 		jx_append(jx_config, jx_key("autoplugin", jx_array()));
+	jx_config_changed();
 
 	/* Scan the options for things we need to know to decide whether this
 	 * will be batch or interactive.  Check whether the first arg after
@@ -368,6 +382,8 @@ int main(int argc, char **argv)
 		case 'c':
 		case 'p':
 		case 's':
+		case 'P':
+		case 'R':
 			if (interactive == -1)
 				interactive = 0;
 			break;
@@ -636,6 +652,25 @@ int main(int argc, char **argv)
 		case 'r':
 			restricted = 1;
 			break;
+		case 'P':
+			parallel = atoi(optarg);
+			if (parallel < 1) {
+				usage("Invalid worker count -P%s\n", optarg);
+				exitcode = 1;
+				goto CleanExit;
+			}
+			val = strchr(optarg, ',');
+			if (val && !strcmp(val + 1, "unordered"))
+				unordered = 1;
+			else if (val) {
+				usage("Invalid -P option %s\n", val + 1);
+				exitcode = 1;
+				goto CleanExit;
+			}
+			break;
+		case 'R':
+			reducecmd = jx_cmd_append(reducecmd, jx_cmd_parse_string(optarg), context);
+			break;
 		case 'o':
 			jx_file_new_type = 'o';
 			break;
@@ -752,6 +787,13 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Parallel processing and reducing only make sense in batch mode */
+	if (interactive && (parallel > 1 || reducecmd)) {
+		fprintf(stderr, "The -P and -R flags only work for batch invocations\n");
+		exitcode = 1;
+		goto CleanExit;
+	}
+
 	/* If one or more -p flags were given, adjust the format accordingly. */
 	if (pretty > 0) {
 		if (interactive) {
@@ -786,7 +828,7 @@ int main(int argc, char **argv)
 	/* If -ccmd or -fscript resulted in an error (already reported) then
 	 * quit now.
 	 */
-	if (initcmd == JX_CMD_ERROR || autocmd == JX_CMD_ERROR) {
+	if (initcmd == JX_CMD_ERROR || autocmd == JX_CMD_ERROR || reducecmd == JX_CMD_ERROR) {
 		exitcode = 1;
 		goto CleanExit;
 	}
@@ -883,12 +925,22 @@ CleanExit:
 		jx_context_file(context, NULL, 0, &i);
 	}
 
+	/* If profiling, output the profile */
+	if (jx_debug_flags.profile) {
+		jxformat_t format = jx_format_default;
+		jx_t *profile = jx_profile();
+		format.fp = stderr;
+		jx_print(profile, &format);
+		jx_free(profile);
+	}
+
 	/* Free the context stack */
 	while (context)
 		context = jx_context_free(context);
 
 	/* Free the initialization commands (from -ccmd and -fffile) */
 	jx_cmd_free(initcmd);
+	jx_cmd_free(reducecmd);
 
 	/* Revert to normal text colors */
 	jx_user_printf(NULL, "normal", "");
@@ -2,6 +2,10 @@
 
 extern int interactive;
 extern jxcontext_t *context;
+extern int allow_update;
+extern int parallel;
+extern int unordered;
+extern jxcmd_t *reducecmd;
 
 char **jx_completion(const char *text, int start, int end);
 void interact(jxcontext_t **contextref, jxcmd_t *initcmd);
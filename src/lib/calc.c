@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <limits.h>
 #include <locale.h>
 #include <assert.h>
 #include <regex.h>
@@ -88,6 +89,31 @@ static jx_t *jcsimple(jxcalc_t *calc, jxcontext_t *context)
 }
 
 
+/* Compare two numbers.  If both are integers then they're compared exactly,
+ * otherwise they're compared as doubles.  Returns -1, 0, or 1.
+ */
+static int jcnumcmp(jx_t *left, jx_t *right)
+{
+	long long ll, lr;
+	double	nl, nr;
+
+	if (jx_is_integer(left, &ll) && jx_is_integer(right, &lr))
+		return (ll < lr) ? -1 : (ll > lr);
+	nl = jx_double(left);
+	nr = jx_double(right);
+	return (nl < nr) ? -1 : (nl > nr);
+}
+
+/* Return the value of a number as a 64-bit integer, for bitwise operators */
+static long long jcint64(jx_t *json)
+{
+	long long i;
+
+	if (jx_is_integer(json, &i))
+		return i;
+	return (long long)jx_double(json);
+}
+
 /* Implement @= natural join, @< left join, and @> right join */
 jx_t *jcnjoin(jx_t *jl, jx_t *jr, int left, int right)
 {
@@ -159,8 +185,11 @@ jx_t *jcnjoin(jx_t *jl, jx_t *jr, int left, int right)
 					jx_append(merge, jx_copy(rmem));
 			}
 
-			/* Add the merged object to the result */
+			/* Add the merged object to the result.  If memory
+			 * is short, spill the result to a temp file.
+			 */
 			jx_append(result, merge);
+			jx_defer_spill(result, JX_SPILL_MIN);
 
 			/* Remember that there was a match */
 			if (right)
@@ -171,8 +200,10 @@ jx_t *jcnjoin(jx_t *jl, jx_t *jr, int left, int right)
 		/* If doing a left join and left didn't match anything, add it
 		 * by itself.
 		 */
-		if (left && !leftmatch)
+		if (left && !leftmatch) {
 			jx_append(result, jx_copy(jl));
+			jx_defer_spill(result, JX_SPILL_MIN);
+		}
 	}
 
 	/* If doing a right join, add any right elements that didn't match
@@ -249,15 +280,18 @@ static jx_t *jcvalues(jx_t *keys, jx_t *values)
 }
 
 
-/* Invoke all aggregates for the current item ("this" in context) */
-static void jcag(jxag_t *ag, jxcontext_t *context, void *agdata)
+/* Invoke all aggregates for the current item ("this" in context).  Returns
+ * the number of aggregate calls that were skipped because their argument
+ * was an array -- those compute their result from the array, not the rows.
+ */
+static int jcag(jxag_t *ag, jxcontext_t *context, void *agdata)
 {
-	int     i;
+	int     i, skipped;
 	void    *fnag = agdata;
 	jx_t  *args;
 
 	/* For each aggregate function... */
-	for (i = 0; i < ag->nags; i++) {
+	for (i = skipped = 0; i < ag->nags; i++) {
 		/* Evaluate its parameters */
 		args = jx_calc(ag->ag[i]->u.func.args, context, agdata);
 
@@ -270,7 +304,8 @@ static void jcag(jxag_t *ag, jxcontext_t *context, void *agdata)
 		if (args->first->type != JX_ARRAY) {
 			/* Call the aggregator function */
 			ag->ag[i]->u.func.jf->agfn(args, fnag);
-		}
+		} else
+			skipped++;
 
 		/* Free its parameters */
 		jx_free(args);
@@ -278,6 +313,7 @@ static void jcag(jxag_t *ag, jxcontext_t *context, void *agdata)
 		/* Find the location of the next function's storage */
 		fnag = (void *)((char *)fnag + ag->ag[i]->u.func.jf->agsize);
 	}
+	return skipped;
 }
 
 /* If calc uses aggregates, then allocate storage space for them and return
@@ -310,6 +346,9 @@ void *jx_calc_ag(jxcalc_t *calc, void *existingag)
 				jx_free(doomed);
 				toFree = *(void **)(data + sizeof(jx_t *));
 
+			} else if (jf->jfoptions & JXFUNC_EXFREE) {
+				jx_explain_free(*(jxexplain_t **)data);
+				toFree = NULL;
 			} else
 				toFree = *(void **)data;
 			if ((jf->jfoptions & JXFUNC_FREE) && toFree) {
@@ -340,6 +379,54 @@ void *jx_calc_ag(jxcalc_t *calc, void *existingag)
 	return existingag;
 }
  
+/* Return 1 if every aggregate function used by calc has a merge function,
+ * so partial results can be combined via jx_calc_ag_merge().  Returns 0 if
+ * any doesn't, or if calc doesn't use aggregates at all.
+ */
+int jx_calc_ag_mergeable(jxcalc_t *calc)
+{
+	int	i;
+
+	if (!calc || calc->op != JXOP_AG)
+		return 0;
+	for (i = 0; i < calc->u.ag->nags; i++)
+		if (!calc->u.ag->ag[i]->u.func.jf->merge)
+			return 0;
+	return 1;
+}
+
+/* Combine the aggregate data in "other" into "agdata".  Both must have been
+ * allocated by jx_calc_ag() for the same calc, and each may have accumulated
+ * a different set of rows; afterward, "agdata" holds the aggregates for both
+ * sets.  "other" is unchanged, and must still be freed by calling
+ * jx_calc_ag(NULL, other).  Returns 1 if successful, or 0 (without changing
+ * anything) if some aggregate function can't be merged.
+ */
+int jx_calc_ag_merge(void *agdata, void *other)
+{
+	jxcalc_t *calc;
+	char	*data, *more;
+	int	i;
+
+	if (!agdata || !other)
+		return 0;
+	calc = ((jxcalc_t **)agdata)[-1];
+	assert(calc == ((jxcalc_t **)other)[-1]);
+	if (!jx_calc_ag_mergeable(calc))
+		return 0;
+
+	/* For each function call, merge its data */
+	data = (char *)agdata;
+	more = (char *)other;
+	for (i = 0; i < calc->u.ag->nags; i++) {
+		jxfunc_t *jf = calc->u.ag->ag[i]->u.func.jf;
+		(*jf->merge)(data, more);
+		data += jf->agsize;
+		more += jf->agsize;
+	}
+	return 1;
+}
+
 /* If a jxcalc_t uses aggregate functions, then incorporate this row's
  * data into the aggregates.  If it doesn't use aggregates then do nothing.
  */
@@ -362,6 +449,154 @@ void jx_calc_ag_row(jxcalc_t *calc, jxcontext_t *context, void *agdata, jx_t *ro
 	jx_context_free(local);
 }
 
+/* Test whether an aggregate expression gives the same value for every row,
+ * because it only refers to row data via aggregate functions.  This is
+ * conservative -- any name outside of an aggregate function's arguments is
+ * assumed to refer to the row.
+ */
+static int jcrowfree(jxcalc_t *calc)
+{
+	jxcalc_t *tmp;
+
+	if (!calc)
+		return 1;
+	switch (calc->op) {
+	  case JXOP_LITERAL:
+	  case JXOP_STRING:
+	  case JXOP_NUMBER:
+	  case JXOP_BOOLEAN:
+	  case JXOP_NULL:
+		return 1;
+
+	  case JXOP_FNCALL:
+		/* An aggregate's arguments are handled by jcag(), so only its
+		 * final value matters here.  Pure functions depend only on their
+		 * arguments.  Anything else -- random(), I/O, plugins, and
+		 * user-defined functions -- may return a different value for
+		 * each row even if its arguments don't change.
+		 */
+		if (calc->u.func.jf->agfn)
+			return !(calc->u.func.jf->jfoptions & JXFUNC_PERROW);
+		if (!(calc->u.func.jf->jfoptions & JXFUNC_PURE))
+			return 0;
+		return jcrowfree(calc->u.func.args);
+
+	  case JXOP_OBJECT:
+		/* The member names aren't evaluated, only their values */
+		if (calc->LEFT && !jcrowfree(calc->LEFT->RIGHT))
+			return 0;
+		for (tmp = calc->RIGHT; tmp; tmp = tmp->RIGHT)
+			if (!jcrowfree(tmp->LEFT->RIGHT))
+				return 0;
+		return 1;
+
+	  case JXOP_ARRAY:
+		if (!jcrowfree(calc->LEFT))
+			return 0;
+		for (tmp = calc->RIGHT; tmp; tmp = tmp->RIGHT)
+			if (!jcrowfree(tmp->LEFT))
+				return 0;
+		return 1;
+
+	  case JXOP_NEGATE:
+	  case JXOP_NOT:
+	  case JXOP_BITNOT:
+	  case JXOP_MULTIPLY:
+	  case JXOP_DIVIDE:
+	  case JXOP_MODULO:
+	  case JXOP_ADD:
+	  case JXOP_SUBTRACT:
+	  case JXOP_BITAND:
+	  case JXOP_BITOR:
+	  case JXOP_BITXOR:
+	  case JXOP_AND:
+	  case JXOP_OR:
+	  case JXOP_LT:
+	  case JXOP_LE:
+	  case JXOP_EQ:
+	  case JXOP_NE:
+	  case JXOP_GE:
+	  case JXOP_GT:
+	  case JXOP_ICEQ:
+	  case JXOP_ICNE:
+	  case JXOP_EQSTRICT:
+	  case JXOP_NESTRICT:
+	  case JXOP_COALESCE:
+	  case JXOP_QUESTION:
+	  case JXOP_COLON:
+	  case JXOP_COMMA:
+		return jcrowfree(calc->LEFT) && jcrowfree(calc->RIGHT);
+
+	  default:
+		return 0;
+	}
+}
+
+/* Evaluate an aggregate expression over a deferred array in a single pass,
+ * for expressions where jcrowfree() is true.  The aggregates are accumulated
+ * for every row, and then the expression is evaluated just once and its
+ * value is repeated for each row.  This avoids reading the deferred array
+ * a second time, and avoids keeping copies of its rows.  Returns NULL if
+ * the array turns out to contain groups, or uses aggregates in some way
+ * that depends on the rows; in that case the caller should do it the slow
+ * way.
+ */
+static jx_t *jceachstream(jx_t *arr, jxcalc_t *calc, jxcontext_t *context, void *ag)
+{
+	jx_t	*scan, *value, *result;
+	jxcontext_t *local;
+	long	rows, i;
+
+	/* Accumulate the aggregates */
+	for (rows = 0, scan = jx_first(arr); scan; scan = jx_next(scan), rows++) {
+		if (jx_interrupt) {
+			jx_break(scan);
+			return jx_error_null(NULL, "intr:Interrupted");
+		}
+		if (scan->type == JX_ARRAY) {
+			jx_break(scan);
+			return NULL;
+		}
+		local = jx_context(context, scan, JX_CONTEXT_THIS | JX_CONTEXT_NOFREE);
+		i = jcag(calc->u.ag, local, ag);
+		jx_context_free(local);
+		if (i > 0) {
+			jx_break(scan);
+			return NULL;
+		}
+	}
+
+	/* Evaluate the expression once.  It doesn't refer to "this" but
+	 * there should be something there anyway.
+	 */
+	result = jx_array();
+	if (rows == 0)
+		return result;
+	local = jx_context(context, jx_null(), JX_CONTEXT_THIS);
+	value = jx_calc(calc, local, ag);
+	jx_context_free(local);
+
+	/* A boolean "true" would mean we have to copy the rows themselves.
+	 * That's the only case where we need to read the array again.
+	 */
+	if (value->type == JX_BOOLEAN && jx_is_true(value)) {
+		for (scan = jx_first(arr); scan; scan = jx_next(scan))
+			jx_append(result, jx_copy(scan));
+		jx_free(value);
+		return result;
+	}
+
+	/* Null or false adds nothing.  Anything else is added once per row. */
+	if (value->type == JX_NULL || value->type == JX_BOOLEAN) {
+		jx_free(value);
+		return result;
+	}
+	for (i = 1; i < rows; i++)
+		jx_append(result, jx_copy(value));
+	jx_append(result, value);
+	return result;
+}
+
 /* This implements the @ and @@ operators.  "arr" is normally an array of items
  * to loop over, but it can also be a single item to treat as a singleton array.
  * "expr" is an expression to apply to each member of the array (which may
@@ -370,10 +605,10 @@ void jx_calc_ag_row(jxcalc_t *calc, jxcontext_t *context, void *agdata, jx_t *ro
 jx_t *jceach(jx_t *arr, jxcalc_t *calc, jxcontext_t *context, jxop_t op)
 {
 	jx_t	*scan, *gscan;
-	jx_t	*result, *tmp;
+	jx_t	*result, *tmp, *copy;
 	jxcontext_t *local;
 	void *ag, **groupag;
-	int	ngroups, nongroup, g;
+	int	ngroups, nongroup, g, merge;
 
 	/* The array may include subarrays to indicate grouping. If grouping
 	 * is used, there may or may not be ungrouped items.  We'll need
@@ -383,7 +618,34 @@ jx_t *jceach(jx_t *arr, jxcalc_t *calc, jxcontext_t *context, jxop_t op)
 	 */
 	ngroups = 0;
 	groupag = NULL;
+	copy = NULL;
 	ag = jx_calc_ag(calc, NULL);
+	if (ag && jx_is_deferred_array(arr)) {
+		/* Every scan of a deferred array reparses its source, which
+		 * for big files is expensive.  If the expression only uses
+		 * row data via aggregates, we can do it in one pass.
+		 */
+		if (jcrowfree(calc->u.ag->expr)) {
+			result = jceachstream(arr, calc, context, ag);
+			if (result) {
+				jx_calc_ag(NULL, ag);
+				return result;
+			}
+			jx_calc_ag(calc, ag); /* reset it */
+		}
+
+		/* Otherwise read it once, into a copy.  If memory is short
+		 * the copy is spilled, so the rows are kept in a compact
+		 * binary form that can be rescanned without parsing.
+		 */
+		copy = jx_array();
+		for (g = 0, scan = jx_first(arr); scan; scan = jx_next(scan)) {
+			jx_append(copy, jx_copy(scan));
+			if (++g % JX_SPILL_MIN == 0)
+				jx_defer_spill(copy, JX_SPILL_MIN);
+		}
+		arr = copy;
+	}
 	if (ag) {
 		/* STEP 1: Count groups, and watch for any ungrouped elements */
 		for (ngroups = nongroup = 0, scan = jx_first(arr); scan; scan = jx_next(scan)) {
@@ -393,7 +655,13 @@ jx_t *jceach(jx_t *arr, jxcalc_t *calc, jxcontext_t *context, jxop_t op)
 				nongroup++;
 		}
 
-		/* STEP 2: Allocate an array to hold groups' aggregate data */
+		/* STEP 2: Allocate an array to hold groups' aggregate data.
+		 * If there are also ungrouped elements, then the overall
+		 * aggregates include the grouped rows too.  If possible we
+		 * get those by merging each group's aggregates, instead of
+		 * accumulating every grouped row twice.
+		 */
+		merge = (ngroups > 0 && nongroup > 0 && jx_calc_ag_mergeable(calc));
 		if (ngroups > 0) {
 			groupag = calloc(ngroups, sizeof(void *));
 			for (g = 0; g < ngroups; g++)
@@ -404,7 +672,8 @@ jx_t *jceach(jx_t *arr, jxcalc_t *calc, jxcontext_t *context, jxop_t op)
 		for (g = 0, scan = jx_first(arr); scan; scan = jx_next(scan)) {
 			if (jx_interrupt) {
 				jx_break(scan);
-				return jx_error_null(NULL, "intr:Interrupted");
+				result = jx_error_null(NULL, "intr:Interrupted");
+				goto CleanUp;
 			}
 
 			/* Is this element a nested array? */
@@ -414,17 +683,24 @@ jx_t *jceach(jx_t *arr, jxcalc_t *calc, jxcontext_t *context, jxop_t op)
 					if (jx_interrupt) {
 						jx_break(gscan);
 						jx_break(scan);
-						return jx_error_null(NULL, "intr:Interrupted");
+						result = jx_error_null(NULL, "intr:Interrupted");
+						goto CleanUp;
 					}
 
 					/* Invoke the aggregators on "this" */
 					local = jx_context(context, gscan, JX_CONTEXT_THIS | JX_CONTEXT_NOFREE);
 					jcag(calc->u.ag, local, groupag[g]);
-					if (nongroup)
+					if (nongroup && !merge)
 						jcag(calc->u.ag, local, ag);
 					jx_context_free(local);
 				}
 
+				/* Combine the group's aggregates with the
+				 * overall aggregates.
+				 */
+				if (merge)
+					jx_calc_ag_merge(ag, groupag[g]);
+
 				/* Prepare for next group */
 				g++;
 			} else {
@@ -448,7 +724,7 @@ jx_t *jceach(jx_t *arr, jxcalc_t *calc, jxcontext_t *context, jxop_t op)
 			 * data.  For EACH process all of them, for GROUP only
 			 * process the first.
 			 */
-			for (gscan = jx_first(scan); gscan; gscan = (op == JXOP_EACH ? jx_next(gscan) : NULL)) {
+			for (gscan = jx_first(scan); gscan; gscan = jx_next(gscan)) {
 				/* If interrupted then discard results so far
 				 * and return an error null.
 				 */
@@ -456,7 +732,8 @@ jx_t *jceach(jx_t *arr, jxcalc_t *calc, jxcontext_t *context, jxop_t op)
 					jx_free(result);
 					jx_break(gscan);
 					jx_break(scan);
-					return jx_error_null(NULL, "intr:Interrupted");
+					result = jx_error_null(NULL, "intr:Interrupted");
+					goto CleanUp;
 				}
 
 				/* Evaluate with element as "this" */
@@ -474,8 +751,16 @@ jx_t *jceach(jx_t *arr, jxcalc_t *calc, jxcontext_t *context, jxop_t op)
 					/* Not a symbol, append whatever it is */
 					jx_append(result, tmp);
 				}
+
+				/* JXOP_GROUP stops after the first element.  The
+				 * group may be a deferred (spilled) array, so
+				 * end the scan properly.
+				 */
+				if (op != JXOP_EACH) {
+					jx_break(gscan);
+					break;
+				}
 			}
-			jx_break(gscan); /* since JXOP_GROUP stops early */
 
 			/* Prepare for the next group */
 			g++;
@@ -485,7 +770,9 @@ jx_t *jceach(jx_t *arr, jxcalc_t *calc, jxcontext_t *context, jxop_t op)
 			 */
 			if (jx_interrupt) {
 				jx_free(result);
-				return jx_error_null(NULL, "intr:Interrupted");
+				jx_break(scan);
+				result = jx_error_null(NULL, "intr:Interrupted");
+				goto CleanUp;
 			}
 
 			local = jx_context(context, scan, JX_CONTEXT_THIS | JX_CONTEXT_NOFREE);
@@ -503,19 +790,24 @@ jx_t *jceach(jx_t *arr, jxcalc_t *calc, jxcontext_t *context, jxop_t op)
 		}
 	}
 
-	/* Clean up */
+	/* Clean up.  Interrupts jump here too, with an error null result */
+CleanUp:
 	jx_calc_ag(NULL, ag);
 	if (ngroups > 0) {
 		for (g = 0; g < ngroups; g++)
 			jx_calc_ag(NULL, groupag[g]);
 		free(groupag);
 	}
+	if (copy)
+		jx_free(copy);
 
 	/* Done! */
 	return result;
 }
 
 
+static jx_t *jcalc(jxcalc_t *calc, jxcontext_t *context, void *agdata);
+
 /* Evaluate an expression and return the result.
  *   calc       The expression to evaluate.  This should be obtained from a 
  *              previous call to jx_calc_parse().
@@ -529,6 +821,23 @@ jx_t *jceach(jx_t *arr, jxcalc_t *calc, jxcontext_t *context, jxop_t op)
  * containing an error message in ->text, and the error code in ->first.
  */
 jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
+{
+	jxprofile_t *prof;
+	jx_t	*result;
+
+	/* Usually we aren't profiling, so just evaluate it */
+	if (!jx_debug_flags.profile)
+		return jcalc(calc, context, agdata);
+
+	/* Evaluate it with profiling */
+	prof = jx_profile_enter(calc, NULL);
+	result = jcalc(calc, context, agdata);
+	jx_profile_exit(prof, result);
+	return result;
+}
+
+/* This does the real work of jx_calc() */
+static jx_t *jcalc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 {
 	jx_t *left, *right, *freeleft, *freeright;
 	jx_t *result;
@@ -536,6 +845,7 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 	jx_t  *scan, *found;
 	double  nl, nr;
 	int     il,ir;
+	long long ll, lr, lresult;
 	char    *str;
 	void    *localag;
 	jxfuncextra_t recon;
@@ -553,11 +863,12 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 	switch (calc->op)
 	{
 	  case JXOP_LITERAL:
-		result = jx_copy(calc->u.literal);
+		result = jx_copy(jx_defer_share(calc->u.literal));
 		break;
 
 	  case JXOP_NAME:
-		result = jx_copy(jx_context_by_key(context, calc->u.text, NULL));
+		/* Large arrays are shared rather than deep-copied */
+		result = jx_copy(jx_defer_share(jx_context_by_key(context, calc->u.text, NULL)));
 		break;
 
 	  case JXOP_ENVIRON:
@@ -780,7 +1091,9 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 				toFree = (void **)((jx_t **)localag + 1);
 			} else
 				toFree = (void **)localag;
-			if (jf->jfoptions & JXFUNC_FREE && *toFree != NULL)
+			if (jf->jfoptions & JXFUNC_EXFREE)
+				jx_explain_free(*(jxexplain_t **)localag);
+			else if (jf->jfoptions & JXFUNC_FREE && *toFree != NULL)
 				free(*toFree);
 			free(localag);
 		} else {
@@ -842,6 +1155,8 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 		 * right operand to jx_find_calc() to build the result table.
 		 */
 		USE_LEFT_OPERAND(calc);
+		if (jx_debug_flags.profile)
+			jx_profile_input(left, NULL);
 		if (jx_is_null(left))
 			result = left;
 		else
@@ -856,6 +1171,8 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 		 * so it'll effectively be treated like a single-element array.
 		 */
 		USE_LEFT_OPERAND(calc);
+		if (jx_debug_flags.profile)
+			jx_profile_input(left, NULL);
 		if (jx_is_null(left)) {
 			result = jx_array();
 			break;
@@ -874,6 +1191,8 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 		 */
 		USE_LEFT_OPERAND(calc);
 		USE_RIGHT_OPERAND(calc);
+		if (jx_debug_flags.profile)
+			jx_profile_input(left, right);
 		result = jcnjoin(left, right, calc->op == JXOP_LJOIN, calc->op == JXOP_RJOIN);
 		/* NOTE: jcnjoin() always copies any data it uses.  Nothing
 		 * in it could still be used by jl or jr.
@@ -989,30 +1308,19 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 
 	  case JXOP_NEGATE:
 		USE_RIGHT_OPERAND(calc);
-		if (right->type == JX_NUMBER || right->type == JX_STRING)
+		if (jx_is_integer(right, &lr) && lr != LLONG_MIN)
+			result = jx_from_int(-lr);
+		else if (right->type == JX_NUMBER || right->type == JX_STRING)
 			result = jx_from_double(-jx_double(right));
 		break;
 
 	  case JXOP_ADD:
 		USE_LEFT_OPERAND(calc);
 		USE_RIGHT_OPERAND(calc);
-		if (jx_is_date(left) && jx_is_period(right)) {
-			/* ISO datetime+period.  Add the period to the
-			 * datetime, and return the resulting datetime.
-			 * Note that both the datetime and period are strings.
+		if ((result = jx_datetime_calc(left, '+', right)) != NULL) {
+			/* ISO date/datetime+period.  The result is the
+			 * adjusted date/datetime.
 			 */
-			char buf[50];
-			jx_datetime_add(buf, left->text, right->text);
-			buf[10] = '\0';
-			result = jx_string(buf, -1);
-		} else if ((jx_is_date(left) || jx_is_datetime(left)) && jx_is_period(right)) {
-			/* ISO datetime+period.  Add the period to the
-			 * datetime, and return the resulting datetime.
-			 * Note that both the datetime and period are strings.
-			 */
-			char buf[50];
-			jx_datetime_add(buf, left->text, right->text);
-			result = jx_string(buf, -1);
 		} else if (left->type == JX_STRING || right->type == JX_STRING) {
 			/* String version.  If one of the operands is a
 			 * non-string, then convert it to a string.
@@ -1052,40 +1360,25 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 			}
 		}
 		else if (left->type == JX_NUMBER && right->type == JX_NUMBER) {
-			/* Number version */
-			result = jx_from_double(jx_double(left) + jx_double(right));
+			/* Number version.  Integers stay integers unless the
+			 * result overflows.
+			 */
+			if (jx_is_integer(left, &ll) && jx_is_integer(right, &lr)
+			 && !__builtin_add_overflow(ll, lr, &lresult))
+				result = jx_from_int(lresult);
+			else
+				result = jx_from_double(jx_double(left) + jx_double(right));
 		}
 		break;
 
 	  case JXOP_SUBTRACT:
 		USE_LEFT_OPERAND(calc);
 		USE_RIGHT_OPERAND(calc);
-		if (jx_is_date(left) && jx_is_period(right)) {
-			/* ISO date-period.  Subtract the period from the
-			 * datetime, and return the resulting datetime.
-			 * Note that both the datetime and period are strings.
-			 */
-			char buf[50];
-			jx_datetime_subtract(buf, left->text, right->text);
-			buf[10] = '\0';
-			result = jx_string(buf, -1);
-		} else if (jx_is_datetime(left) && jx_is_period(right)) {
-			/* ISO datetime-period.  Subtract the period from the
-			 * datetime, and return the resulting datetime.
-			 * Note that both the datetime and period are strings.
-			 */
-			char buf[50];
-			jx_datetime_subtract(buf, left->text, right->text);
-			result = jx_string(buf, -1);
-		} else if ((jx_is_date(left) || jx_is_datetime(left))
-		        && (jx_is_date(right) || jx_is_datetime(right))) {
-			/* ISO datetime-datetime.  Find the difference between
-			 * two dates, and return it as a period.
-			 * Note that the datetimes are strings.
+		if ((result = jx_datetime_calc(left, '-', right)) != NULL) {
+			/* ISO date/datetime-period is the adjusted
+			 * date/datetime, and date/datetime-date/datetime
+			 * is the period between them.
 			 */
-			char buf[50];
-			jx_datetime_diff(buf, left->text, right->text);
-			result = jx_string(buf, -1);
 		} else if (left->type == JX_STRING || right->type == JX_STRING) {
 			/* String version.  If one of the operands is a
 			 * non-string, then convert it to a string.
@@ -1148,8 +1441,14 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 				free(str);
 		}
 		else if (left->type == JX_NUMBER && right->type == JX_NUMBER) {
-			/* Number version */
-			result = jx_from_double(jx_double(left) - jx_double(right));
+			/* Number version.  Integers stay integers unless the
+			 * result overflows.
+			 */
+			if (jx_is_integer(left, &ll) && jx_is_integer(right, &lr)
+			 && !__builtin_sub_overflow(ll, lr, &lresult))
+				result = jx_from_int(lresult);
+			else
+				result = jx_from_double(jx_double(left) - jx_double(right));
 		}
 		break;
 
@@ -1159,6 +1458,30 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 		USE_LEFT_OPERAND(calc);
 		USE_RIGHT_OPERAND(calc);
 		if (left->type == JX_NUMBER && right->type == JX_NUMBER) {
+			/* If both are integers, try to keep the result an
+			 * integer.  Overflow or an inexact quotient fall
+			 * through to the floating-point version below.
+			 */
+			if (jx_is_integer(left, &ll) && jx_is_integer(right, &lr)) {
+				if (calc->op == JXOP_MULTIPLY) {
+					if (!__builtin_mul_overflow(ll, lr, &lresult)) {
+						result = jx_from_int(lresult);
+						break;
+					}
+				} else if (calc->op == JXOP_DIVIDE) {
+					if (lr != 0 && lr != -1 && ll % lr == 0) {
+						result = jx_from_int(ll / lr);
+						break;
+					}
+				} else { /* JXOP_MODULO */
+					if (lr == 0)
+						result = jx_error_null(NULL, "div0:division by 0");
+					else
+						result = jx_from_int(lr == -1 ? 0 : ll % lr);
+					break;
+				}
+			}
+
 			/* Convert to binary */
 			nl = jx_double(left);
 			nr = jx_double(right);
@@ -1180,7 +1503,7 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 	  case JXOP_BITNOT:
 		USE_RIGHT_OPERAND(calc);
 		if (right->type == JX_NUMBER)
-			result = jx_from_int(~jx_int(right));
+			result = jx_from_int(~jcint64(right));
 		break;
 
 	  case JXOP_BITAND:
@@ -1190,16 +1513,16 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 		USE_RIGHT_OPERAND(calc);
 		if (left->type == JX_NUMBER && right->type == JX_NUMBER) {
 			/* Convert to binary */
-			il = jx_int(left);
-			ir = jx_int(right);
+			ll = jcint64(left);
+			lr = jcint64(right);
 
 			/* Do the bitwise math */
 			if (calc->op == JXOP_BITAND)
-				result = jx_from_int(il & ir);
+				result = jx_from_int(ll & lr);
 			else if (calc->op == JXOP_BITOR)
-				result = jx_from_int(il | ir);
+				result = jx_from_int(ll | lr);
 			else /* JXOP_BITOR */
-				result = jx_from_int(il ^ ir);
+				result = jx_from_int(ll ^ lr);
 		} else if (left->type == JX_OBJECT && right->type == JX_OBJECT) {
 			if (calc->op == JXOP_BITAND) {
 				/* Keep left keys/values only if same key is in right */
@@ -1278,14 +1601,7 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 
 		/* Compare them in an appropriate way */
 		if (left->type == JX_NUMBER && right->type == JX_NUMBER) {
-			nl = jx_double(left);
-			nr = jx_double(right);
-			if (nl < nr)
-				il = -1;
-			else if (nl > nr)
-				il = 1;
-			else
-				il = 0;
+			il = jcnumcmp(left, right);
 		} else if ((left->type == JX_BOOLEAN || right->type == JX_BOOLEAN)
 		        && (calc->op == JXOP_EQ || calc->op == JXOP_NE)) {
 			/* Compare as booleans, but only for equality */
@@ -1373,7 +1689,7 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 					il = 0; /* both are empty */
 				else
 					il = jx_mbs_ncasecmp(left->text, right->text, lenl - spacesl);
-			} else
+			} else if ((il = jx_datetime_compare(left, right)) == 0)
 				il = strcmp(left->text, right->text);
 		}
 
@@ -1404,16 +1720,19 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 		 */
 		scan = left;
 		found = freeleft;
+		freeleft = NULL;
 		USE_LEFT_OPERAND(calc->RIGHT);
 		right = left;
 		freeright = freeleft;
 		left = scan;
 		freeleft = found;
 		if (left->type == JX_NUMBER && right->type == JX_NUMBER) {
-			if (jx_double(left) < jx_double(right))
+			if (jcnumcmp(left, right) < 0)
 				result = jx_boolean(0);
 		} else if (left->type == JX_STRING && right->type == JX_STRING) {
-			if (jx_mbs_casecmp(left->text, right->text) < 0)
+			if ((il = jx_datetime_compare(left, right)) == 0)
+				il = jx_mbs_casecmp(left->text, right->text);
+			if (il < 0)
 				result = jx_boolean(0);
 		} else if ((left->type == JX_NUMBER && right->type == JX_STRING)
 			|| (left->type == JX_STRING && right->type == JX_NUMBER)) {
@@ -1456,10 +1775,12 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 		if (!result) {
 			USE_RIGHT_OPERAND(calc->RIGHT);
 			if (left->type == JX_NUMBER && right->type == JX_NUMBER) {
-				if (jx_double(left) > jx_double(right))
+				if (jcnumcmp(left, right) > 0)
 					result = jx_boolean(0);
-			} else if (left->type == JX_STRING && right->type == JX_NUMBER) {
-				if (jx_mbs_casecmp(left->text, right->text) > 0)
+			} else if (left->type == JX_STRING && right->type == JX_STRING) {
+				if ((il = jx_datetime_compare(left, right)) == 0)
+					il = jx_mbs_casecmp(left->text, right->text);
+				if (il > 0)
 					result = jx_boolean(0);
 			} else if ((left->type == JX_NUMBER && right->type == JX_STRING)
 				|| (left->type == JX_STRING && right->type == JX_NUMBER)) {
@@ -1502,9 +1823,8 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 	  case JXOP_NOTLIKE:
 		USE_LEFT_OPERAND(calc);
 		if (calc->RIGHT->op == JXOP_REGEX) {
-			regmatch_t matches[10];
 			if (left->type == JX_STRING
-			 && regexec((regex_t *)calc->RIGHT->u.regex.preg, left->text, 10, matches, 0) == 0)
+			 && jx_regex_test((jxregex_t *)calc->RIGHT->u.regex.preg, left->text))
 				result = jx_boolean(1);
 			else
 				result = jx_boolean(0);
@@ -1588,7 +1908,7 @@ jx_t *jx_calc(jxcalc_t *calc, jxcontext_t *context, void *agdata)
 		 */
 		result = jcsimple(calc, context);
 		if (result)
-			result = jx_copy(result);
+			result = jx_copy(jx_defer_share(result));
 		else
 			result = jx_error_null(NULL, "noDefTable:There is no default table for SELECT");
 		break;
@@ -2,12 +2,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
 #include <regex.h>
 #include <assert.h>
 #include <time.h>
 #define _XOPEN_SOURCE
 #define __USE_XOPEN
 #include <wchar.h>
+#include <wctype.h>
 #include <jx.h>
 
 /* This file mostly implements the built-in functions.  It also defines
@@ -31,9 +34,9 @@
  */
 
 /* Several aggregate functions use these to store results */
-typedef struct { int count; double val; } agdata_t;
-typedef struct { jx_t *json; char *sval; int count; double dval; } agmaxdata_t;
-typedef struct { char *ag; size_t size;} agjoindata_t;
+typedef struct { int count; double val; long long ival; int scale; int inexact; } agdata_t;
+typedef struct { jx_t *json; char *sval; int count; double dval; long long ival; int isint; } agmaxdata_t;
+typedef struct { char *ag; size_t size; size_t text; size_t len;} agjoindata_t;
 
 /* Forward declarations of the built-in non-aggregate functions */
 static jx_t *jfn_toUpperCase(jx_t *args, void *agdata);
@@ -109,121 +112,263 @@ static jx_t *jfn_writeJSON(jx_t *args, void *agdata);
 /* Forward declarations of the built-in aggregate functions */
 static jx_t *jfn_count(jx_t *args, void *agdata);
 static void    jag_count(jx_t *args, void *agdata);
+static void    jmg_count(void *agdata, void *other);
 static jx_t *jfn_rowNumber(jx_t *args, void *agdata);
 static void    jag_rowNumber(jx_t *args, void *agdata);
+static void    jmg_rowNumber(void *agdata, void *other);
 static jx_t *jfn_min(jx_t *args, void *agdata);
 static void    jag_min(jx_t *args, void *agdata);
+static void    jmg_min(void *agdata, void *other);
 static jx_t *jfn_max(jx_t *args, void *agdata);
 static void    jag_max(jx_t *args, void *agdata);
+static void    jmg_max(void *agdata, void *other);
 static jx_t *jfn_avg(jx_t *args, void *agdata);
 static void    jag_avg(jx_t *args, void *agdata);
+static void    jmg_avg(void *agdata, void *other);
 static jx_t *jfn_sum(jx_t *args, void *agdata);
 static void    jag_sum(jx_t *args, void *agdata);
+static void    jmg_sum(void *agdata, void *other);
 static jx_t *jfn_product(jx_t *args, void *agdata);
 static void    jag_product(jx_t *args, void *agdata);
+static void    jmg_product(void *agdata, void *other);
 static jx_t *jfn_any(jx_t *args, void *agdata);
 static void    jag_any(jx_t *args, void *agdata);
+static void    jmg_any(void *agdata, void *other);
 static jx_t *jfn_all(jx_t *args, void *agdata);
 static void    jag_all(jx_t *args, void *agdata);
+static void    jmg_all(void *agdata, void *other);
 static jx_t *jfn_explain(jx_t *args, void *agdata);
 static void    jag_explain(jx_t *args, void *agdata);
 static jx_t *jfn_writeArray(jx_t *args, void *agdata);
 static void    jag_writeArray(jx_t *args, void *agdata);
 static jx_t *jfn_arrayAgg(jx_t *args, void *agdata);
 static void    jag_arrayAgg(jx_t *args, void *agdata);
+static void    jmg_arrayAgg(void *agdata, void *other);
 static jx_t *jfn_objectAgg(jx_t *args, void *agdata);
 static void    jag_objectAgg(jx_t *args, void *agdata);
+static void    jmg_objectAgg(void *agdata, void *other);
 static jx_t *jfn_join(jx_t *args, void *agdata);
 static void    jag_join(jx_t *args, void *agdata);
+static void    jmg_join(void *agdata, void *other);
 
-/* A linked list of the built-in functions */
-static jxfunc_t toUpperCase_jf = {NULL,            "toUpperCase", "str:string", "string",	jfn_toUpperCase};
-static jxfunc_t toLowerCase_jf = {&toUpperCase_jf, "toLowerCase", "str:string", "string",	jfn_toLowerCase};
-static jxfunc_t toMixedCase_jf = {&toLowerCase_jf, "toMixedCase", "str:string, exceptions?:string[]",	"string",	jfn_toMixedCase};
-static jxfunc_t simpleKey_jf = {&toMixedCase_jf,    "simpleKey",    "str:string",	"string",	jfn_simpleKey};
-static jxfunc_t substr_jf      = {&simpleKey_jf,    "substr",      "str:string, start:number, length?:number",	"string", jfn_substr};
-static jxfunc_t hex_jf         = {&substr_jf,      "hex",         "val:string|number, length?:number", "string",	jfn_hex};
-static jxfunc_t toString_jf    = {&hex_jf,         "toString",    "val:any", "string",		jfn_toString};
-static jxfunc_t String_jf      = {&toString_jf,    "String",      "val:any", "string",		jfn_toString};
-static jxfunc_t isString_jf    = {&String_jf,      "isString",    "val:any", "boolean",		jfn_isString};
-static jxfunc_t isArray_jf     = {&isString_jf,    "isArray",     "val:any", "boolean",		jfn_isArray};
-static jxfunc_t isTable_jf     = {&isArray_jf,     "isTable",     "val:any", "boolean",		jfn_isTable};
-static jxfunc_t isObject_jf    = {&isTable_jf,     "isObject",    "val:any", "boolean",		jfn_isObject};
-static jxfunc_t isNumber_jf    = {&isObject_jf,    "isNumber",    "val:any", "boolean",		jfn_isNumber};
-static jxfunc_t isInteger_jf   = {&isNumber_jf,    "isInteger",   "val:any", "boolean",		jfn_isInteger};
-static jxfunc_t isNaN_jf       = {&isInteger_jf,   "isNaN",       "val:any", "boolean",		jfn_isNaN};
-static jxfunc_t isDate_jf      = {&isNaN_jf,       "isDate",      "val:any", "boolean",		jfn_isDate};
-static jxfunc_t isTime_jf      = {&isDate_jf,      "isTime",      "val:any", "boolean",		jfn_isTime};
-static jxfunc_t isDateTime_jf  = {&isTime_jf,      "isDateTime",  "val:any", "boolean",		jfn_isDateTime};
-static jxfunc_t isPeriod_jf    = {&isDateTime_jf,  "isPeriod",    "val:any", "boolean",		jfn_isPeriod};
-static jxfunc_t typeOf_jf      = {&isPeriod_jf,    "typeOf",      "val:any, prevtype:string|true", "string",	jfn_typeOf};
-static jxfunc_t deferTypeOf_jf = {&typeOf_jf,      "deferTypeOf", "val:any", "string",	jfn_deferTypeOf};
-static jxfunc_t blob_jf 	 = {&deferTypeOf_jf, "blob", 	    "data:string|array, convout?:number, convin?:number", "string|array",	jfn_blob};
-static jxfunc_t sizeOf_jf      = {&blob_jf,	     "sizeOf",      "val:any", "number",		jfn_sizeOf};
-static jxfunc_t widthOf_jf     = {&sizeOf_jf,      "widthOf",     "str:string", "number",		jfn_widthOf};
-static jxfunc_t heightOf_jf    = {&widthOf_jf,     "heightOf",    "str:string", "number",		jfn_heightOf};
-static jxfunc_t keys_jf        = {&heightOf_jf,    "keys",        "obj:object", "string[]",		jfn_keys};
-static jxfunc_t trim_jf        = {&keys_jf,        "trim",        "str:string", "string",		jfn_trim};
-static jxfunc_t trimStart_jf   = {&trim_jf,        "trimStart",   "str:string", "string",		jfn_trimStart};
-static jxfunc_t trimEnd_jf     = {&trimStart_jf,   "trimEnd",     "str:string", "string",		jfn_trimEnd};
-static jxfunc_t concat_jf      = {&trimEnd_jf,     "concat",      "item:array|string, ...more", "array|string",	jfn_concat};
-static jxfunc_t orderBy_jf     = {&concat_jf,      "orderBy",     "tbl:table, columns:string|string[]", "table",	jfn_orderBy};
-static jxfunc_t groupBy_jf     = {&orderBy_jf,     "groupBy",     "tbl:table, columns:string|string[]", "array",	jfn_groupBy};
-static jxfunc_t flat_jf        = {&groupBy_jf,     "flat",        "arr:array, depth?:number",	"array",	jfn_flat};
-static jxfunc_t slice_jf       = {&flat_jf,        "slice",       "val:array|string, start:number, end?:number", "array|string", jfn_slice};
-static jxfunc_t repeat_jf      = {&slice_jf,       "repeat",      "str:string, count:number", "string",	jfn_repeat};
-static jxfunc_t toFixed_jf     = {&repeat_jf,      "toFixed",     "num:number, precision:number", "string",	jfn_toFixed};
-static jxfunc_t distinct_jf    = {&toFixed_jf,     "distinct",    "arr:array, strict?:true, columns?:string[]", "array",	jfn_distinct};
-static jxfunc_t unroll_jf      = {&distinct_jf,    "unroll",      "tbl:table, nestlist:string|string[]", "table",	jfn_unroll};
-static jxfunc_t nameBits_jf    = {&unroll_jf,      "nameBits",    "num:number, names:array, delim?:string", "object|string", jfn_nameBits};
-static jxfunc_t keysValues_jf  = {&nameBits_jf,    "keysValues",  "val:object|table", "table",		jfn_keysValues};
-static jxfunc_t charAt_jf      = {&keysValues_jf,  "charAt",      "str:string, pos?:number", "string",	jfn_charAt};
-static jxfunc_t charCodeAt_jf  = {&charAt_jf,      "charCodeAt",  "str:string, pos?:number|number[]", "number|number[]",	jfn_charCodeAt};
-static jxfunc_t fromCharCode_jf= {&charCodeAt_jf,  "fromCharCode","what:number|string|array, ...", "string",	jfn_fromCharCode};
-static jxfunc_t replace_jf     = {&fromCharCode_jf,"replace",     "str:string, find:string|regex, replace:string", "string",	jfn_replace};
-static jxfunc_t replaceAll_jf  = {&replace_jf,     "replaceAll",  "str:string, find:string|regex, replace:string", "string",	jfn_replaceAll};
-static jxfunc_t includes_jf    = {&replaceAll_jf,  "includes",    "subj:string|array, find:string|regex, ignorecase?:true", "boolean",	jfn_includes};
-static jxfunc_t indexOf_jf     = {&includes_jf,    "indexOf",     "subj:string|array, find:string|regex, ignorecase?:true", "number",	jfn_indexOf};
-static jxfunc_t lastIndexOf_jf = {&indexOf_jf,     "lastIndexOf", "subj:string|array, find:string|regex, ignorecase?:true", "number",	jfn_lastIndexOf};
-static jxfunc_t startsWith_jf  = {&lastIndexOf_jf, "startsWith",  "subj:string, srch:string, ignorecase?:true", "boolean",	jfn_startsWith};
-static jxfunc_t endsWith_jf    = {&startsWith_jf,  "endsWith",    "subj:string, srch:string, ignorecase?:true", "boolean",	jfn_endsWith};
-static jxfunc_t split_jf       = {&endsWith_jf,    "split",       "str:string, delim?:string|regex, limit?:number", "string[]",	jfn_split};
+/* A linked list of the built-in functions.  Non-aggregate functions whose
+ * result depends only on their arguments are marked JXFUNC_PURE; functions
+ * that use the clock, the environment, files, or the context are not.
+ */
+static jxfunc_t toUpperCase_jf = {NULL,            "toUpperCase", "str:string", "string",	jfn_toUpperCase, NULL, 0, JXFUNC_PURE};
+static jxfunc_t toLowerCase_jf = {&toUpperCase_jf, "toLowerCase", "str:string", "string",	jfn_toLowerCase, NULL, 0, JXFUNC_PURE};
+static jxfunc_t toMixedCase_jf = {&toLowerCase_jf, "toMixedCase", "str:string, exceptions?:string[]",	"string",	jfn_toMixedCase, NULL, 0, JXFUNC_PURE};
+static jxfunc_t simpleKey_jf = {&toMixedCase_jf,    "simpleKey",    "str:string",	"string",	jfn_simpleKey, NULL, 0, JXFUNC_PURE};
+static jxfunc_t substr_jf      = {&simpleKey_jf,    "substr",      "str:string, start:number, length?:number",	"string", jfn_substr, NULL, 0, JXFUNC_PURE};
+static jxfunc_t hex_jf         = {&substr_jf,      "hex",         "val:string|number, length?:number", "string",	jfn_hex, NULL, 0, JXFUNC_PURE};
+static jxfunc_t toString_jf    = {&hex_jf,         "toString",    "val:any", "string",		jfn_toString, NULL, 0, JXFUNC_PURE};
+static jxfunc_t String_jf      = {&toString_jf,    "String",      "val:any", "string",		jfn_toString, NULL, 0, JXFUNC_PURE};
+static jxfunc_t isString_jf    = {&String_jf,      "isString",    "val:any", "boolean",		jfn_isString, NULL, 0, JXFUNC_PURE};
+static jxfunc_t isArray_jf     = {&isString_jf,    "isArray",     "val:any", "boolean",		jfn_isArray, NULL, 0, JXFUNC_PURE};
+static jxfunc_t isTable_jf     = {&isArray_jf,     "isTable",     "val:any", "boolean",		jfn_isTable, NULL, 0, JXFUNC_PURE};
+static jxfunc_t isObject_jf    = {&isTable_jf,     "isObject",    "val:any", "boolean",		jfn_isObject, NULL, 0, JXFUNC_PURE};
+static jxfunc_t isNumber_jf    = {&isObject_jf,    "isNumber",    "val:any", "boolean",		jfn_isNumber, NULL, 0, JXFUNC_PURE};
+static jxfunc_t isInteger_jf   = {&isNumber_jf,    "isInteger",   "val:any", "boolean",		jfn_isInteger, NULL, 0, JXFUNC_PURE};
+static jxfunc_t isNaN_jf       = {&isInteger_jf,   "isNaN",       "val:any", "boolean",		jfn_isNaN, NULL, 0, JXFUNC_PURE};
+static jxfunc_t isDate_jf      = {&isNaN_jf,       "isDate",      "val:any", "boolean",		jfn_isDate, NULL, 0, JXFUNC_PURE};
+static jxfunc_t isTime_jf      = {&isDate_jf,      "isTime",      "val:any", "boolean",		jfn_isTime, NULL, 0, JXFUNC_PURE};
+static jxfunc_t isDateTime_jf  = {&isTime_jf,      "isDateTime",  "val:any", "boolean",		jfn_isDateTime, NULL, 0, JXFUNC_PURE};
+static jxfunc_t isPeriod_jf    = {&isDateTime_jf,  "isPeriod",    "val:any", "boolean",		jfn_isPeriod, NULL, 0, JXFUNC_PURE};
+static jxfunc_t typeOf_jf      = {&isPeriod_jf,    "typeOf",      "val:any, prevtype:string|true", "string",	jfn_typeOf, NULL, 0, JXFUNC_PURE};
+static jxfunc_t deferTypeOf_jf = {&typeOf_jf,      "deferTypeOf", "val:any", "string",	jfn_deferTypeOf, NULL, 0, JXFUNC_PURE};
+static jxfunc_t blob_jf 	 = {&deferTypeOf_jf, "blob", 	    "data:string|array, convout?:number, convin?:number", "string|array",	jfn_blob, NULL, 0, JXFUNC_PURE};
+static jxfunc_t sizeOf_jf      = {&blob_jf,	     "sizeOf",      "val:any", "number",		jfn_sizeOf, NULL, 0, JXFUNC_PURE};
+static jxfunc_t widthOf_jf     = {&sizeOf_jf,      "widthOf",     "str:string", "number",		jfn_widthOf, NULL, 0, JXFUNC_PURE};
+static jxfunc_t heightOf_jf    = {&widthOf_jf,     "heightOf",    "str:string", "number",		jfn_heightOf, NULL, 0, JXFUNC_PURE};
+static jxfunc_t keys_jf        = {&heightOf_jf,    "keys",        "obj:object", "string[]",		jfn_keys, NULL, 0, JXFUNC_PURE};
+static jxfunc_t trim_jf        = {&keys_jf,        "trim",        "str:string", "string",		jfn_trim, NULL, 0, JXFUNC_PURE};
+static jxfunc_t trimStart_jf   = {&trim_jf,        "trimStart",   "str:string", "string",		jfn_trimStart, NULL, 0, JXFUNC_PURE};
+static jxfunc_t trimEnd_jf     = {&trimStart_jf,   "trimEnd",     "str:string", "string",		jfn_trimEnd, NULL, 0, JXFUNC_PURE};
+static jxfunc_t concat_jf      = {&trimEnd_jf,     "concat",      "item:array|string, ...more", "array|string",	jfn_concat, NULL, 0, JXFUNC_PURE};
+static jxfunc_t orderBy_jf     = {&concat_jf,      "orderBy",     "tbl:table, columns:string|string[]", "table",	jfn_orderBy, NULL, 0, JXFUNC_PURE};
+static jxfunc_t groupBy_jf     = {&orderBy_jf,     "groupBy",     "tbl:table, columns:string|string[]", "array",	jfn_groupBy, NULL, 0, JXFUNC_PURE};
+static jxfunc_t flat_jf        = {&groupBy_jf,     "flat",        "arr:array, depth?:number",	"array",	jfn_flat, NULL, 0, JXFUNC_PURE};
+static jxfunc_t slice_jf       = {&flat_jf,        "slice",       "val:array|string, start:number, end?:number", "array|string", jfn_slice, NULL, 0, JXFUNC_PURE};
+static jxfunc_t repeat_jf      = {&slice_jf,       "repeat",      "str:string, count:number", "string",	jfn_repeat, NULL, 0, JXFUNC_PURE};
+static jxfunc_t toFixed_jf     = {&repeat_jf,      "toFixed",     "num:number, precision:number", "string",	jfn_toFixed, NULL, 0, JXFUNC_PURE};
+static jxfunc_t distinct_jf    = {&toFixed_jf,     "distinct",    "arr:array, strict?:true, columns?:string[]", "array",	jfn_distinct, NULL, 0, JXFUNC_PURE};
+static jxfunc_t unroll_jf      = {&distinct_jf,    "unroll",      "tbl:table, nestlist:string|string[]", "table",	jfn_unroll, NULL, 0, JXFUNC_PURE};
+static jxfunc_t nameBits_jf    = {&unroll_jf,      "nameBits",    "num:number, names:array, delim?:string", "object|string", jfn_nameBits, NULL, 0, JXFUNC_PURE};
+static jxfunc_t keysValues_jf  = {&nameBits_jf,    "keysValues",  "val:object|table", "table",		jfn_keysValues, NULL, 0, JXFUNC_PURE};
+static jxfunc_t charAt_jf      = {&keysValues_jf,  "charAt",      "str:string, pos?:number", "string",	jfn_charAt, NULL, 0, JXFUNC_PURE};
+static jxfunc_t charCodeAt_jf  = {&charAt_jf,      "charCodeAt",  "str:string, pos?:number|number[]", "number|number[]",	jfn_charCodeAt, NULL, 0, JXFUNC_PURE};
+static jxfunc_t fromCharCode_jf= {&charCodeAt_jf,  "fromCharCode","what:number|string|array, ...", "string",	jfn_fromCharCode, NULL, 0, JXFUNC_PURE};
+static jxfunc_t replace_jf     = {&fromCharCode_jf,"replace",     "str:string, find:string|regex, replace:string", "string",	jfn_replace, NULL, 0, JXFUNC_PURE};
+static jxfunc_t replaceAll_jf  = {&replace_jf,     "replaceAll",  "str:string, find:string|regex, replace:string", "string",	jfn_replaceAll, NULL, 0, JXFUNC_PURE};
+static jxfunc_t includes_jf    = {&replaceAll_jf,  "includes",    "subj:string|array, find:string|regex, ignorecase?:true", "boolean",	jfn_includes, NULL, 0, JXFUNC_PURE};
+static jxfunc_t indexOf_jf     = {&includes_jf,    "indexOf",     "subj:string|array, find:string|regex, ignorecase?:true", "number",	jfn_indexOf, NULL, 0, JXFUNC_PURE};
+static jxfunc_t lastIndexOf_jf = {&indexOf_jf,     "lastIndexOf", "subj:string|array, find:string|regex, ignorecase?:true", "number",	jfn_lastIndexOf, NULL, 0, JXFUNC_PURE};
+static jxfunc_t startsWith_jf  = {&lastIndexOf_jf, "startsWith",  "subj:string, srch:string, ignorecase?:true", "boolean",	jfn_startsWith, NULL, 0, JXFUNC_PURE};
+static jxfunc_t endsWith_jf    = {&startsWith_jf,  "endsWith",    "subj:string, srch:string, ignorecase?:true", "boolean",	jfn_endsWith, NULL, 0, JXFUNC_PURE};
+static jxfunc_t split_jf       = {&endsWith_jf,    "split",       "str:string, delim?:string|regex, limit?:number", "string[]",	jfn_split, NULL, 0, JXFUNC_PURE};
 static jxfunc_t getenv_jf      = {&split_jf,       "getenv",      "str:string", "string:null",		jfn_getenv};
-static jxfunc_t stringify_jf   = {&getenv_jf,      "stringify",   "data:any", "string",		jfn_stringify};
-static jxfunc_t parse_jf       = {&stringify_jf,   "parse",       "str:string", "any",		jfn_parse};
-static jxfunc_t parseInt_jf    = {&parse_jf,       "parseInt",    "str:string", "number",		jfn_parseInt};
-static jxfunc_t parseFloat_jf  = {&parseInt_jf,    "parseFloat",  "str:string", "number",		jfn_parseFloat};
+static jxfunc_t stringify_jf   = {&getenv_jf,      "stringify",   "data:any", "string",		jfn_stringify, NULL, 0, JXFUNC_PURE};
+static jxfunc_t parse_jf       = {&stringify_jf,   "parse",       "str:string", "any",		jfn_parse, NULL, 0, JXFUNC_PURE};
+static jxfunc_t parseInt_jf    = {&parse_jf,       "parseInt",    "str:string", "number",		jfn_parseInt, NULL, 0, JXFUNC_PURE};
+static jxfunc_t parseFloat_jf  = {&parseInt_jf,    "parseFloat",  "str:string", "number",		jfn_parseFloat, NULL, 0, JXFUNC_PURE};
 static jxfunc_t find_jf	       = {&parseFloat_jf,  "find", 	  "haystack?:array|object, needle:string|regex|number, key?:string, ignorecase?:true", "table",	jfn_find};
-static jxfunc_t hash_jf        = {&find_jf,        "hash", 	  "data:any, seed?:number", "number",	jfn_hash};
+static jxfunc_t hash_jf        = {&find_jf,        "hash", 	  "data:any, seed?:number", "number",	jfn_hash, NULL, 0, JXFUNC_PURE};
 static jxfunc_t diff_jf        = {&hash_jf,        "diff", 	  "old:array|object, new?:array|object, style?:number=config.diffstyle", "table", jfn_diff};
 static jxfunc_t date_jf        = {&diff_jf,	   "date",        "when:string|object|number, action?:string|number|true, ...", "string|object|number",	jfn_date};
 static jxfunc_t time_jf        = {&date_jf,        "time",        "when:string|object|number, action?:string|number|true, ...", "string|object|number",	jfn_time};
 static jxfunc_t dateTime_jf    = {&time_jf,        "dateTime",    "when:string|object|number, action?:string|number|true, ...", "string|object|number",	jfn_dateTime};
 static jxfunc_t timeZone_jf    = {&dateTime_jf,    "timeZone",    "when:string|object|number, action?:string|number|true, ...", "null",	jfn_timeZone};
 static jxfunc_t period_jf      = {&timeZone_jf,    "period",      "when:string|object|number, action?:string|number|true, ...", "string|object|number",	jfn_period};
-static jxfunc_t abs_jf         = {&period_jf,      "abs",         "val:number", "number", jfn_abs};
+static jxfunc_t abs_jf         = {&period_jf,      "abs",         "val:number", "number", jfn_abs, NULL, 0, JXFUNC_PURE};
 static jxfunc_t random_jf      = {&abs_jf,         "random",      "intbound?:number", "number", jfn_random};
-static jxfunc_t sign_jf        = {&random_jf,      "sign",        "val:number", "number", jfn_sign};
-static jxfunc_t wrap_jf        = {&sign_jf,        "wrap",        "text:string, width?:number", "number", jfn_wrap};
+static jxfunc_t sign_jf        = {&random_jf,      "sign",        "val:number", "number", jfn_sign, NULL, 0, JXFUNC_PURE};
+static jxfunc_t wrap_jf        = {&sign_jf,        "wrap",        "text:string, width?:number", "number", jfn_wrap, NULL, 0, JXFUNC_PURE};
 static jxfunc_t sleep_jf       = {&wrap_jf,        "sleep",       "seconds:number|period", "number", jfn_sleep};
 static jxfunc_t writeJX_jf   = {&sleep_jf,       "writeJSON",   "data:any, filename:string", "null", jfn_writeJSON};
 
-static jxfunc_t count_jf       = {&writeJX_jf,   "count",       "val:any|*", "number",	jfn_count, jag_count, sizeof(long)};
-static jxfunc_t rowNumber_jf   = {&count_jf,       "rowNumber",   "format:string", "number|string",		jfn_rowNumber, jag_rowNumber, sizeof(int)};
-static jxfunc_t min_jf         = {&rowNumber_jf,   "min",         "val:number|string, marker?:any", "number|string|any",	jfn_min,   jag_min, sizeof(agmaxdata_t), JXFUNC_JXFREE | JXFUNC_FREE};
-static jxfunc_t max_jf         = {&min_jf,         "max",         "val:number|string, marker?:any", "number|string|any",	jfn_max,   jag_max, sizeof(agmaxdata_t), JXFUNC_JXFREE | JXFUNC_FREE};
-static jxfunc_t avg_jf         = {&max_jf,         "avg",         "num:number", "number",		jfn_avg,   jag_avg, sizeof(agdata_t)};
-static jxfunc_t sum_jf         = {&avg_jf,         "sum",         "num:number", "number",		jfn_sum,   jag_sum, sizeof(agdata_t)};
-static jxfunc_t product_jf     = {&sum_jf,         "product",     "num:number", "number",		jfn_product,jag_product, sizeof(agdata_t)};
-static jxfunc_t any_jf         = {&product_jf,     "any",         "bool:boolean", "boolean",		jfn_any,   jag_any, sizeof(int)};
-static jxfunc_t all_jf         = {&any_jf,         "all",         "bool:boolean", "boolean",		jfn_all,   jag_all, sizeof(int)};
-static jxfunc_t explain_jf     = {&all_jf,         "explain",     "tbl:table, depth:?number", "table",		jfn_explain,jag_explain, sizeof(jx_t *), JXFUNC_JXFREE};
+static jxfunc_t count_jf       = {&writeJX_jf,   "count",       "val:any|*", "number",	jfn_count, jag_count, sizeof(long), 0, jmg_count};
+static jxfunc_t rowNumber_jf   = {&count_jf,       "rowNumber",   "format:string", "number|string",		jfn_rowNumber, jag_rowNumber, sizeof(int), JXFUNC_PERROW, jmg_rowNumber};
+static jxfunc_t min_jf         = {&rowNumber_jf,   "min",         "val:number|string, marker?:any", "number|string|any",	jfn_min,   jag_min, sizeof(agmaxdata_t), JXFUNC_JXFREE | JXFUNC_FREE, jmg_min};
+static jxfunc_t max_jf         = {&min_jf,         "max",         "val:number|string, marker?:any", "number|string|any",	jfn_max,   jag_max, sizeof(agmaxdata_t), JXFUNC_JXFREE | JXFUNC_FREE, jmg_max};
+static jxfunc_t avg_jf         = {&max_jf,         "avg",         "num:number", "number",		jfn_avg,   jag_avg, sizeof(agdata_t), 0, jmg_avg};
+static jxfunc_t sum_jf         = {&avg_jf,         "sum",         "num:number", "number",		jfn_sum,   jag_sum, sizeof(agdata_t), 0, jmg_sum};
+static jxfunc_t product_jf     = {&sum_jf,         "product",     "num:number", "number",		jfn_product,jag_product, sizeof(agdata_t), 0, jmg_product};
+static jxfunc_t any_jf         = {&product_jf,     "any",         "bool:boolean", "boolean",		jfn_any,   jag_any, sizeof(int), 0, jmg_any};
+static jxfunc_t all_jf         = {&any_jf,         "all",         "bool:boolean", "boolean",		jfn_all,   jag_all, sizeof(int), 0, jmg_all};
+static jxfunc_t explain_jf     = {&all_jf,         "explain",     "tbl:table, depth:?number", "table",		jfn_explain,jag_explain, sizeof(jxexplain_t *), JXFUNC_EXFREE};
 static jxfunc_t writeArray_jf  = {&explain_jf,     "writeArray",  "data:any, filename:?string", "null",	jfn_writeArray,jag_writeArray, sizeof(FILE *)};
-static jxfunc_t arrayAgg_jf    = {&writeArray_jf,  "arrayAgg",    "data:any", "array",		jfn_arrayAgg,jag_arrayAgg, sizeof(jx_t *), JXFUNC_JXFREE};
-static jxfunc_t objectAgg_jf   = {&arrayAgg_jf,    "objectAgg",   "key:string, value:any", "object",	jfn_objectAgg,jag_objectAgg, sizeof(jx_t *), JXFUNC_JXFREE};
-static jxfunc_t join_jf        = {&objectAgg_jf,   "join",        "str:string, delim?:string", "string",	jfn_join,  jag_join, sizeof(agjoindata_t),	JXFUNC_FREE};
+static jxfunc_t arrayAgg_jf    = {&writeArray_jf,  "arrayAgg",    "data:any", "array",		jfn_arrayAgg,jag_arrayAgg, sizeof(jx_t *), JXFUNC_JXFREE, jmg_arrayAgg};
+static jxfunc_t objectAgg_jf   = {&arrayAgg_jf,    "objectAgg",   "key:string, value:any", "object",	jfn_objectAgg,jag_objectAgg, sizeof(jx_t *), JXFUNC_JXFREE, jmg_objectAgg};
+static jxfunc_t join_jf        = {&objectAgg_jf,   "join",        "str:string, delim?:string", "string",	jfn_join,  jag_join, sizeof(agjoindata_t),	JXFUNC_FREE, jmg_join};
 static jxfunc_t *funclist      = &join_jf;
 
+/* Functions are looked up via hash tables, built from funclist when first
+ * needed.  There are three: one for exact names, one for case-folded names,
+ * and one for abbreviations.  The abbreviation of a name is its first
+ * character plus all of its other non-lowercase characters, in uppercase,
+ * so "tUC" or "tuc" folds to "TUC" which is the abbreviation of "toUpperCase".
+ * Each key maps to the first function in funclist with that key -- the
+ * most recently added one -- same as a linear search of funclist would.
+ */
+#define FUNCINDEX_SIZE	512
+typedef struct funcindex_s {
+	struct funcindex_s *next;	/* next entry in the same bucket */
+	jxfunc_t *fn;			/* the function */
+	char	key[1];			/* name, folded name, or abbreviation */
+} funcindex_t;
+static funcindex_t *exactindex[FUNCINDEX_SIZE];
+static funcindex_t *foldindex[FUNCINDEX_SIZE];
+static funcindex_t *abbrindex[FUNCINDEX_SIZE];
+static int indexed;
+
+/* Compute the hash bucket for a key */
+static int funchash(const char *key)
+{
+	unsigned hash;
+
+	for (hash = 2166136261u; *key; key++)
+		hash = (hash ^ (unsigned char)*key) * 16777619u;
+	return hash % FUNCINDEX_SIZE;
+}
+
+/* Return a dynamically-allocated uppercase copy of a name.  If "abbr" is
+ * set, then lowercase characters after the first are omitted, yielding the
+ * name's abbreviation.
+ */
+static char *funckey(const char *name, int abbr)
+{
+	char	*key, *build;
+	wchar_t	wc;
+	mbstate_t state, outstate;
+	size_t	in;
+	int	first;
+
+	key = build = (char *)malloc(strlen(name) * MB_CUR_MAX + 1);
+	memset(&state, 0, sizeof state);
+	memset(&outstate, 0, sizeof outstate);
+	for (first = 1; *name; first = 0) {
+		in = mbrtowc(&wc, name, MB_CUR_MAX, &state);
+		if (in == 0 || in == (size_t)-1 || in == (size_t)-2)
+			break;
+		name += in;
+		if (first || !abbr || !iswlower(wc))
+			build += wcrtomb(build, towupper(wc), &outstate);
+	}
+	*build = '\0';
+	return key;
+}
+
+/* Find a key in one of the index tables */
+static jxfunc_t *indexfind(funcindex_t **table, const char *key)
+{
+	funcindex_t *scan;
+
+	for (scan = table[funchash(key)]; scan; scan = scan->next)
+		if (!strcmp(scan->key, key))
+			return scan->fn;
+	return NULL;
+}
+
+/* Add a key to one of the index tables.  The key is freed.  If "shadow" is
+ * set then the new entry hides any older one with the same key; otherwise
+ * an existing entry is left alone.
+ */
+static void indexadd(funcindex_t **table, char *key, jxfunc_t *fn, int shadow)
+{
+	funcindex_t *entry;
+	int	bucket;
+
+	if (shadow || !indexfind(table, key)) {
+		bucket = funchash(key);
+		entry = (funcindex_t *)malloc(sizeof(funcindex_t) + strlen(key));
+		strcpy(entry->key, key);
+		entry->fn = fn;
+		entry->next = table[bucket];
+		table[bucket] = entry;
+	}
+	free(key);
+}
+
+/* Add a function to all three index tables */
+static void indexfunc(jxfunc_t *fn, int shadow)
+{
+	indexadd(exactindex, strdup(fn->name), fn, shadow);
+	indexadd(foldindex, funckey(fn->name, 0), fn, shadow);
+	indexadd(abbrindex, funckey(fn->name, 1), fn, shadow);
+}
+
+/* Discard the index tables.  They'll be rebuilt when next needed. */
+static void unindex(void)
+{
+	funcindex_t **tables[3], *entry;
+	int	t, i;
+
+	tables[0] = exactindex;
+	tables[1] = foldindex;
+	tables[2] = abbrindex;
+	for (t = 0; t < 3; t++) {
+		for (i = 0; i < FUNCINDEX_SIZE; i++) {
+			while ((entry = tables[t][i]) != NULL) {
+				tables[t][i] = entry->next;
+				free(entry);
+			}
+		}
+	}
+	indexed = 0;
+}
+
+/* Build the index tables from funclist, if not built already */
+static void buildindex(void)
+{
+	jxfunc_t *scan;
+
+	if (indexed)
+		return;
+	for (scan = funclist; scan; scan = scan->other)
+		indexfunc(scan, 0);
+	indexed = 1;
+}
+
 
 /* Return the start of the function list.  You can find successive functions
  * by following each function's ->other pointer.
@@ -253,6 +398,10 @@ jxfunc_t *jx_calc_function_first(void)
  * typically sizeof(int) or something like that.  The agdata starts out all
  * zeroes.  The idea is that agfn() will accumulate data, and fn() will return
  * the final result.
+ *
+ * Aggregate functions may also have a merge function, which combines two
+ * partially accumulated agdata blobs.  That's set separately, via
+ * jx_calc_aggregate_merge_hook().
  */
 void jx_calc_aggregate_hook(
 	const char    *name,
@@ -270,14 +419,16 @@ void jx_calc_aggregate_hook(
 		agsize = ((agsize - 1) | 0x7) + 1;
 
 	/* If it's already in the table then update it */
-	for (f = funclist; f; f = f->other) {
-		if (!strcmp(f->name, name)) {
-			f->args = (char *)args;
-			f->fn = fn;
-			f->agfn = agfn;
-			f->agsize = agsize;
-			return;
-		}
+	buildindex();
+	f = indexfind(exactindex, name);
+	if (f) {
+		f->args = (char *)args;
+		f->fn = fn;
+		f->agfn = agfn;
+		f->agsize = agsize;
+		f->jfoptions = jfoptions;
+		f->merge = NULL;
+		return;
 	}
 
 	/* Add it */
@@ -292,6 +443,35 @@ void jx_calc_aggregate_hook(
 	f->jfoptions = jfoptions;
 	f->other = funclist;
 	funclist = f;
+	indexfunc(f, 1);
+}
+
+/* Register a merge function for an aggregate function that was previously
+ * registered via jx_calc_aggregate_hook().  The merge function looks like...
+ *
+ *    void myMerge(void *agdata, void *other)
+ *
+ * ... where "agdata" and "other" are both agdata blobs for this function,
+ * which have accumulated different sets of rows via agfn().  It should
+ * combine "other" into "agdata", so that fn() returns the result for both
+ * sets of rows.  It must not change "other" -- that may still be used to
+ * compute its own result -- so any allocated data should be copied, not
+ * moved.  Returns 1 if successful, or 0 if the function isn't a known
+ * aggregate function.
+ */
+int jx_calc_aggregate_merge_hook(
+	const char	*name,
+	void	(*merge)(void *agdata, void *other))
+{
+	jxfunc_t *f;
+
+	buildindex();
+	f = indexfind(exactindex, name);
+	if (f && f->agfn) {
+		f->merge = merge;
+		return 1;
+	}
+	return 0;
 }
 
 /* Register a non-aggregate function.  "name" is the name of the function,
@@ -317,6 +497,9 @@ static void free_user_functions()
 {
 	jxfunc_t	*scan, *lag, *other;
 
+	/* The index tables would refer to freed functions */
+	unindex();
+
 	/* For each function in the list... */
 	for (scan = funclist, lag = NULL; scan; scan = other) {
 		/* Skip if not user-defined */
@@ -377,11 +560,18 @@ int jx_calc_function_user(
 		memset(fn, 0, sizeof(jxfunc_t));
 		fn->other = funclist;
 		funclist = fn;
+		fn->name = name;
+		indexfunc(fn, 1);
 	} else if (fn->fn) {
 		/* Can't redefine built-ins */
 		return 1;
 	} else {
-		/* Redefining, so discard the old details */
+		/* Redefining, so discard the old details.  The jxfunc_t
+		 * itself is reused so that parsed calls to it remain valid.
+		 * The name might differ in case though, so reindex it then.
+		 */
+		if (strcmp(fn->name, name))
+			unindex();
 		free(fn->name);
 		jx_free(fn->userparams);
 		if (fn->args) {
@@ -409,29 +599,25 @@ int jx_calc_function_user(
 /* Look up a function by name, and return its info */
 jxfunc_t *jx_calc_function_by_name(const char *name)
 {
-	jxfunc_t *scan;
+	jxfunc_t *fn;
+	char	*key;
 
 	/* Try case-sensitive */
-	for (scan = funclist; scan; scan = scan->other) {
-		if (!strcmp(name, scan->name))
-			return scan;
-	}
+	buildindex();
+	fn = indexfind(exactindex, name);
+	if (fn)
+		return fn;
 
 	/* Try case-insensitive */
-	for (scan = funclist; scan; scan = scan->other) {
-		if (!jx_mbs_casecmp(name, scan->name))
-			return scan;
-	}
+	key = funckey(name, 0);
+	fn = indexfind(foldindex, key);
 
 	/* Try abbreviation, if the name is more than 1 letter long */
-	if (jx_mbs_len(name) > 1) {
-		for (scan = funclist; scan; scan = scan->other) {
-			if (!jx_mbs_abbrcmp(name, scan->name))
-				return scan;
-		}
-	}
+	if (!fn && jx_mbs_len(name) > 1)
+		fn = indexfind(abbrindex, key);
 
-	return NULL;
+	free(key);
+	return fn;
 }
 
 /***************************************************************************
@@ -571,7 +757,7 @@ static jx_t *jfn_hex(jx_t *args, void *agdata)
 	char    *str;
 	int     len;
 	size_t	size;
-	long    n;
+	long long n;
 
 	if (args->first->type == JX_STRING) {
 		/* Allocate a big enough string */
@@ -586,7 +772,8 @@ static jx_t *jfn_hex(jx_t *args, void *agdata)
 		return result;
 	} else if (args->first->type == JX_NUMBER) {
 		/* Get the args, including length */
-		n = jx_int(args->first);
+		if (!jx_is_integer(args->first, &n))
+			n = (long long)jx_double(args->first);
 		len = 0;
 		if (args->first->next && args->first->next->type == JX_NUMBER) /* undeferred */
 			len = jx_int(args->first->next); /* undeferred */
@@ -600,9 +787,9 @@ static jx_t *jfn_hex(jx_t *args, void *agdata)
 
 		/* Fill it */
 		if (len == 0)
-			snprintf(result->text, size + 1, "0x%lx", n);
+			snprintf(result->text, size + 1, "0x%llx", n);
 		else
-			snprintf(result->text, size + 1, "%0*lx", len, n);
+			snprintf(result->text, size + 1, "%0*llx", len, n);
 
 		return result;
 	}
@@ -662,14 +849,15 @@ static jx_t *jfn_isNumber(jx_t *args, void *agdata)
 
 static jx_t *jfn_isInteger(jx_t *args, void *agdata)
 {
+	long long i;
 	double d;
 
 	if (args->first->type != JX_NUMBER)
 		return jx_boolean(0);
-	if (args->first->text[0] == '\0' && args->first->text[1] == 'i')
+	if (jx_is_integer(args->first, &i))
 		return jx_boolean(1);
 	d = jx_double(args->first);
-	return jx_boolean(d == (int)d);
+	return jx_boolean(d == (long long)d);
 }
 
 static jx_t *jfn_isNaN(jx_t *args, void *agdata)
@@ -906,7 +1094,7 @@ static jx_t *jfn_concat(jx_t *args, void *agdata)
 				continue;
 			else if (scan->type == JX_NUMBER && !*scan->text) {
 				if (scan->text[1] == 'i')
-					snprintf(build, len, "%i", JX_INT(scan));
+					snprintf(build, len, "%lld", JX_INT(scan));
 				else
 					snprintf(build, len, "%.*g", jx_format_default.digits, JX_DOUBLE(scan));
 			} else
@@ -1338,7 +1526,7 @@ static jx_t *jfn_keysValues(jx_t *args, void *agdata)
 		 * single row from the argument table.
 		 */
 		result = jx_array();
-		for (scan = args->first->first; scan; scan = scan->next) /* undeferred */
+		for (scan = jx_first(args->first); scan; scan = jx_next(scan))
 			jx_append(result, keysValuesHelper(scan));
 		return result;
 	}
@@ -1541,7 +1729,7 @@ static char *addstr(char *buf, size_t *refsize, size_t used, const char *str, si
 	return buf;
 }
 
-static jx_t *help_replace(jx_t *args, regex_t *preg, int globally)
+static jx_t *help_replace(jx_t *args, jxregex_t *preg, int globally)
 {
 	const char	*subject, *search, *replace;
 	size_t		searchlen;
@@ -1578,7 +1766,7 @@ static jx_t *help_replace(jx_t *args, regex_t *preg, int globally)
 		/* REGULAR EXPRESSION VERSION */
 
 		/* For each match... */
-		while (0 == regexec(preg, subject, 10, matches, 0)) {
+		while (jx_regex_exec(preg, subject, 10, matches)) {
 			/* Include any text from before the match */
 			buf = addstr(buf, &bufsize, used, subject, matches[0].rm_so);
 			used += matches[0].rm_so;
@@ -1893,7 +2081,7 @@ static jx_t *jfn_split(jx_t *args, void *agdata)
 	jx_t	*djson;		/* delimiter, as a jx_t */
 	char	*delim;		/* delimiter if djson is a JX_STRING */
 	size_t	delimlen;
-	regex_t *regex;
+	jxregex_t *regex;
 	regmatch_t matches[10];
 	int	nelems, limit, all, regexmatch;
 	jx_t	*result;
@@ -1977,7 +2165,7 @@ static jx_t *jfn_split(jx_t *args, void *agdata)
 				next = &str[len] + delimlen;
 		} else /* regex */ {
 			/* Search for the next match */
-			regexmatch = (0 == regexec(regex, str, 10, matches, 0));
+			regexmatch = jx_regex_exec(regex, str, 10, matches);
 
 			if (regexmatch) {
 				/* Found! matches[0] contains overall match */
@@ -2108,7 +2296,7 @@ static jx_t *jfn_parse(jx_t *args, void *agdata)
 /* Convert a string to an integer */
 static jx_t *jfn_parseInt(jx_t *args, void *agdata)
 {
-	int	value;
+	long long value;
 	if (args->first->type == JX_STRING
 	 || (args->first->type == JX_NUMBER && args->first->text[0])) {
 		char	*digits = args->first->text;
@@ -2120,13 +2308,13 @@ static jx_t *jfn_parseInt(jx_t *args, void *agdata)
 			case 'b': case 'B': radix = 2;	digits += 2; break;
 			default:	    radix = 8;
 			}
-			value = (int)strtol(digits, NULL, radix);
+			value = strtoll(digits, NULL, radix);
 		} else
-			value = atoi(digits);
+			value = atoll(digits);
 	} else if (args->first->type == JX_NUMBER && args->first->text[1] == 'i')
 		value = JX_INT(args->first);
 	else if (args->first->type == JX_NUMBER /* text[1] == 'f' */)
-		value = (int)JX_DOUBLE(args->first);
+		value = (long long)JX_DOUBLE(args->first);
 	else
 		return jx_error_null(NULL, "string:%s() expects a string", "parseInt");
 
@@ -2154,7 +2342,7 @@ static jx_t *jfn_parseFloat(jx_t *args, void *agdata)
 static jx_t *jfn_find(jx_t *args, void *agdata)
 {
 	jxfuncextra_t *recon = (jxfuncextra_t *)agdata;
-	regex_t *regex = recon->regex ? recon->regex->u.regex.preg : NULL;
+	jxregex_t *regex = recon->regex ? recon->regex->u.regex.preg : NULL;
 	jx_t	*haystack, *needle, *result, *other;
 	char	*defaulttable, *needkey;
 	int	ignorecase;
@@ -2256,7 +2444,7 @@ static jx_t *jfn_diff(jx_t *args, void *agdata)
 	 * to treat as the diff style, defaulting to the "diffstyle" config
 	 * setting.
 	 */
-	style = jx_config_get_int(NULL, "diffstyle");
+	style = jx_config_snapshot()->diffstyle;
 	if (args->first->next && args->first->next->type != JX_NUMBER) {
 		/* Two things to diff, maybe with a style after that */
 		oldjx = args->first;
@@ -2567,6 +2755,10 @@ static void jag_count(jx_t *args, void *agdata)
 		return;
 	(*(int *)agdata)++;
 }
+static void jmg_count(void *agdata, void *other)
+{
+	*(int *)agdata += *(int *)other;
+}
 
 /* rowNumber(arg) returns a different value for each element in the group */
 static jx_t *jfn_rowNumber(jx_t *args, void *agdata)
@@ -2613,6 +2805,49 @@ static jx_t *jfn_rowNumber(jx_t *args, void *agdata)
 static void jag_rowNumber(jx_t *args, void *agdata)
 {
 }
+static void jmg_rowNumber(void *agdata, void *other)
+{
+	/* The counter is only advanced while generating results, so this is
+	 * normally adding 0, but it doesn't hurt to be thorough.
+	 */
+	*(int *)agdata += *(int *)other;
+}
+
+/* Merge the min() or max() data in "more" into "data".  "dir" is -1 for
+ * min() or 1 for max().  As with jag_min() and jag_max(), strings take
+ * precedence over numbers.
+ */
+static void agmaxmerge(agmaxdata_t *data, agmaxdata_t *more, int dir)
+{
+	int	better;
+
+	if (more->count == 0)
+		return;
+	if (more->sval)
+		better = !data->sval || dir * jx_mbs_casecmp(more->sval, data->sval) > 0;
+	else if (data->sval)
+		better = 0;
+	else if (data->count == 0)
+		better = 1;
+	else if (more->isint && data->isint)
+		better = dir > 0 ? more->ival > data->ival : more->ival < data->ival;
+	else
+		better = dir > 0 ? more->dval > data->dval : more->dval < data->dval;
+	data->count += more->count;
+	if (!better)
+		return;
+
+	/* Copy the better value into data */
+	if (data->json)
+		jx_free(data->json);
+	if (data->sval)
+		free(data->sval);
+	data->json = more->json ? jx_copy(more->json) : NULL;
+	data->sval = more->sval ? strdup(more->sval) : NULL;
+	data->dval = more->dval;
+	data->ival = more->ival;
+	data->isint = more->isint;
+}
 
 /* min(arg) returns the minimum value */
 static jx_t *jfn_min(jx_t *args, void *agdata)
@@ -2626,6 +2861,8 @@ static jx_t *jfn_min(jx_t *args, void *agdata)
 		return jx_copy(data->json);
 	if (data->sval)
 		return jx_string(data->sval, -1);
+	if (data->isint)
+		return jx_from_int(data->ival);
 	return jx_from_double(data->dval);
 
 }
@@ -2636,9 +2873,14 @@ static void jag_min(jx_t *args, void *agdata)
 	/* If this is a number and we're comparing numbers ... */
 	if (args->first->type == JX_NUMBER && !data->sval) {
 		/* If this is first, or less than previous, use it */
+		long long i;
+		int isint = jx_is_integer(args->first, &i);
 		double d = jx_double(args->first);
-		if (data->count == 0 || d < data->dval) {
+		if (data->count == 0
+		 || (isint && data->isint ? i < data->ival : d < data->dval)) {
 			data->dval = d;
+			data->ival = i;
+			data->isint = isint;
 			if (data->json) {
 				jx_free(data->json);
 				data->json = NULL;
@@ -2662,6 +2904,10 @@ static void jag_min(jx_t *args, void *agdata)
 		data->count++;
 	}
 }
+static void jmg_min(void *agdata, void *other)
+{
+	agmaxmerge((agmaxdata_t *)agdata, (agmaxdata_t *)other, -1);
+}
 
 /* max(arg) returns the maximum value */
 static jx_t *jfn_max(jx_t *args, void *agdata)
@@ -2675,6 +2921,8 @@ static jx_t *jfn_max(jx_t *args, void *agdata)
 		return jx_copy(data->json);
 	if (data->sval)
 		return jx_string(data->sval, -1);
+	if (data->isint)
+		return jx_from_int(data->ival);
 	return jx_from_double(data->dval);
 
 }
@@ -2684,11 +2932,16 @@ static void jag_max(jx_t *args, void *agdata)
 
 	/* If this is a number, and we're comparing numbers... */
 	if (args->first->type == JX_NUMBER && !data->sval) {
+		long long i;
+		int isint = jx_is_integer(args->first, &i);
 		double d = jx_double(args->first);
 
 		/* If this is first, or more than previous max, use it*/
-		if (data->count == 0 || d > data->dval) {
+		if (data->count == 0
+		 || (isint && data->isint ? i > data->ival : d > data->dval)) {
 			data->dval = d;
+			data->ival = i;
+			data->isint = isint;
 			if (data->json) {
 				jx_free(data->json);
 				data->json = NULL;
@@ -2712,6 +2965,115 @@ static void jag_max(jx_t *args, void *agdata)
 		data->count++;
 	}
 }
+static void jmg_max(void *agdata, void *other)
+{
+	agmaxmerge((agmaxdata_t *)agdata, (agmaxdata_t *)other, 1);
+}
+
+/* Convert a number to a scaled decimal integer -- the value is
+ * *refmant / 10^*refscale.  Returns 1 if that worked, or 0 if the number
+ * can't be represented exactly that way (binary doubles, exponents, or too
+ * many digits).
+ */
+static int agdecimal(jx_t *json, long long *refmant, int *refscale)
+{
+	const char *s;
+	long long mant;
+	int	digits, scale, neg, frac;
+
+	if (jx_is_integer(json, refmant)) {
+		*refscale = 0;
+		return 1;
+	}
+	if (json->text[0] == '\0')
+		return 0;
+
+	s = json->text;
+	neg = (*s == '-');
+	if (*s == '-' || *s == '+')
+		s++;
+	for (mant = 0, digits = scale = frac = 0; *s; s++) {
+		if (*s == '.' && !frac)
+			frac = 1;
+		else if (!isdigit(*s) || ++digits > 18)
+			return 0;
+		else {
+			mant = mant * 10 + (*s - '0');
+			scale += frac;
+		}
+	}
+	*refmant = neg ? -mant : mant;
+	*refscale = scale;
+	return 1;
+}
+
+/* Add a number to an aggregate's running total.  The double total is always
+ * kept, but as long as every value has been an integer or a short decimal
+ * number, an exact scaled integer total is kept too.
+ */
+static void agaddscaled(agdata_t *data, long long mant, int scale);
+static void agaddexact(agdata_t *data, jx_t *num)
+{
+	long long mant;
+	int	scale;
+
+	data->val += jx_double(num);
+	if (data->inexact)
+		return;
+	if (!agdecimal(num, &mant, &scale)) {
+		data->inexact = 1;
+		return;
+	}
+	agaddscaled(data, mant, scale);
+}
+
+/* Add mant / 10^scale to an aggregate's exact total.  If the result can't
+ * be represented exactly, the total is marked as inexact.
+ */
+static void agaddscaled(agdata_t *data, long long mant, int scale)
+{
+	/* Bring both to the same scale, then add */
+	while (scale < data->scale) {
+		if (__builtin_mul_overflow(mant, 10, &mant))
+			goto Overflow;
+		scale++;
+	}
+	while (data->scale < scale) {
+		if (__builtin_mul_overflow(data->ival, 10, &data->ival))
+			goto Overflow;
+		data->scale++;
+	}
+	if (!__builtin_add_overflow(data->ival, mant, &data->ival))
+		return;
+Overflow:
+	data->inexact = 1;
+}
+
+/* Return the exact total as a number, without trailing 0's after the
+ * decimal point.
+ */
+static jx_t *agexact(agdata_t *data)
+{
+	char	buf[50];
+	long long ival = data->ival;
+	unsigned long long u, p10;
+	int	scale = data->scale;
+	int	i;
+
+	while (scale > 0 && ival % 10 == 0) {
+		ival /= 10;
+		scale--;
+	}
+	if (scale == 0)
+		return jx_from_int(ival);
+
+	/* Split into whole and fraction parts, and format them */
+	u = (ival < 0) ? 0ULL - (unsigned long long)ival : (unsigned long long)ival;
+	for (p10 = 1, i = 0; i < scale; i++)
+		p10 *= 10;
+	snprintf(buf, sizeof buf, "%s%llu.%0*llu", ival < 0 ? "-" : "", u / p10, scale, u % p10);
+	return jx_number(buf, -1);
+}
 
 /* avg(arg) returns the average value of arg */
 static jx_t *jfn_avg(jx_t *args, void *agdata)
@@ -2735,14 +3097,26 @@ static void jag_avg(jx_t *args, void *agdata)
 		data->count++;
 	}
 }
+static void jmg_avg(void *agdata, void *other)
+{
+	agdata_t *data = (agdata_t *)agdata;
+	agdata_t *more = (agdata_t *)other;
+
+	data->val += more->val;
+	data->count += more->count;
+}
 
-/* sum(arg) returns the sum of arg */
+/* sum(arg) returns the sum of arg.  Integers and short decimal numbers are
+ * summed exactly, so adding up prices doesn't accumulate rounding errors.
+ */
 static jx_t *jfn_sum(jx_t *args, void *agdata)
 {
 	agdata_t *data = (agdata_t *)agdata;
 
 	if (data->count == 0)
 		return jx_from_int(0);
+	if (!data->inexact)
+		return agexact(data);
 	return jx_from_double(data->val);
 }
 static void jag_sum(jx_t *args, void *agdata)
@@ -2750,22 +3124,40 @@ static void jag_sum(jx_t *args, void *agdata)
 	agdata_t *data = (agdata_t *)agdata;
 
 	if (args->first->type == JX_NUMBER) {
-		double d = jx_double(args->first);
-		if (data->count == 0)
-			data->val = d;
-		else
-			data->val += d;
+		agaddexact(data, args->first);
 		data->count++;
 	}
 }
+static void jmg_sum(void *agdata, void *other)
+{
+	agdata_t *data = (agdata_t *)agdata;
+	agdata_t *more = (agdata_t *)other;
+
+	if (more->count == 0)
+		return;
+	if (data->count == 0) {
+		*data = *more;
+		return;
+	}
+	data->val += more->val;
+	data->count += more->count;
+	if (more->inexact)
+		data->inexact = 1;
+	if (!data->inexact)
+		agaddscaled(data, more->ival, more->scale);
+}
 
-/* product(arg) returns the product of arg */
+/* product(arg) returns the product of arg.  Integers stay integers unless
+ * the product overflows.
+ */
 static jx_t *jfn_product(jx_t *args, void *agdata)
 {
 	agdata_t *data = (agdata_t *)agdata;
 
 	if (data->count == 0)
 		return jx_from_int(1);
+	if (!data->inexact)
+		return jx_from_int(data->ival);
 	return jx_from_double(data->val);
 }
 static void jag_product(jx_t *args, void *agdata)
@@ -2773,14 +3165,37 @@ static void jag_product(jx_t *args, void *agdata)
 	agdata_t *data = (agdata_t *)agdata;
 
 	if (args->first->type == JX_NUMBER) {
+		long long i;
 		double d = jx_double(args->first);
-		if (data->count == 0)
+		if (data->count == 0) {
 			data->val = d;
-		else
+			data->inexact = !jx_is_integer(args->first, &data->ival);
+		} else {
 			data->val *= d;
+			if (!data->inexact
+			 && (!jx_is_integer(args->first, &i)
+			  || __builtin_mul_overflow(data->ival, i, &data->ival)))
+				data->inexact = 1;
+		}
 		data->count++;
 	}
 }
+static void jmg_product(void *agdata, void *other)
+{
+	agdata_t *data = (agdata_t *)agdata;
+	agdata_t *more = (agdata_t *)other;
+
+	if (more->count == 0)
+		return;
+	if (data->count == 0) {
+		*data = *more;
+		return;
+	}
+	data->val *= more->val;
+	data->count += more->count;
+	if (more->inexact || __builtin_mul_overflow(data->ival, more->ival, &data->ival))
+		data->inexact = 1;
+}
 
 /* any(arg) returns true if any row's arg is true */
 static jx_t *jfn_any(jx_t *args, void *agdata)
@@ -2793,6 +3208,10 @@ static void jag_any(jx_t *args, void *agdata)
 	int *refi = (int *)agdata;
 	*refi |= jx_is_true(args->first);
 }
+static void jmg_any(void *agdata, void *other)
+{
+	*(int *)agdata |= *(int *)other;
+}
 
 /* all(arg) returns true if all of row's arg is true */
 static jx_t *jfn_all(jx_t *args, void *agdata)
@@ -2806,15 +3225,20 @@ static void jag_all(jx_t *args, void *agdata)
 
 	*refi |= !jx_is_true(args->first);
 }
+static void jmg_all(void *agdata, void *other)
+{
+	/* The flag means "some value was false", so merge with OR too */
+	*(int *)agdata |= *(int *)other;
+}
 
 
 /* Return column statistics about a table (array of objects) */
 static jx_t *jfn_explain(jx_t *args, void *agdata)
 {
-	jx_t *stats = *(jx_t **)agdata;
+	jx_t *stats = jx_explain_finish(*(jxexplain_t **)agdata);
 
-	/* Don't free the memory -- we're returning it */
-	*(jx_t **)agdata = NULL;
+	/* The accumulator was freed by jx_explain_finish() */
+	*(jxexplain_t **)agdata = NULL;
 
 	if (!stats)
 		stats = jx_null();
@@ -2823,17 +3247,19 @@ static jx_t *jfn_explain(jx_t *args, void *agdata)
 
 static void jag_explain(jx_t *args, void *agdata)
 {
-	jx_t *stats = *(jx_t **)agdata;
+	jxexplain_t *ex = *(jxexplain_t **)agdata;
 	int depth = 0;
 
 	/* If second parameter is given and is true, then recursively explain
 	 * any embedded objects or arrays of objects.
 	 */
-	if (args->first->next && jx_is_true(args->first->next)) /* undeferred */
-		depth = -1;
-	stats = jx_explain(stats, args->first, depth);
-
-	*(jx_t **)agdata = stats;
+	if (!ex) {
+		if (args->first->next && jx_is_true(args->first->next)) /* undeferred */
+			depth = -1;
+		ex = jx_explain_start(depth);
+		*(jxexplain_t **)agdata = ex;
+	}
+	jx_explain_row(ex, args->first);
 }
 
 
@@ -2901,7 +3327,23 @@ static void  jag_arrayAgg(jx_t *args, void *agdata)
 		result = jx_array();
 	if (!jx_is_null(args->first))
 		jx_append(result, jx_copy(args->first));
-	*(jx_t **)agdata = result;
+	*(jx_t **)agdata = jx_defer_spill(result, JX_SPILL_MIN);
+}
+static void  jmg_arrayAgg(void *agdata, void *other)
+{
+	jx_t *result = *(jx_t **)agdata;
+	jx_t *more = *(jx_t **)other;
+	jx_t *item;
+
+	if (!more)
+		return;
+	if (!result)
+		*(jx_t **)agdata = jx_copy(more);
+	else {
+		for (item = jx_first(more); item; item = jx_next(item))
+			jx_append(result, jx_copy(item));
+		jx_defer_spill(result, JX_SPILL_MIN);
+	}
 }
 
 
@@ -2922,9 +3364,29 @@ static void  jag_objectAgg(jx_t *args, void *agdata)
 		jx_append(result, jx_key(args->first->text, jx_copy(args->first->next))); /* undeferred */
 	*(jx_t **)agdata = result;
 }
+static void  jmg_objectAgg(void *agdata, void *other)
+{
+	jx_t *result = *(jx_t **)agdata;
+	jx_t *more = *(jx_t **)other;
+	jx_t *member;
+
+	if (!more)
+		return;
+	if (!result) {
+		*(jx_t **)agdata = jx_copy(more);
+		return;
+	}
+
+	/* As with jag_objectAgg(), a later value for a key replaces the
+	 * earlier one.
+	 */
+	for (member = more->first; member; member = member->next) /* object */
+		jx_append(result, jx_key(member->text, jx_copy(member->first)));
+}
 
 /* join(str, delim) Concatenate a series of strings into a single big string.
- * The delim is optional and defaults to ",".
+ * The delim is optional and defaults to ",".  The agdata's buffer starts with
+ * the delimiter, so jmg_join() can use it later; the joined text follows it.
  */
 static jx_t *jfn_join(jx_t *args, void *agdata)
 {
@@ -2932,16 +3394,35 @@ static jx_t *jfn_join(jx_t *args, void *agdata)
 
 	/* Return the accumulated string.  If no string, return "" */
 	if (data->ag)
-		return jx_string(data->ag, -1);
+		return jx_string(data->ag + data->text, -1);
 	else
 		return jx_string("", 0);
 }
+
+/* Append a delimiter and text to the joined string */
+static void agjoinappend(agjoindata_t *data, const char *delim, const char *text)
+{
+	size_t	dlen = strlen(delim);
+	size_t	tlen = strlen(text);
+
+	/* Maybe need to reallocate */
+	if (data->len + dlen + tlen + 1 > data->size) {
+		data->size = ((data->len + dlen + tlen) | 0x1ff) + 1;
+		data->ag = (char *)realloc(data->ag, data->size);
+	}
+
+	/* Append the delimiter and text */
+	memcpy(data->ag + data->len, delim, dlen);
+	data->len += dlen;
+	memcpy(data->ag + data->len, text, tlen + 1);
+	data->len += tlen;
+}
+
 static void  jag_join(jx_t *args, void *agdata)
 {
 	char	*text, *mustfree, *delim;
 	char	buf[40];
 	agjoindata_t *data = (agjoindata_t *)agdata;
-	size_t	newlen;
 
 	/* Get the text.  Skip null, but get text for anything else */
 	mustfree = NULL;
@@ -2957,7 +3438,7 @@ static void  jag_join(jx_t *args, void *agdata)
 			text = args->first->text; /* number in text format */
 		else {
 			if (args->first->text[1] == 'i')
-				snprintf(buf, sizeof buf, "%i", JX_INT(args->first));
+				snprintf(buf, sizeof buf, "%lld", JX_INT(args->first));
 			else
 				snprintf(buf, sizeof buf, "%g", JX_DOUBLE(args->first));
 			text = buf;
@@ -2967,32 +3448,44 @@ static void  jag_join(jx_t *args, void *agdata)
 		text = mustfree = jx_serialize(args->first, NULL);
 	}
 
-	/* First string? */
+	/* Get the delimiter, default to "," */
+	if (args->first->next && args->first->next->type == JX_STRING) /* undeferred */
+		delim = args->first->next->text; /* undeferred */
+	else
+		delim = ",";
+
 	if (data->ag == NULL) {
-		/* The first call always stores a string unchanged */
-		data->size = (strlen(text) | 0xff) + 1;
+		/* The first call stores the delimiter and the string unchanged */
+		data->text = strlen(delim) + 1;
+		data->len = data->text + strlen(text);
+		data->size = (data->len | 0xff) + 1;
 		data->ag = (char *)malloc(data->size);
-		strcpy(data->ag, text);
+		strcpy(data->ag, delim);
+		strcpy(data->ag + data->text, text);
 	} else {
-		/* Get the delimiter, default to "," */
-		if (args->first->next && args->first->next->type == JX_STRING) /* undeferred */
-			delim = args->first->next->text; /* undeferred */
-		else
-			delim = ",";
-
-		/* Maybe need to reallocate */
-		newlen = strlen(data->ag) + strlen(delim) + strlen(text);
-		if (newlen + 1 > data->size) {
-			data->size = (newlen | 0x1ff) + 1;
-			data->ag = (char *)realloc(data->ag, data->size);
-		}
-
-		/* Append the delimiter and text */
-		strcat(data->ag, delim);
-		strcat(data->ag, text);
+		agjoinappend(data, delim, text);
 	}
 
 	/* Clean up */
 	if (mustfree)
 		free(mustfree);
 }
+static void  jmg_join(void *agdata, void *other)
+{
+	agjoindata_t *data = (agjoindata_t *)agdata;
+	agjoindata_t *more = (agjoindata_t *)other;
+	char	*delim;
+
+	if (!more->ag)
+		return;
+	if (!data->ag) {
+		*data = *more;
+		data->ag = (char *)malloc(data->size);
+		memcpy(data->ag, more->ag, more->len + 1);
+		return;
+	}
+	/* The delimiter is in data's buffer, which might be reallocated */
+	delim = strdup(data->ag);
+	agjoinappend(data, delim, more->ag + more->text);
+	free(delim);
+}
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <errno.h>
 #include <locale.h>
 #include <regex.h>
 #include <assert.h>
@@ -813,7 +814,7 @@ static jxcalc_t *jcalloc(token_t *token)
 	} else if (token->op == JXOP_NUMBER) {
 		jc->op = JXOP_LITERAL;
 		if (*token->full == '0' && token->len > 1 && strchr("0123456789XxOoBb", token->full[1])) {
-			long	value;
+			long long value;
 			int	radix;
 			const char	*digits = token->full;
 			switch (token->full[1]) {
@@ -822,15 +823,22 @@ static jxcalc_t *jcalloc(token_t *token)
 			case 'b': case 'B': radix = 2;	digits += 2; break;
 			default:	    radix = 8;
 			}
-			value = strtol(digits, NULL, radix);
-			jc->u.literal = jx_from_int((int)value);
+			value = strtoll(digits, NULL, radix);
+			jc->u.literal = jx_from_int(value);
 		} else if (((end = strchr(token->full, '.')) != NULL
 			 || (end = strchr(token->full, 'e')) != NULL
 			 || (end = strchr(token->full, 'E')) != NULL)
 			&& end < token->full + token->len) {
 			jc->u.literal = jx_from_double(atof(token->full));
 		} else {
-			jc->u.literal = jx_from_int(atoi(token->full));
+			/* Integers too large for 64 bits become doubles */
+			long long value;
+			errno = 0;
+			value = strtoll(token->full, NULL, 10);
+			if (errno == ERANGE)
+				jc->u.literal = jx_from_double(atof(token->full));
+			else
+				jc->u.literal = jx_from_int(value);
 		}
 	} else if (token->op == JXOP_BOOLEAN) {
 		jc->op = JXOP_LITERAL;
@@ -852,10 +860,7 @@ static jxcalc_t *jcalloc(token_t *token)
 		int	ignorecase = 0;
 		char	*tmp, *build;
 		const char *scan;
-		int	err;
-
-		/* Allocate a regex_t buffer */
-		jc->u.regex.preg = malloc(sizeof(regex_t));
+		char	buf[200];
 
 		/* Extract the regex source from the token */
 		tmp = (char *)malloc(token->len);
@@ -872,16 +877,14 @@ static jxcalc_t *jcalloc(token_t *token)
 			jc->u.regex.global |= (*scan == 'g');
 		}
 
-		/* Compile the regex */
-		err = regcomp((regex_t *)jc->u.regex.preg, tmp, ignorecase ? REG_ICASE : 0);
-		if (err) {
-			char	buf[200];
-			/* Fetch the error messaged */
-			regerror(err, (regex_t *)jc->u.regex.preg, buf, sizeof buf);
-			/* Stuff it into a null */
+		/* Compile the regex, or fetch it from the cache */
+		jc->u.regex.preg = jx_regex(tmp, ignorecase, buf, sizeof buf);
+		if (!jc->u.regex.preg) {
+			/* Stuff the error message into a null */
 			jc->op = JXOP_LITERAL;
 			jc->u.literal = jx_error_null(NULL, "regex:%s", buf);
 		}
+		free(tmp);
 	}
 
 	/* return it */
@@ -1057,13 +1060,8 @@ void jx_calc_free(jxcalc_t *jc)
 		break;
 
 	  case JXOP_REGEX:
-		/* jc->u.regex.preg is a pointer to a regex_t buffer.  We need
-		 * to call regfree() on that buffer to release the data
-		 * associated with the buffer, and also free() to release
-		 * the memory for the buffer itself.
-		 */
-		regfree((regex_t *)jc->u.regex.preg);
-		free(jc->u.regex.preg);
+		/* jc->u.regex.preg is a pointer to a shared jxregex_t */
+		jx_regex_free((jxregex_t *)jc->u.regex.preg);
 		break;
 
 	  case JXOP_DISTINCT:
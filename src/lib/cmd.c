@@ -721,7 +721,12 @@ jxcmdout_t *jx_cmd_run(jxcmd_t *cmd, jxcontext_t **refcontext)
 		}
 
 		/* Run the command */
-		result = (*cmd->name->run)(cmd, refcontext);
+		if (jx_debug_flags.profile) {
+			jxprofile_t *prof = jx_profile_enter(NULL, cmd);
+			result = (*cmd->name->run)(cmd, refcontext);
+			jx_profile_exit(prof, NULL);
+		} else
+			result = (*cmd->name->run)(cmd, refcontext);
 
 		/* If mismatched "case", then skip ahead to the next case */
 		if (result && result->ret == &jx_cmd_case_mismatch) {
@@ -2080,12 +2085,26 @@ static jxcmd_t *explain_parse(jxsrc_t *src, jxcmdout_t **referr)
 	/* Allocate a cmd */
 	cmd = jx_cmd(src, &jcn_explain);
 
-	/* Three ways to go: "explain" explains the default table, "explain?"
-	 * says where the default table is located, and "explain expr" explains
-	 * the result of an expression.
+	/* Four ways to go: "explain" explains the default table, "explain?"
+	 * says where the default table is located, "explain expr" explains
+	 * the result of an expression, and "explain analyze expr" evaluates
+	 * an expression with profiling and outputs the profile.
 	 */
 	jx_cmd_parse_whitespace(src);
-	if (!*src->str || *src->str == ';' || *src->str == '}') {
+	if (!strncasecmp(src->str, "analyze", 7) && !isalnum(src->str[7]) && src->str[7] != '_') {
+		/* Profile an expression */
+		cmd->var = 2;
+		src->str += 7;
+		jx_cmd_parse_whitespace(src);
+		err = NULL;
+		cmd->calc = jx_calc_parse(src->str, &end, &err, 0);
+		if (err || !cmd->calc) {
+			*referr = jx_cmd_error(src->str, "%s", err ? err : "Expression expected");
+			jx_cmd_free(cmd);
+			return NULL;
+		}
+		src->str = end;
+	} else if (!*src->str || *src->str == ';' || *src->str == '}') {
 		/* Use the default */
 	} else if (*src->str == '?') {
 		/* Use the default, but suppress the actual "explain" table */
@@ -2125,6 +2144,23 @@ static jxcmdout_t *explain_run(jxcmd_t *cmd, jxcontext_t **refcontext)
 	jx_t	*table, *mustfree, *columns;
 	char	*expr;
 
+	/* "explain analyze expr" evaluates expr and outputs the profile */
+	if (cmd->var == 2) {
+		jxprofile_t *prof = jx_profile_begin();
+		table = jx_calc(cmd->calc, *refcontext, NULL);
+		columns = jx_profile_end(prof);
+		if (jx_is_error(table)) {
+			jxcmdout_t *out = jx_cmd_error(cmd->where, "%s", table->text);
+			jx_free(table);
+			jx_free(columns);
+			return out;
+		}
+		jx_free(table);
+		jx_print(columns, NULL);
+		jx_free(columns);
+		return NULL;
+	}
+
 	/* Is there an expression, explicitly naming a table? */
 	if (!cmd->calc) {
 		/* No, so look for a default table */
@@ -2168,21 +2204,7 @@ static jxcmdout_t *explain_run(jxcmd_t *cmd, jxcontext_t **refcontext)
 		/* If it is a deferred array, then we might want to check only
 		 * some of the rows.
 		 */
-		if (jx_is_deferred_array(table)) {
-			int deferexplain = 0;
-			jx_t *jc = jx_by_key(jx_config, "deferexplain");
-			if (jc && jc->type == JX_NUMBER)
-				deferexplain = jx_int(jc);
-			if (deferexplain >= 1) {
-				for (table = jx_first(table); deferexplain > 0 && table; deferexplain--, table = jx_next(table))
-					columns = jx_explain(columns, table, 0);
-				jx_break(table);
-			}
-		}
-		if (!columns) {
-			for (table = jx_first(table); table; table = jx_next(table))
-				columns = jx_explain(columns, table, 0);
-		}
+		columns = jx_explain_table(table, 0, jx_is_deferred_array(table) ? jx_config_snapshot()->deferexplain : 0);
 		jx_print(columns, NULL);
 	}
 
@@ -14,6 +14,7 @@ int jx_compare(jx_t *obj1, jx_t *obj2, jx_t *orderby)
 	jx_t *field1, *field2, *key;
 	int	descending, isnull1, isnull2;
 	double	diff;
+	long long i1, i2;
 
 	// Check parameters.
 	if (obj1->type != JX_OBJECT || obj2->type != JX_OBJECT)
@@ -23,9 +24,10 @@ int jx_compare(jx_t *obj1, jx_t *obj2, jx_t *orderby)
 
 	// For each field...
 	descending = 0;
-	if (orderby->type == JX_ARRAY)
+	if (orderby->type == JX_ARRAY) {
+		jx_undefer(orderby);
 		key = orderby->first;
-	else
+	} else
 		key = orderby;
 	for (;key; key = key->next) { /* object */
 		// If this is a "descending" flag, then just do that
@@ -61,9 +63,11 @@ int jx_compare(jx_t *obj1, jx_t *obj2, jx_t *orderby)
 		}
 
 		/* Compare, based on type.  Assume both are same type */
-		if (field1->type == JX_NUMBER)
+		if (field1->type == JX_NUMBER && jx_is_integer(field1, &i1) && jx_is_integer(field2, &i2))
+			diff = (i1 > i2) - (i1 < i2);
+		else if (field1->type == JX_NUMBER)
 			diff = jx_double(field1) - jx_double(field2);
-		else
+		else if ((diff = jx_datetime_compare(field1, field2)) == 0)
 			diff = strcasecmp(field1->text, field2->text);
 
 		/* jx_by_expr() may encounter deferred arrays */
@@ -48,6 +48,10 @@ static const char *defaultconfig = "{"
 	"\"emptyobject\":\"object\","
 	"\"defersize\":10000000,"
 	"\"deferexplain\":100,"
+	"\"journal\":false,"
+	"\"journallimit\":25,"
+	"\"sharesize\":100,"
+	"\"memorylimit\":0,"
 	"\"styles\": ["
 		"{"
 			"\"style\":\"normal\","
@@ -170,6 +174,14 @@ static const char *defaultconfig = "{"
 /* This stores a pointer to the config data */
 jx_t *jx_config;
 
+/* This is incremented whenever jx_config changes.  It starts at 1 so a
+ * zeroed jxconfigsnap_t is always stale.
+ */
+unsigned jx_config_version = 1;
+
+/* This stores binary copies of frequently-used settings */
+static jxconfigsnap_t snapshot;
+
 /* This is a combination of all system data.  It is initialized by
  * jx_config_load(), though other code may add to it.
  */
@@ -303,6 +315,7 @@ void jx_config_load(const char *name)
 
 	/* Load the default config */
 	jx_config = jx_parse_string(defaultconfig);
+	jx_config_changed();
 
 	/* If jx_system isn't set up yet, then set it up now */
 	if (!jx_system) {
@@ -402,6 +415,7 @@ void jx_config_load(const char *name)
 
 	/* Merge its settings into the default config */
 	merge(jx_config, conf);
+	jx_config_changed();
 
 	/* Free the data from the file */
 	jx_free(conf);
@@ -461,13 +475,13 @@ void jx_config_save(const char *name)
 	copy = jx_copy_filter(jx_config, notlist);
 
 	/* Write it to the file */
-	fp = jx_file_update(pathname);
+	fp = jx_file_update_atomic(pathname);
 	if (fp) {
 		jxformat_t fmt = jx_format_default;
 		fmt.string = fmt.elem = fmt.sh = fmt.ascii = fmt.color = 0;
 		fmt.fp = fp;
 		jx_print(copy, &fmt);
-		fclose(fp);
+		jx_file_update_close(fp);
 	}
 	jx_free(copy);
 }
@@ -526,6 +540,7 @@ jx_t *jx_config_style(const char *name, jx_t **refstyles)
 	scan = jx_copy(styles->first);
 	jx_append(scan, jx_key("style", jx_string(name, -1)));
 	jx_append(styles, scan);
+	jx_config_changed();
 	return scan;
 }
 
@@ -595,6 +610,61 @@ void jx_config_set(const char *section, const char *key, jx_t *value)
 
 	/* Append the value to the section */
 	jx_append(jsect, jx_key(key, value));
+	jx_config_changed();
+}
+
+/* Note that jx_config has changed, so any snapshot of it is stale */
+void jx_config_changed(void)
+{
+	jx_config_version++;
+}
+
+/* Return a snapshot of frequently-used settings, recomputing it if
+ * jx_config has changed since the last time.
+ */
+const jxconfigsnap_t *jx_config_snapshot(void)
+{
+	jx_t	*jc;
+
+	/* If still current, use it */
+	if (snapshot.version == jx_config_version)
+		return &snapshot;
+
+	/* If the config isn't loaded yet (e.g., while parsing the default
+	 * config), then use defaults and leave the snapshot marked as stale.
+	 */
+	if (!jx_config) {
+		snapshot.emptyobject = 'o';
+		snapshot.defersize = 0;
+		snapshot.deferexplain = 0;
+		snapshot.diffstyle = 0;
+		snapshot.journal = 0;
+		snapshot.journallimit = 0;
+		snapshot.sharesize = 0;
+		snapshot.memorylimit = 0;
+		return &snapshot;
+	}
+
+	/* Recompute */
+	jc = jx_by_key(jx_config, "emptyobject");
+	snapshot.emptyobject = (jc && jc->type == JX_STRING) ? *jc->text : 'o';
+	jc = jx_by_key(jx_config, "defersize");
+	snapshot.defersize = (jc && jc->type == JX_NUMBER) ? jx_int(jc) : 0;
+	jc = jx_by_key(jx_config, "deferexplain");
+	snapshot.deferexplain = (jc && jc->type == JX_NUMBER) ? jx_int(jc) : 0;
+	jc = jx_by_key(jx_config, "diffstyle");
+	snapshot.diffstyle = (jc && jc->type == JX_NUMBER) ? jx_int(jc) : 0;
+	snapshot.journal = jx_is_true(jx_by_key(jx_config, "journal"));
+	jc = jx_by_key(jx_config, "journallimit");
+	snapshot.journallimit = (jc && jc->type == JX_NUMBER) ? jx_int(jc) : 0;
+	jc = jx_by_key(jx_config, "sharesize");
+	snapshot.sharesize = (jc && jc->type == JX_NUMBER) ? jx_int(jc) : 0;
+	jc = jx_by_key(jx_config, "memorylimit");
+	snapshot.memorylimit = 0;
+	if (jc && jc->type == JX_NUMBER && jx_double(jc) > 0.0)
+		snapshot.memorylimit = (size_t)(jx_double(jc) * 1024 * 1024);
+	snapshot.version = jx_config_version;
+	return &snapshot;
 }
 
 /* Parse an option string, and merge its settings into a given section.
@@ -633,6 +703,9 @@ jx_t *jx_config_parse(jx_t *config, const char *settings, const char **refend)
 	if (!config)
 		config = jx_config;
 
+	/* Even if there's an error, earlier settings may have been changed */
+	jx_config_changed();
+
 	/* Until we hit the end... */
 	while (*settings && (!refend || *settings != ',')) {
 		/* Skip whitespace or commas between settings */
@@ -756,7 +829,7 @@ jx_t *jx_config_parse(jx_t *config, const char *settings, const char **refend)
 						/* It's integer */
 						found->text[0] = 0;
 						found->text[1] = 'i';
-						JX_INT(found) = (int)l;
+						JX_INT(found) = l;
 						settings = lend;
 					}
 				}
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <assert.h>
 #include <sys/stat.h>
@@ -69,6 +70,33 @@ void jx_context_dump(jxcontext_t *context)
 	}
 }
 
+/* When the "journal" setting is on, this describes the file whose changes
+ * are being journaled.  "ok" is cleared if a change can't be journaled, so
+ * the whole file must be rewritten instead.
+ */
+static struct {
+	jxcontext_t *layer;	/* the "data" layer */
+	char	*filename;	/* name of the loaded data file */
+	int	ok;		/* journal is usable */
+} journal;
+
+/* When the current file is writable, it's locked from when it's loaded
+ * until we switch to another file, so other processes updating it can't
+ * read it before our changes are written back.  A process forked while
+ * holding the lock doesn't own it, so it must reload the file to lock it.
+ */
+static struct {
+	int	fd;		/* from jx_file_lock(), or -1 */
+	pid_t	pid;		/* process that locked it */
+} datalock = {-1};
+
+/* jx_context_assign() and jx_context_append() store a description of the
+ * change here, for data_modified() to add to the journal.
+ */
+static const char *changeop;
+static jx_t *changepath;
+static jx_t *changevalue;
+
 /* This callback is called if the current file's parsed data gets modified */
 static void data_modified(jxcontext_t *layer, jxcalc_t *lvalue)
 {
@@ -81,6 +109,13 @@ static void data_modified(jxcontext_t *layer, jxcalc_t *lvalue)
 	if (layer->flags & JX_CONTEXT_THIS)
 		layer = layer->older;
 
+	/* If the change can be journaled, do that */
+	if (journal.ok && journal.layer == layer) {
+		if (!changeop
+		 || jx_journal_append(journal.filename, changeop, changepath, changevalue) != 0)
+			journal.ok = 0;
+	}
+
 	/* Set the MODIFIED flag */
 	layer->flags |= JX_CONTEXT_MODIFIED;
 }
@@ -407,7 +442,7 @@ jxcontext_t *jx_context_func(jxcontext_t *context, jxfunc_t *fn, jx_t *args)
 	for (name = fn->userparams->first, value = jx_first(args);
 	     name && value;
 	     name = name->next, value = jx_next(value)) { /* object */
-		jx_append(cargs, jx_key(name->text, jx_copy(value)));
+		jx_append(cargs, jx_key(name->text, jx_copy(jx_defer_share(value))));
 	}
 
 	/* It's possible that we hit the end of names before values or
@@ -582,6 +617,30 @@ jx_t *jx_context_file(jxcontext_t *context, const char *filename, int writable,
 	 && (j = jx_by_index(files, current_file)) != NULL /* undeferred */
 	 && jx_is_true(jx_by_key(j, "writable"))) {
 		char *filename = jx_text_by_key(j, "filename");
+		long limit;
+
+		/* If the changes were journaled, and the journal isn't too
+		 * big compared to the data file, then just make sure the
+		 * journal is safely on disk.
+		 */
+		if (filename
+		 && journal.ok
+		 && journal.layer == datacontext
+		 && !strcmp(journal.filename, filename)
+		 && stat(filename, &st) == 0) {
+			limit = (long)st.st_size * jx_config_snapshot()->journallimit / 100;
+			if (jx_journal_size(filename) <= limit) {
+				if (jx_journal_sync(filename) == 0)
+					datacontext->flags &= ~JX_CONTEXT_MODIFIED;
+				else
+					jx_user_printf(NULL, "error", "%s.journal: %s\n", filename, strerror(errno));
+				filename = NULL;
+			}
+		}
+
+		/* Otherwise rewrite the whole file, which also compacts any
+		 * journal into it.
+		 */
 		if (filename) {
 			/* Tweak the formatting rules */
 			jxformat_t tweaked = jx_format_default;
@@ -591,16 +650,22 @@ jx_t *jx_context_file(jxcontext_t *context, const char *filename, int writable,
 			tweaked.pretty = 0;  /* Not pretty-printed */
 			tweaked.sh = 0;	     /* Not shell quoted */
 
-			/* Open the data file for writing */
-			tweaked.fp = jx_file_update(filename);
+			/* Write the data to a temp file, and then replace
+			 * the data file with it.  If anything goes wrong, the
+			 * old file is left unchanged.
+			 */
+			tweaked.fp = jx_file_update_atomic(filename);
 			if (tweaked.fp) {
-				/* Write the data */
 				jx_print(jx_by_key(datacontext->data, "data"), &tweaked);
-				fclose(tweaked.fp);
-
-				/* Turn off the MODIFIED flag */
-				datacontext->flags &= ~JX_CONTEXT_MODIFIED;
+				if (jx_file_update_close(tweaked.fp) == 0) {
+					datacontext->flags &= ~JX_CONTEXT_MODIFIED;
+					jx_journal_remove(filename);
+					journal.ok = 0;
+				} else
+					tweaked.fp = NULL;
 			}
+			if (!tweaked.fp)
+				jx_user_printf(NULL, "error", "%s: %s\n", filename, strerror(errno));
 		}
 	}
 
@@ -615,16 +680,52 @@ jx_t *jx_context_file(jxcontext_t *context, const char *filename, int writable,
 	 * free the old data, because it gets freed when we reassign the
 	 * "data" member (the first jx_append() below).
 	 */
-	if (current_file != *refcurrent || !j) {
+	if (current_file != *refcurrent || !j || (datalock.fd >= 0 && datalock.pid != getpid())) {
 		/* Load the data.  If it couldn't be loaded then say why */
 		char *currentname = jx_text_by_key(jx_by_index(files, *refcurrent), "filename"); /* undeferred */
 		jx_t *data;
+		journal.ok = 0;
+
+		/* Unlock the old file, and lock the new one if writable */
+		jx_file_unlock(datalock.fd);
+		datalock.fd = -1;
+		if (currentname
+		 && strcmp(currentname, "-")
+		 && jx_is_true(jx_by_key(jx_by_index(files, *refcurrent), "writable"))) { /* undeferred */
+			datalock.fd = jx_file_lock(currentname);
+			datalock.pid = getpid();
+		}
+
 		if (!currentname)
 			data = jx_error_null(0, "There is no current file");
 		else {
 			data = jx_parse_file(currentname);
 			if (!data)
 				data = jx_error_null(0, "File \"%s\" is unreadable", currentname);
+			else if (strcmp(currentname, "-")) {
+				/* Apply any journaled changes.  If the journal
+				 * is damaged, or journaling is now turned off,
+				 * then treat the data as modified so -u will
+				 * compact the journal into the data file.  If
+				 * the journal is for some other version of the
+				 * data file then it's ignored, and any change
+				 * will rewrite the data file and delete it.
+				 */
+				i = jx_journal_replay(currentname, &data);
+				if (i == -2)
+					jx_user_printf(NULL, "error", "%s.journal: Doesn't match the data file, ignored\n", currentname);
+				else if (i < 0 || (i > 0 && !jx_config_snapshot()->journal))
+					datacontext->flags |= JX_CONTEXT_MODIFIED;
+
+				/* Should later changes be journaled? */
+				if (journal.filename)
+					free(journal.filename);
+				journal.layer = datacontext;
+				journal.filename = strdup(currentname);
+				journal.ok = i >= 0
+					&& jx_config_snapshot()->journal
+					&& jx_is_true(jx_by_key(jx_by_index(files, *refcurrent), "writable")); /* undeferred */
+			}
 		}
 
 		/* Store it as the variable "data".  This also has the
@@ -757,10 +858,11 @@ jx_t *jx_context_by_key(jxcontext_t *context, char *key, jxcontext_t **reflayer)
  * because that hack is so obnoxious, at least this way it's only used by a
  * couple of functions within the same source file.
  */
-static const char *jxlvalue(jxcalc_t *lvalue, jxcontext_t *context, jxcontext_t **reflayer, jx_t **refcontainer, jx_t **refvalue, char **refkey)
+static const char *jxlvalue(jxcalc_t *lvalue, jxcontext_t *context, jxcontext_t **reflayer, jx_t **refcontainer, jx_t **refvalue, char **refkey, jx_t *path)
 {
 	jx_t	*value, *t, *v, *m;
 	char	*skey;
+	int	i;
 	jxcalc_t *sub;
 	const char *err, *ret;
 	jxcontext_t *layer;
@@ -791,11 +893,16 @@ static const char *jxlvalue(jxcalc_t *lvalue, jxcontext_t *context, jxcontext_t
 			return "UnknownVar:Unknown variable \"%s\"";
 		}
 
-		/* Found!  Since we're doing assignments, if this is a
-		 * deferred array then we need to undefer it.
+		/* Found!  If the value is a deferred array, it'll only be
+		 * undeferred if an element is changed; assigning a whole new
+		 * value doesn't need that.
 		 */
-		jx_undefer(layer->data);
-		jx_undefer(value);
+
+		/* Start the path with the variable name, except that the
+		 * "data" variable is the top of a data file so it's omitted.
+		 */
+		if (path && !(layer->flags & JX_CONTEXT_DATA))
+			jx_append(path, jx_string(*refkey, -1));
 
 		/* Return what we found */
 		if (reflayer)
@@ -808,7 +915,7 @@ static const char *jxlvalue(jxcalc_t *lvalue, jxcontext_t *context, jxcontext_t
 
 	case JXOP_DOT:
 		/* Recursively look up the left side of the dot */
-		if ((err = jxlvalue(lvalue->u.param.left, context, reflayer, refcontainer, &value, refkey)) != NULL && *err)
+		if ((err = jxlvalue(lvalue->u.param.left, context, reflayer, refcontainer, &value, refkey, path)) != NULL && *err)
 			return err;
 		if (err) { /* "" */
 			free(*refkey);
@@ -843,6 +950,8 @@ static const char *jxlvalue(jxcalc_t *lvalue, jxcontext_t *context, jxcontext_t
 		 * deferred arrays.
 		 */
 		jx_undefer(value);
+		if (path)
+			jx_append(path, jx_string(*refkey, -1));
 
 		/* The value becomes the container, and "t" becomes the value */
 		if (refcontainer)
@@ -853,7 +962,7 @@ static const char *jxlvalue(jxcalc_t *lvalue, jxcontext_t *context, jxcontext_t
 
 	case JXOP_SUBSCRIPT:
 		/* Recursively look up the left side of the subscript */
-		if ((err = jxlvalue(lvalue->u.param.left, context, reflayer, refcontainer, &value, refkey)) != NULL && *err)
+		if ((err = jxlvalue(lvalue->u.param.left, context, reflayer, refcontainer, &value, refkey, path)) != NULL && *err)
 			return err;
 		if (err) { /* "" */
 			free(*refkey);
@@ -862,6 +971,11 @@ static const char *jxlvalue(jxcalc_t *lvalue, jxcontext_t *context, jxcontext_t
 		if (value == NULL)
 			return "UnknownVar:Unknown variable \"%s\"";
 
+		/* An element is about to be changed, so a deferred array
+		 * must be undeferred before we look for the element.
+		 */
+		jx_undefer(value);
+
 		/* The [key:value] style of subscripts is handled specially */
 		sub = lvalue->u.param.right;
 		if (sub->op == JXOP_COLON) {
@@ -883,17 +997,20 @@ static const char *jxlvalue(jxcalc_t *lvalue, jxcontext_t *context, jxcontext_t
 			/* Scan the array for an element with that member key
 			 * and value.
 			 */
-			for (v = jx_first(value); v; v = jx_next(v)) {
+			for (i = 0, v = jx_first(value); v; i++, v = jx_next(v)) {
 				if (v->type == JX_OBJECT) {
 					m = jx_by_key(v, skey);
 					if (m && jx_equal(m, t))
 						break;
 				}
 			}
+			jx_free(t);
 
 			/* If not found, fail */
 			if (!v)
 				return "UnknownSub:No element found with the requested subscript";
+			if (path)
+				jx_append(path, jx_from_int(i));
 
 			/* Return what we found */
 			if (refcontainer)
@@ -932,6 +1049,15 @@ static const char *jxlvalue(jxcalc_t *lvalue, jxcontext_t *context, jxcontext_t
 			 * subscript then we need to keep it the string for
 			 * a while.
 			 */
+			if (path && value->type == JX_ARRAY) {
+				/* Negative subscripts count from the end */
+				i = jx_int(t);
+				if (i < 0)
+					i += jx_length(value);
+				jx_append(path, jx_from_int(i));
+			}
+			else if (path)
+				jx_append(path, jx_string(*refkey, -1));
 			ret = NULL;
 			if (t->type == JX_STRING) {
 				*refkey = strdup(t->text);
@@ -974,24 +1100,30 @@ static const char *jxlvalue(jxcalc_t *lvalue, jxcontext_t *context, jxcontext_t
 jx_t *jx_context_assign(jxcalc_t *lvalue, jx_t *rvalue, jxcontext_t *context)
 {
 	jxcontext_t	*layer;
-	jx_t	*container, *value, *scan;
+	jx_t	*container, *value, *scan, *path;
 	char	*key;
 	const char	*err;
 
 	/* We can't use a value that's already part of something else. */
 	assert(rvalue->next == NULL); /* undeferred */
 
+	/* If changes are being journaled, we'll need the path of the change */
+	path = journal.ok ? jx_array() : NULL;
+
 	/* Get the details on what to change.  Note that for new members,
 	 * value may be NULL even if jxlvalue() returns 1.
 	 */
-	if ((err = jxlvalue(lvalue, context, &layer, &container, &value, &key)) != NULL && *err)
+	if ((err = jxlvalue(lvalue, context, &layer, &container, &value, &key, path)) != NULL && *err) {
+		jx_free(path);
 		return jx_error_null(0, err, key);
+	}
 
 	/* If it's const then fail */
 	if (layer->flags & JX_CONTEXT_CONST) {
 		value = jx_error_null(0, "Const:Attempt to change const \"%s\"", key);
 		if (err) /* "" */
 			free(key);
+		jx_free(path);
 		return value;
 	}
 
@@ -1000,9 +1132,12 @@ jx_t *jx_context_assign(jxcalc_t *lvalue, jx_t *rvalue, jxcontext_t *context)
 		jx_append(container, jx_key(key, rvalue));
 		if (err) /* "" */
 			free(key);
+		changeop = "add";
 	} else if (container->type == JX_ARRAY) {
-		if (!value)
+		if (!value) {
+			jx_free(path);
 			return jx_error_null(0, "UnknownSub:No element found with the requested subscript", key);
+		}
 
 		/* If it's a deferred array, convert to undeferred */
 		jx_undefer(container);
@@ -1022,18 +1157,28 @@ jx_t *jx_context_assign(jxcalc_t *lvalue, jx_t *rvalue, jxcontext_t *context)
 			/* Replace the element after it with a new one */
 			scan->next = rvalue; /* undeferred */
 		}
+		if (!rvalue->next) /* undeferred */
+			JX_END_POINTER(container) = rvalue;
 
 		/* Free the old value (but not its siblings) */
 		value->next = NULL; /* undeferred */
 		jx_free(value);
+		changeop = "replace";
 	} else {
 		/* Not something that can be assigned */
+		jx_free(path);
 		return NULL;
 	}
 
 	/* If this layer has a callback for modifications, call it */
-	if (layer->modified)
+	if (layer->modified) {
+		changepath = path;
+		changevalue = rvalue;
 		(*layer->modified)(layer, lvalue);
+	}
+	changeop = NULL;
+	changepath = changevalue = NULL;
+	jx_free(path);
 
 	/* All good! */
 	return NULL;
@@ -1050,38 +1195,52 @@ jx_t *jx_context_assign(jxcalc_t *lvalue, jx_t *rvalue, jxcontext_t *context)
 jx_t *jx_context_append(jxcalc_t *lvalue, jx_t *rvalue, jxcontext_t *context)
 {
 	jxcontext_t	*layer;
-	jx_t	*container, *value;
+	jx_t	*container, *value, *path;
 	char	*key;
 	const char *err;
 
 	/* We can't use a value that's already part of something else. */
 	assert(rvalue->next == NULL); /* undeferred */
 
+	/* If changes are being journaled, we'll need the path of the change */
+	path = journal.ok ? jx_array() : NULL;
+
 	/* Get the details on what to change */
-	if ((err = jxlvalue(lvalue, context, &layer, &container, &value, &key)) != NULL)
-		return jx_error_null(0, err, key);
-	if (value == NULL)
-		return jx_error_null(0, "UnknownVar:Unknown variable \"%s\"", key);
+	if ((err = jxlvalue(lvalue, context, &layer, &container, &value, &key, path)) != NULL)
+		value = jx_error_null(0, err, key);
+	else if (value == NULL)
+		value = jx_error_null(0, "UnknownVar:Unknown variable \"%s\"", key);
 
 	/* If it's const then fail */
-	if (layer->flags & JX_CONTEXT_CONST)
-		return jx_error_null(0, "Const:Attempt to change const \"%s\"", key);
+	else if (layer->flags & JX_CONTEXT_CONST)
+		value = jx_error_null(0, "Const:Attempt to change const \"%s\"", key);
 
 	/* We can only append to arrays */
-	if (value->type != JX_ARRAY)
-		return jx_error_null(0, "Append:Can't append to %s \"%s\"", jx_typeof(value, 0), key);
-
-	/* If its a deferred array, convert to undeferred */
-	jx_undefer(value);
-
-	/* Append! */
-	jx_append(value, rvalue);
+	else if (value->type != JX_ARRAY)
+		value = jx_error_null(0, "Append:Can't append to %s \"%s\"", jx_typeof(value, 0), key);
+	else {
+		/* If its a deferred array, convert to undeferred */
+		jx_undefer(value);
 
-	/* If this layer has a callback for modifications, call it */
-	if (layer->modified)
-		(*layer->modified)(layer, lvalue);
+		/* Append! */
+		jx_append(value, rvalue);
+
+		/* If this layer has a callback for modifications, call it */
+		if (layer->modified) {
+			changeop = "add";
+			if (path)
+				jx_append(path, jx_string("-", 1));
+			changepath = path;
+			changevalue = rvalue;
+			(*layer->modified)(layer, lvalue);
+			changeop = NULL;
+			changepath = changevalue = NULL;
+		}
+		value = NULL;
+	}
 
-	return NULL;
+	jx_free(path);
+	return value;
 }
 
 /* Add a variable.  If necessary (as indicated by "flags") then add a context
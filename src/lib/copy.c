@@ -14,6 +14,9 @@
 /* Return a deep copy of a json object... meaning that if "json" is a container
  * then its contents are deep-copied too.  The returned object will be identical
  * to the "json" object, but altering one will have no effect on the other.
+ * The exception is deferred arrays, which are copied by making another
+ * deferred array that refers to the same source; they're read-only anyway,
+ * and anything that changes one will undefer it first.
  */
 jx_t *jx_copy_filter(jx_t *json, int (*test)(jx_t *elem))
 {
@@ -69,6 +72,16 @@ jx_t *jx_copy_filter(jx_t *json, int (*test)(jx_t *elem))
 			/* If a file is referenced, this is a new reference */
 			if (def->file)
 				def->file->refs++;
+
+			/* Let the deferred type adjust any references of its own */
+			if (def->fns->copy)
+				(*def->fns->copy)(copy);
+
+			/* Keep the table flag, so the copy won't need to be
+			 * scanned to find out whether it's a table.
+			 */
+			copy->text[1] = json->text[1];
+			JX_ARRAY_LENGTH(copy) = JX_ARRAY_LENGTH(json);
 			break;
 		}
 
@@ -112,6 +125,6 @@ jx_t *jx_copy_filter(jx_t *json, int (*test)(jx_t *elem))
 
 jx_t *jx_copy(jx_t *json)
 {
-	/* !!! It'd be nice if a deferred array was copied as deferred too */
+	/* Deferred arrays, including shared arrays, are copied as deferred */
 	return jx_copy_filter(json, NULL);
 }
@@ -19,78 +19,81 @@ typedef struct {
 } jxdatetime_t;
 
 
-/* Return the number of days in the given month.  This is used by normalizedt()
- * and it also has the side-effect of normalizing the month and year, since we
- * need that to know the days.
+/* Divide, rounding toward negative infinity instead of toward 0 */
+#define FLOORDIV(a, b)	((a) >= 0 ? (a) / (b) : ((a) - (b) + 1) / (b))
+
+/* Convert a Gregorian date to the number of days since 1970-01-01.  The day
+ * may be out of range; 2000-01-32 is the same as 2000-02-01.  The month must
+ * be 1-12.  This uses the closed-form algorithm from Howard Hinnant's
+ * "chrono-Compatible Low-Level Date Algorithms", so it costs the same for
+ * any date.
  */
-static int dayspermonth(jxdatetime_t *dt)
+static long long daysfromcivil(int year, int month, int day)
 {
-	static int daysper[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-
-	/* Normalize months, adjusting years */
-	while (dt->month < 1) {
-		dt->month += 12;
-		dt->year--;
-	}
-	while (dt->month > 12) {
-		dt->month -= 12;
-		dt->year++;
-	}
+	long long era, yoe, doy, doe;
+
+	year -= (month <= 2);
+	era = FLOORDIV(year, 400);
+	yoe = year - era * 400;
+	doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
 
-	if (dt->month == 2 && dt->year % 4 == 0)
-		return 29;
-	return daysper[dt->month - 1];
+/* Convert a number of days since 1970-01-01 to a Gregorian date.  This is
+ * the inverse of daysfromcivil(), and only alters the date fields of *dt.
+ */
+static void civilfromdays(long long days, jxdatetime_t *dt)
+{
+	long long era, doe, yoe, doy, mp;
+
+	days += 719468;
+	era = FLOORDIV(days, 146097);
+	doe = days - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	dt->day = doy - (153 * mp + 2) / 5 + 1;
+	dt->month = mp < 10 ? mp + 3 : mp - 9;
+	dt->year = yoe + era * 400 + (dt->month <= 2);
 }
 
 /* Normalize a date/time.  After editing one or more of the datetime fields, 
  * it's possible for some of them to get out of range; this adjusts those
  * fields and related fields to get everthing back in range again.  For example
  * if you *dt is 1999-12-32 then after normalization it'll be 2000-01-01.
+ * This is done arithmetically, so adding "P10000D" is as fast as "P1D".
  */
 static void normalize(jxdatetime_t *dt)
 {
-	/* normalize seconds, adjusting minutes */
-	while (dt->second < 0) {
-		dt->second += 60;
-		dt->minute--;
-	}
-	while (dt->second >= 60) {
-		dt->second -= 60;
-		dt->minute++;
-	}
-
-	/* normalize minutes, adjusting hours */
-	while (dt->minute < 0) {
-		dt->minute += 60;
-		dt->hour--;
-	}
-	while (dt->minute >= 60) {
-		dt->minute -= 60;
-		dt->hour++;
-	}
-
-	/* normalize hours, adjusting days */
-	while (dt->hour < 0) {
-		dt->hour += 24;
-		dt->day--;
-	}
-	while (dt->hour >= 24) {
-		dt->hour -= 24;
-		dt->day++;
-	}
+	long long seconds, days;
+	int	months;
+
+	/* Fold the time into seconds, carrying whole days */
+	seconds = (long long)dt->hour * 3600 + (long long)dt->minute * 60 + dt->second;
+	days = FLOORDIV(seconds, 86400);
+	seconds -= days * 86400;
+	dt->hour = seconds / 3600;
+	dt->minute = seconds / 60 % 60;
+	dt->second = seconds % 60;
+
+	/* Fold months into years */
+	months = dt->month - 1;
+	dt->year += FLOORDIV(months, 12);
+	months -= FLOORDIV(months, 12) * 12;
+
+	/* Count days from the start of the month, and convert back */
+	days += daysfromcivil(dt->year, months + 1, 1) + dt->day - 1;
+	civilfromdays(days, dt);
+}
 
-	/* Normalize days, adjusting months.  This is tricky since different
-	 * months have different numbers of days.  The dayspermonth() function
-	 * also has the side-effect of normalizing the month and year.
-	 */
-	while (dt->day < 1) {
-		dt->month--; /* yes, adjust the month first */
-		dt->day += dayspermonth(dt);
-	}
-	while (dt->day > dayspermonth(dt)) {
-		dt->day -= dayspermonth(dt);
-		dt->month++;
-	}
+/* Return the wall-clock time of a normalized datetime as seconds since
+ * 1970-01-01T00:00:00, ignoring timezones.
+ */
+static long long dtcivil(const jxdatetime_t *dt)
+{
+	return daysfromcivil(dt->year, dt->month, dt->day) * 86400
+		+ dt->hour * 3600 + dt->minute * 60 + dt->second;
 }
 
 /* Parse an ISO period string.  Return 0 if successful, 1 if malformed */
@@ -327,19 +330,10 @@ static time_t dtbinary(jxdatetime_t *dt)
 	/* Make a copy of *dt that we can tweak */
 	localdt = *dt;
 
-	/* If not local timezone, then adjust to be local timezone */
+	/* If not local timezone, then we can compute it directly */
 	if (!localdt.localtz) {
-		/* Subtract timezone minutes and normalize to get UTC date */
-		localdt.minute -= localdt.tz;
-		normalize(&localdt);
-
-		/* Add local timezone minutes for that date and normalize to
-		 * get local date time.
-		 */
-		localdt.localtz = 1;
-		setlocaltz(&localdt);
-		localdt.minute += localdt.tz;
 		normalize(&localdt);
+		return (time_t)(dtcivil(&localdt) - localdt.tz * 60);
 	}
 
 	/* Convert to struct tm, and then to time_t */
@@ -583,6 +577,167 @@ static int match(const char *pattern, const char *str)
 	return 1;
 }
 
+/* Pack a parsed date/time or period into 64 bits, so it can be cached in a
+ * JX_STRING node.  Dates and times use 54 bits, with the year in the most
+ * significant bits.  Periods use 10 signed bits per field.  Returns 0 on
+ * success, or 1 if some field is out of range.
+ */
+static int dtpack(const jxdatetime_t *dt, int isperiod, long long *refpacked)
+{
+	int	i, fields[6];
+	unsigned long long packed;
+
+	fields[0] = dt->year;
+	fields[1] = dt->month;
+	fields[2] = dt->day;
+	fields[3] = dt->hour;
+	fields[4] = dt->minute;
+	fields[5] = dt->second;
+	if (isperiod) {
+		for (packed = 0, i = 0; i < 6; i++) {
+			if (fields[i] < -512 || fields[i] > 511)
+				return 1;
+			packed = (packed << 10) | (fields[i] + 512);
+		}
+	} else {
+		if (dt->year < 0 || dt->year > 16383
+		 || dt->month < 0 || dt->month > 15
+		 || dt->day < 0 || dt->day > 31
+		 || dt->hour < 0 || dt->hour > 31
+		 || dt->minute < 0 || dt->minute > 63
+		 || dt->second < 0 || dt->second > 63
+		 || dt->tz < -2048 || dt->tz > 2047)
+			return 1;
+		packed = dt->year;
+		packed = (packed << 4) | dt->month;
+		packed = (packed << 5) | dt->day;
+		packed = (packed << 5) | dt->hour;
+		packed = (packed << 6) | dt->minute;
+		packed = (packed << 6) | dt->second;
+		packed = (packed << 12) | (dt->tz + 2048);
+		packed = (packed << 1) | (dt->localtz != 0);
+		packed = (packed << 1) | (dt->z != 0);
+	}
+	*refpacked = (long long)packed;
+	return 0;
+}
+
+/* Unpack a value that was packed by dtpack() */
+static void dtunpack(long long value, int isperiod, jxdatetime_t *dt)
+{
+	unsigned long long packed = (unsigned long long)value;
+
+	memset(dt, 0, sizeof *dt);
+	if (isperiod) {
+		dt->second = (int)(packed & 0x3ff) - 512; packed >>= 10;
+		dt->minute = (int)(packed & 0x3ff) - 512; packed >>= 10;
+		dt->hour = (int)(packed & 0x3ff) - 512; packed >>= 10;
+		dt->day = (int)(packed & 0x3ff) - 512; packed >>= 10;
+		dt->month = (int)(packed & 0x3ff) - 512; packed >>= 10;
+		dt->year = (int)(packed & 0x3ff) - 512;
+	} else {
+		dt->z = packed & 1; packed >>= 1;
+		dt->localtz = packed & 1; packed >>= 1;
+		dt->tz = (int)(packed & 0xfff) - 2048; packed >>= 12;
+		dt->second = packed & 0x3f; packed >>= 6;
+		dt->minute = packed & 0x3f; packed >>= 6;
+		dt->hour = packed & 0x1f; packed >>= 5;
+		dt->day = packed & 0x1f; packed >>= 5;
+		dt->month = packed & 0xf; packed >>= 4;
+		dt->year = (int)packed;
+	}
+}
+
+/* Parse a JX_STRING as a date, time, datetime, or period, according to its
+ * jx_string_class().  If the node has room, the parsed value is cached there
+ * so later calls don't need to parse it again.  Returns the class, or 0 if
+ * it isn't any of those or can't be parsed.
+ */
+static jxstrclass_t parsejson(jx_t *json, jxdatetime_t *dt)
+{
+	jxstrclass_t cls;
+	size_t	len;
+	long long packed;
+	int	err;
+
+	cls = jx_string_class(json);
+	if (cls == JX_STRCLASS_OTHER)
+		return 0;
+
+	/* If we already have the parsed value, use it */
+	len = strlen(json->text);
+	if (JX_STRING_CACHE_FLAG(json, len) & JX_STRING_CACHE_PARSED) {
+		dtunpack(JX_STRING_CACHE_VALUE(json, len), cls == JX_STRCLASS_PERIOD, dt);
+		return cls;
+	}
+
+	/* Parse it */
+	if (cls == JX_STRCLASS_PERIOD)
+		err = parseperiod(json->text, dt);
+	else if (cls == JX_STRCLASS_TIME)
+		err = parsetime(json->text, dt);
+	else
+		err = parsedatetime(json->text, dt);
+	if (err)
+		return 0;
+
+	/* Cache it, if there's room */
+	if (JX_STRING_CACHE_ROOM(len) && !dtpack(dt, cls == JX_STRCLASS_PERIOD, &packed)) {
+		JX_STRING_CACHE_VALUE(json, len) = packed;
+		JX_STRING_CACHE_FLAG(json, len) |= JX_STRING_CACHE_PARSED;
+	}
+	return cls;
+}
+
+/* Return a new JX_STRING for a date, time, or datetime.  "dtz" is passed to
+ * datetimestr() to choose the format.  The binary value is cached in the
+ * new node, so if it's used in more arithmetic or comparisons it won't need
+ * to be parsed.
+ */
+static jx_t *dtstring(const jxdatetime_t *dt, const char *dtz)
+{
+	char	buf[50];
+	jx_t	*result;
+	jxdatetime_t canon;
+	jxstrclass_t cls;
+	size_t	len;
+	long long packed;
+
+	datetimestr(buf, dt, dtz);
+	len = strlen(buf);
+	result = jx_string(buf, len);
+
+	/* Find what parsing the string would produce.  Fields that aren't
+	 * part of the string are zeroed.
+	 */
+	canon = *dt;
+	if (*dtz != 'D') {
+		cls = JX_STRCLASS_TIME;
+		canon.year = canon.month = canon.day = 0;
+	} else if (dtz[1] != 'T') {
+		cls = JX_STRCLASS_DATE;
+		canon.hour = canon.minute = canon.second = 0;
+		canon.localtz = 1;
+	} else
+		cls = JX_STRCLASS_DATETIME;
+	if (canon.localtz)
+		canon.tz = canon.z = 0;
+	else if (canon.tz != 0)
+		canon.z = 0;
+
+	/* Years outside 0-9999 won't look like ISO dates, so don't cache */
+	if (cls != JX_STRCLASS_TIME && (canon.year < 0 || canon.year > 9999))
+		return result;
+
+	/* Cache the class, and the binary value if there's room */
+	JX_STRING_CACHE_FLAG(result, len) = cls;
+	if (JX_STRING_CACHE_ROOM(len) && !dtpack(&canon, 0, &packed)) {
+		JX_STRING_CACHE_VALUE(result, len) = packed;
+		JX_STRING_CACHE_FLAG(result, len) |= JX_STRING_CACHE_PARSED;
+	}
+	return result;
+}
+
 /******************************************************************************/
 /* Finally we get to the exposed functions                                    */
 
@@ -741,33 +896,21 @@ int jx_datetime_subtract(char *result, const char *str, const char *period)
 	return 0;
 }
 
-/* Return the difference between two ISO datetimes, as an ISO period.
- * Returns 0 on success or non-zero on error.
+/* Find the difference between two parsed datetimes, as an ISO period.  If
+ * "dates" is set then round to whole days.
  */
-int jx_datetime_diff(char *result, const char *str1, const char *str2)
+static void dtdiff(char *result, jxdatetime_t *dt1, jxdatetime_t *dt2, int dates)
 {
-	jxdatetime_t dt1, dt2;
 	time_t when1, when2, diff, seconds;
-	int	neg, dates;
-
-	/* Detect whether they're dates instead of datetimes */
-	dates = jx_str_date(str1) || jx_str_date(str2);
+	int	neg;
 
 	/* Convert both datetimes to time_t values */
-	if (parsedatetime(str1, &dt1) || parsedatetime(str2, &dt2))
-		return 1;
-	when1 = dtbinary(&dt1);
-	when2 = dtbinary(&dt2);
+	when1 = dtbinary(dt1);
+	when2 = dtbinary(dt2);
 
 	/* Find their difference */
 	diff = when1 - when2;
 
-	/* If no difference, return "P0D" */
-	if (diff == 0) {
-		strcpy(result, "P0D");
-		return 0;
-	}
-
 	/* If negative, then we want all numbers to be negative.  Its easier
 	 * to do the math on positive numbers, though so negate it and
 	 * remember.
@@ -789,6 +932,12 @@ int jx_datetime_diff(char *result, const char *str1, const char *str2)
 		diff = diff - seconds;
 	}
 
+	/* If no difference, return "P0D" */
+	if (diff == 0) {
+		strcpy(result, "P0D");
+		return;
+	}
+
 	/* We don't do months and years since they vary.  We start with days */
 	*result++ = 'P';
 	if (diff >= 86400) {
@@ -811,11 +960,97 @@ int jx_datetime_diff(char *result, const char *str1, const char *str2)
 	if (diff > 0) {
 		sprintf(result, "%s%ldS", neg ? "-" : "", (long)diff);
 	}
+}
 
+/* Return the difference between two ISO datetimes, as an ISO period.
+ * Returns 0 on success or non-zero on error.
+ */
+int jx_datetime_diff(char *result, const char *str1, const char *str2)
+{
+	jxdatetime_t dt1, dt2;
 
+	/* Parse both datetimes */
+	if (parsedatetime(str1, &dt1) || parsedatetime(str2, &dt2))
+		return 1;
+
+	/* Find the difference, rounded to days if either is a date */
+	dtdiff(result, &dt1, &dt2, jx_str_date(str1) || jx_str_date(str2));
 	return 0;
 }
 
+/* Do date arithmetic on JX_STRING values, for the "+" and "-" operators.
+ * "op" is '+' or '-'.  A date or datetime plus or minus a period is the
+ * adjusted date or datetime, and a date or datetime minus another is the
+ * period between them.  For any other operands this returns NULL, so the
+ * caller can try other interpretations.  The operands' parsed values are
+ * cached in the nodes, so repeated arithmetic on the same values is cheap.
+ */
+jx_t *jx_datetime_calc(jx_t *left, int op, jx_t *right)
+{
+	jxstrclass_t lcls, rcls;
+	jxdatetime_t dt, other;
+	char	buf[50];
+
+	/* The left operand must be a date or datetime */
+	lcls = jx_string_class(left);
+	if (lcls != JX_STRCLASS_DATE && lcls != JX_STRCLASS_DATETIME)
+		return NULL;
+	rcls = jx_string_class(right);
+	if (rcls == JX_STRCLASS_PERIOD) {
+		/* Date/datetime plus or minus a period */
+		if (!parsejson(left, &dt) || !parsejson(right, &other))
+			return NULL;
+		if (op == '+')
+			addperiod(&dt, &other);
+		else
+			subtractperiod(&dt, &other);
+		normalize(&dt);
+		return dtstring(&dt, lcls == JX_STRCLASS_DATE ? "D" : "DTZ");
+	} else if (op == '-' && (rcls == JX_STRCLASS_DATE || rcls == JX_STRCLASS_DATETIME)) {
+		/* Difference between two dates/datetimes */
+		if (!parsejson(left, &dt) || !parsejson(right, &other))
+			return NULL;
+		dtdiff(buf, &dt, &other, lcls == JX_STRCLASS_DATE || rcls == JX_STRCLASS_DATE);
+		return jx_string(buf, -1);
+	}
+	return NULL;
+}
+
+/* Compare two dates or datetimes chronologically, using their cached binary
+ * values.  Returns -1 if left is earlier, 1 if it's later, or 0 if they're
+ * the same moment or aren't both dates/datetimes.  Callers should compare
+ * the text when this returns 0, so different strings never compare as equal.
+ */
+int jx_datetime_compare(jx_t *left, jx_t *right)
+{
+	jxstrclass_t cls;
+	jxdatetime_t l, r;
+	long long tl, tr;
+
+	cls = jx_string_class(left);
+	if (cls != JX_STRCLASS_DATE && cls != JX_STRCLASS_DATETIME)
+		return 0;
+	cls = jx_string_class(right);
+	if (cls != JX_STRCLASS_DATE && cls != JX_STRCLASS_DATETIME)
+		return 0;
+	if (!parsejson(left, &l) || !parsejson(right, &r))
+		return 0;
+
+	/* If both are local time, compare wall-clock times.  Otherwise convert
+	 * both to UTC, which is only slow for a local time.
+	 */
+	if (l.localtz && r.localtz) {
+		normalize(&l);
+		normalize(&r);
+		tl = dtcivil(&l);
+		tr = dtcivil(&r);
+	} else {
+		tl = dtbinary(&l);
+		tr = dtbinary(&r);
+	}
+	return (tl > tr) - (tl < tr);
+}
+
 /*****************************************************************************/
 
 /* Return a pointer to the named unit within a jxdatetime_t */
@@ -865,6 +1100,7 @@ jx_t *jx_datetime_fn(jx_t *args, char *typename)
 {
 	jx_t		*scan;
 	jxdatetime_t	jdt, newtz;
+	jxstrclass_t	cls;
 	time_t		t;
 	struct tm	tmlocal;
 	int		num, *unitptr;
@@ -896,6 +1132,16 @@ jx_t *jx_datetime_fn(jx_t *args, char *typename)
 	memset(&jdt, 0, sizeof jdt);
 	switch (args->first->type) {
 	case JX_STRING:
+		/* ISO strings may have a cached binary value.  Other formats
+		 * need to be parsed the hard way.
+		 */
+		cls = parsejson(args->first, &jdt);
+		if (cls == JX_STRCLASS_PERIOD && (asdate || astime))
+			return jx_error_null(0, "Invalid date/time");
+		if (cls && cls != JX_STRCLASS_PERIOD && !asdate && !astime)
+			return jx_error_null(0, "Invalid period");
+		if (cls)
+			break;
 		if (!asdate && !astime) {
 			if (parseperiod(args->first->text, &jdt))
 				return jx_error_null(0, "Invalid period");
@@ -1154,7 +1400,6 @@ jx_t *jx_datetime_fn(jx_t *args, char *typename)
 			s = "D";
 		else
 			s = "TZ";
-		datetimestr(buf, &jdt, s);
-		return jx_string(buf, -1);
+		return dtstring(&jdt, s);
 	}
 }
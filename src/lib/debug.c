@@ -16,6 +16,7 @@ jx_debug_t jx_debug_flags;
  *                  "a" to call abort() on a JSON error.
  *                  "e" to output info for jx_by_expr()
  *                  "c" to output info for jx_calc()
+ *                  "p" to collect profiling data -- see jx_profile()
  */
 char *jx_debug(char *flags)
 {
@@ -28,6 +29,7 @@ char *jx_debug(char *flags)
 		  case 'e':     jx_debug_flags.expr = set;	break;
 		  case 'c':     jx_debug_flags.calc = set;	break;
 		  case 't':	jx_debug_flags.trace = set;	break;
+		  case 'p':	jx_debug_flags.profile = set;	break;
 		  case '+':	set = 1;			break;
 		  case '-':	set = 0;			break;
 		  case '=':
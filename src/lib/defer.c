@@ -140,19 +140,34 @@ int jx_is_deferred_element(const jx_t *elem)
 void jx_undefer(jx_t *arr)
 {
 	jx_t	*undeferred, *scan;
+	jxdef_t	*def;
 
 	/* If already undeferred, just leave it */
 	if (!jx_is_deferred_array(arr))
 		return;
 
-	/* Copy the elements into a new array */
-	undeferred = jx_array();
-	for (scan = jx_first(arr); scan; scan = jx_next(scan))
-		jx_append(undeferred, jx_copy(scan));
+	/* Some deferred types can hand over their elements without copying.
+	 * Otherwise, copy the elements into a new array.
+	 */
+	def = (jxdef_t *)arr->first;
+	undeferred = NULL;
+	if (def->fns->undefer)
+		undeferred = (*def->fns->undefer)(arr);
+	if (!undeferred) {
+		undeferred = jx_array();
+		for (scan = jx_first(arr); scan; scan = jx_next(scan))
+			jx_append(undeferred, jx_copy(scan));
+	}
 
-	/* Replace the JX_DEFER node with the new array's contents */
+	/* Replace the JX_DEFER node with the new array's contents.  If the
+	 * deferred type has resources of its own, free them first.
+	 */
+	if (((jxdef_t *)arr->first)->fns->free)
+		(*((jxdef_t *)arr->first)->fns->free)(arr);
 	jx_free(arr->first);
 	arr->first = undeferred->first;
+	JX_END_POINTER(arr) = JX_END_POINTER(undeferred);
+	JX_ARRAY_LENGTH(arr) = JX_ARRAY_LENGTH(undeferred);
 
 	/* Clean up */
 	undeferred->first = NULL;
@@ -278,3 +293,137 @@ jx_t *jx_defer_ellipsis(int from, int to)
 
 	return result;
 }
+
+/******************************************************************************/
+/* The following implement shared arrays.  When a large array is referenced
+ * by name, jx_calc() would normally make a deep copy of it.  Instead, the
+ * array's elements are moved into a reference-counted block, and the array
+ * becomes a deferred array that refers to that block.  Copying it then just
+ * increments the reference count, and freeing it decrements the count.
+ *
+ * The elements in the block are never changed.  Scanning a shared array
+ * returns the block's own elements, which aren't deferred elements, so
+ * jx_next() just follows their ->next links.  Anything that changes the
+ * array must call jx_undefer() first -- jx_append() does that automatically
+ * -- which copies the elements, or simply takes them if no other array is
+ * sharing the block.
+ */
+
+typedef struct {
+	int	refs;	/* number of arrays using this block */
+	jx_t	*array;	/* an undeferred array containing the elements */
+} jshareblock_t;
+
+typedef struct {
+	jxdef_t basic;	/* normal stuff */
+	jshareblock_t *block; /* the shared elements */
+} jshare_t;
+
+static jx_t *jshare_first(jx_t *defarray);
+static jx_t *jshare_next(jx_t *defelem);
+static int jshare_islast(const jx_t *defelem);
+static void jshare_free(jx_t *defarray);
+static void jshare_copy(jx_t *defarray);
+static jx_t *jshare_undefer(jx_t *defarray);
+
+static jxdeffns_t jshare_fns = {
+	/* size */	sizeof(jshare_t),
+	/* desc */	"Shared",
+	/* first */	jshare_first,
+	/* next */	jshare_next,
+	/* islast */	jshare_islast,
+	/* free */	jshare_free,
+	/* byindex */	NULL,
+	/* bykey */	NULL,
+	/* copy */	jshare_copy,
+	/* undefer */	jshare_undefer
+};
+
+/* Return the first element.  This is the block's own element, so the rest
+ * of the scan doesn't involve the deferred array logic at all.
+ */
+static jx_t *jshare_first(jx_t *defarray)
+{
+	assert(defarray->first->type == JX_DEFER);
+	return ((jshare_t *)defarray->first)->block->array->first;
+}
+
+/* Elements aren't deferred, so these should never be called */
+static jx_t *jshare_next(jx_t *defelem)
+{
+	return NULL;
+}
+static int jshare_islast(const jx_t *defelem)
+{
+	return 1;
+}
+
+/* Release a reference to the block.  If it was the last one, free it. */
+static void jshare_free(jx_t *defarray)
+{
+	jshareblock_t *block = ((jshare_t *)defarray->first)->block;
+
+	if (--block->refs == 0) {
+		jx_free(block->array);
+		free(block);
+	}
+}
+
+/* jx_copy() has copied the jshare_t.  Count the new reference. */
+static void jshare_copy(jx_t *defarray)
+{
+	((jshare_t *)defarray->first)->block->refs++;
+}
+
+/* If this is the only array using the block, then hand over its elements
+ * so jx_undefer() doesn't need to copy them.
+ */
+static jx_t *jshare_undefer(jx_t *defarray)
+{
+	jshareblock_t *block = ((jshare_t *)defarray->first)->block;
+	jx_t	*array;
+
+	if (block->refs > 1)
+		return NULL;
+	array = block->array;
+	block->array = NULL;
+	return array;
+}
+
+/* If "array" is a large, undeferred array then convert it in place to a
+ * shared array, so copies of it will be cheap.  The "sharesize" setting is
+ * the minimum length.  Returns "array" either way.
+ */
+jx_t *jx_defer_share(jx_t *array)
+{
+	int	sharesize;
+	jx_t	*elements;
+	jshareblock_t *block;
+
+	/* Only large, undeferred arrays are worth sharing */
+	sharesize = jx_config_snapshot()->sharesize;
+	if (!array
+	 || array->type != JX_ARRAY
+	 || !array->first
+	 || jx_is_deferred_array(array)
+	 || sharesize <= 0
+	 || jx_length(array) < sharesize)
+		return array;
+
+	/* Move the elements to a new array, stored in a new block */
+	elements = jx_array();
+	elements->first = array->first;
+	elements->text[1] = array->text[1];
+	JX_END_POINTER(elements) = JX_END_POINTER(array);
+	JX_ARRAY_LENGTH(elements) = JX_ARRAY_LENGTH(array);
+	block = (jshareblock_t *)malloc(sizeof(jshareblock_t));
+	block->refs = 1;
+	block->array = elements;
+
+	/* Make the original array refer to the block */
+	array->first = jx_defer(&jshare_fns);
+	((jshare_t *)array->first)->block = block;
+	JX_END_POINTER(array) = NULL;
+
+	return array;
+}
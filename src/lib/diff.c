@@ -96,21 +96,13 @@ int jx_hash(jx_t *json, int seed)
 		 * binary.
 		 */
 		if (*json->text) {
-			/* Textual. Is it integer or float? */
-			pos = 0;
-			if (json->text[0] == '-')
-				pos++;
-			for (; isdigit(json->text[pos]); pos++) {
-			}
-
-			/* Convert to the appropriate type of binary */
+			/* Textual.  Convert to the appropriate type of binary */
 			memset(&tmpbuf, 0, sizeof tmpbuf);
-			if (json->text[pos]) {
-				JX_DOUBLE(&tmpbuf) = atof(json->text);
-				tmpbuf.text[1] = 'd';
-			} else {
-				JX_INT(&tmpbuf) = atoi(json->text);
+			if (jx_is_integer(json, &JX_INT(&tmpbuf))) {
 				tmpbuf.text[1] = 'i';
+			} else {
+				JX_DOUBLE(&tmpbuf) = jx_double(json);
+				tmpbuf.text[1] = 'd';
 			}
 
 			/* Sum up the words in ->text */
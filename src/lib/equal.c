@@ -12,6 +12,7 @@
 int jx_equal(jx_t *j1, jx_t *j2)
 {
         jx_t  *tmp;
+	long long i1, i2;
 
         /* Trivial case */
         if (j1 == j2)
@@ -39,6 +40,8 @@ int jx_equal(jx_t *j1, jx_t *j2)
 		if (j1->text[0] == '\0' && j1->text[1] == 'd'
 		 && j2->text[0] == '\0' && j2->text[1] == 'd')
 			return JX_DOUBLE(j1) == JX_DOUBLE(j2);
+		if (jx_is_integer(j1, &i1) && jx_is_integer(j2, &i2))
+			return i1 == i2;
 		return jx_double(j1) == jx_double(j2);
 
           case JX_ARRAY:
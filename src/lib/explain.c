@@ -121,6 +121,273 @@ char *jx_mix_types(char *oldtype, char *newtype)
 	return "any";
 }
 
+/* Column statistics are accumulated in native C structures, and only
+ * converted to jx_t form when the caller is done adding rows.  Columns
+ * are found via a small hash table keyed on the column name, and are
+ * also kept in a linked list so they can be output in order of discovery.
+ */
+typedef struct jxexcol_s {
+	struct jxexcol_s *next;	/* next column, in order of discovery */
+	struct jxexcol_s *chain;/* next column in the same hash bucket */
+	unsigned hash;		/* hash of the key */
+	char	*type;		/* static type name, from jx_typeof() */
+	int	width;		/* widest value seen so far */
+	int	nullable;	/* null seen (not counting missing values) */
+	size_t	seen;		/* number of rows containing this column */
+	size_t	lastrow;	/* last row counted in "seen" */
+	jxexplain_t *explain;	/* embedded object/table stats, or NULL */
+	char	key[1];		/* column name -- allocated larger */
+} jxexcol_t;
+
+struct jxexplain_s {
+	int	depth;		/* recursion limit for embedded tables */
+	size_t	rows;		/* number of rows examined */
+	int	ncols;		/* number of columns */
+	int	nbuckets;	/* size of bucket[], always a power of 2 */
+	jxexcol_t **bucket;	/* hash table */
+	jxexcol_t *first, *last;/* list of columns */
+};
+
+/* Compute a hash for a column name */
+static unsigned keyhash(const char *key)
+{
+	unsigned hash = 2166136261u;
+
+	while (*key)
+		hash = (hash ^ (unsigned char)*key++) * 16777619u;
+	return hash;
+}
+
+/* Return the display width of a cell's value.  The biggest complication
+ * here is that sometimes numbers are binary.  For those, snprintf() with
+ * no buffer tells us the length without any risk of truncation.
+ */
+static int cellwidth(jx_t *cell)
+{
+	if (cell->type == JX_NUMBER && !cell->text[0]) {
+		if (cell->text[1] == 'i')
+			return snprintf(NULL, 0, "%lld", JX_INT(cell));
+		return snprintf(NULL, 0, "%.*g", jx_format_default.digits, JX_DOUBLE(cell));
+	}
+	return jx_mbs_width(cell->text);
+}
+
+/* Locate a column's stats, or add a new one if it isn't found. */
+static jxexcol_t *findcol(jxexplain_t *ex, const char *key, char *type)
+{
+	unsigned hash = keyhash(key);
+	jxexcol_t *col, *scan, **newbucket;
+	int	i;
+
+	/* Look for it */
+	for (col = ex->bucket[hash & (ex->nbuckets - 1)]; col; col = col->chain)
+		if (col->hash == hash && !strcmp(col->key, key))
+			return col;
+
+	/* Not found, so add it */
+	col = (jxexcol_t *)calloc(1, sizeof(jxexcol_t) + strlen(key));
+	strcpy(col->key, key);
+	col->hash = hash;
+	col->type = type;
+	col->lastrow = (size_t)-1;
+	if (ex->last)
+		ex->last->next = col;
+	else
+		ex->first = col;
+	ex->last = col;
+
+	/* If the hash table is getting crowded, double its size */
+	if (++ex->ncols > ex->nbuckets) {
+		newbucket = (jxexcol_t **)calloc(ex->nbuckets * 2, sizeof(jxexcol_t *));
+		ex->nbuckets *= 2;
+		for (scan = ex->first; scan; scan = scan->next) {
+			i = scan->hash & (ex->nbuckets - 1);
+			scan->chain = newbucket[i];
+			newbucket[i] = scan;
+		}
+		free(ex->bucket);
+		ex->bucket = newbucket;
+	} else {
+		i = hash & (ex->nbuckets - 1);
+		col->chain = ex->bucket[i];
+		ex->bucket[i] = col;
+	}
+	return col;
+}
+
+/* Allocate a column statistics accumulator.  The "depth" has the same
+ * meaning as for jx_explain().  Add rows to it via jx_explain_row(), and
+ * when done convert it to jx_t form via jx_explain_finish().
+ */
+jxexplain_t *jx_explain_start(int depth)
+{
+	jxexplain_t *ex = (jxexplain_t *)calloc(1, sizeof(jxexplain_t));
+
+	ex->depth = depth;
+	ex->nbuckets = 16;
+	ex->bucket = (jxexcol_t **)calloc(ex->nbuckets, sizeof(jxexcol_t *));
+	return ex;
+}
+
+/* Free an accumulator without converting it */
+void jx_explain_free(jxexplain_t *ex)
+{
+	jxexcol_t *col;
+
+	if (!ex)
+		return;
+	while ((col = ex->first) != NULL) {
+		ex->first = col->next;
+		jx_explain_free(col->explain);
+		free(col);
+	}
+	free(ex->bucket);
+	free(ex);
+}
+
+/* Add a single row to an accumulator.  Rows that aren't objects are ignored */
+void jx_explain_row(jxexplain_t *ex, jx_t *row)
+{
+	jx_t	*cell, *elem;
+	jxexcol_t *col;
+	char	*type, *mixed;
+	int	width;
+
+	/* If row isn't an object, then we can't do much with it */
+	if (!row || row->type != JX_OBJECT)
+		return;
+
+	/* For each column of the row ... */
+	for (cell = row->first; cell; cell = cell->next) { /* object */
+		assert(cell->type == JX_KEY);
+
+		/* Derive the type by examining the key's value */
+		type = jx_typeof(cell->first, 1);
+
+		/* Locate or add the column's stats, and merge the type */
+		col = findcol(ex, cell->text, type);
+		mixed = jx_mix_types(col->type, type);
+		if (mixed)
+			col->type = mixed;
+		if (!strcmp(type, "null"))
+			col->nullable = 1;
+		if (col->lastrow != ex->rows) {
+			col->lastrow = ex->rows;
+			col->seen++;
+		}
+
+		/* Width can only increase */
+		width = cellwidth(cell->first);
+		if (width > col->width)
+			col->width = width;
+
+		/* Do we want to recurse for objects/tables? */
+		if (ex->depth != 0) {
+			if (!strcmp(type, "object")) {
+				if (!col->explain)
+					col->explain = jx_explain_start(ex->depth - 1);
+				jx_explain_row(col->explain, cell->first);
+			} else if (!strcmp(type, "table")) {
+				if (!col->explain)
+					col->explain = jx_explain_start(ex->depth - 1);
+				for (elem = jx_first(cell->first); elem; elem = jx_next(elem))
+					jx_explain_row(col->explain, elem);
+			}
+		}
+	}
+
+	/* Count the row */
+	ex->rows++;
+}
+
+/* Merge the stats from "other" into "ex", and free "other".  This allows
+ * separate portions of a table to be explained independently, perhaps by
+ * separate threads, and combined afterward.
+ */
+void jx_explain_merge(jxexplain_t *ex, jxexplain_t *other)
+{
+	jxexcol_t *col, *ocol;
+	char	*mixed;
+
+	for (ocol = other->first; ocol; ocol = ocol->next) {
+		col = findcol(ex, ocol->key, ocol->type);
+		mixed = jx_mix_types(col->type, ocol->type);
+		if (mixed)
+			col->type = mixed;
+		if (ocol->width > col->width)
+			col->width = ocol->width;
+		col->nullable |= ocol->nullable;
+		col->seen += ocol->seen;
+		if (!col->explain) {
+			col->explain = ocol->explain;
+		} else if (ocol->explain) {
+			jx_explain_merge(col->explain, ocol->explain);
+		}
+		ocol->explain = NULL;
+	}
+	ex->rows += other->rows;
+	jx_explain_free(other);
+}
+
+/* Convert the accumulated stats to an array of objects describing each
+ * column, in the same form as jx_explain() returns, and free the
+ * accumulator.  If no rows were objects then it returns NULL.
+ */
+jx_t *jx_explain_finish(jxexplain_t *ex)
+{
+	jx_t	*columns, *stats;
+	jxexcol_t *col;
+
+	if (!ex)
+		return NULL;
+	if (ex->rows == 0) {
+		jx_explain_free(ex);
+		return NULL;
+	}
+
+	/* Build the array.  A column that was missing from any row is
+	 * nullable.
+	 */
+	columns = jx_array();
+	for (col = ex->first; col; col = col->next) {
+		stats = jx_object();
+		jx_append(stats, jx_key("key", jx_string(col->key, -1)));
+		jx_append(stats, jx_key("type", jx_string(col->type, -1)));
+		jx_append(stats, jx_key("width", jx_from_int(col->width)));
+		jx_append(stats, jx_key("nullable", jx_boolean(col->nullable || col->seen < ex->rows)));
+		if (col->explain) {
+			jx_append(stats, jx_key("explain", jx_explain_finish(col->explain)));
+			col->explain = NULL;
+		}
+		jx_append(columns, stats);
+	}
+	jx_explain_free(ex);
+	return columns;
+}
+
+/* Explain all rows of a table.  If "sample" is greater than 0 then only
+ * the first "sample" rows are examined; if none of those are objects
+ * then it falls back to examining the whole table.  Works for deferred
+ * arrays too.  Returns NULL if the table contains no objects.
+ */
+jx_t *jx_explain_table(jx_t *table, int depth, int sample)
+{
+	jxexplain_t *ex;
+	jx_t	*row;
+
+	ex = jx_explain_start(depth);
+	if (sample > 0) {
+		for (row = jx_first(table); sample > 0 && row; sample--, row = jx_next(row))
+			jx_explain_row(ex, row);
+		jx_break(row);
+	}
+	if (ex->rows == 0) {
+		for (row = jx_first(table); row; row = jx_next(row))
+			jx_explain_row(ex, row);
+	}
+	return jx_explain_finish(ex);
+}
+
 /* Collect column info from a single row and merge it into aggregated info. If
  * the aggregated info is NULL, allocate it.  Depth is 0 normally, or higher
  * values to allow embedded objects and tables (arrays of objects) to also
@@ -130,6 +397,10 @@ char *jx_mix_types(char *oldtype, char *newtype)
  * Returns the updated aggregated data, as an array of objects describing each
  * column.  When the aggregated data is no longer needed, you must free it
  * via the usual jx_free() function.
+ *
+ * This is slow for wide tables since the stats are searched linearly and
+ * updated in jx_t form for every row.  When explaining many rows, use
+ * jx_explain_table() or jx_explain_start()/jx_explain_row() instead.
  */
 jx_t *jx_explain(jx_t *columns, jx_t *row, int depth)
 {
@@ -185,7 +456,7 @@ jx_t *jx_explain(jx_t *columns, jx_t *row, int depth)
 			 */
 			if (col->first->type == JX_NUMBER && !col->first->text[0]) {
 				if (col->first->text[1] == 'i')
-					snprintf(number, sizeof number, "%d", JX_INT(col->first));
+					snprintf(number, sizeof number, "%lld", JX_INT(col->first));
 				else
 					snprintf(number, sizeof number, "%.*g", jx_format_default.digits, JX_DOUBLE(col->first));
 				newwidth = strlen(number);
@@ -205,7 +476,7 @@ jx_t *jx_explain(jx_t *columns, jx_t *row, int depth)
 			jx_append(stats, jx_key("type", jx_string(newtype, -1)));
 			if (col->first->type == JX_NUMBER && !col->first->text[0]) {
 				if (col->first->text[1] == 'i')
-					snprintf(number, sizeof number, "%d", JX_INT(col->first));
+					snprintf(number, sizeof number, "%lld", JX_INT(col->first));
 				else
 					snprintf(number, sizeof number, "%.*g", jx_format_default.digits, JX_DOUBLE(col->first));
 				newwidth = strlen(number);
@@ -227,7 +498,7 @@ jx_t *jx_explain(jx_t *columns, jx_t *row, int depth)
 					jx_append(stats, jx_key("explain", t2));
 			} else if (!strcmp(newtype, "table") && col->first->type == JX_ARRAY) {
 				t = jx_by_key(stats, "explain");
-				for (t2 = col->first->first; t2; t2 = t2->next) { /* undeferred */
+				for (t2 = jx_first(col->first); t2; t2 = jx_next(t2)) {
 					t = jx_explain(t, t2, depth - 1);
 				}
 				if (jx_by_key(stats, "explain") != t)
@@ -1,8 +1,11 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -19,14 +22,77 @@ char jx_file_new_type = '\0';
 /* This stores a linked list of loaded files */
 static jxfile_t *loaded;
 
+/* This stores a linked list of files being written by
+ * jx_file_update_atomic(), so jx_file_update_close() can finish them.
+ */
+typedef struct jxupdate_s {
+	struct jxupdate_s *other;
+	FILE	*fp;		/* the temporary file, open for writing */
+	char	*tmpname;	/* name of the temporary file */
+	char	*filename;	/* name of the file it'll replace */
+} jxupdate_t;
+static jxupdate_t *updating;
+
+/* Read from a pipe into jf's dynamically-allocated buffer, appending to any
+ * data that's already there.  Reads until EOF, or until at least "limit"
+ * bytes have been read if "limit" isn't 0.  If it stops before EOF then
+ * jf->partial is set.
+ */
+static void readpipe(jxfile_t *jf, size_t limit)
+{
+	char	*base;
+	size_t	size, used;
+	ssize_t	nread;
+
+	/* Start with room for 4096 more bytes */
+	used = jf->size;
+	size = used + 4096;
+	base = (char *)realloc((char *)jf->base, size);
+
+	/* Read until EOF or the limit */
+	jf->partial = 1;
+	while (!limit || used < limit) {
+		nread = read(jf->fd, base + used, size - used - 1);
+		if (nread < 0 && errno == EINTR)
+			continue;
+		if (nread <= 0) {
+			jf->partial = 0;
+			break;
+		}
+		used += nread;
+		if (size - used < 1024) {
+			size *= 2;
+			base = (char *)realloc(base, size);
+		}
+	}
+
+	/* If we got it all, then trim the excess, rounding up to a multiple
+	 * of 1024.  Either way, keep one extra byte as a '\0'.
+	 */
+	if (!jf->partial)
+		base = (char *)realloc(base, ((used + 1) | 0x3ff) + 1);
+	base[used] = '\0';
+	jf->base = base;
+	jf->size = used;
+}
+
 /* Open a file for reading.  This also locks one byte and maps it into memory */
 jxfile_t *jx_file_load(const char *filename)
+{
+	return jx_file_load_partial(filename, 0);
+}
+
+/* Open a file for reading.  This is like jx_file_load(), except that for
+ * pipes it only reads the first "limit" bytes or so.  If there's more, then
+ * jf->partial will be set, and the caller can either read the rest via
+ * jx_file_load_rest() or read it some other way via jf->fd.
+ */
+jxfile_t *jx_file_load_partial(const char *filename, size_t limit)
 {
 	int	fd;
 	char	*base;
 	jxfile_t *jf;
 	struct stat st;
-	size_t	size, used, nread;
 
 	/* Open the file */
 	if (!strcmp(filename, "-"))
@@ -39,6 +105,7 @@ jxfile_t *jx_file_load(const char *filename)
 			jf = (jxfile_t *)malloc(sizeof(jxfile_t));
 			jf->fd = -1;
 			jf->isfile = 0;
+			jf->partial = 0;
 			jf->size = 3;
 			if (jx_file_new_type == 'o')
 				jf->base = strdup("{}\n");
@@ -61,36 +128,36 @@ jxfile_t *jx_file_load(const char *filename)
 		/* Map the file into memory */
 		base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, (off_t)0);
 	} else {
-		/* Read into a dynamically-allocated buffer */
-		size = 4096;
-		base = (char *)malloc(size);
-		for (used = 0; (nread = read(fd, base + used, size - used)) > 0; used += nread) {
-			if (size - (used + nread) < 1024) {
-				size *= 2;
-				base = (char *)realloc(base, size);
-			}
-		}
-
-		/* Got it all.  Trim the excess, rounding up to a multiple of
-		 * 4096 and keeping one extra byte as a '\0'.
-		 */
-		size = ((used + 1) | 0x3ff) + 1;
-		base = (char *)realloc(base, size);
-		st.st_size = size;
+		/* Read into a dynamically-allocated buffer, below */
+		base = NULL;
+		st.st_size = 0;
 	}
 
-	/* Return the info */
+	/* Build the info */
 	jf = (jxfile_t *)malloc(sizeof *jf);
 	jf->fd = fd;
 	jf->filename = strdup(filename);
 	jf->isfile = (st.st_mode & S_IFMT) == S_IFREG;
+	jf->partial = 0;
+	jf->refs = 0;
 	jf->size = st.st_size;
 	jf->base = base;
+	if (!jf->isfile)
+		readpipe(jf, limit);
+
+	/* Add it to the list, and return it */
 	jf->other = loaded;
 	loaded = jf;
 	return jf;
 }
 
+/* Finish reading a pipe that was opened via jx_file_load_partial() */
+void jx_file_load_rest(jxfile_t *jf)
+{
+	if (jf->partial)
+		readpipe(jf, 0);
+}
+
 /* Connect an open file with a deferred array.  This increments the deferred
  * count of the file, and stores the file's pointer in the array's jxdef_t.
  */
@@ -199,7 +266,8 @@ jxfile_t *jx_file_containing(const char *where, int *refline)
 
 /* Open a file for writing.  This locks the whole file -- that's the only
  * difference between this and fopen(filename,"w").  When done, the FILE*
- * should be closed via the conventional fclose() function.
+ * should be closed via the conventional fclose() function.  See also
+ * jx_file_update_atomic(), which is safer for replacing data files.
  */
 FILE *jx_file_update(const char *filename)
 {
@@ -228,6 +296,185 @@ FILE *jx_file_update(const char *filename)
 	return fdopen(fd, "w");
 }
 
+/* Open a file for writing, without disturbing the existing file until the
+ * new contents are complete.  The data is written to a temporary file in
+ * the same directory, and jx_file_update_close() then flushes it to disk
+ * and renames it over the original.  A crash while writing leaves the old
+ * file intact, and other processes reading the old file -- including via
+ * mmap(), as jx_file_load() does -- keep seeing the old contents.  Unlike
+ * jx_file_update(), no lock is held while writing.
+ *
+ * The FILE* *MUST* be closed via jx_file_update_close(), not fclose().
+ */
+FILE *jx_file_update_atomic(const char *filename)
+{
+	char	*target, *tmpname, *slash;
+	struct stat st;
+	jxupdate_t *up;
+	FILE	*fp;
+	int	fd;
+
+	/* Writing to stdout can't be done atomically */
+	if (!strcmp(filename, "-"))
+		return jx_file_update(filename);
+
+	/* If the file is a symbolic link, replace the file it refers to
+	 * instead of replacing the link.
+	 */
+	target = realpath(filename, NULL);
+	if (!target)
+		target = strdup(filename);
+
+	/* Create a temp file in the same directory, so rename() works */
+	tmpname = (char *)malloc(strlen(target) + 10);
+	strcpy(tmpname, target);
+	slash = strrchr(tmpname, '/');
+	slash = slash ? slash + 1 : tmpname;
+	sprintf(slash, ".%s.XXXXXX", strrchr(target, '/') ? strrchr(target, '/') + 1 : target);
+	fd = mkstemp(tmpname);
+	if (fd < 0) {
+		free(tmpname);
+		free(target);
+		return NULL;
+	}
+
+	/* Give it the same permissions as the old file.  For new files,
+	 * use the same permissions that open() would have used.
+	 */
+	if (stat(target, &st) == 0)
+		fchmod(fd, st.st_mode & 07777);
+	else {
+		mode_t mask = umask(0);
+		umask(mask);
+		fchmod(fd, 0666 & ~mask);
+	}
+
+	/* Add stdio buffering */
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		unlink(tmpname);
+		free(tmpname);
+		free(target);
+		return NULL;
+	}
+
+	/* Remember it, so jx_file_update_close() can finish the job */
+	up = (jxupdate_t *)malloc(sizeof *up);
+	up->fp = fp;
+	up->tmpname = tmpname;
+	up->filename = target;
+	up->other = updating;
+	updating = up;
+	return fp;
+}
+
+/* Close a FILE* that was opened by jx_file_update_atomic() or
+ * jx_file_update().  For atomic updates, if everything was written
+ * successfully then the temporary file is flushed to disk and renamed to
+ * replace the original file; otherwise the temporary file is discarded and
+ * the original is left unchanged.  Returns 0 if successful, or -1 (with
+ * errno set) if the data couldn't be written.
+ */
+int jx_file_update_close(FILE *fp)
+{
+	jxupdate_t *up, *lag;
+	char	*dir, *slash;
+	int	err, dirfd;
+
+	/* Find it in the list of atomic updates.  If not there, then it
+	 * was opened via jx_file_update() so just close it.
+	 */
+	for (lag = NULL, up = updating; up && up->fp != fp; lag = up, up = up->other) {
+	}
+	if (!up)
+		return fclose(fp) == 0 ? 0 : -1;
+	if (lag)
+		lag->other = up->other;
+	else
+		updating = up->other;
+
+	/* Flush it to disk, and close it.  Any error along the way means
+	 * we should discard it.
+	 */
+	err = errno = 0;
+	if (fflush(fp) != 0 || ferror(fp) || fsync(fileno(fp)) != 0)
+		err = errno ? errno : EIO;
+	if (fclose(fp) != 0 && !err)
+		err = errno;
+
+	/* Replace the old file, or discard the new one */
+	if (!err && rename(up->tmpname, up->filename) != 0)
+		err = errno;
+	if (err)
+		unlink(up->tmpname);
+	else {
+		/* Also flush the directory, so the rename is durable */
+		dir = strdup(up->filename);
+		slash = strrchr(dir, '/');
+		if (slash == dir)
+			slash[1] = '\0';
+		else if (slash)
+			*slash = '\0';
+		dirfd = open(slash ? dir : ".", O_RDONLY);
+		if (dirfd >= 0) {
+			fsync(dirfd);
+			close(dirfd);
+		}
+		free(dir);
+	}
+
+	/* Clean up */
+	free(up->tmpname);
+	free(up->filename);
+	free(up);
+	errno = err;
+	return err ? -1 : 0;
+}
+
+/* Lock a data file that's about to be read, changed, and written back via
+ * jx_file_update_atomic().  Other processes that lock the same file wait
+ * until it's unlocked via jx_file_unlock().  Since jx_file_update_atomic()
+ * replaces the file instead of rewriting it, a process that was waiting
+ * may end up holding a lock on the old file; if so, it tries again with
+ * the new one.  Returns a file descriptor, or -1 if the file couldn't be
+ * locked, e.g. because it doesn't exist yet.
+ */
+int jx_file_lock(const char *filename)
+{
+	struct stat st, fst;
+	int	fd;
+
+	for (;;) {
+		fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			return -1;
+		if (flock(fd, LOCK_EX) != 0) {
+			close(fd);
+			return -1;
+		}
+
+		/* Is it still the file that goes by that name? */
+		if (fstat(fd, &fst) == 0
+		 && stat(filename, &st) == 0
+		 && st.st_dev == fst.st_dev
+		 && st.st_ino == fst.st_ino)
+			return fd;
+		close(fd);
+	}
+}
+
+/* Release a lock obtained via jx_file_lock().  The lock is released even if
+ * a forked process shares it.
+ */
+void jx_file_unlock(int fd)
+{
+	if (fd < 0)
+		return;
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+
 /* Scan jx's path for a given file.  If found, return its full pathname
  * as a dynamically-allocated string (which the calling function must free).
  * If not found, return NULL.  If "filename" is NULL then just look for a
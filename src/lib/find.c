@@ -12,7 +12,7 @@
  */
 typedef struct {
 	jx_t	*needle;	/* String or number to search for */
-	regex_t *regex;		/* Regular expression to search for */
+	jxregex_t *regex;	/* Regular expression to search for */
 	jxcalc_t *calc;	/* Expression to search for (RHS of @ operator) */
 	jxcontext_t *context;	/* Context of the "calc" expression */
 	char	*needkey;	/* If not NULL, key must match this */
@@ -138,8 +138,7 @@ static void help_find(jx_t *haystack, jxfind_t *find)
 					continue;
 			} else if (scan->type == JX_STRING && find->regex) {
 				/* Compare against the regexp */
-				regmatch_t matches[10];
-				if (regexec(find->regex, scan->text, 10, matches, 0) != 0)
+				if (!jx_regex_test(find->regex, scan->text))
 					continue;
 			} else if (scan->type == JX_STRING && find->needle->type == JX_STRING) {
 				/* Compare as strings */
@@ -238,8 +237,7 @@ static void help_find(jx_t *haystack, jxfind_t *find)
 				}
 			} else if (scan->first->type == JX_STRING && find->regex) {
 				/* Compare against the regexp */
-				regmatch_t matches[10];
-				if (regexec(find->regex, scan->first->text, 10, matches, 0) != 0)
+				if (!jx_regex_test(find->regex, scan->first->text))
 					continue;
 			} else if (scan->first->type == JX_NUMBER && find->needle && find->needle->type == JX_NUMBER) {
 				/* Does it match? */
@@ -299,7 +297,7 @@ static void help_find(jx_t *haystack, jxfind_t *find)
  * If no matches are found, an empty array is returned.  Parameter errors cause
  * a "null" jx_t to be returned containing an error message.
  */
-static jx_t *find(jx_t *haystack, jx_t *needle, int ignorecase, regex_t *regex, char *needkey, jxcalc_t *calc, jxcontext_t *context)
+static jx_t *find(jx_t *haystack, jx_t *needle, int ignorecase, jxregex_t *regex, char *needkey, jxcalc_t *calc, jxcontext_t *context)
 {
 	jxfind_t find;
 
@@ -360,7 +358,7 @@ jx_t *jx_find(jx_t *haystack, jx_t *needle, int ignorecase, char *needkey)
 }
 
 /* Do a deep search for a regular expression */
-jx_t *jx_find_regex(jx_t *haystack, regex_t *regex, char *needkey)
+jx_t *jx_find_regex(jx_t *haystack, jxregex_t *regex, char *needkey)
 {
 	return find(haystack, NULL, 0, regex, needkey, NULL, NULL);
 }
@@ -30,7 +30,7 @@ jx_t *jx_array_flat(jx_t *array, int depth)
 	result = jx_array();
 
 	/* For each element of the array... */
-	for (lag = NULL, scan = array->first; scan; scan = scan->next) { /* undeferred */
+	for (lag = NULL, scan = jx_first(array); scan; scan = jx_next(scan)) {
 		/* If depth is 0 or this element isn't array, copy it */
 		if (depth == 0 || scan->type != JX_ARRAY) {
 			lag = jx_copy(scan);
@@ -42,16 +42,20 @@ jx_t *jx_array_flat(jx_t *array, int depth)
 		 * via a recursive call to jx_array_flat(), and then munge
 		 * the pointers to make it appear after "lag".  If "lag" is
 		 * NULL then it's the first segment in the result.  Leave
-		 * "lag" pointing at the end of the array.
+		 * "lag" pointing at the end of the array.  Empty arrays add
+		 * nothing.
 		 */
 		copy = jx_array_flat(scan, depth - 1);
-		if (lag)
-			lag->next = copy->first; /* undeferred */
-		else
-			result->first = copy->first;
-		for (lag = copy->first; lag && lag->next; lag = lag->next) { /* undeferred */
+		if (copy->first) {
+			JX_ARRAY_LENGTH(result) += jx_length(copy);
+			if (lag)
+				lag->next = copy->first; /* undeferred */
+			else
+				result->first = copy->first;
+			for (lag = copy->first; lag->next; lag = lag->next) { /* undeferred */
+			}
+			JX_END_POINTER(result) = lag;
 		}
-		JX_END_POINTER(result) = lag;
 
 		/* Free the copy array node, but not its elements. */
 		copy->first = NULL;
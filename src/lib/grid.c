@@ -9,118 +9,106 @@
 
 /* NOTE: The jx_is_table() function is defined in is.c */
 
-/* If json appears to be a table, then output it as a table/grid.  */
-void jx_grid(jx_t *json, jxformat_t *format)
+/* This stores the layout of a grid -- the columns and their widths */
+typedef struct {
+	jxformat_t *format;	/* output format */
+	jx_t	*explain;	/* column stats, from jx_explain_table() */
+	int	ncols;		/* number of columns */
+	int	*widths;	/* width of data in each column */
+	int	*pad;		/* extra padding when heading is wider than data */
+	int	hdrheight;	/* number of lines in the headings */
+	char	hdrpad;		/* character used to pad headings */
+	char	*bar;		/* delimiter between columns */
+} gridlayout_t;
+
+/* Compute the column widths from the explain data.  If "keep" is true then
+ * columns never get narrower than they were in the previous layout.
+ */
+static void layout(gridlayout_t *g, int keep)
 {
-	jx_t	*explain, *row, *col, *cell;
+	jx_t	*col;
 	char	*text;
-	int	wdata, width, c, i, line;
-	int	rowheight, cellheight;
-	size_t	size;
-	char	hdrpad;
-	char	number[40];
-	char	*bar, *barface, *cellface;
-	int	*widths, *pad;
-	jxformat_t tweaked;
-
-	/* If not a table, return 0 */
-	if (!jx_is_table(json))
-		return;
-
-	/* If format is NULL then use the default format */
-	if (!format)
-		format = &jx_format_default;
-	tweaked = *format;
-	format = &tweaked;
-	if (!format->fp) /* Default output is stdout */
-		format->fp = stdout;
-	if (!isatty(fileno(format->fp))) /* Disable color if not a tty */
-		format->color = 0;
-
-	/* Collect statistics about the columns.  For deferred arrays,
-	 * we may want to limit the number of rows that we check.
-	 */
-	explain = NULL;
-	if (jx_is_deferred_array(json)) {
-		/* Get the limit on explain rows to check for deferred arrays.
-		 * If >=1 then only scan those rows.
-		 */
-		int deferexplain = 0;
-		jx_t *jdef = jx_by_key(jx_config, "deferexplain");
-		if (jdef && jdef->type == JX_NUMBER)
-			deferexplain = jx_int(jdef);
-		if (deferexplain > 0) {
-			/* Collect statistics about columns in the first few rows */
-			for (row = jx_first(json);
-			     deferexplain > 0 && row;
-			     deferexplain--, row = jx_next(row)) {
-				explain = jx_explain(explain, row, 0);
-			}
-			jx_break(row);
-		}
-	}
-	if (!explain) {
-		/* Collect column statistics across all rows */
-		for (row = jx_first(json); row; row = jx_next(row))
-			explain = jx_explain(explain, row, 0);
-	}
+	int	c, width, wdata, cellheight;
+	int	oldncols = g->ncols;
+	int	*oldwidths = g->widths;
+	int	*oldpad = g->pad;
 
 	/* Allocate arrays to hold padding tips. */
-	c = jx_length(explain);
-	widths = (int *)calloc(c, sizeof(int));
-	pad = (int *)calloc(c, sizeof(int));
+	g->ncols = jx_length(g->explain);
+	g->widths = (int *)calloc(g->ncols + 1, sizeof(int));
+	g->pad = (int *)calloc(g->ncols + 1, sizeof(int));
 
 	/* If any column's key is wider than their data, expand the column. */
-	rowheight = 1;
-	for (c = 0, col = jx_first(explain); col; c++, col = jx_next(col)) {
+	g->hdrheight = 1;
+	for (c = 0, col = jx_first(g->explain); col; c++, col = jx_next(col)) {
 		/* For columns that can contain arrays or objects, make sure
 		 * it's wide enough to show "[array]" or "{object}".
 		 */
 		text = jx_text_by_key(col, "type");
-		width = widths[c] = jx_int(jx_by_key(col, "width"));
+		width = g->widths[c] = jx_int(jx_by_key(col, "width"));
 		if ((!strcmp(text, "array") || !strcmp(text, "table")) && width < 7)
-			width = widths[c] = 7;
+			width = g->widths[c] = 7;
 		else if ((!strcmp(text, "object") || !strcmp(text, "any")) && width < 8)
-			width = widths[c] = 8;
+			width = g->widths[c] = 8;
 
 		/* For nullable columns, if null isn't displayed as "" then
 		 * make sure the column is wide enough for it.
 		 */
-		if (*format->null && jx_is_true(jx_by_key(col, "nullable"))) {
-			int w = jx_mbs_width(format->null);
+		if (*g->format->null && jx_is_true(jx_by_key(col, "nullable"))) {
+			int w = jx_mbs_width(g->format->null);
 			if (width < w)
-				width = widths[c] = w;
+				width = g->widths[c] = w;
 		}
 
+		/* Don't let a re-layout shrink a column */
+		if (keep && c < oldncols && width < oldwidths[c] + oldpad[c])
+			width = g->widths[c] = oldwidths[c] + oldpad[c];
+
 		/* Expand the column if key is wide */
 		text = jx_text_by_key(col, "key");
 		wdata = jx_mbs_width(text);
 		if (wdata > width) {
-			pad[c] = wdata - width;
+			g->pad[c] = wdata - width;
 			width = wdata;
 		}
 
 		/* If this is the highest key, then increase rowheight */
 		cellheight = jx_mbs_height(text);
-		if (cellheight > rowheight)
-			rowheight = cellheight;
+		if (cellheight > g->hdrheight)
+			g->hdrheight = cellheight;
 	}
 
-	/* Decide whether to color the output */
-	hdrpad = format->color ? ' ' : '_';
-	bar = format->graphic ? "\xe2\x94\x82" : "|";
+	/* Discard the old layout, if any */
+	if (oldwidths) {
+		free(oldwidths);
+		free(oldpad);
+	}
+}
+
+/* Output the column headings */
+static void header(gridlayout_t *g)
+{
+	jxformat_t *format = g->format;
+	jx_t	*col;
+	char	*text, *cellface;
+	int	c, i, line, width, wdata;
+	size_t	size;
 
-	/* Output the column headings.  If rowheight > 1 we need to do this
+	/* If no columns, then no headings */
+	if (g->ncols == 0)
+		return;
+
+	/* Output the column headings.  If hdrheight > 1 we need to do this
 	 * separately for each line of the headings.
 	 */
-	for (line = 0; line < rowheight; line++) {
+	for (line = 0; line < g->hdrheight; line++) {
 		/* Colorize? */
-		cellface = (line == rowheight - 1 ? "gridhead" : "_gridhead");
+		cellface = (line == g->hdrheight - 1 ? "gridhead" : "_gridhead");
 
 		/* Output this line of this column's heading */
-		for (c = 0, col = jx_first(explain); col; c++, col = jx_next(col)) {
+		for (c = 0, col = jx_first(g->explain); col; c++, col = jx_next(col)) {
 			/* Get this line of the heading, and its width */
-			width = widths[c] + pad[c];
+			width = g->widths[c] + g->pad[c];
 			text = jx_text_by_key(col, "key");
 			size = jx_mbs_line(text, line, NULL, &text, &wdata);
 			if (size > 0)
@@ -129,129 +117,275 @@ void jx_grid(jx_t *json, jxformat_t *format)
 			/* Output the key as a column heading */
 			jx_user_printf(format, cellface, "");
 			for (i = 0; i < (width - wdata + 1) / 2; i++)
-				jx_user_ch(hdrpad);
+				jx_user_ch(g->hdrpad);
 			if (size > 0)
 				jx_user_printf(format, cellface, "%.*s", size, text);
 			for (; i < (width - wdata); i++)
-				jx_user_ch(hdrpad);
+				jx_user_ch(g->hdrpad);
 
 			/* Bar between columns */
 			if (!jx_is_last(col))
-				jx_user_printf(format, cellface, "%s", bar);
+				jx_user_printf(format, cellface, "%s", g->bar);
 		}
 
 		/* End the line */
 		jx_user_printf(format, "normal", "\n");
 	}
+}
 
-	/* For each row... */
-	for (row = jx_first(json); row && !jx_interrupt; row = jx_next(row)) {
-		/* Find the height of the tallest cell.  All cells are 1
-		 * except for strings that contain newlines.
-		 */
-		rowheight = 1;
-		for (c = 0, col = jx_first(explain); col; c++, col = jx_next(col)) {
+/* Return the text to show for a non-string cell.  If it's a binary number
+ * then the number buffer is used to hold the text.
+ */
+static char *celltext(jx_t *cell, jxformat_t *format, char *number, size_t size)
+{
+	if (!cell || cell->type == JX_NULL)
+		return format->null;
+	if (cell->type == JX_ARRAY)
+		return jx_is_table(cell) ? "[table]" : "[array]";
+	if (cell->type == JX_OBJECT)
+		return "{object}";
+	if (cell->type == JX_NUMBER && !cell->text[0] && cell->text[1] == 'i') {
+		snprintf(number, size, "%lld", JX_INT(cell));
+		return number;
+	}
+	if (cell->type == JX_NUMBER && !cell->text[0] && cell->text[1] == 'd') {
+		snprintf(number, size, "%.*g", format->digits, JX_DOUBLE(cell));
+		return number;
+	}
+	return cell->text; /* boolean or non-binary number */
+}
+
+/* Check whether a row fits in the current layout.  A cell that's wider
+ * than its column's data may still fit into the padding of a wide heading,
+ * in which case the layout is adjusted without changing the total width.
+ * Returns 1 if it fits, or 0 if the row has wider data or new columns.
+ */
+static int fits(gridlayout_t *g, jx_t *row)
+{
+	jx_t	*col, *cell;
+	char	number[40];
+	int	c, w, matched;
+
+	/* Check each known column */
+	matched = 0;
+	for (c = 0, col = jx_first(g->explain); col; c++, col = jx_next(col)) {
+		cell = jx_by_key(row, jx_text_by_key(col, "key"));
+		if (cell)
+			matched++;
+		if (cell && cell->type == JX_STRING)
+			w = jx_mbs_width(cell->text);
+		else
+			w = jx_mbs_width(celltext(cell, g->format, number, sizeof number));
+		if (w > g->widths[c]) {
+			if (w > g->widths[c] + g->pad[c])
+				return 0;
+			g->pad[c] -= w - g->widths[c];
+			g->widths[c] = w;
+		}
+	}
+
+	/* Any columns that we haven't seen before? */
+	for (cell = row->first; cell; cell = cell->next) /* object */
+		matched--;
+	return matched >= 0;
+}
+
+/* Output a single row */
+static void gridrow(gridlayout_t *g, jx_t *row)
+{
+	jxformat_t *format = g->format;
+	jx_t	*col, *cell;
+	char	*text, *barface, *cellface;
+	int	c, line, width, wdata, rowheight, cellheight;
+	size_t	size;
+	char	number[40];
+
+	/* Find the height of the tallest cell.  All cells are 1
+	 * except for strings that contain newlines.
+	 */
+	rowheight = 1;
+	for (c = 0, col = jx_first(g->explain); col; c++, col = jx_next(col)) {
+		cell = jx_by_key(row, jx_text_by_key(col, "key"));
+		if (cell && cell->type == JX_STRING) {
+			cellheight = jx_mbs_height(cell->text);
+			if (cellheight > rowheight)
+				rowheight = cellheight;
+		}
+	}
+
+	/* For each line of the row... */
+	for (line = 0; line < rowheight; line++) {
+
+		/* Choose the color */
+		barface = (line == rowheight - 1 ? "gridline" : "_gridline");
+		cellface = (line == rowheight - 1 ? "gridcell" : "_gridcell");
+
+		/* Output this line of the row */
+		for (c = 0, col = jx_first(g->explain); col; c++, col = jx_next(col)) {
+			/* Fetch the cell */
 			cell = jx_by_key(row, jx_text_by_key(col, "key"));
+			/* Get its text and width.  Since strings can
+			 * be multi-line, they're handled differently.
+			 */
+			if (cell && cell->type == JX_STRING) {
+				size = jx_mbs_line(cell->text, line, NULL, &text, &wdata);
+				if (size > 0)
+					size--; /* remove newline */
+			} else if (line > 0) {
+				/* All non-strings are 1 row high */
+				size = 0;
+				text = "";
+				wdata = 0;
+			} else {
+				text = celltext(cell, format, number, sizeof number);
+
+				/* Get widths */
+				size = strlen(text);
+				wdata = jx_mbs_width(text);
+			}
+
+			/* width of this column */
+			width = g->widths[c];
+
+			/* If a wide column heading dictates that we
+			 * need extra padding (more than data width),
+			 * then output half of that extra padding now.
+			 */
+			if (g->pad[c] >= 2)
+				jx_user_printf(format, cellface, "%*c", g->pad[c] >> 1, ' ');
+
+			/* Output the cell. Alignment depends on type */
 			if (cell && cell->type == JX_STRING) {
-				cellheight = jx_mbs_height(cell->text);
-				if (cellheight > rowheight)
-					rowheight = cellheight;
+				/* left-justify strings */
+				if (size > 0)
+					jx_user_printf(format, cellface, "%.*s", size, text);
+				if (width - wdata > 0)
+					jx_user_printf(format, cellface, "%*c", width - wdata, ' ');
+			} else if (cell && cell->type == JX_NUMBER) {
+				/* right-justify numbers */
+				if (width - wdata > 0)
+					jx_user_printf(format, cellface, "%*c", width - wdata, ' ');
+				jx_user_printf(format, cellface, "%s", text);
+			} else {
+				/* center everything else */
+				if (width - wdata > 0)
+					jx_user_printf(format, cellface, "%*c", (width - wdata + 1) >> 1, ' ');
+				jx_user_printf(format, cellface, "%s", text);
+				if (width - wdata > 1)
+					jx_user_printf(format, cellface, "%*c", (width - wdata) >> 1, ' ');
 			}
+
+			/* If a wide column heading dictates that we
+			 * need extra padding, then output the second
+			 * half of that extra padding now.
+			 */
+			if (g->pad[c] >= 1)
+				jx_user_printf(format, cellface, "%*c", (g->pad[c] + 1) >> 1, ' ');
+
+			/* Delimiter between columns */
+			if (!jx_is_last(col))
+				jx_user_printf(format, barface, "%s", g->bar);
+
+		}
+		jx_user_printf(format, "normal", "\n");
+	}
+}
+
+/* If json appears to be a table, then output it as a table/grid.
+ *
+ * Normally the column widths are computed from all rows before any output
+ * is generated.  For deferred arrays, or when format->quick is set, the
+ * table is streamed instead: widths are computed from a leading window of
+ * "deferexplain" rows, and the remaining rows are output as they're read.
+ * If a later row has wider data or new columns, the layout is widened and
+ * the headings are repeated before that row.
+ */
+void jx_grid(jx_t *json, jxformat_t *format)
+{
+	gridlayout_t g;
+	jxexplain_t *ex;
+	jx_t	*window, *row, *elem;
+	int	nwindow, deferred;
+	jxformat_t tweaked;
+
+	/* If not a table, return 0 */
+	if (!jx_is_table(json))
+		return;
+
+	/* If format is NULL then use the default format */
+	if (!format)
+		format = &jx_format_default;
+	tweaked = *format;
+	format = &tweaked;
+	if (!format->fp) /* Default output is stdout */
+		format->fp = stdout;
+	if (!isatty(fileno(format->fp))) /* Disable color if not a tty */
+		format->color = 0;
+
+	/* Decide how to output it */
+	memset(&g, 0, sizeof g);
+	g.format = format;
+	g.hdrpad = format->color ? ' ' : '_';
+	g.bar = format->graphic ? "\xe2\x94\x82" : "|";
+	deferred = jx_is_deferred_array(json);
+	nwindow = 0;
+	if (deferred || format->quick) {
+		nwindow = jx_config_snapshot()->deferexplain;
+		if (nwindow <= 0 && format->quick)
+			nwindow = 1;
+	}
+
+	if (nwindow <= 0) {
+		/* Collect column statistics across all rows, then output */
+		g.explain = jx_explain_table(json, 0, 0);
+		layout(&g, 0);
+		header(&g);
+		for (row = jx_first(json); row && !jx_interrupt; row = jx_next(row))
+			gridrow(&g, row);
+		jx_break(row);
+	} else {
+		/* Collect statistics about columns in the first few rows.
+		 * For deferred arrays, keep copies of those rows so we don't
+		 * need to scan the array twice.
+		 */
+		window = jx_array();
+		ex = jx_explain_start(0);
+		for (row = jx_first(json); nwindow > 0 && row; nwindow--, row = jx_next(row)) {
+			jx_explain_row(ex, row);
+			if (deferred)
+				jx_append(window, jx_copy(row));
 		}
+		g.explain = jx_explain_finish(ex);
+		layout(&g, 0);
+		header(&g);
 
-		/* For each line of the row... */
-		for (line = 0; line < rowheight; line++) {
-
-			/* Choose the color */
-			barface = (line == rowheight - 1 ? "gridline" : "_gridline");
-			cellface = (line == rowheight - 1 ? "gridcell" : "_gridcell");
-
-			/* Output this line of the row */
-			for (c = 0, col = jx_first(explain); col; c++, col = jx_next(col)) {
-				/* Fetch the cell */
-				cell = jx_by_key(row, jx_text_by_key(col, "key"));
-				/* Get its text and width.  Since strings can
-				 * be multi-line, they're handled differently.
-				 */
-				if (cell && cell->type == JX_STRING) {
-					size = jx_mbs_line(cell->text, line, NULL, &text, &wdata);
-					if (size > 0)
-						size--; /* remove newline */
-				} else if (line > 0) {
-					/* All non-strings are 1 row high */
-					size = 0;
-					text = "";
-					wdata = 0;
-				} else {
-					if (!cell || cell->type == JX_NULL)
-						text = format->null;
-					else if (cell->type == JX_ARRAY)
-						text = jx_is_table(cell) ? "[table]" : "[array]";
-					else if (cell->type == JX_OBJECT)
-						text = "{object}";
-					else if (cell->type == JX_NUMBER && !cell->text[0] && cell->text[1] == 'i')
-						snprintf(text = number, sizeof number, "%d", JX_INT(cell));
-					else if (cell->type == JX_NUMBER && !cell->text[0] && cell->text[1] == 'd')
-						snprintf(text = number, sizeof number, "%.*g", format->digits, JX_DOUBLE(cell));
-					else /* boolean or non-binary number */
-						text = cell->text;
-
-					/* Get widths */
-					size = strlen(text);
-					wdata = jx_mbs_width(text);
-				}
-
-				/* width of this column */
-				width = widths[c];
-
-				/* If a wide column heading dictates that we
-				 * need extra padding (more than data width),
-				 * then output half of that extra padding now.
-				 */
-				if (pad[c] >= 2)
-					jx_user_printf(format, cellface, "%*c", pad[c] >> 1, ' ');
-
-				/* Output the cell. Alignment depends on type */
-				if (cell && cell->type == JX_STRING) {
-					/* left-justify strings */
-					if (size > 0)
-						jx_user_printf(format, cellface, "%.*s", size, text);
-					if (width - wdata > 0)
-						jx_user_printf(format, cellface, "%*c", width - wdata, ' ');
-				} else if (cell && cell->type == JX_NUMBER) {
-					/* right-justify numbers */
-					if (width - wdata > 0)
-						jx_user_printf(format, cellface, "%*c", width - wdata, ' ');
-					jx_user_printf(format, cellface, "%s", text);
-				} else {
-					/* center everything else */
-					if (width - wdata > 0)
-						jx_user_printf(format, cellface, "%*c", (width - wdata + 1) >> 1, ' ');
-					jx_user_printf(format, cellface, "%s", text);
-					if (width - wdata > 1)
-						jx_user_printf(format, cellface, "%*c", (width - wdata) >> 1, ' ');
-				}
-
-				/* If a wide column heading dictates that we
-				 * need extra padding, then output the second
-				 * half of that extra padding now.
-				 */
-				if (pad[c] >= 1)
-					jx_user_printf(format, cellface, "%*c", (pad[c] + 1) >> 1, ' ');
-
-				/* Delimiter between columns */
-				if (!jx_is_last(col))
-					jx_user_printf(format, barface, "%s", bar);
+		/* Output the leading window.  For undeferred arrays, just
+		 * start over at the first row; they're still there.
+		 */
+		if (deferred) {
+			for (elem = window->first; elem && !jx_interrupt; elem = elem->next) /* undeferred */
+				gridrow(&g, elem);
+		} else {
+			row = jx_first(json);
+		}
 
+		/* Output the remaining rows as they're read, re-laying out
+		 * the grid whenever a row doesn't fit.
+		 */
+		for (; row && !jx_interrupt; row = jx_next(row)) {
+			if (!fits(&g, row)) {
+				g.explain = jx_explain(g.explain, row, 0);
+				layout(&g, 1);
+				header(&g);
 			}
-			jx_user_printf(format, "normal", "\n");
+			gridrow(&g, row);
 		}
+		jx_break(row);
+		jx_free(window);
 	}
 
 	/* Discard the "explain" data */
-	jx_free(explain);
-
-	/* Done! */
-	return;
+	jx_free(g.explain);
+	free(g.widths);
+	free(g.pad);
 }
-
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <jx.h>
 
 /* Test whether a JSON value is true.  Everything is true except for the
@@ -112,7 +113,7 @@ static size_t shorthelper(jx_t *json, size_t oneline)
 			if (*json->text)
 				size += strlen(json->text);
 			else if (json->text[1] == 'i') {
-				int i = JX_INT(json);
+				long long i = JX_INT(json);
 				if (i < 0) {
 					size++; /* for "-" */
 					i = -i;
@@ -168,34 +169,66 @@ int jx_is_short(jx_t *json, size_t oneline)
         return shorthelper(json, oneline) < oneline;
 }
 
+/* Classify a string as a date, time, datetime, period, or none of those.
+ * The answer is cached in the string's node, so the pattern matching only
+ * happens the first time a given string is tested.  Non-strings are
+ * always JX_STRCLASS_OTHER.
+ */
+jxstrclass_t jx_string_class(jx_t *json)
+{
+	size_t	len;
+	int	flag;
+	jxstrclass_t cls;
+
+	if (!json || json->type != JX_STRING)
+		return JX_STRCLASS_OTHER;
+
+	/* If already classified, use that */
+	len = strlen(json->text);
+	flag = JX_STRING_CACHE_FLAG(json, len) & ~JX_STRING_CACHE_PARSED;
+	if (flag >= JX_STRCLASS_OTHER && flag <= JX_STRCLASS_PERIOD)
+		return (jxstrclass_t)flag;
+
+	/* Dates and times start with a digit, periods start with "P" */
+	if (isdigit(*json->text)) {
+		if (jx_str_date(json->text))
+			cls = JX_STRCLASS_DATE;
+		else if (jx_str_datetime(json->text))
+			cls = JX_STRCLASS_DATETIME;
+		else if (jx_str_time(json->text))
+			cls = JX_STRCLASS_TIME;
+		else
+			cls = JX_STRCLASS_OTHER;
+	} else if ((*json->text == 'P' || *json->text == 'p') && jx_str_period(json->text))
+		cls = JX_STRCLASS_PERIOD;
+	else
+		cls = JX_STRCLASS_OTHER;
+
+	/* Cache it */
+	JX_STRING_CACHE_FLAG(json, len) = cls;
+	return cls;
+}
+
 /* Return 1 iff json looks like an ISO date string "YYYY-MM-DD" */
 int jx_is_date(jx_t *json)
 {
-	if (!json || json->type != JX_STRING || !jx_str_date(json->text))
-		return 0;
-	return 1;
+	return jx_string_class(json) == JX_STRCLASS_DATE;
 }
 
 /* Return 1 iff json looks like an ISO time string "hh:mm:ss" */
 int jx_is_time(jx_t *json)
 {
-	if (!json || json->type != JX_STRING || !jx_str_time(json->text))
-		return 0;
-	return 1;
+	return jx_string_class(json) == JX_STRCLASS_TIME;
 }
 
 /* Return 1 iff json looks like an ISO datetime string "YYYY-MM-DDThh:mm:ss" */
 int jx_is_datetime(jx_t *json)
 {
-	if (!json || json->type != JX_STRING || !jx_str_datetime(json->text))
-		return 0;
-	return 1;
+	return jx_string_class(json) == JX_STRCLASS_DATETIME;
 }
 
 /* Return 1 iff json looks like an ISO period string "PnYnMnWnDTnHnMnS" */
 int jx_is_period(jx_t *json)
 {
-	if (!json || json->type != JX_STRING || !jx_str_period(json->text))
-		return 0;
-	return 1;
+	return jx_string_class(json) == JX_STRCLASS_PERIOD;
 }
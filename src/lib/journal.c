@@ -0,0 +1,396 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <jx.h>
+
+/* This file implements a change journal for data files.  When the "journal"
+ * setting is true, changes made to a writable data file (via "jx -u") are
+ * appended to a side file instead of rewriting the whole data file.  The
+ * side file's name is the data file's name plus ".journal".  Each line is a
+ * JSON-Patch-style operation such as...
+ *
+ *	{"op":"replace","path":"/rows/12345/status","value":"done"}
+ *
+ * ... where "op" is "add" (new object member, or "-" to append to an array)
+ * or "replace", and "path" is a JSON Pointer relative to the data file's
+ * top-level value.  When the data file is loaded, any journal is replayed.
+ *
+ * The first line of a journal identifies the version of the data file that
+ * the changes apply to, like this...
+ *
+ *	{"file":{"size":123456,"mtime":1700000000,"inode":1234}}
+ *
+ * ... so if the data file is replaced by some other means, the journal is
+ * ignored instead of being applied to the wrong data.  Appends are done
+ * while holding an exclusive flock() on the journal, so two processes
+ * updating the same file can't interleave their lines.
+ *
+ * When the journal grows too big, it is compacted by rewriting the data file
+ * and deleting the journal.  All of that is managed by jx_context_file();
+ * this file just handles the journal itself.
+ */
+
+/* The journal that's currently open for appending, if any */
+static FILE *journalfp;
+static char *journalname;
+
+/* The data file that was most recently replayed, as it was when loaded */
+static char *loadedname;
+static struct stat loadedst;
+
+/* Return the dynamically-allocated name of a data file's journal */
+static char *journalfile(const char *filename)
+{
+	char	*name;
+
+	name = (char *)malloc(strlen(filename) + 9);
+	strcpy(name, filename);
+	strcat(name, ".journal");
+	return name;
+}
+
+/* Return the header line for a data file's journal, including the newline,
+ * as a dynamically-allocated string.
+ */
+static char *header(struct stat *st)
+{
+	char	*text;
+
+	text = (char *)malloc(100);
+	snprintf(text, 100, "{\"file\":{\"size\":%lld,\"mtime\":%lld,\"inode\":%llu}}\n",
+		(long long)st->st_size, (long long)st->st_mtime,
+		(unsigned long long)st->st_ino);
+	return text;
+}
+
+/* Convert an array of keys and indexes to a JSON Pointer, and return it as
+ * a dynamically-allocated string.  Within keys, "~" and "/" are encoded as
+ * "~0" and "~1".
+ */
+static char *pointer(jx_t *path)
+{
+	jx_t	*scan;
+	char	*ptr, *build, *s;
+	size_t	size;
+	char	buf[30];
+
+	/* Compute the size */
+	size = 1;
+	for (scan = path->first; scan; scan = scan->next) { /* undeferred */
+		size++;
+		if (scan->type == JX_STRING) {
+			for (s = scan->text; *s; s++)
+				size += (*s == '~' || *s == '/') ? 2 : 1;
+		} else
+			size += sizeof buf;
+	}
+
+	/* Build it */
+	ptr = build = (char *)malloc(size);
+	for (scan = path->first; scan; scan = scan->next) { /* undeferred */
+		*build++ = '/';
+		if (scan->type == JX_STRING) {
+			for (s = scan->text; *s; s++) {
+				if (*s == '~') {
+					*build++ = '~';
+					*build++ = '0';
+				} else if (*s == '/') {
+					*build++ = '~';
+					*build++ = '1';
+				} else
+					*build++ = *s;
+			}
+		} else {
+			snprintf(buf, sizeof buf, "%d", jx_int(scan));
+			strcpy(build, buf);
+			build += strlen(build);
+		}
+	}
+	*build = '\0';
+	return ptr;
+}
+
+/* Extract the next token from a JSON Pointer, decoding "~0" and "~1".  The
+ * token is stored in "buf" (which is at least as long as ptr) and a pointer
+ * to the rest of the pointer is returned.
+ */
+static const char *token(const char *ptr, char *buf)
+{
+	for (ptr++; *ptr && *ptr != '/'; ptr++) {
+		if (*ptr == '~' && ptr[1] == '0')
+			*buf++ = '~', ptr++;
+		else if (*ptr == '~' && ptr[1] == '1')
+			*buf++ = '/', ptr++;
+		else
+			*buf++ = *ptr;
+	}
+	*buf = '\0';
+	return ptr;
+}
+
+/* Replace an element of an undeferred array with a new value */
+static void replaceelem(jx_t *array, jx_t *old, jx_t *value)
+{
+	jx_t	*scan;
+
+	value->next = old->next; /* undeferred */
+	if (old == array->first)
+		array->first = value;
+	else {
+		for (scan = array->first; scan->next != old; scan = scan->next) { /* undeferred */
+		}
+		scan->next = value; /* undeferred */
+	}
+	if (!value->next) /* undeferred */
+		JX_END_POINTER(array) = value;
+	old->next = NULL; /* undeferred */
+	jx_free(old);
+}
+
+/* Apply a single journal entry to the data.  The data may be replaced, so
+ * it is passed by reference.  Returns 1 if successful, or 0 if the entry is
+ * invalid or doesn't fit the data.
+ */
+static int apply(jx_t **refdata, jx_t *change)
+{
+	const char *op, *ptr;
+	char	*tok;
+	jx_t	*value, *container, *old;
+	int	ok;
+
+	/* Get the parts of the change */
+	op = jx_text_by_key(change, "op");
+	ptr = jx_text_by_key(change, "path");
+	value = jx_by_key(change, "value");
+	if (!op || !ptr || !value)
+		return 0;
+	if (strcmp(op, "add") && strcmp(op, "replace"))
+		return 0;
+
+	/* An empty path replaces the whole thing */
+	if (!*ptr) {
+		jx_free(*refdata);
+		*refdata = jx_copy(value);
+		return 1;
+	}
+
+	/* Find the container of the value to change */
+	tok = (char *)malloc(strlen(ptr) + 1);
+	container = *refdata;
+	for (ptr = token(ptr, tok); *ptr; ptr = token(ptr, tok)) {
+		jx_undefer(container);
+		if (container->type == JX_OBJECT)
+			container = jx_by_key(container, tok);
+		else if (container->type == JX_ARRAY)
+			container = jx_by_index(container, atoi(tok));
+		else
+			container = NULL;
+		if (!container) {
+			free(tok);
+			return 0;
+		}
+	}
+
+	/* Change it */
+	ok = 1;
+	jx_undefer(container);
+	if (container->type == JX_OBJECT)
+		jx_append(container, jx_key(tok, jx_copy(value)));
+	else if (container->type == JX_ARRAY && !strcmp(tok, "-"))
+		jx_append(container, jx_copy(value));
+	else if (container->type == JX_ARRAY && (old = jx_by_index(container, atoi(tok))) != NULL)
+		replaceelem(container, old, jx_copy(value));
+	else
+		ok = 0;
+	free(tok);
+	return ok;
+}
+
+/* Close the journal that's open for appending, if any */
+static int closejournal(void)
+{
+	int	err = 0;
+
+	if (journalfp) {
+		if (fflush(journalfp) != 0 || fsync(fileno(journalfp)) != 0)
+			err = -1;
+		if (fclose(journalfp) != 0)
+			err = -1;
+		journalfp = NULL;
+	}
+	if (journalname) {
+		free(journalname);
+		journalname = NULL;
+	}
+	return err;
+}
+
+/* If a data file has a journal, then apply its changes to the data.
+ * Returns the number of changes applied, or -1 if the journal is damaged
+ * (in which case the changes before the damage are still applied), or -2 if
+ * the journal is for some other version of the data file (in which case
+ * nothing is applied).
+ */
+int jx_journal_replay(const char *filename, jx_t **refdata)
+{
+	char	*name, *line, *expect;
+	size_t	size;
+	FILE	*fp;
+	jx_t	*change;
+	int	count;
+
+	/* Remember the data file's identity, for the journal's header */
+	if (loadedname)
+		free(loadedname);
+	loadedname = NULL;
+	if (stat(filename, &loadedst) == 0)
+		loadedname = strdup(filename);
+
+	/* If there's no journal, there's nothing to do */
+	name = journalfile(filename);
+	fp = fopen(name, "r");
+	free(name);
+	if (!fp)
+		return 0;
+	flock(fileno(fp), LOCK_SH);
+
+	/* The header must match the data file.  An empty journal is okay. */
+	line = NULL;
+	size = 0;
+	if (getline(&line, &size, fp) <= 0) {
+		free(line);
+		fclose(fp);
+		return 0;
+	}
+	expect = loadedname ? header(&loadedst) : NULL;
+	count = (expect && !strcmp(line, expect)) ? 0 : -2;
+	free(expect);
+
+	/* Apply each line.  A partial line at the end, left by a crash, counts
+	 * as damage.
+	 */
+	while (count >= 0 && getline(&line, &size, fp) > 0) {
+		change = jx_parse_string(line);
+		if (!change || !apply(refdata, change)) {
+			jx_free(change);
+			count = -1;
+			break;
+		}
+		jx_free(change);
+		count++;
+	}
+	free(line);
+	fclose(fp);
+	return count;
+}
+
+/* Append a change to a data file's journal.  "op" is "add" or "replace",
+ * "path" is an array of member keys and array indexes leading to the changed
+ * value, and "value" is the new value.  Returns 0 if successful, or -1 if
+ * the journal couldn't be written.
+ */
+int jx_journal_append(const char *filename, const char *op, jx_t *path, jx_t *value)
+{
+	char	*name, *ptr, *text;
+	jx_t	*change;
+	struct stat st;
+	int	err;
+
+	/* If some other journal is open, close it.  Then open this one. */
+	name = journalfile(filename);
+	if (journalname && strcmp(journalname, name))
+		closejournal();
+	if (!journalfp) {
+		journalfp = fopen(name, "a");
+		if (!journalfp) {
+			free(name);
+			return -1;
+		}
+		journalname = name;
+	} else
+		free(name);
+
+	/* Build the change, and write it as a single line */
+	ptr = pointer(path);
+	change = jx_object();
+	jx_append(change, jx_key("op", jx_string(op, -1)));
+	jx_append(change, jx_key("path", jx_string(ptr, -1)));
+	jx_append(change, jx_key("value", jx_copy(value)));
+	text = jx_serialize(change, NULL);
+	jx_free(change);
+	free(ptr);
+
+	/* Lock the journal while writing to it.  If it's new then start it
+	 * with a header identifying the data file, as it was when loaded.
+	 */
+	err = flock(fileno(journalfp), LOCK_EX);
+	if (!err && fstat(fileno(journalfp), &st) == 0 && st.st_size == 0) {
+		if (loadedname && !strcmp(loadedname, filename))
+			st = loadedst;
+		else if (stat(filename, &st) != 0)
+			err = -1;
+		if (!err) {
+			ptr = header(&st);
+			fputs(ptr, journalfp);
+			free(ptr);
+		}
+	}
+	if (!err) {
+		fprintf(journalfp, "%s\n", text);
+		if (fflush(journalfp) != 0)
+			err = -1;
+	}
+	flock(fileno(journalfp), LOCK_UN);
+	free(text);
+	return (err || ferror(journalfp)) ? -1 : 0;
+}
+
+/* Flush a data file's journal to disk and close it.  Returns 0 if
+ * successful, or -1 if the journal couldn't be written.
+ */
+int jx_journal_sync(const char *filename)
+{
+	char	*name;
+	int	err;
+
+	name = journalfile(filename);
+	err = (journalname && !strcmp(journalname, name)) ? closejournal() : 0;
+	free(name);
+	return err;
+}
+
+/* Return the size of a data file's journal, in bytes.  Returns 0 if it has
+ * no journal.
+ */
+long jx_journal_size(const char *filename)
+{
+	char	*name;
+	struct stat st;
+
+	name = journalfile(filename);
+	if (journalname && !strcmp(journalname, name))
+		fflush(journalfp);
+	if (stat(name, &st) != 0)
+		st.st_size = 0;
+	free(name);
+	return (long)st.st_size;
+}
+
+/* Delete a data file's journal, after its changes have been written into
+ * the data file itself.
+ */
+void jx_journal_remove(const char *filename)
+{
+	char	*name;
+
+	name = journalfile(filename);
+	if (journalname && !strcmp(journalname, name))
+		closejournal();
+	unlink(name);
+	free(name);
+}
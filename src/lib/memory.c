@@ -9,6 +9,7 @@
 #include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <malloc.h>
 #include <jx.h>
 
 /* Here we need to access the "real" allocation/free functions */
@@ -49,6 +50,28 @@ static memory_tracker_t *memory_tracker;
 /* This counts the number of jx_t's currently allocated.  Not threadsafe! */
 int jx_debug_count = 0;
 
+/* This counts the total number of jx_t's ever allocated.  Also not
+ * threadsafe.  Benchmarks use it to measure allocations per operation.
+ */
+long jx_debug_allocs = 0;
+
+/* This counts the bytes used by jx_t's currently allocated, as reported by
+ * malloc_usable_size().  It is compared to the "memorylimit" setting by
+ * jx_memory_over_budget().  Also not threadsafe.
+ */
+size_t jx_memory_used = 0;
+
+/* Return 1 if the jx_t's currently allocated use more memory than the
+ * "memorylimit" setting allows, else 0.  Operators that build large results
+ * call this to decide when to spill to disk.  A limit of 0 means unlimited.
+ */
+int jx_memory_over_budget(void)
+{
+	size_t	limit = jx_config_snapshot()->memorylimit;
+
+	return limit > 0 && jx_memory_used > limit;
+}
+
 /* Return an estimated byte count for a given jx_t tree */
 size_t jx_sizeof(jx_t *json)
 {
@@ -116,7 +139,7 @@ void jx_free(jx_t *json)
 	 * resources used for this scan session.
 	 */
 	if (json->next && json->next->type == JX_DEFER) {
-		jxdeffns_t *fns = (jxdeffns_t *)json->next;
+		jxdeffns_t *fns = ((jxdef_t *)json->next)->fns;
 		if (fns->free)
 			(*fns->free)(json);
 	}
@@ -142,6 +165,7 @@ void jx_free(jx_t *json)
 
 		/* Free this jx_t struct */
 		next = json->next; /* undeferred */
+		jx_memory_used -= malloc_usable_size(json);
 		free(json);
 		jx_debug_count--;
 		json = next;
@@ -160,8 +184,13 @@ jx_t *jx_simple(const char *str, size_t len, jxtype_t type)
 	else if (len == (size_t)-1)
 		len = strlen(str);
 
-        /* Compute the size, rounding up to a multiple of 32 */
-        size = sizeof(jx_t) - sizeof json->text + len + 1;
+        /* Compute the size, rounding up to a multiple of 32.  Numbers also
+         * get space after the text for caching the binary value.
+         */
+        if (type == JX_NUMBER)
+                size = JX_NUMBER_CACHE_OFFSET(len) + sizeof(double);
+        else
+                size = sizeof(jx_t) - sizeof json->text + len + 1;
         size = (size | 0x1f) + 1;
 
 	/* Allocate it.  Trust malloc() to be efficient */
@@ -175,6 +204,8 @@ jx_t *jx_simple(const char *str, size_t len, jxtype_t type)
 
 	/* return it */
 	jx_debug_count++;
+	jx_debug_allocs++;
+	jx_memory_used += malloc_usable_size(json);
 	return json;
 }
 
@@ -198,7 +229,7 @@ jx_t *jx_number(const char *str, size_t len)
 }
 
 /* Allocate a jx_t for a given integer */
-jx_t *jx_from_int(int i)
+jx_t *jx_from_int(long long i)
 {
 	jx_t *json = jx_number("", 0);
 	json->text[1] = 'i';
@@ -322,10 +353,11 @@ jx_t *jx_defer(jxdeffns_t *fns)
 
 	/* Allocate it, with extra space.  Note that we must tweak the size
 	 * because jx_simple wants to be passed the size of the "text" field,
-	 * but fns->size is the size of the whole thing.
+	 * but fns->size is the size of the whole thing.  Pass "" instead of
+	 * NULL, because jx_simple() ignores the size if there's no string.
 	 */
 	size = fns->size - sizeof(jx_t) + sizeof json->text;
-	json = jx_simple(NULL, size, JX_DEFER);
+	json = jx_simple("", size, JX_DEFER);
 
 	/* Store the fns pointer, with this deferred array's implementation
 	 * functions.  The rest of the jxdef_t is already initialized to 0's
@@ -439,6 +471,15 @@ void jx_debug_free(const char *file, int line, jx_t *json)
 		else if (memory_tracker)
 			memory_tracker[slot].count--;
 
+		/* Deferred arrays and elements may have resources of their
+		 * own.  jx_free() won't see them since we clear the links
+		 * below, so free them here.
+		 */
+		if (json->next && json->next->type == JX_DEFER && ((jxdef_t *)json->next)->fns->free)
+			(*((jxdef_t *)json->next)->fns->free)(json);
+		if (json->type == JX_ARRAY && json->first && json->first->type == JX_DEFER && ((jxdef_t *)json->first)->fns->free)
+			(*((jxdef_t *)json->first)->fns->free)(json);
+
 		/* Free the ->first link recursively... except that an error
 		 * "null" uses ->first for the position of the error, so we
 		 * don't want to free that.
@@ -476,7 +517,7 @@ jx_t *jx_debug_number(const char *file, int line, const char *str, size_t len)
 }
 
 /* Allocate a jx_t for a given integer */
-jx_t *jx_debug_from_int(const char *file, int line, int i)
+jx_t *jx_debug_from_int(const char *file, int line, long long i)
 {
 	jx_t	*json = jx_debug_number(file, line, "", 0);
 	json->text[1] = 'i';
@@ -96,7 +96,7 @@ static jx_t *jdefarray_next(jx_t *elem)
 /* Test whether the current element is the last element. */
 static int jdefarray_islast(const jx_t *elem)
 {
-	jdefarray_t *def = (jdefarray_t *)elem->first;
+	jdefarray_t *def = (jdefarray_t *)elem->next;
 	const char *skip;
 
 	/* "start" points to the next element's source code. Skip over
@@ -197,6 +197,16 @@ char *jx_append(jx_t *container, jx_t *more)
 		break;
 
 	  case JX_ARRAY:
+		/* A deferred array must be converted before it's changed.
+		 * For shared arrays, this is the "copy" of copy-on-write.
+		 * Some types (spilled arrays) can append without that.
+		 */
+		if (jx_is_deferred_array(container)) {
+			jxdeffns_t *fns = ((jxdef_t *)container->first)->fns;
+			if (fns->append && (*fns->append)(container, more))
+				break;
+			jx_undefer(container);
+		}
 		jappendarray(container, more);
 		break;
 
@@ -297,16 +307,10 @@ static jx_t *parseJSON(const char *str, size_t len, const char **refend, const c
 	size_t	keysize;
 	size_t	tlen;	/* token length */
 	int	escape;
-	char	*emptyobject = "object";
-	int	defersize = 0;
+	const jxconfigsnap_t *conf;
 
 	/* Get parser config */
-	jc = jx_by_key(jx_config, "emptyobject");
-	if (jc && jc->type == JX_STRING)
-		emptyobject = jc->text;
-	jc = jx_by_key(jx_config, "defersize");
-	if (jc && jc->type == JX_NUMBER)
-		defersize = jx_int(jc);
+	conf = jx_config_snapshot();
 
 	/* Start with a stack containing an empty array.  We expect parsing to
 	 * put one thing in the array.
@@ -464,12 +468,12 @@ static jx_t *parseJSON(const char *str, size_t len, const char **refend, const c
 		case '[':
 			/* Start of an array  -- maybe deferred? */
 			jc = jx_array();
-			if (allowdefer && defersize > 0 && (end - str) >= defersize) {
+			if (allowdefer && conf->defersize > 0 && (end - str) >= conf->defersize) {
 				/* Find the end of the array */
 				int count, istable;
 				const char *endarray = jskim(str, end, &count, &istable);
 				/* Is it big enough to be worth deferring? */
-				if ((endarray - str) >= defersize) {
+				if ((endarray - str) >= conf->defersize) {
 					/* Yes, defer it */
 					jdefarray_t *def;
 					jc->text[1] = istable ? 't' : 'n';
@@ -518,9 +522,9 @@ static jx_t *parseJSON(const char *str, size_t len, const char **refend, const c
 			 * string or array.
 			 */
 			if (!stack[sp]->first) {
-				if (*emptyobject == 'a')
+				if (conf->emptyobject == 'a')
 					stack[sp]->type = JX_ARRAY;
-				else if (*emptyobject == 's')
+				else if (conf->emptyobject == 's')
 					stack[sp]->type = JX_STRING;
 			}
 			sp--;
@@ -601,6 +605,7 @@ static jx_t *parseJSON(const char *str, size_t len, const char **refend, const c
 	}
 
 	/* Return the thing in the arraybuf */
+	free(key);
 	if (refend)
 		*refend = str;
 	return arraybuf.first;
@@ -619,6 +624,7 @@ Error:
 	jx_free(arraybuf.first);
 	if (jc)
 		jx_free(jc);
+	free(key);
 
 	/* Stuff the error info into the appropriate places */
 	if (refend)
@@ -679,12 +685,42 @@ jx_t *jx_parse_file(const char *filename)
 	jxfile_t *jf;
 	const char	*end, *error;
 	jx_t	*result;
+	jxparser_t *jp;
+	size_t	limit;
+	int	format;
 
-	/* Map the file into memory */
-	jf = jx_file_load(filename);
+	/* Map the file into memory.  For pipes, if deferred arrays are
+	 * allowed, then only read the first chunk for now.
+	 */
+	limit = 0;
+	if (jx_config_snapshot()->defersize > 0)
+		limit = jx_config_snapshot()->defersize;
+	if (limit > 65536)
+		limit = 65536;
+	jf = jx_file_load_partial(filename, limit);
 	if (!jf)
 		return NULL;
 
+	/* If a pipe looks like a JSON array with more data to come, or like
+	 * NDJSON, then parse it incrementally as a deferred array.  Other
+	 * formats need the whole pipe.
+	 */
+	if (!jf->isfile && limit > 0) {
+		for (jp = parsers; jp && !jp->tester(jf->base, jf->size); jp = jp->other) {
+		}
+		format = 0;
+		if (!jp && !jx_blob_test(jf->base, jf->size))
+			format = jx_stream_test(jf->base, jf->size);
+		result = NULL;
+		if (format == 'n' || (format == '[' && jf->partial))
+			result = jx_stream(jf);
+		if (result) {
+			jx_file_unload(jf);
+			return result;
+		}
+		jx_file_load_rest(jf);
+	}
+
 	/* Parse it */
 	result = parse(jf->base, jf->size, &end, &error, 1);
 
@@ -179,6 +179,11 @@ jx_t *jx_plugin_load(const char *name)
 			dlclose(dlhandle);
 			return jx_error_null(0, "The \"%s\" plugin failed to initialize: %s", name, err);
 		}
+
+		/* Init functions add their default settings to jx_config
+		 * directly, so any snapshot of it is stale now.
+		 */
+		jx_config_changed();
 	}
 
 	/* If there's a script file, load it */
@@ -133,7 +133,7 @@ static void jcprint(jx_t *json, int indent, jxformat_t *format)
 	  case JX_NUMBER:
 		/* could be binary int or double, or it could be text */
 		if (scan->text[0] == '\0' && scan->text[1] == 'i')
-			jx_user_printf(format, "result", "%d", JX_INT(scan));
+			jx_user_printf(format, "result", "%lld", JX_INT(scan));
 		else if (scan->text[0] == '\0' && scan->text[1] == 'd')
 			jx_user_printf(format, "result", "%.*g", format->digits, JX_DOUBLE(scan));
 		else
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jx.h>
+
+/* This file implements a simple profiler for expressions and commands.
+ * When jx_debug_flags.profile is set, jx_calc() and jx_cmd_run() call
+ * jx_profile_enter() and jx_profile_exit() around each jxcalc_t node and
+ * each command.  The data is collected as a call tree -- a node that's
+ * evaluated from two different places will have two entries in the tree --
+ * which is converted to a jx_t tree by jx_profile() or jx_profile_end().
+ *
+ * The tree may be converted after the expressions and commands have been
+ * freed (e.g., when a function is redefined), so each node copies whatever
+ * it needs to describe itself.  The calc, cmd, args and arg0 pointers are
+ * only compared, never dereferenced.
+ */
+
+struct jxprofile_s {
+	struct jxprofile_s *parent;	/* caller, or NULL for a root */
+	struct jxprofile_s *child;	/* first callee */
+	struct jxprofile_s *sibling;	/* next callee of the same caller */
+	const jxcalc_t *calc;		/* expression node, or NULL */
+	const jxcmd_t *cmd;		/* command, or NULL */
+	const jxcalc_t *args;		/* for FNCALL, the argument list */
+	const jxcalc_t *arg0;		/* for FNCALL, the first argument */
+	jxop_t	op;			/* expression node's operator */
+	char	*label;			/* command name, or node's text or fn */
+	char	*key;			/* command's key, or NULL */
+	int	line;			/* command's line number, or 0 */
+	long	calls;			/* number of times it was run */
+	double	time;			/* inclusive time, in seconds */
+	long	allocs;			/* inclusive jx_t allocations */
+	long	rows;			/* array elements returned */
+	long	rowsin;			/* array elements consumed */
+	long	rowsinright;		/* right-hand elements, for joins */
+	int	hasin;			/* jx_profile_input() was called */
+	struct timespec start;		/* when the current call started */
+	long	startallocs;		/* jx_debug_allocs when it started */
+	int	oldflag;		/* for roots, previous profile flag */
+};
+
+/* The root used when profiling is enabled via jx_debug("p") */
+static jxprofile_t globalroot;
+
+/* The node that's currently running */
+static jxprofile_t *current = &globalroot;
+
+/* Return the number of seconds since "start" */
+static double elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Count the elements of an array.  For deferred arrays this scans them, but
+ * jx_length() remembers the count so later scans don't repeat the work.
+ */
+static long countrows(jx_t *table)
+{
+	if (!table || table->type != JX_ARRAY)
+		return 0;
+	return jx_length(table);
+}
+
+/* Return the text that describes a calc node or command, or NULL */
+static const char *label(const jxcalc_t *calc, const jxcmd_t *cmd)
+{
+	if (cmd)
+		return cmd->name->name;
+	switch (calc->op) {
+	  case JXOP_NAME:
+	  case JXOP_STRING:
+	  case JXOP_NUMBER:
+		return calc->u.text;
+	  case JXOP_FNCALL:
+		return calc->u.func.jf ? calc->u.func.jf->name : NULL;
+	  default:
+		return NULL;
+	}
+}
+
+/* Test whether a profile node is for a given calc node or command.  The
+ * pointers alone aren't enough, because a freed calc node's memory may be
+ * reused for a different one.
+ */
+static int same(jxprofile_t *node, const jxcalc_t *calc, const jxcmd_t *cmd)
+{
+	const char *text;
+
+	if (node->calc != calc || node->cmd != cmd)
+		return 0;
+	if (calc && node->op != calc->op)
+		return 0;
+	text = label(calc, cmd);
+	if (!text || !node->label)
+		return !text && !node->label;
+	return !strcmp(text, node->label);
+}
+
+/* Start running a calc node or command.  Returns the profile node, which
+ * should be passed to jx_profile_exit() when it's done.
+ */
+jxprofile_t *jx_profile_enter(const jxcalc_t *calc, const jxcmd_t *cmd)
+{
+	jxprofile_t *node, **ptr;
+	const char *text;
+
+	/* Find this node among the current node's callees, or add it */
+	for (ptr = &current->child; (node = *ptr) != NULL; ptr = &node->sibling)
+		if (same(node, calc, cmd))
+			break;
+	if (!node) {
+		node = (jxprofile_t *)calloc(1, sizeof(jxprofile_t));
+		node->parent = current;
+		node->calc = calc;
+		node->cmd = cmd;
+		text = label(calc, cmd);
+		if (text)
+			node->label = strdup(text);
+		if (cmd) {
+			if (cmd->key)
+				node->key = strdup(cmd->key);
+			if (!jx_file_containing(cmd->where, &node->line))
+				node->line = 0;
+		} else {
+			node->op = calc->op;
+			if (calc->op == JXOP_FNCALL) {
+				node->args = calc->u.func.args;
+				if (node->args && node->args->op == JXOP_ARRAY)
+					node->arg0 = node->args->u.param.left;
+			}
+		}
+		*ptr = node;
+	}
+
+	/* Start timing it */
+	node->calls++;
+	node->startallocs = jx_debug_allocs;
+	clock_gettime(CLOCK_MONOTONIC, &node->start);
+	current = node;
+	return node;
+}
+
+/* Finish running a calc node or command.  "result" is the value it
+ * returned, or NULL for commands.
+ */
+void jx_profile_exit(jxprofile_t *node, jx_t *result)
+{
+	node->time += elapsed(&node->start);
+	node->allocs += jx_debug_allocs - node->startallocs;
+	node->rows += countrows(result);
+	current = node->parent;
+}
+
+/* Record the tables consumed by the currently running calc node.  This is
+ * called by operators such as EACH and the joins, after they've evaluated
+ * their operands.  "right" is NULL except for joins.
+ */
+void jx_profile_input(jx_t *left, jx_t *right)
+{
+	current->rowsin += countrows(left);
+	current->rowsinright += countrows(right);
+	current->hasin = 1;
+}
+
+/* Free a profile node's callees */
+static void freechildren(jxprofile_t *node)
+{
+	jxprofile_t *child;
+
+	while ((child = node->child) != NULL) {
+		node->child = child->sibling;
+		freechildren(child);
+		if (child->label)
+			free(child->label);
+		if (child->key)
+			free(child->key);
+		free(child);
+	}
+}
+
+/* Find the callee for a given calc node, or NULL if it was never run.  The
+ * calc node may have been freed; it's only compared.
+ */
+static jxprofile_t *callee(jxprofile_t *node, const jxcalc_t *calc)
+{
+	for (node = node->child; node; node = node->sibling)
+		if (calc && node->calc == calc)
+			return node;
+	return NULL;
+}
+
+/* Convert a profile node and its callees to a jx_t object */
+static jx_t *convert(jxprofile_t *node)
+{
+	jx_t	*obj, *children;
+	jxprofile_t *child, *in;
+	int	iscalc = (node->calc != NULL);
+	double	self;
+
+	obj = jx_object();
+
+	/* Describe the node */
+	if (node->cmd) {
+		jx_append(obj, jx_key("cmd", jx_string(node->label, -1)));
+		if (node->key)
+			jx_append(obj, jx_key("key", jx_string(node->key, -1)));
+		if (node->line)
+			jx_append(obj, jx_key("line", jx_from_int(node->line)));
+	} else if (iscalc) {
+		jx_append(obj, jx_key("op", jx_string(jx_calc_op_name(node->op), -1)));
+		if (node->label)
+			jx_append(obj, jx_key(node->op == JXOP_FNCALL ? "fn" : "text", jx_string(node->label, -1)));
+	}
+
+	/* Add the statistics */
+	self = node->time;
+	for (child = node->child; child; child = child->sibling)
+		self -= child->time;
+	jx_append(obj, jx_key("calls", jx_from_int(node->calls)));
+	jx_append(obj, jx_key("time_ms", jx_from_double(node->time * 1000.0)));
+	jx_append(obj, jx_key("self_ms", jx_from_double(self > 0.0 ? self * 1000.0 : 0.0)));
+	jx_append(obj, jx_key("allocs", jx_from_int(node->allocs)));
+
+	/* Operators that process tables report their input via
+	 * jx_profile_input().  For functions, use the rows returned by the
+	 * first argument.
+	 */
+	if (node->hasin) {
+		jx_append(obj, jx_key("rows_in", jx_from_int(node->rowsin)));
+		if (iscalc && (node->op == JXOP_NJOIN || node->op == JXOP_LJOIN || node->op == JXOP_RJOIN))
+			jx_append(obj, jx_key("rows_in_right", jx_from_int(node->rowsinright)));
+	} else if (iscalc && node->op == JXOP_FNCALL) {
+		child = callee(node, node->args);
+		in = NULL;
+		if (child && node->arg0)
+			in = callee(child, node->arg0);
+		if (in && in->rows > 0)
+			jx_append(obj, jx_key("rows_in", jx_from_int(in->rows)));
+	}
+	if (node->rows > 0)
+		jx_append(obj, jx_key("rows_out", jx_from_int(node->rows)));
+
+	/* Add the callees */
+	if (node->child) {
+		children = jx_array();
+		for (child = node->child; child; child = child->sibling)
+			jx_append(children, convert(child));
+		jx_append(obj, jx_key("children", children));
+	}
+	return obj;
+}
+
+/* Start a separate profile, such as for "explain analyze".  This turns on
+ * profiling until the matching jx_profile_end() call.
+ */
+jxprofile_t *jx_profile_begin(void)
+{
+	jxprofile_t *root;
+
+	root = (jxprofile_t *)calloc(1, sizeof(jxprofile_t));
+	root->parent = current;
+	root->oldflag = jx_debug_flags.profile;
+	root->calls = 1;
+	root->startallocs = jx_debug_allocs;
+	clock_gettime(CLOCK_MONOTONIC, &root->start);
+	current = root;
+	jx_debug_flags.profile = 1;
+	return root;
+}
+
+/* End a profile started by jx_profile_begin(), and return its data as a
+ * jx_t tree.  The profile flag is restored to its previous value.
+ */
+jx_t *jx_profile_end(jxprofile_t *root)
+{
+	jx_t	*result;
+
+	root->time = elapsed(&root->start);
+	root->allocs = jx_debug_allocs - root->startallocs;
+	current = root->parent;
+	jx_debug_flags.profile = root->oldflag;
+	result = convert(root);
+	freechildren(root);
+	free(root);
+	return result;
+}
+
+/* Return the data collected since profiling was enabled via jx_debug("p"),
+ * or since the previous call to this function, and then reset it.
+ */
+jx_t *jx_profile(void)
+{
+	jx_t	*result;
+	jxprofile_t *child;
+
+	globalroot.calls = 1;
+	globalroot.time = 0.0;
+	globalroot.allocs = 0;
+	for (child = globalroot.child; child; child = child->sibling) {
+		globalroot.time += child->time;
+		globalroot.allocs += child->allocs;
+	}
+	result = convert(&globalroot);
+	freechildren(&globalroot);
+	return result;
+}
@@ -0,0 +1,189 @@
+#include <sys/types.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <regex.h>
+#include <jx.h>
+
+/* This file wraps the POSIX regex functions.  Compiled patterns are cached
+ * and shared, keyed by their source text and flags, so the same regex
+ * appearing in several expressions is only compiled once.  Each pattern
+ * also gets a literal prefix that every match must contain, which lets us
+ * reject most non-matching strings without calling regexec() at all.  For
+ * tests that don't need the matched text, a second copy is compiled with
+ * REG_NOSUB, which lets the C library use its faster DFA-only matcher.
+ */
+
+/* Maximum number of unreferenced patterns to keep in the cache */
+#define UNUSED_MAX	16
+
+/* This is a linked list of compiled patterns, most recently used first */
+static jxregex_t *cache;
+
+/* Find the literal text that any match must start with, or contain if the
+ * pattern isn't anchored.  This is deliberately conservative -- it gives up
+ * on alternation, stops at the first special character, and stops at non-ASCII
+ * bytes since a quantifier may apply to a whole multibyte character.
+ */
+static void regexprefix(jxregex_t *re)
+{
+	const char *s = re->source;
+	char	*build;
+
+	re->prefix = NULL;
+	re->prefixlen = 0;
+	re->anchored = 0;
+
+	/* Alternation means there's no single required prefix */
+	if (strchr(s, '|'))
+		return;
+
+	/* Anchored? */
+	if (*s == '^') {
+		re->anchored = 1;
+		s++;
+	}
+
+	/* Collect literal characters */
+	re->prefix = (char *)malloc(strlen(s) + 1);
+	for (build = re->prefix; *s && !strchr(".[]\\()*+?{}^$|", *s) && !(*s & 0x80); s++)
+		*build++ = *s;
+
+	/* If a quantifier or escape follows, the last char may be optional */
+	if (build > re->prefix && *s && strchr("*?{\\", *s))
+		build--;
+	*build = '\0';
+	re->prefixlen = build - re->prefix;
+	if (re->prefixlen == 0) {
+		free(re->prefix);
+		re->prefix = NULL;
+	}
+}
+
+/* Return 1 if "str" could match the pattern, judging only by its prefix */
+static int regexprefilter(jxregex_t *re, const char *str)
+{
+	const char *scan;
+
+	if (!re->prefix)
+		return 1;
+	if (re->cflags & REG_ICASE) {
+		if (re->anchored)
+			return !strncasecmp(str, re->prefix, re->prefixlen);
+		for (scan = str; *scan; scan++)
+			if (!strncasecmp(scan, re->prefix, re->prefixlen))
+				return 1;
+		return 0;
+	}
+	if (re->anchored)
+		return !strncmp(str, re->prefix, re->prefixlen);
+	return strstr(str, re->prefix) != NULL;
+}
+
+/* Free a pattern for real */
+static void regexdiscard(jxregex_t *re)
+{
+	regfree(&re->preg);
+	if (re->hasnosub)
+		regfree(&re->nosub);
+	free(re->source);
+	free(re->prefix);
+	free(re);
+}
+
+/* Return a compiled regular expression, from the cache if possible.  If the
+ * pattern is invalid, return NULL and store an error message in errbuf.
+ * When you're done with it, call jx_regex_free().
+ */
+jxregex_t *jx_regex(const char *source, int ignorecase, char *errbuf, size_t errsize)
+{
+	jxregex_t *re, *lag;
+	int	cflags = ignorecase ? REG_ICASE : 0;
+	int	err;
+
+	/* Look for it in the cache.  If found, move it to the front */
+	for (lag = NULL, re = cache; re; lag = re, re = re->other) {
+		if (re->cflags == cflags && !strcmp(re->source, source)) {
+			if (lag) {
+				lag->other = re->other;
+				re->other = cache;
+				cache = re;
+			}
+			re->refs++;
+			return re;
+		}
+	}
+
+	/* Compile it */
+	re = (jxregex_t *)calloc(1, sizeof(jxregex_t));
+	err = regcomp(&re->preg, source, cflags);
+	if (err) {
+		regerror(err, &re->preg, errbuf, errsize);
+		free(re);
+		return NULL;
+	}
+	re->source = strdup(source);
+	re->cflags = cflags;
+	re->refs = 1;
+	regexprefix(re);
+
+	/* Add it to the cache */
+	re->other = cache;
+	cache = re;
+	return re;
+}
+
+/* Release a regular expression.  Unused patterns stay in the cache for a
+ * while, in case the same pattern is used again soon.
+ */
+void jx_regex_free(jxregex_t *re)
+{
+	jxregex_t *scan, *lag;
+	int	unused;
+
+	re->refs--;
+
+	/* Discard the least recently used patterns if too many are unused */
+	for (lag = NULL, scan = cache, unused = 0; scan; ) {
+		if (scan->refs <= 0 && ++unused > UNUSED_MAX) {
+			if (lag)
+				lag->other = scan->other;
+			else
+				cache = scan->other;
+			regexdiscard(scan);
+			scan = lag ? lag->other : cache;
+		} else {
+			lag = scan;
+			scan = scan->other;
+		}
+	}
+}
+
+/* Return 1 if "str" contains a match for the pattern, else 0.  This doesn't
+ * report where the match is, which makes it faster than jx_regex_exec().
+ */
+int jx_regex_test(jxregex_t *re, const char *str)
+{
+	/* Try the prefix first */
+	if (!regexprefilter(re, str))
+		return 0;
+
+	/* Compile a REG_NOSUB version if we haven't done that yet */
+	if (!re->hasnosub) {
+		if (regcomp(&re->nosub, re->source, re->cflags | REG_NOSUB) != 0)
+			return regexec(&re->preg, str, 0, NULL, 0) == 0;
+		re->hasnosub = 1;
+	}
+	return regexec(&re->nosub, str, 0, NULL, 0) == 0;
+}
+
+/* Search for a match, storing the positions of up to nmatch subexpressions
+ * in matches[].  Returns 1 if found, else 0.
+ */
+int jx_regex_exec(jxregex_t *re, const char *str, size_t nmatch, regmatch_t *matches)
+{
+	if (!regexprefilter(re, str))
+		return 0;
+	return regexec(&re->preg, str, nmatch, matches, 0) == 0;
+}
@@ -79,7 +79,7 @@ static size_t jcseriallen(jx_t *json, char *buf, jxformat_t *format)
 
 	  case JX_NUMBER:
 		if (json->text[0] == '\0' && json->text[1] == 'i')
-			snprintf(tmp = number, sizeof number, "%i", JX_INT(json));
+			snprintf(tmp = number, sizeof number, "%lld", JX_INT(json));
 		else if (json->text[0] == '\0' && json->text[1] == 'd')
 			snprintf(tmp = number, sizeof number, "%.*g", format->digits, JX_DOUBLE(json));
 		else
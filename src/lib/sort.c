@@ -18,6 +18,7 @@ static int cmpascending(const void *v1, const void *v2)
 {
 	bucket_t *b1 = (bucket_t *)v1;
 	bucket_t *b2 = (bucket_t *)v2;
+	long long i1, i2;
 
 	/* object/array/null/missing comes LAST */
 	if (b1->value && !b2->value)
@@ -33,19 +34,25 @@ static int cmpascending(const void *v1, const void *v2)
 	if (b1->value->type == JX_BOOLEAN || b2->value->type == JX_BOOLEAN)
 		return -1;
 
-	/* Strings before numbers */
-	if (b1->value->type == JX_STRING && b2->value->type == JX_STRING)
-		return jx_mbs_casecmp(b1->value->text, b2->value->text);
+	/* Strings before numbers.  Dates and datetimes are chronological. */
+	if (b1->value->type == JX_STRING && b2->value->type == JX_STRING) {
+		int diff = jx_datetime_compare(b1->value, b2->value);
+		return diff ? diff : jx_mbs_casecmp(b1->value->text, b2->value->text);
+	}
 	if (b1->value->type == JX_STRING)
 		return -1;
 	if (b2->value->type == JX_STRING)
 		return 1;
 
-	/* Numbers */
+	/* Numbers.  Large integers may round to the same double, so compare
+	 * those exactly.
+	 */
 	if (b1->dvalue < b2->dvalue)
 		return -1;
 	if (b1->dvalue > b2->dvalue)
 		return 1;
+	if (jx_is_integer(b1->value, &i1) && jx_is_integer(b2->value, &i2))
+		return (i1 > i2) - (i1 < i2);
 	return 0;
 }
 
@@ -63,7 +70,7 @@ static void jcsort(jx_t *array, jx_t *orderby, int grouping)
 {
 	jx_t	*elem, *value;
 	int	descending;
-	int	nbuckets, used, b, b2;
+	int	nbuckets, used, b, b2, count;
 	bucket_t *bucket;
 	double	dvalue;
 
@@ -96,8 +103,10 @@ static void jcsort(jx_t *array, jx_t *orderby, int grouping)
 	bucket = NULL;
 
 	/* Split the array elements out to buckets.  For strings, we do this
-	 * in a case-sensitive way at this phase.
+	 * in a case-sensitive way at this phase.  Count them, so the array's
+	 * cached length can be set when they're merged back.
 	 */
+	JX_ARRAY_LENGTH(array) = count = 0;
 	while (array->first) {
 		/* If user aborted, then quit */
 		if (jx_interrupt)
@@ -107,6 +116,7 @@ static void jcsort(jx_t *array, jx_t *orderby, int grouping)
 		elem = array->first;
 		array->first = elem->next; /* undeferred */
 		elem->next = NULL; /* undeferred */
+		count++;
 
 		/* Fetch its sort value. */
 		value = jx_by_expr(elem, orderby->text, NULL);
@@ -126,7 +136,8 @@ static void jcsort(jx_t *array, jx_t *orderby, int grouping)
 			} else if (value
 			      && value->type == JX_NUMBER
 			      && bucket[b].value->type == JX_NUMBER) {
-				if (dvalue == bucket[b].dvalue)
+				if (dvalue == bucket[b].dvalue
+				 && jx_equal(value, bucket[b].value))
 					break;
 			} else if (!bucket[b].value)
 				break; /* so arrays/objects/null all share a bucket */
@@ -198,6 +209,7 @@ static void jcsort(jx_t *array, jx_t *orderby, int grouping)
 			JX_END_POINTER(array)->next = bucket[b].arraybuf.first; /* undeferred */
 			JX_END_POINTER(array) = JX_END_POINTER(&bucket[b].arraybuf);
 		}
+		JX_ARRAY_LENGTH(array) = count;
 	} else {
 		/* grouping, and this is the last sort/group key */
 		JX_END_POINTER(array) = NULL;
@@ -216,6 +228,222 @@ static void jcsort(jx_t *array, jx_t *orderby, int grouping)
 }
 
 
+/* Compare two rows by all sort keys, in the same order jcsort() would put
+ * them.  Returns <0, 0, or >0.
+ */
+static int cmprows(jx_t *row1, jx_t *row2, jx_t *orderby)
+{
+	bucket_t b1, b2;
+	int	descending, diff;
+
+	for (; orderby; orderby = orderby->next) { /* undeferred */
+		descending = 0;
+		if (orderby->type == JX_BOOLEAN) {
+			descending = jx_is_true(orderby);
+			orderby = orderby->next; /* undeferred */
+		}
+
+		/* Fetch the values.  Anything other than a string, number,
+		 * or boolean sorts like a missing value.
+		 */
+		b1.value = jx_by_expr(row1, orderby->text, NULL);
+		b2.value = jx_by_expr(row2, orderby->text, NULL);
+		if (b1.value && b1.value->type != JX_STRING && b1.value->type != JX_NUMBER && b1.value->type != JX_BOOLEAN)
+			b1.value = NULL;
+		if (b2.value && b2.value->type != JX_STRING && b2.value->type != JX_NUMBER && b2.value->type != JX_BOOLEAN)
+			b2.value = NULL;
+		if (b1.value && b1.value->type == JX_NUMBER)
+			b1.dvalue = jx_double(b1.value);
+		if (b2.value && b2.value->type == JX_NUMBER)
+			b2.dvalue = jx_double(b2.value);
+
+		diff = descending ? cmpdescending(&b1, &b2) : cmpascending(&b1, &b2);
+		if (diff)
+			return diff;
+	}
+	return 0;
+}
+
+/* This is used for merging sorted runs.  "heads" is the current row of each
+ * run, and "heap" is a binary heap of run numbers, ordered by their current
+ * row and then by run number so the merge is stable.
+ */
+typedef struct {
+	jx_t	**heads;
+	int	*heap;
+	int	n;
+	jx_t	*orderby;
+} merge_t;
+
+/* Return 1 if the heap's entry "a" should come before entry "b" */
+static int mergebefore(merge_t *m, int a, int b)
+{
+	int	diff = cmprows(m->heads[m->heap[a]], m->heads[m->heap[b]], m->orderby);
+
+	return diff < 0 || (diff == 0 && m->heap[a] < m->heap[b]);
+}
+
+/* Move the heap entry at "i" down to where it belongs */
+static void mergedown(merge_t *m, int i)
+{
+	int	child, tmp;
+
+	while ((child = 2 * i + 1) < m->n) {
+		if (child + 1 < m->n && mergebefore(m, child + 1, child))
+			child++;
+		if (!mergebefore(m, child, i))
+			break;
+		tmp = m->heap[i];
+		m->heap[i] = m->heap[child];
+		m->heap[child] = tmp;
+		i = child;
+	}
+}
+
+/* Sort an array when there's a "memorylimit".  Rows are collected into runs,
+ * and whenever memory is over budget the run is sorted and spilled to a temp
+ * file.  The runs are then merged into a result which is itself spilled as
+ * it grows.  For grouping, consecutive equal rows of the merged result are
+ * collected into groups.  To keep the number of temp files down, a run
+ * always holds at least an eighth of the rows seen so far.
+ *
+ * Returns 1 if it did the sort, or 0 if nothing had to be spilled; in that
+ * case "array" is left undeferred but unsorted, and the caller should
+ * just use jcsort().
+ */
+static int extsort(jx_t *array, jx_t *orderby, int grouping)
+{
+	jx_t	*run, **runs, *elem, *result, *group, *groupfirst;
+	int	nruns, seen, i;
+	char	table;
+	merge_t	m;
+
+	/* Collect the rows into runs.  Undeferred rows can simply be moved,
+	 * but deferred rows must be copied.
+	 */
+	table = array->text[1];
+	elem = NULL;
+	runs = NULL;
+	nruns = seen = 0;
+	run = jx_array();
+	for (;;) {
+		if (jx_is_deferred_array(array)) {
+			elem = seen ? jx_next(elem) : jx_first(array);
+			if (!elem)
+				break;
+			jx_append(run, jx_copy(elem));
+		} else {
+			if (!(elem = array->first))
+				break;
+			array->first = elem->next; /* undeferred */
+			elem->next = NULL; /* undeferred */
+			jx_append(run, elem);
+		}
+		seen++;
+
+		/* If memory is short, then sort this run and spill it */
+		if (JX_ARRAY_LENGTH(run) >= JX_SPILL_MIN
+		 && JX_ARRAY_LENGTH(run) >= seen / 8
+		 && jx_memory_over_budget()) {
+			jcsort(run, orderby, 0);
+			runs = (jx_t **)realloc(runs, (nruns + 1) * sizeof(jx_t *));
+			runs[nruns++] = jx_defer_spill(run, JX_SPILL_MIN);
+			run = jx_array();
+		}
+	}
+
+	/* Release the original array's contents.  If nothing was spilled,
+	 * then the run becomes the array's contents.
+	 */
+	if (jx_is_deferred_array(array)) {
+		if (((jxdef_t *)array->first)->fns->free)
+			(*((jxdef_t *)array->first)->fns->free)(array);
+		jx_free(array->first);
+	}
+	array->first = run->first;
+	JX_END_POINTER(array) = JX_END_POINTER(run);
+	JX_ARRAY_LENGTH(array) = JX_ARRAY_LENGTH(run);
+	run->first = NULL;
+	jx_free(run);
+	if (nruns == 0)
+		return 0;
+
+	/* The leftover rows are the last run.  It may stay in memory. */
+	if (array->first) {
+		run = jx_array();
+		run->first = array->first;
+		JX_END_POINTER(run) = JX_END_POINTER(array);
+		JX_ARRAY_LENGTH(run) = JX_ARRAY_LENGTH(array);
+		jcsort(run, orderby, 0);
+		runs = (jx_t **)realloc(runs, (nruns + 1) * sizeof(jx_t *));
+		runs[nruns++] = jx_defer_spill(run, JX_SPILL_MIN);
+	}
+
+	/* Start scanning each run, and build a heap of them */
+	m.heads = (jx_t **)malloc(nruns * sizeof(jx_t *));
+	m.heap = (int *)malloc(nruns * sizeof(int));
+	m.orderby = orderby;
+	for (m.n = i = 0; i < nruns; i++) {
+		m.heads[i] = jx_first(runs[i]);
+		m.heap[m.n++] = i;
+	}
+	for (i = m.n / 2 - 1; i >= 0; i--)
+		mergedown(&m, i);
+
+	/* Merge them.  When grouping, "groupfirst" is a copy of the current
+	 * group's first row, since the group itself may be spilled.
+	 */
+	result = jx_array();
+	group = groupfirst = NULL;
+	while (m.n > 0) {
+		/* Add the first row to the result, or to a group */
+		i = m.heap[0];
+		if (!grouping)
+			jx_append(result, jx_copy(m.heads[i]));
+		else {
+			if (group && cmprows(groupfirst, m.heads[i], orderby)) {
+				jx_append(result, group);
+				jx_free(groupfirst);
+				group = NULL;
+			}
+			if (!group) {
+				group = jx_array();
+				groupfirst = jx_copy(m.heads[i]);
+			}
+			jx_append(group, jx_copy(m.heads[i]));
+			jx_defer_spill(group, JX_SPILL_MIN);
+		}
+		jx_defer_spill(result, grouping ? 1 : JX_SPILL_MIN);
+
+		/* Advance that run, and restore the heap */
+		m.heads[i] = jx_next(m.heads[i]);
+		if (!m.heads[i])
+			m.heap[0] = m.heap[--m.n];
+		mergedown(&m, 0);
+	}
+	if (group) {
+		jx_append(result, group);
+		jx_free(groupfirst);
+	}
+
+	/* The result becomes the array's contents */
+	array->first = result->first;
+	JX_END_POINTER(array) = JX_END_POINTER(result);
+	JX_ARRAY_LENGTH(array) = JX_ARRAY_LENGTH(result);
+	array->text[1] = grouping ? 'n' : table;
+	result->first = NULL;
+	jx_free(result);
+
+	/* Clean up */
+	for (i = 0; i < nruns; i++)
+		jx_free(runs[i]);
+	free(runs);
+	free(m.heads);
+	free(m.heap);
+	return 1;
+}
+
+
 /* Sort a JSON table (array of objects) in place, given a list of fields.
  * The orderby list should be an array of strings; you may also include
  * a boolean "true" before any field name to make it use descending sort.
@@ -235,12 +463,10 @@ void jx_sort(jx_t *array, jx_t *orderby, int grouping)
 		/* EEE "jx_sort() should be passed an array of objects" */
 		return;
 	}
-	if (jx_is_deferred_array(orderby)) {
-		/* EEE "jx_sort() orderby should be an in-memory array (not deferred) */
-		return;
-	}
-	if (orderby->type == JX_ARRAY)
+	if (orderby->type == JX_ARRAY) {
+		jx_undefer(orderby);
 		orderby = orderby->first;
+	}
 	anykeys = 0;
 	for (check = orderby; check; check = check->next) { /* undeferred */
 		if (check->type == JX_STRING)
@@ -259,6 +485,12 @@ void jx_sort(jx_t *array, jx_t *orderby, int grouping)
 		return;
 	}
 
+	/* If there's a memory limit, then the sort may need to spill rows to
+	 * temp files.
+	 */
+	if (jx_config_snapshot()->memorylimit > 0 && extsort(array, orderby, grouping))
+		return;
+
 	/* Sorting only works on in-memory tables (not deferred) */
 	jx_undefer(array);
 
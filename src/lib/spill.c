@@ -0,0 +1,508 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <jx.h>
+
+/* This file implements spilled arrays.  When the jx_t's in memory exceed the
+ * "memorylimit" setting, operators that build large arrays (sorting,
+ * grouping, joins, arrayAgg) can move the array's elements out to an unlinked
+ * temp file and turn the array into a deferred array that reads them back
+ * as needed.  Elements are stored in a compact binary format, not JSON, so
+ * reading them back doesn't involve any parsing of text.
+ *
+ * Each element is stored as a 4-byte length followed by the encoded value.
+ * A value is a type byte followed by type-specific data:
+ *
+ *	'n' null	length and text (the error message, if any)
+ *	't' 'f'		true or false
+ *	'i' 'd'		binary integer or double, 8 bytes
+ *	'#'		number as text: length and text
+ *	's'		string: length and text
+ *	'a'		array: table flag byte, count, and that many values
+ *	'o'		object: count, and that many keys and values, where
+ *			each key is a length and text
+ *
+ * Lengths and counts are stored as variable-length integers, 7 bits per
+ * byte with the high bit set on all but the last byte.  The file is only
+ * ever read by this process, so binary numbers are stored in native order.
+ *
+ * Like shared arrays, copies of a spilled array share the temp file via a
+ * reference count.  Elements can be appended to a spilled array without
+ * undeferring it, as long as it isn't shared.
+ */
+
+/* Bytes to read from the file at a time, when scanning */
+#define SPILL_CHUNK	65536
+
+/* A buffer for encoding values */
+typedef struct {
+	unsigned char *data;
+	size_t	size;	/* allocated size */
+	size_t	used;	/* bytes used */
+} jspillbuf_t;
+
+/* The temp file, shared by all copies of a spilled array */
+typedef struct {
+	int	refs;	/* number of arrays using this file */
+	FILE	*fp;	/* the unlinked temp file, written sequentially */
+	off_t	end;	/* size of the file, including unflushed rows */
+	int	dirty;	/* boolean: rows written but not flushed? */
+	jspillbuf_t buf;/* for encoding rows */
+} jspillfile_t;
+
+/* The state of a scan.  "buf" holds bytes from the file starting with the
+ * byte at "offset", which is the start of the next row.
+ */
+typedef struct {
+	off_t	offset;	/* file offset of the next row */
+	unsigned char *buf; /* bytes read from the file */
+	size_t	size;	/* allocated size of buf */
+	size_t	used;	/* bytes in buf */
+	size_t	pos;	/* offset within buf of the next row */
+} jspillscan_t;
+
+/* This is the JX_DEFER node.  The array's node has a file, and the node of
+ * an element being scanned also has a scan.
+ */
+typedef struct {
+	jxdef_t	basic;		/* Normal stuff */
+	jspillfile_t *file;	/* The temp file */
+	jspillscan_t *scan;	/* State of a scan, only for elements */
+} jspilldef_t;
+
+static jx_t *jspill_first(jx_t *array);
+static jx_t *jspill_next(jx_t *elem);
+static int jspill_islast(const jx_t *elem);
+static void jspill_free(jx_t *array_or_elem);
+static void jspill_copy(jx_t *array);
+static int jspill_append(jx_t *array, jx_t *more);
+
+static jxdeffns_t jspillfns = {
+	sizeof(jspilldef_t),	/* size */
+	"Spilled",		/* desc */
+	jspill_first,		/* first */
+	jspill_next,		/* next */
+	jspill_islast,		/* islast */
+	jspill_free,		/* free */
+	NULL,			/* byindex */
+	NULL,			/* bykey */
+	jspill_copy,		/* copy */
+	NULL,			/* undefer */
+	jspill_append		/* append */
+};
+
+/******************************************************************************/
+/* Encoding and decoding of values                                            */
+
+/* Append bytes to a buffer, enlarging it if necessary */
+static void put(jspillbuf_t *b, const void *data, size_t len)
+{
+	if (b->used + len > b->size) {
+		b->size = (b->used + len) * 2 + 256;
+		b->data = (unsigned char *)realloc(b->data, b->size);
+	}
+	memcpy(b->data + b->used, data, len);
+	b->used += len;
+}
+
+/* Append a variable-length integer to a buffer */
+static void putnum(jspillbuf_t *b, size_t n)
+{
+	unsigned char byte;
+
+	while (n >= 0x80) {
+		byte = (n & 0x7f) | 0x80;
+		put(b, &byte, 1);
+		n >>= 7;
+	}
+	byte = n;
+	put(b, &byte, 1);
+}
+
+/* Append a length and text to a buffer */
+static void puttext(jspillbuf_t *b, const char *text)
+{
+	size_t	len = strlen(text);
+
+	putnum(b, len);
+	put(b, text, len);
+}
+
+/* Append an encoded value to a buffer */
+static void encode(jspillbuf_t *b, jx_t *json)
+{
+	jx_t	*scan;
+	char	type;
+
+	switch (json->type) {
+	  case JX_BOOLEAN:
+		type = jx_is_true(json) ? 't' : 'f';
+		put(b, &type, 1);
+		break;
+
+	  case JX_NUMBER:
+		if (json->text[0]) {
+			put(b, "#", 1);
+			puttext(b, json->text);
+		} else if (json->text[1] == 'i') {
+			put(b, "i", 1);
+			put(b, &JX_INT(json), sizeof(long long));
+		} else {
+			put(b, "d", 1);
+			put(b, &JX_DOUBLE(json), sizeof(double));
+		}
+		break;
+
+	  case JX_STRING:
+		put(b, "s", 1);
+		puttext(b, json->text);
+		break;
+
+	  case JX_ARRAY:
+		put(b, "a", 1);
+		put(b, &json->text[1], 1);
+		putnum(b, jx_length(json));
+		for (scan = jx_first(json); scan; scan = jx_next(scan))
+			encode(b, scan);
+		break;
+
+	  case JX_OBJECT:
+		put(b, "o", 1);
+		putnum(b, jx_length(json));
+		for (scan = json->first; scan; scan = scan->next) { /* object */
+			puttext(b, scan->text);
+			encode(b, scan->first);
+		}
+		break;
+
+	  default: /* JX_NULL, and anything that shouldn't be in data */
+		put(b, "n", 1);
+		puttext(b, json->type == JX_NULL ? json->text : "");
+	}
+}
+
+/* Fetch a variable-length integer */
+static size_t getnum(const unsigned char **refp)
+{
+	size_t	n;
+	int	shift;
+
+	for (n = 0, shift = 0; **refp & 0x80; shift += 7)
+		n |= (size_t)(*(*refp)++ & 0x7f) << shift;
+	n |= (size_t)*(*refp)++ << shift;
+	return n;
+}
+
+/* Decode a value, and advance *refp past it */
+static jx_t *decode(const unsigned char **refp)
+{
+	const unsigned char *p = *refp;
+	jx_t	*json, *value;
+	size_t	len, count;
+	char	key[200], *bigkey;
+
+	switch (*p++) {
+	  case 't':
+		json = jx_boolean(1);
+		break;
+
+	  case 'f':
+		json = jx_boolean(0);
+		break;
+
+	  case 'i':
+		json = jx_from_int(0);
+		memcpy(&JX_INT(json), p, sizeof(long long));
+		p += sizeof(long long);
+		break;
+
+	  case 'd':
+		json = jx_from_double(0.0);
+		memcpy(&JX_DOUBLE(json), p, sizeof(double));
+		p += sizeof(double);
+		break;
+
+	  case '#':
+		len = getnum(&p);
+		json = jx_number((const char *)p, len);
+		p += len;
+		break;
+
+	  case 's':
+		len = getnum(&p);
+		json = jx_string((const char *)p, len);
+		p += len;
+		break;
+
+	  case 'a':
+		json = jx_array();
+		json->text[1] = *p++;
+		for (count = getnum(&p); count > 0; count--)
+			jx_append(json, decode(&p));
+		break;
+
+	  case 'o':
+		json = jx_object();
+		for (count = getnum(&p); count > 0; count--) {
+			len = getnum(&p);
+			bigkey = len < sizeof key ? key : (char *)malloc(len + 1);
+			memcpy(bigkey, p, len);
+			bigkey[len] = '\0';
+			p += len;
+			value = decode(&p);
+			jx_append(json, jx_key(bigkey, value));
+			if (bigkey != key)
+				free(bigkey);
+		}
+		break;
+
+	  default: /* 'n' */
+		len = getnum(&p);
+		json = len ? jx_simple((const char *)p, len, JX_NULL) : jx_null();
+		p += len;
+	}
+
+	*refp = p;
+	return json;
+}
+
+/******************************************************************************/
+/* Reading and writing rows                                                   */
+
+/* Append a row to the temp file.  Returns 1 if successful, or 0 if the
+ * write failed.
+ */
+static int writerow(jspillfile_t *file, jx_t *json)
+{
+	__uint32_t len;
+
+	file->buf.used = 0;
+	encode(&file->buf, json);
+	len = file->buf.used;
+	if (fwrite(&len, sizeof len, 1, file->fp) != 1
+	 || fwrite(file->buf.data, len, 1, file->fp) != 1)
+		return 0;
+	file->end += sizeof len + len;
+	file->dirty = 1;
+	return 1;
+}
+
+/* Make sure the scan buffer contains at least "need" bytes starting with
+ * the next row.  Returns 1 if successful, or 0 at the end of the file.
+ */
+static int fill(jspillfile_t *file, jspillscan_t *scan, size_t need)
+{
+	ssize_t	got;
+
+	if (scan->used - scan->pos >= need)
+		return 1;
+	if (scan->offset + (off_t)need > file->end)
+		return 0;
+
+	/* Rows written via stdio must be flushed before we can read them */
+	if (file->dirty) {
+		fflush(file->fp);
+		file->dirty = 0;
+	}
+
+	/* Read a chunk starting at the next row */
+	if (need < SPILL_CHUNK)
+		need = SPILL_CHUNK;
+	if (need > scan->size) {
+		scan->size = need;
+		scan->buf = (unsigned char *)realloc(scan->buf, scan->size);
+	}
+	got = pread(fileno(file->fp), scan->buf, scan->size, scan->offset);
+	scan->used = got > 0 ? got : 0;
+	scan->pos = 0;
+	return 1;
+}
+
+/* Read the next row of a scan, or return NULL if there are no more rows */
+static jx_t *readrow(jspillfile_t *file, jspillscan_t *scan)
+{
+	__uint32_t len;
+	const unsigned char *p;
+	jx_t	*json;
+
+	if (!fill(file, scan, sizeof len))
+		return NULL;
+	memcpy(&len, scan->buf + scan->pos, sizeof len);
+	if (!fill(file, scan, sizeof len + len) || scan->used - scan->pos < sizeof len + len)
+		return NULL;
+	p = scan->buf + scan->pos + sizeof len;
+	json = decode(&p);
+	scan->pos += sizeof len + len;
+	scan->offset += sizeof len + len;
+	return json;
+}
+
+/******************************************************************************/
+/* The deferred array functions                                               */
+
+/* Start a scan, and return the first element */
+static jx_t *jspill_first(jx_t *array)
+{
+	jspilldef_t *def = (jspilldef_t *)array->first;
+	jspilldef_t *elemdef;
+	jspillscan_t *scan;
+	jx_t	*elem;
+
+	scan = (jspillscan_t *)calloc(1, sizeof(jspillscan_t));
+	elem = readrow(def->file, scan);
+	if (!elem) {
+		free(scan->buf);
+		free(scan);
+		return NULL;
+	}
+	elem->next = jx_defer(&jspillfns);
+	elemdef = (jspilldef_t *)elem->next;
+	elemdef->file = def->file;
+	elemdef->scan = scan;
+	return elem;
+}
+
+/* Read the next element, and free the previous one.  The JX_DEFER node is
+ * moved to the new element.
+ */
+static jx_t *jspill_next(jx_t *elem)
+{
+	jspilldef_t *def = (jspilldef_t *)elem->next;
+	jx_t	*next;
+
+	/* If no more, then jx_next() will clean up */
+	next = readrow(def->file, def->scan);
+	if (!next)
+		return NULL;
+
+	next->next = elem->next;
+	elem->next = NULL;
+	jx_free(elem);
+	return next;
+}
+
+/* Test whether the current element is the last */
+static int jspill_islast(const jx_t *elem)
+{
+	jspilldef_t *def = (jspilldef_t *)elem->next;
+
+	return def->scan->offset >= def->file->end;
+}
+
+/* Free a scan, or release a reference to the temp file */
+static void jspill_free(jx_t *array_or_elem)
+{
+	jspilldef_t *def;
+	jspillfile_t *file;
+
+	/* An element whose ->next is ours has a scan.  Note that a spilled
+	 * array could itself be an element of some other deferred array, so
+	 * check for the array case first.
+	 */
+	if (!jx_is_deferred_array(array_or_elem)
+	 || ((jxdef_t *)array_or_elem->first)->fns != &jspillfns) {
+		def = (jspilldef_t *)array_or_elem->next;
+		if (def->scan) {
+			free(def->scan->buf);
+			free(def->scan);
+		}
+		def->scan = NULL;
+		return;
+	}
+
+	def = (jspilldef_t *)array_or_elem->first;
+	file = def->file;
+	if (!file || --file->refs > 0)
+		return;
+	fclose(file->fp);
+	free(file->buf.data);
+	free(file);
+	def->file = NULL;
+}
+
+/* When a spilled array is copied, the copy shares its temp file */
+static void jspill_copy(jx_t *array)
+{
+	((jspilldef_t *)array->first)->file->refs++;
+}
+
+/* Append an element by writing it to the temp file.  This only works if no
+ * other array shares the file; otherwise return 0 so jx_append() will
+ * undefer the array first.
+ */
+static int jspill_append(jx_t *array, jx_t *more)
+{
+	jspillfile_t *file = ((jspilldef_t *)array->first)->file;
+
+	if (file->refs > 1 || !writerow(file, more))
+		return 0;
+	JX_ARRAY_LENGTH(array)++;
+	if (array->text[1] == 't' && (more->type != JX_OBJECT || more->first == NULL))
+		array->text[1] = 'n';
+	jx_free(more);
+	return 1;
+}
+
+/******************************************************************************/
+
+/* If the jx_t's in memory exceed the "memorylimit" setting and "array" is an
+ * undeferred array with at least "minlength" elements, then move its elements
+ * to a temp file and convert it in place to a spilled array.  Returns "array"
+ * either way.  If the temp file can't be written, the array is left in memory.
+ * Each spilled array uses a file descriptor, so "minlength" should normally
+ * be JX_SPILL_MIN, but it can be lower for arrays of large elements.
+ */
+jx_t *jx_defer_spill(jx_t *array, int minlength)
+{
+	jspillfile_t *file;
+	jx_t	*scan;
+	const char *tmpdir;
+	char	*tmpname;
+	int	fd;
+
+	/* Only long, undeferred arrays are worth spilling, and only when
+	 * memory is short.
+	 */
+	if (!array
+	 || array->type != JX_ARRAY
+	 || jx_is_deferred_array(array)
+	 || jx_length(array) < minlength
+	 || !jx_memory_over_budget())
+		return array;
+
+	/* Create an unlinked temp file in $TMPDIR, or /tmp */
+	tmpdir = getenv("TMPDIR");
+	if (!tmpdir || !*tmpdir)
+		tmpdir = "/tmp";
+	tmpname = (char *)malloc(strlen(tmpdir) + 20);
+	sprintf(tmpname, "%s/jxS.XXXXXX", tmpdir);
+	fd = mkstemp(tmpname);
+	if (fd < 0) {
+		free(tmpname);
+		return array;
+	}
+	unlink(tmpname);
+	free(tmpname);
+	file = (jspillfile_t *)calloc(1, sizeof(jspillfile_t));
+	file->fp = fdopen(fd, "w+");
+	file->refs = 1;
+
+	/* Write the elements.  If that fails, leave it in memory. */
+	for (scan = array->first; scan; scan = scan->next) { /* undeferred */
+		if (!writerow(file, scan)) {
+			fclose(file->fp);
+			free(file->buf.data);
+			free(file);
+			return array;
+		}
+	}
+
+	/* Free the elements, and make the array refer to the file */
+	jx_free(array->first);
+	array->first = jx_defer(&jspillfns);
+	((jspilldef_t *)array->first)->file = file;
+	JX_END_POINTER(array) = NULL;
+	return array;
+}
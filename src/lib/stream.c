@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <jx.h>
+
+/* This file implements incremental parsing of pipes.  When jx_parse_file()
+ * reads a pipe (including stdin) and the first chunk looks like the start of
+ * a JSON array or of NDJSON (one value per line), it calls jx_stream() to
+ * return a deferred array whose elements are parsed as the data arrives.
+ * Memory use is bounded by the size of the largest element, not the whole
+ * stream.
+ *
+ * Since a pipe can only be read once, everything read from it is also copied
+ * into an unlinked temporary file.  Each scan of the array reads from that
+ * file as far as it goes, and then from the pipe.  Scans can overlap, and a
+ * later scan never has to wait for data that an earlier scan already read.
+ * The temporary file isn't limited in size; it holds the whole stream.
+ *
+ * The scanner that splits the text into elements, jx_stream_element(), is
+ * exported so plugins (such as curl's CURL.stream) can use it too.
+ */
+
+/* Number of bytes to read at a time */
+#define STREAMCHUNK	16384
+
+/* This is shared by all copies of a streamed array */
+typedef struct {
+	int	refs;		/* Number of arrays using this */
+	int	fd;		/* The pipe, or -1 after EOF */
+	FILE	*spool;		/* Everything read from the pipe so far */
+	off_t	spooled;	/* Number of bytes in the spool */
+} jstreamsource_t;
+
+/* This is the state of a single scan */
+typedef struct {
+	jxstreamscan_t basic;	/* The text, and the scanner's state */
+	jstreamsource_t *source;/* Where the text comes from */
+	off_t	offset;		/* Spool offset of the byte after buf[used-1] */
+	int	done;		/* No more data to read? */
+	jx_t	*pending;	/* The next element, or NULL at the end */
+} jstreamscan_t;
+
+/* This is the JX_DEFER node.  The array's node has a source, and the scan
+ * node of an element also has a scan.
+ */
+typedef struct {
+	jxdef_t	basic;		/* Normal stuff */
+	jstreamsource_t *source;/* The pipe and its spool */
+	jstreamscan_t *scan;	/* State of a scan, only for elements */
+} jstreamdef_t;
+
+static jx_t *jstream_first(jx_t *array);
+static jx_t *jstream_next(jx_t *elem);
+static int jstream_islast(const jx_t *elem);
+static void jstream_free(jx_t *array_or_elem);
+static void jstream_copy(jx_t *array);
+
+static jxdeffns_t jstreamfns = {
+	sizeof(jstreamdef_t),	/* size */
+	"Stream",		/* desc */
+	jstream_first,		/* first */
+	jstream_next,		/* next */
+	jstream_islast,		/* islast */
+	jstream_free,		/* free */
+	NULL,			/* byindex */
+	NULL,			/* bykey */
+	jstream_copy		/* copy */
+};
+
+/* Discard text that has already been parsed, and make room for "len" more
+ * bytes plus a '\0'.  Returns a pointer to where the new text should go; the
+ * caller should then add the number of bytes actually stored to scan->used.
+ * Memory use stays bounded by the size of the largest element rather than
+ * the whole stream.
+ */
+char *jx_stream_room(jxstreamscan_t *scan, size_t len)
+{
+	if (scan->start > 0) {
+		memmove(scan->buf, scan->buf + scan->start, scan->used - scan->start);
+		scan->used -= scan->start;
+		scan->scanned -= scan->start;
+		scan->start = 0;
+	}
+	if (scan->used + len + 1 > scan->size) {
+		scan->size = ((scan->used + len) | 0x3fff) + 1;
+		scan->buf = (char *)realloc(scan->buf, scan->size);
+	}
+	return scan->buf + scan->used;
+}
+
+/* Add more data to the scan's buffer, either from the spool or from the
+ * pipe.  Returns 1 if data was added, or 0 at the end.
+ */
+static int streamfill(jxstreamscan_t *scan)
+{
+	jstreamscan_t *ss = (jstreamscan_t *)scan;
+	jstreamsource_t *source = ss->source;
+	char	*room;
+	ssize_t	got;
+
+	if (ss->done)
+		return 0;
+	room = jx_stream_room(scan, STREAMCHUNK);
+
+	/* If the spool doesn't have it yet, read more from the pipe and add
+	 * it to the spool.
+	 */
+	if (ss->offset >= source->spooled) {
+		if (source->fd < 0) {
+			ss->done = 1;
+			return 0;
+		}
+		do {
+			got = read(source->fd, room, STREAMCHUNK);
+		} while (got < 0 && errno == EINTR);
+		if (got <= 0) {
+			if (source->fd != 0) /* never close stdin */
+				close(source->fd);
+			source->fd = -1;
+			ss->done = 1;
+			return 0;
+		}
+		if (pwrite(fileno(source->spool), room, got, source->spooled) != got) {
+			/* Can't spool it, so later scans will be truncated */
+			if (source->fd != 0)
+				close(source->fd);
+			source->fd = -1;
+		}
+		source->spooled += got;
+	} else {
+		got = source->spooled - ss->offset;
+		if (got > STREAMCHUNK)
+			got = STREAMCHUNK;
+		got = pread(fileno(source->spool), room, got, ss->offset);
+		if (got <= 0) {
+			ss->done = 1;
+			return 0;
+		}
+	}
+	ss->offset += got;
+	scan->used += got;
+	scan->buf[scan->used] = '\0';
+	return 1;
+}
+
+/* Parse the buffer text from scan->start up to "end" as an element, and then
+ * skip past the delimiter.  Returns NULL if the text is only whitespace.
+ */
+static jx_t *streamparse(jxstreamscan_t *scan, size_t end)
+{
+	char	save, *s;
+	jx_t	*elem = NULL;
+
+	for (s = scan->buf + scan->start; s < scan->buf + end && strchr(" \t\r\n", *s); s++) {
+	}
+	if (s < scan->buf + end) {
+		save = scan->buf[end];
+		scan->buf[end] = '\0';
+		elem = jx_parse_string(s);
+		scan->buf[end] = save;
+	}
+	scan->start = scan->scanned = end + 1;
+	return elem;
+}
+
+/* Return the next element of a scan, calling scan->fill() to read more data
+ * as needed.  Returns NULL at the end.
+ */
+jx_t *jx_stream_element(jxstreamscan_t *scan)
+{
+	char	*s;
+	jx_t	*elem;
+
+	do {
+		for (s = scan->buf + scan->scanned; !scan->ended && s < scan->buf + scan->used; s++) {
+			/* Strings may contain anything */
+			if (scan->instring) {
+				if (scan->escape)
+					scan->escape = 0;
+				else if (*s == '\\')
+					scan->escape = 1;
+				else if (*s == '"')
+					scan->instring = 0;
+				continue;
+			}
+
+			/* The first non-space byte tells us the format */
+			if (!scan->format) {
+				if (strchr(" \t\r\n", *s))
+					continue;
+				if (*s == '[') {
+					scan->format = '[';
+					scan->start = s + 1 - scan->buf;
+					continue;
+				}
+				scan->format = 'n';
+			}
+
+			/* Watch for element delimiters at the top level */
+			switch (*s) {
+			case '"':
+				scan->instring = 1;
+				break;
+
+			case '[':
+			case '{':
+				scan->depth++;
+				break;
+
+			case ']':
+			case '}':
+				if (scan->depth > 0) {
+					scan->depth--;
+					break;
+				}
+				if (scan->format != '[' || *s != ']')
+					break;
+				scan->ended = 1;
+				/* and fall through... */
+
+			case ',':
+			case '\n':
+				if (scan->depth > 0)
+					break;
+				if (!scan->ended && *s != (scan->format == '[' ? ',' : '\n'))
+					break;
+				elem = streamparse(scan, s - scan->buf);
+				if (elem)
+					return elem;
+				s = scan->buf + scan->scanned - 1;
+				break;
+			}
+		}
+		scan->scanned = s - scan->buf;
+	} while (!scan->ended && (*scan->fill)(scan));
+
+	/* Anything left over is the last element of NDJSON */
+	if (!scan->ended && scan->format == 'n') {
+		scan->ended = 1;
+		return streamparse(scan, scan->used);
+	}
+	return NULL;
+}
+
+/* Free a scan */
+static void streamscanfree(jstreamscan_t *ss)
+{
+	free(ss->basic.buf);
+	jx_free(ss->pending);
+	free(ss);
+}
+
+/* Start a scan, and return the first element */
+static jx_t *jstream_first(jx_t *array)
+{
+	jstreamdef_t *def = (jstreamdef_t *)array->first;
+	jstreamscan_t *ss;
+	jstreamdef_t *scandef;
+	jx_t	*elem;
+
+	/* Start reading at the beginning of the spool */
+	ss = (jstreamscan_t *)calloc(1, sizeof(jstreamscan_t));
+	ss->basic.fill = streamfill;
+	ss->source = def->source;
+
+	/* Get the first element, and the one after that */
+	elem = jx_stream_element(&ss->basic);
+	if (!elem) {
+		streamscanfree(ss);
+		return NULL;
+	}
+	ss->pending = jx_stream_element(&ss->basic);
+
+	/* Make its "->next" point to a new JX_DEFER node */
+	elem->next = jx_defer(&jstreamfns);
+	scandef = (jstreamdef_t *)elem->next;
+	scandef->source = def->source;
+	scandef->scan = ss;
+	return elem;
+}
+
+/* Move to the next element.  This frees the previous one, but reuses its
+ * JX_DEFER node.
+ */
+static jx_t *jstream_next(jx_t *elem)
+{
+	jstreamdef_t *def = (jstreamdef_t *)elem->next;
+	jstreamscan_t *ss = def->scan;
+	jx_t	*next;
+
+	/* If no more elements, return NULL and jx_next() will clean up */
+	if (!ss->pending)
+		return NULL;
+
+	/* Move the JX_DEFER node to the new element, and read ahead */
+	next = ss->pending;
+	next->next = (jx_t *)def;
+	elem->next = NULL;
+	jx_free(elem);
+	ss->pending = jx_stream_element(&ss->basic);
+	return next;
+}
+
+/* Test whether the current element is the last one */
+static int jstream_islast(const jx_t *elem)
+{
+	return ((jstreamdef_t *)elem->next)->scan->pending == NULL;
+}
+
+/* Free a scan when it ends, or the source when the array is freed */
+static void jstream_free(jx_t *array_or_elem)
+{
+	jstreamdef_t *def;
+	jstreamsource_t *source;
+
+	if (jx_is_deferred_element(array_or_elem)) {
+		def = (jstreamdef_t *)array_or_elem->next;
+		if (def->scan)
+			streamscanfree(def->scan);
+		def->scan = NULL;
+		return;
+	}
+
+	def = (jstreamdef_t *)array_or_elem->first;
+	source = def->source;
+	if (!source || --source->refs > 0)
+		return;
+	if (source->fd > 0)
+		close(source->fd);
+	fclose(source->spool);
+	free(source);
+	def->source = NULL;
+}
+
+/* When a streamed array is copied, the copy shares its source */
+static void jstream_copy(jx_t *array)
+{
+	((jstreamdef_t *)array->first)->source->refs++;
+}
+
+/* Test whether the first chunk of a pipe's data looks like a JSON array or
+ * NDJSON, and return '[' or 'n' respectively, or 0 for neither.  For NDJSON,
+ * the chunk must start with an object that ends on the first line, followed
+ * by another value; otherwise a pipe containing a single large object (or
+ * some non-JSON format) would be mistaken for NDJSON.
+ */
+int jx_stream_test(const char *str, size_t len)
+{
+	const char *end = str + len;
+	int	depth, instring, escape;
+
+	/* Skip leading whitespace.  An array is easy to recognize. */
+	while (str < end && strchr(" \t\r\n", *str))
+		str++;
+	if (str >= end)
+		return 0;
+	if (*str == '[')
+		return '[';
+	if (*str != '{')
+		return 0;
+
+	/* Find the end of the object, which must be followed by a newline */
+	depth = instring = escape = 0;
+	for (; str < end; str++) {
+		if (instring) {
+			if (escape)
+				escape = 0;
+			else if (*str == '\\')
+				escape = 1;
+			else if (*str == '"')
+				instring = 0;
+		} else if (*str == '"')
+			instring = 1;
+		else if (*str == '[' || *str == '{')
+			depth++;
+		else if ((*str == ']' || *str == '}') && --depth == 0)
+			break;
+		else if (*str == '\n' && depth == 1)
+			return 0;
+	}
+	if (str >= end)
+		return 0;
+	for (str++; str < end && strchr(" \t\r", *str); str++) {
+	}
+	if (str >= end || *str != '\n')
+		return 0;
+
+	/* Is there another value after it? */
+	while (str < end && strchr(" \t\r\n", *str))
+		str++;
+	return str < end ? 'n' : 0;
+}
+
+/* Guess whether a stream is a table, by checking the elements that are in the
+ * first chunk of data.  If they're all non-empty objects, assume it is.
+ * Checking the whole stream via jx_is_table() would mean waiting for EOF
+ * before any output could be written.
+ */
+static char streamtable(const char *str, size_t len)
+{
+	const char *end = str + len;
+	int	depth, instring, escape, elems;
+
+	/* Skip leading whitespace, and the "[" if it's an array */
+	while (str < end && strchr(" \t\r\n", *str))
+		str++;
+	if (str < end && *str == '[')
+		str++;
+
+	/* Check each element that starts within the chunk */
+	elems = depth = instring = escape = 0;
+	for (; str < end; str++) {
+		if (instring) {
+			if (escape)
+				escape = 0;
+			else if (*str == '\\')
+				escape = 1;
+			else if (*str == '"')
+				instring = 0;
+			continue;
+		}
+		if (strchr(" \t\r\n,", *str))
+			continue;
+		if (depth == 0) {
+			/* Start of an element.  Is it a non-empty object? */
+			if (*str == ']')
+				break;
+			if (*str != '{')
+				return 'n';
+			elems++;
+		}
+		if (*str == '"')
+			instring = 1;
+		else if (*str == '[' || *str == '{')
+			depth++;
+		else if (*str == ']' || *str == '}')
+			depth--;
+	}
+	return elems > 0 ? 't' : 0;
+}
+
+/* Return a deferred array that parses a pipe's data incrementally.  "jf" is
+ * the partially-loaded pipe; its data so far is copied, and its file
+ * descriptor is duplicated, so the caller should still unload it.  Returns
+ * NULL if the temporary file can't be created.
+ */
+jx_t *jx_stream(jxfile_t *jf)
+{
+	jstreamsource_t *source;
+	jstreamdef_t *def;
+	jx_t	*array;
+	FILE	*spool;
+	char	table;
+
+	/* Create the spool, and copy the data that's already been read */
+	spool = tmpfile();
+	if (!spool)
+		return NULL;
+	if (fwrite(jf->base, 1, jf->size, spool) != jf->size || fflush(spool) != 0) {
+		fclose(spool);
+		return NULL;
+	}
+
+	/* Create the source */
+	source = (jstreamsource_t *)calloc(1, sizeof(jstreamsource_t));
+	source->refs = 1;
+	source->fd = jf->fd == 0 ? 0 : dup(jf->fd);
+	source->spool = spool;
+	source->spooled = jf->size;
+
+	/* Build the deferred array */
+	array = jx_array();
+	array->first = jx_defer(&jstreamfns);
+	def = (jstreamdef_t *)array->first;
+	def->source = source;
+	table = streamtable(jf->base, jf->size);
+	if (table)
+		array->text[1] = table;
+	return array;
+}
@@ -1,5 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
 #include <jx.h>
 
 static char *defaultvalue;
@@ -25,26 +28,166 @@ char *jx_text(jx_t *json)
 	return json->text;
 }
 
+/* Powers of ten that can be represented exactly as a double */
+static const double exactpow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Convert a number's text to binary.  This handles the common cases without
+ * calling strtod(): integers that fit in a long long, and decimal numbers
+ * with at most 19 significant digits whose value fits in 53 bits and whose
+ * exponent is small enough that the power of ten is exact, so a single
+ * multiply or divide gives a correctly rounded result.  Anything else falls
+ * back to strtod().  Returns 'i' if the integer was set, or 'd' if the
+ * double was set.
+ */
+static char numparse(const char *str, long long *refint, double *refdouble)
+{
+	const char	*s = str;
+	unsigned long long mant = 0;
+	int	neg = 0, digits = 0, exp10 = 0, isfloat = 0, e, expdigits;
+	double	d;
+
+	/* Sign */
+	if (*s == '-' || *s == '+')
+		neg = (*s++ == '-');
+	if (!isdigit(*s) && (*s != '.' || !isdigit(s[1])))
+		goto Slow;
+
+	/* Integer part, then fraction part.  Leading 0's aren't significant */
+	for (; isdigit(*s); s++) {
+		if (mant == 0 && *s == '0')
+			continue;
+		if (++digits > 19)
+			goto Slow;
+		mant = mant * 10 + (*s - '0');
+	}
+	if (*s == '.') {
+		isfloat = 1;
+		for (s++; isdigit(*s); s++) {
+			exp10--;
+			if (mant == 0 && *s == '0')
+				continue;
+			if (++digits > 19)
+				goto Slow;
+			mant = mant * 10 + (*s - '0');
+		}
+	}
+
+	/* Exponent */
+	if (*s == 'e' || *s == 'E') {
+		isfloat = 1;
+		s++;
+		e = (*s == '-') ? -1 : 1;
+		if (*s == '-' || *s == '+')
+			s++;
+		if (!isdigit(*s))
+			goto Slow;
+		for (digits = 0, expdigits = 0; isdigit(*s); s++) {
+			if (++digits > 4)
+				goto Slow;
+			expdigits = expdigits * 10 + (*s - '0');
+		}
+		exp10 += e * expdigits;
+	}
+
+	/* Anything left over (such as a hex number) needs the slow way */
+	if (*s)
+		goto Slow;
+
+	/* Integer that fits? */
+	if (!isfloat && mant <= (unsigned long long)LLONG_MAX) {
+		*refint = neg ? -(long long)mant : (long long)mant;
+		return 'i';
+	}
+
+	/* Exact fast path? */
+	if (mant <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+		d = (double)mant;
+		if (exp10 < 0)
+			d /= exactpow10[-exp10];
+		else
+			d *= exactpow10[exp10];
+		*refdouble = neg ? -d : d;
+		return 'd';
+	}
+
+Slow:
+	*refdouble = strtod(str, NULL);
+	return 'd';
+}
+
+/* Return the binary value of a JX_NUMBER that's stored as text, using the
+ * cached value if there is one, or parsing and caching it otherwise.  Returns
+ * 'i' if *refint was set, or 'd' if *refdouble was set.
+ */
+static char numcache(jx_t *json, long long *refint, double *refdouble)
+{
+	size_t	len = strlen(json->text);
+	char	flag = JX_NUMBER_CACHE_FLAG(json, len);
+
+	if (!flag) {
+		flag = numparse(json->text, &JX_NUMBER_CACHE_INT(json, len), &JX_NUMBER_CACHE_DOUBLE(json, len));
+		JX_NUMBER_CACHE_FLAG(json, len) = flag;
+	}
+	if (flag == 'i')
+		*refint = JX_NUMBER_CACHE_INT(json, len);
+	else
+		*refdouble = JX_NUMBER_CACHE_DOUBLE(json, len);
+	return flag;
+}
+
 /* Return the value of a number as a double */
 double jx_double(jx_t *json)
 {
+	long long i;
+	double	d;
+
 	if (!json || json->type != JX_NUMBER)
 		return -1.0;
 	if (json->text[0] == '\0' && json->text[1] == 'i')
 		return (double)JX_INT(json);
 	if (json->text[0] == '\0' && json->text[1] == 'd')
 		return JX_DOUBLE(json);
-	return atof(json->text);
+	if (numcache(json, &i, &d) == 'i')
+		return (double)i;
+	return d;
 }
 
 /* Return the value of a number as an int */
 int jx_int(jx_t *json)
 {
+	long long i;
+	double	d;
+
 	if (!json || json->type != JX_NUMBER)
 		return -1;
 	if (json->text[0] == '\0' && json->text[1] == 'i')
 		return JX_INT(json);
 	if (json->text[0] == '\0' && json->text[1] == 'd')
 		return (int)JX_DOUBLE(json);
-	return atoi(json->text);
+	if (numcache(json, &i, &d) == 'i')
+		return (int)i;
+	return (int)d;
+}
+
+/* If json is a number with an integer value, then store the value in *refint
+ * and return 1.  Otherwise return 0.  Binary doubles are never treated as
+ * integers here, even if they happen to have an integral value, so results
+ * of floating-point arithmetic stay floating-point.
+ */
+int jx_is_integer(jx_t *json, long long *refint)
+{
+	double	d;
+
+	if (!json || json->type != JX_NUMBER)
+		return 0;
+	if (json->text[0] == '\0') {
+		if (json->text[1] != 'i')
+			return 0;
+		*refint = JX_INT(json);
+		return 1;
+	}
+	return numcache(json, refint, &d) == 'i';
 }
@@ -8,16 +8,22 @@
 #include <glob.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <jx.h>
 
 /* This is the name of the file that stores a cache's settings */
 #define SETTINGS ".config"
 
+/* This is the name of the file that stores a cache's manifest */
+#define MANIFEST ".index"
+
 /* These are the default settings, used for new caches. */
 static char *config = "{"
 	"\"seconds\":600,"
 	"\"bytes\":0,"
 	"\"touch\":false,"
+	"\"binary\":false,"
+	"\"memory\":100,"
 	"\"dir\":\"\","
 "}";
 
@@ -87,6 +93,665 @@ static int omitDir(jx_t *json)
 }
 
 
+/*****************************************************************************/
+/* Each cache directory has a manifest listing the size and time of every
+ * item, so we can tell how big the cache is without scanning the directory.
+ * It's loaded from the ".index" file when the cache is first used, kept up to
+ * date as items are added and removed, and saved when jx exits.  Other
+ * processes may change the cache too, so saving merges in their changes, and
+ * the directory is rescanned if the manifest is more than RESCAN seconds old.
+ *
+ * The items also serve as an in-memory cache of parsed values.  Each value
+ * remembers the file's modification time, size, and inode so we can detect
+ * when another process has changed it.  Items with values are kept in a
+ * most-recently-used list so the total number of values can be limited.
+ */
+
+/* Rescan a directory if its manifest is older than this many seconds */
+#define RESCAN	600
+
+/* This stores what we know about one item in a cache */
+typedef struct cacheitem_s {
+	struct cacheitem_s *other;	/* next item in the same hash bucket */
+	struct cacheitem_s *newer;	/* more recently used item with a value */
+	struct cacheitem_s *older;	/* less recently used item with a value */
+	struct cachedir_s *dir;		/* cache containing this item */
+	off_t	size;			/* size of the file */
+	time_t	time;			/* modification or access time */
+	jx_t	*value;			/* parsed value, or NULL */
+	struct timespec mtim;		/* modification time when value was read */
+	ino_t	ino;			/* inode when value was read */
+	char	index[1];		/* name of the item (extends past end) */
+} cacheitem_t;
+
+/* This stores what we know about one cache directory */
+typedef struct cachedir_s {
+	struct cachedir_s *other;	/* next cache */
+	char	*path;			/* directory name, ending with "/" */
+	cacheitem_t **bucket;		/* hash table of items */
+	int	nbuckets;		/* size of the hash table */
+	int	nitems;			/* number of items */
+	off_t	totbytes;		/* total size of all items */
+	time_t	scanned;		/* when the directory was last scanned */
+	int	dirty;			/* does the manifest need to be saved? */
+} cachedir_t;
+
+static cachedir_t *dirs;
+static cacheitem_t *newest, *oldest;
+static int nvalues;
+
+/* Compute a hash value for an index name */
+static unsigned hashIndex(const char *index)
+{
+	unsigned hash = 2166136261u;
+	while (*index)
+		hash = (hash ^ (unsigned char)*index++) * 16777619u;
+	return hash;
+}
+
+/* Remove an item's value from the in-memory cache */
+static void forgetValue(cacheitem_t *item)
+{
+	if (!item->value)
+		return;
+	if (item->newer)
+		item->newer->older = item->older;
+	else
+		newest = item->older;
+	if (item->older)
+		item->older->newer = item->newer;
+	else
+		oldest = item->newer;
+	item->newer = item->older = NULL;
+	jx_free(item->value);
+	item->value = NULL;
+	nvalues--;
+}
+
+/* Store an item's value in the in-memory cache, and mark it as the most
+ * recently used.  "st" is the file's status after it was read or written.
+ * "max" is the maximum number of values to keep.
+ */
+static void rememberValue(cacheitem_t *item, jx_t *value, struct stat *st, int max)
+{
+	forgetValue(item);
+	if (max <= 0 || jx_is_deferred_array(value)) {
+		jx_free(value);
+		return;
+	}
+	item->value = value;
+	item->mtim = st->st_mtim;
+	item->ino = st->st_ino;
+	item->older = newest;
+	if (newest)
+		newest->newer = item;
+	else
+		oldest = item;
+	newest = item;
+	nvalues++;
+
+	/* Discard the least recently used values if there are too many */
+	while (nvalues > max)
+		forgetValue(oldest);
+}
+
+/* Move an item's value to the front of the most-recently-used list */
+static void touchValue(cacheitem_t *item)
+{
+	if (!item->value || item == newest)
+		return;
+	if (item->older)
+		item->older->newer = item->newer;
+	else
+		oldest = item->newer;
+	item->newer->older = item->older;
+	item->newer = NULL;
+	item->older = newest;
+	newest->newer = item;
+	newest = item;
+}
+
+/* Look up an item in a cache.  If it isn't found and "add" is set, then add
+ * it with size 0.
+ */
+static cacheitem_t *findItem(cachedir_t *dir, const char *index, int add)
+{
+	cacheitem_t *item, **newbucket;
+	unsigned hash;
+	int	i;
+
+	/* Look for it */
+	hash = hashIndex(index);
+	for (item = dir->bucket[hash % dir->nbuckets]; item; item = item->other)
+		if (!strcmp(item->index, index))
+			return item;
+	if (!add)
+		return NULL;
+
+	/* If the hash table is getting crowded, then enlarge it */
+	if (dir->nitems >= dir->nbuckets * 2) {
+		newbucket = (cacheitem_t **)calloc(dir->nbuckets * 4, sizeof(cacheitem_t *));
+		for (i = 0; i < dir->nbuckets; i++) {
+			while ((item = dir->bucket[i]) != NULL) {
+				dir->bucket[i] = item->other;
+				item->other = newbucket[hashIndex(item->index) % (dir->nbuckets * 4)];
+				newbucket[hashIndex(item->index) % (dir->nbuckets * 4)] = item;
+			}
+		}
+		free(dir->bucket);
+		dir->bucket = newbucket;
+		dir->nbuckets *= 4;
+	}
+
+	/* Add it */
+	item = (cacheitem_t *)calloc(1, sizeof(cacheitem_t) + strlen(index));
+	strcpy(item->index, index);
+	item->dir = dir;
+	item->other = dir->bucket[hash % dir->nbuckets];
+	dir->bucket[hash % dir->nbuckets] = item;
+	dir->nitems++;
+	dir->dirty = 1;
+	return item;
+}
+
+/* Update an item's size and time */
+static void updateItem(cacheitem_t *item, off_t size, time_t time)
+{
+	item->dir->totbytes += size - item->size;
+	item->size = size;
+	item->time = time;
+	item->dir->dirty = 1;
+}
+
+/* Remove an item from a cache's manifest.  This doesn't delete the file. */
+static void removeItem(cacheitem_t *item)
+{
+	cachedir_t *dir = item->dir;
+	cacheitem_t **ref;
+
+	for (ref = &dir->bucket[hashIndex(item->index) % dir->nbuckets]; *ref != item; ref = &(*ref)->other) {
+	}
+	*ref = item->other;
+	forgetValue(item);
+	dir->totbytes -= item->size;
+	dir->nitems--;
+	dir->dirty = 1;
+	free(item);
+}
+
+/* Remove all items from a cache's manifest */
+static void clearItems(cachedir_t *dir)
+{
+	int	i;
+
+	for (i = 0; i < dir->nbuckets; i++)
+		while (dir->bucket[i])
+			removeItem(dir->bucket[i]);
+}
+
+/* Rebuild a cache's manifest by scanning its directory */
+static void scanDir(cachedir_t *dir, int touch)
+{
+	char	*pattern;
+	glob_t	globbuf;
+	struct stat st;
+	int	i;
+
+	clearItems(dir);
+	pattern = (char *)malloc(strlen(dir->path) + 2);
+	strcpy(pattern, dir->path);
+	strcat(pattern, "*");
+	if (0 == glob(pattern, GLOB_NOSORT|GLOB_NOESCAPE, NULL, &globbuf)) {
+		for (i = 0; i < globbuf.gl_pathc; i++) {
+			if (stat(globbuf.gl_pathv[i], &st) < 0)
+				continue;
+			updateItem(findItem(dir, globbuf.gl_pathv[i] + strlen(dir->path), 1), st.st_size, touch ? st.st_atime : st.st_mtime);
+		}
+		globfree(&globbuf);
+	}
+	free(pattern);
+	time(&dir->scanned);
+	dir->dirty = 1;
+}
+
+/* Load a cache's manifest from its ".index" file.  Returns 1 if successful,
+ * or 0 if the file is missing, unreadable, or too old.
+ */
+static int loadManifest(cachedir_t *dir)
+{
+	FILE	*fp;
+	char	*filename, line[300];
+	long long size, when;
+	int	n;
+	time_t	now;
+
+	filename = (char *)malloc(strlen(dir->path) + sizeof MANIFEST);
+	strcpy(filename, dir->path);
+	strcat(filename, MANIFEST);
+	fp = fopen(filename, "r");
+	free(filename);
+	if (!fp)
+		return 0;
+
+	/* The first line has the time of the last scan */
+	time(&now);
+	if (!fgets(line, sizeof line, fp)
+	 || sscanf(line, "jxcache %lld", &when) != 1
+	 || when > now
+	 || when + RESCAN < now) {
+		fclose(fp);
+		return 0;
+	}
+	dir->scanned = (time_t)when;
+
+	/* Each other line has a size, time, and index name */
+	while (fgets(line, sizeof line, fp)) {
+		if (sscanf(line, "%lld %lld%n", &size, &when, &n) != 2 || line[n++] != ' ' || !strchr(line + n, '\n'))
+			continue;
+		*strchr(line + n, '\n') = '\0';
+		updateItem(findItem(dir, line + n, 1), (off_t)size, (time_t)when);
+	}
+	fclose(fp);
+	dir->dirty = 0;
+	return 1;
+}
+
+/* Merge another process' changes from a cache's ".index" file into our
+ * manifest.  Items that we don't know about are added if their files still
+ * exist, and items that we do know about take the newer size and time.
+ */
+static void mergeManifest(cachedir_t *dir, const char *filename)
+{
+	FILE	*fp;
+	char	line[300], *itemname;
+	long long size, when;
+	int	n;
+	struct stat st;
+	cacheitem_t *item;
+
+	fp = fopen(filename, "r");
+	if (!fp)
+		return;
+	if (!fgets(line, sizeof line, fp)
+	 || sscanf(line, "jxcache %lld", &when) != 1) {
+		fclose(fp);
+		return;
+	}
+	while (fgets(line, sizeof line, fp)) {
+		if (sscanf(line, "%lld %lld%n", &size, &when, &n) != 2 || line[n++] != ' ' || !strchr(line + n, '\n'))
+			continue;
+		*strchr(line + n, '\n') = '\0';
+		item = findItem(dir, line + n, 0);
+		if (!item) {
+			itemname = (char *)malloc(strlen(dir->path) + strlen(line + n) + 1);
+			strcpy(itemname, dir->path);
+			strcat(itemname, line + n);
+			if (stat(itemname, &st) == 0)
+				updateItem(findItem(dir, line + n, 1), (off_t)size, (time_t)when);
+			free(itemname);
+		} else if ((time_t)when > item->time)
+			updateItem(item, (off_t)size, (time_t)when);
+	}
+	fclose(fp);
+}
+
+/* Save a cache's manifest, if it has changed.  Other processes may be using
+ * the same cache, so this locks the cache directory and merges in any changes
+ * they've saved since we loaded the manifest.
+ */
+static void saveManifest(cachedir_t *dir)
+{
+	FILE	*fp;
+	char	*filename;
+	cacheitem_t *item;
+	int	i, lockfd;
+
+	if (!dir->dirty)
+		return;
+	filename = (char *)malloc(strlen(dir->path) + sizeof MANIFEST);
+	strcpy(filename, dir->path);
+	strcat(filename, MANIFEST);
+	lockfd = open(dir->path, O_RDONLY);
+	if (lockfd >= 0)
+		flock(lockfd, LOCK_EX);
+	mergeManifest(dir, filename);
+	fp = jx_file_update_atomic(filename);
+	free(filename);
+	if (fp) {
+		fprintf(fp, "jxcache %lld\n", (long long)dir->scanned);
+		for (i = 0; i < dir->nbuckets; i++)
+			for (item = dir->bucket[i]; item; item = item->other)
+				if (!strchr(item->index, '\n'))
+					fprintf(fp, "%lld %lld %s\n", (long long)item->size, (long long)item->time, item->index);
+		jx_file_update_close(fp);
+		dir->dirty = 0;
+	}
+	if (lockfd >= 0)
+		close(lockfd); /* also releases the lock */
+}
+
+/* Save all changed manifests, and free the in-memory values.  This is
+ * called when jx exits.
+ */
+static void cacheExit(void)
+{
+	cachedir_t *dir;
+
+	for (dir = dirs; dir; dir = dir->other)
+		saveManifest(dir);
+	while (newest)
+		forgetValue(newest);
+}
+
+/* Return the manifest for a cache, loading or building it if necessary */
+static cachedir_t *cacheDir(char *cache, int touch)
+{
+	cachedir_t *dir;
+	char	*path;
+	time_t	now;
+
+	/* Look for it among the caches we've already used */
+	path = cacheFile(cache, "");
+	for (dir = dirs; dir && strcmp(dir->path, path); dir = dir->other) {
+	}
+
+	/* If not found, then create it */
+	if (!dir) {
+		dir = (cachedir_t *)calloc(1, sizeof(cachedir_t));
+		dir->path = path;
+		dir->nbuckets = 64;
+		dir->bucket = (cacheitem_t **)calloc(dir->nbuckets, sizeof(cacheitem_t *));
+		dir->other = dirs;
+		dirs = dir;
+		if (!loadManifest(dir))
+			scanDir(dir, touch);
+		return dir;
+	}
+	free(path);
+
+	/* If it's been a while, rescan it in case other processes changed it */
+	time(&now);
+	if (dir->scanned + RESCAN < now)
+		scanDir(dir, touch);
+	return dir;
+}
+
+/*****************************************************************************/
+/* Cache items can optionally be stored in a compact binary format, which is
+ * much faster to read than JSON.  Binary files start with the MAGIC string,
+ * which can never appear at the start of a JSON file.  After that, each value
+ * starts with a type byte:
+ *
+ *   'n'		null
+ *   't' / 'f'		true / false
+ *   'i' int64		binary integer
+ *   'd' double		binary floating point number
+ *   'N' len text	number stored as text
+ *   's' len text	string
+ *   '[' values ']'	array
+ *   '{' members '}'	object, each member is 'k' len text value
+ *
+ * Lengths are stored as unsigned variable-length integers, 7 bits per byte
+ * with the low bits first.  Binary numbers use the host's byte order, since
+ * caches aren't meant to be portable.
+ */
+
+#define MAGIC		"\0JXB"
+#define MAGICLEN	4
+
+/* Write a length */
+static void binLength(FILE *fp, size_t len)
+{
+	while (len >= 0x80) {
+		putc((int)(len & 0x7f) | 0x80, fp);
+		len >>= 7;
+	}
+	putc((int)len, fp);
+}
+
+/* Write a value */
+static void binWrite(FILE *fp, jx_t *json)
+{
+	jx_t	*scan;
+	long long i;
+	double	d;
+	size_t	len;
+
+	switch (json->type) {
+	case JX_NULL:
+		putc('n', fp);
+		break;
+
+	case JX_BOOLEAN:
+		putc(json->text[0] == 't' ? 't' : 'f', fp);
+		break;
+
+	case JX_NUMBER:
+		if (json->text[0]) {
+			len = strlen(json->text);
+			putc('N', fp);
+			binLength(fp, len);
+			fwrite(json->text, 1, len, fp);
+		} else if (json->text[1] == 'i') {
+			i = JX_INT(json);
+			putc('i', fp);
+			fwrite(&i, sizeof i, 1, fp);
+		} else {
+			d = JX_DOUBLE(json);
+			putc('d', fp);
+			fwrite(&d, sizeof d, 1, fp);
+		}
+		break;
+
+	case JX_STRING:
+		len = strlen(json->text);
+		putc('s', fp);
+		binLength(fp, len);
+		fwrite(json->text, 1, len, fp);
+		break;
+
+	case JX_ARRAY:
+		putc('[', fp);
+		for (scan = jx_first(json); scan; scan = jx_next(scan))
+			binWrite(fp, scan);
+		putc(']', fp);
+		break;
+
+	case JX_OBJECT:
+		putc('{', fp);
+		for (scan = json->first; scan; scan = scan->next) {
+			len = strlen(scan->text);
+			putc('k', fp);
+			binLength(fp, len);
+			fwrite(scan->text, 1, len, fp);
+			binWrite(fp, scan->first);
+		}
+		putc('}', fp);
+		break;
+
+	default:
+		/* Shouldn't happen, but store it as null */
+		putc('n', fp);
+	}
+}
+
+/* Read a length.  Returns 0 if the data is truncated. */
+static int binReadLength(const char **refp, const char *end, size_t *reflen)
+{
+	size_t	len = 0;
+	int	shift = 0;
+
+	while (*refp < end && shift < 64) {
+		len |= (size_t)(**refp & 0x7f) << shift;
+		if (!(*(*refp)++ & 0x80)) {
+			if ((size_t)(end - *refp) < len)
+				return 0;
+			*reflen = len;
+			return 1;
+		}
+		shift += 7;
+	}
+	return 0;
+}
+
+/* Read a value.  Returns NULL if the data is malformed. */
+static jx_t *binRead(const char **refp, const char *end)
+{
+	jx_t	*json, *sub, *tail;
+	long long i;
+	double	d;
+	size_t	len;
+	char	*name, type;
+
+	if (*refp >= end)
+		return NULL;
+	type = *(*refp)++;
+	switch (type) {
+	case 'n':
+		return jx_null();
+
+	case 't':
+		return jx_boolean(1);
+
+	case 'f':
+		return jx_boolean(0);
+
+	case 'i':
+		if ((size_t)(end - *refp) < sizeof i)
+			return NULL;
+		memcpy(&i, *refp, sizeof i);
+		*refp += sizeof i;
+		return jx_from_int(i);
+
+	case 'd':
+		if ((size_t)(end - *refp) < sizeof d)
+			return NULL;
+		memcpy(&d, *refp, sizeof d);
+		*refp += sizeof d;
+		return jx_from_double(d);
+
+	case 'N':
+	case 's':
+		if (!binReadLength(refp, end, &len))
+			return NULL;
+		if (type == 'N')
+			json = jx_number(*refp, len);
+		else
+			json = jx_string(*refp, len);
+		*refp += len;
+		return json;
+
+	case '[':
+		json = jx_array();
+		while (*refp < end && **refp != ']') {
+			sub = binRead(refp, end);
+			if (!sub) {
+				jx_free(json);
+				return NULL;
+			}
+			jx_append(json, sub);
+		}
+		if (*refp >= end) {
+			jx_free(json);
+			return NULL;
+		}
+		(*refp)++;
+		return json;
+
+	case '{':
+		/* Link the members directly, since they're already unique */
+		json = jx_object();
+		tail = NULL;
+		while (*refp < end && **refp == 'k') {
+			(*refp)++;
+			if (!binReadLength(refp, end, &len))
+				break;
+			name = (char *)malloc(len + 1);
+			memcpy(name, *refp, len);
+			name[len] = '\0';
+			*refp += len;
+			sub = binRead(refp, end);
+			if (!sub) {
+				free(name);
+				break;
+			}
+			sub = jx_key(name, sub);
+			free(name);
+			if (tail)
+				tail->next = sub; /* object */
+			else
+				json->first = sub;
+			tail = sub;
+		}
+		if (*refp >= end || **refp != '}') {
+			jx_free(json);
+			return NULL;
+		}
+		(*refp)++;
+		return json;
+
+	default:
+		return NULL;
+	}
+}
+
+/* Read a cache item, in either binary or JSON format.  Returns NULL if it
+ * can't be read.
+ */
+static jx_t *readItem(const char *filename)
+{
+	FILE	*fp;
+	char	magic[MAGICLEN], *buf;
+	const char *p;
+	struct stat st;
+	jx_t	*data;
+
+	/* Check for the binary format's magic string */
+	fp = fopen(filename, "r");
+	if (!fp)
+		return NULL;
+	if (fread(magic, 1, MAGICLEN, fp) != MAGICLEN || memcmp(magic, MAGIC, MAGICLEN)) {
+		/* Not binary, so parse it as JSON */
+		fclose(fp);
+		return jx_parse_file(filename);
+	}
+
+	/* Read the rest of the file, and decode it */
+	data = NULL;
+	if (fstat(fileno(fp), &st) == 0 && st.st_size > MAGICLEN) {
+		buf = (char *)malloc(st.st_size - MAGICLEN);
+		if (fread(buf, 1, st.st_size - MAGICLEN, fp) == st.st_size - MAGICLEN) {
+			p = buf;
+			data = binRead(&p, buf + st.st_size - MAGICLEN);
+		}
+		free(buf);
+	}
+	fclose(fp);
+	return data;
+}
+
+/* Write a cache item, in either binary or JSON format */
+static void writeItem(const char *filename, jx_t *data, int binary)
+{
+	FILE	*fp;
+	char	*tmp;
+
+	fp = jx_file_update_atomic(filename);
+	if (!fp)
+		return;
+	if (binary) {
+		fwrite(MAGIC, 1, MAGICLEN, fp);
+		binWrite(fp, data);
+	} else {
+		tmp = jx_serialize(data, NULL);
+		fputs(tmp, fp);
+		free(tmp);
+	}
+	jx_file_update_close(fp);
+}
+
+/*****************************************************************************/
+
 /* Clean a cache.  Can also be used to store settings.  Returns the current
  * settings, which the calling function must free via jx_free() even if
  * passed settings.
@@ -101,11 +766,10 @@ static jx_t *cleanCache(char *cache, jx_t *newSettings)
 	time_t	now;
 	time_t	seconds;	/* derived from from "seconds" */
 	off_t	maxbytes;	/* from "bytes" */
-	off_t	totbytes;
 	int	touch;	/* from "touch" */
-	glob_t	globbuf;
-	struct stat st;
-	int	i;
+	cachedir_t *dir;
+	cacheitem_t *item, *next;
+	int	i, pass;
 
 	/* Load the settings */
 	filename = cacheFile(cache, SETTINGS);
@@ -140,12 +804,12 @@ static jx_t *cleanCache(char *cache, jx_t *newSettings)
 		}
 
 		/* Save these settings */
-		FILE *fp = jx_file_update(filename);
+		FILE *fp = jx_file_update_atomic(filename);
 		if (fp) {
 			char *tmp = jx_serialize(settings, NULL);
 			fputs(tmp, fp);
 			free(tmp);
-			fclose(fp);
+			jx_file_update_close(fp);
 		}
 	}
 	free(filename);
@@ -156,42 +820,33 @@ static jx_t *cleanCache(char *cache, jx_t *newSettings)
 	maxbytes = jx_int(jx_by_key(settings, "bytes"));
 	touch = jx_is_true(jx_by_key(settings, "touch"));
 
-	/* Scan the files in the cache */
-	filename = cacheFile(cache, "*");
-	if (0 == glob(filename, GLOB_NOSORT|GLOB_NOESCAPE, NULL, &globbuf)) {
-		/* For each match... */
-		totbytes = 0;
-		for (i = 0; i < globbuf.gl_pathc; i++) {
-			/* Get its statistics */
-			if (stat(globbuf.gl_pathv[i], &st) < 0)
-				continue;
-
-			/* If old, delete it.  Else count its size. */
-			if (seconds > 0 && (touch ? st.st_atime : st.st_mtime) < now - seconds)
-				unlink(globbuf.gl_pathv[i]);
-			else
-				totbytes += st.st_size;
-		}
-
-		/* If totbytes is bigger than the requested limit, then scale
-		 * down the seconds and try one more time.
-		 */
-		if (maxbytes > 0 && totbytes > maxbytes) {
-			seconds = seconds * ( (double)maxbytes / (double)totbytes );
+	/* Scan the items in the cache's manifest.  The first pass deletes
+	 * old items.  If the cache is still bigger than the requested limit,
+	 * then a second pass scales down the seconds and tries again.
+	 */
+	dir = cacheDir(cache, touch);
+	for (pass = 1; pass <= 2; pass++) {
+		if (pass == 2) {
+			if (maxbytes <= 0 || dir->totbytes <= maxbytes)
+				break;
+			seconds = seconds * ( (double)maxbytes / (double)dir->totbytes );
 			if (seconds < 5) /* even if 0! */
 				seconds = 5;
-			for (i = 0; i < globbuf.gl_pathc; i++) {
-				/* Get its statistics */
-				if (stat(globbuf.gl_pathv[i], &st) < 0)
-					continue;
-
-				/* If old, delete it. */
-				if ((touch ? st.st_atime : st.st_mtime) < now - seconds)
-					unlink(globbuf.gl_pathv[i]);
+		}
+		if (seconds <= 0)
+			continue;
+		for (i = 0; i < dir->nbuckets; i++) {
+			for (item = dir->bucket[i]; item; item = next) {
+				next = item->other;
+				if (item->time < now - seconds) {
+					filename = cacheFile(cache, item->index);
+					unlink(filename);
+					free(filename);
+					removeItem(item);
+				}
 			}
 		}
 	}
-	free(filename);
 
 	/* Return the settings */
 	return settings;
@@ -208,7 +863,10 @@ static jx_t *jfn_cache(jx_t *args, void *agdata)
 	time_t	now;
 	time_t	seconds;	/* derived from from "seconds" */
 	int	touch;
+	int	memory;
 	struct stat st;
+	cachedir_t *dir;
+	cacheitem_t *item;
 
 	/* Get the cache name */
 	if (args->first->type != JX_STRING)
@@ -244,42 +902,70 @@ static jx_t *jfn_cache(jx_t *args, void *agdata)
 	else
 		data = args->first->next->next;
 
-	/* Get the name of this cache item */
+	/* Get the name of this cache item, and its manifest entry */
 	filename = cacheFile(cache, index);
+	settings = jx_by_expr(jx_config, "plugin.cache", NULL);
+	time(&now);
+	seconds = jx_int(jx_by_key(settings, "seconds"));
+	touch = jx_is_true(jx_by_key(settings, "touch"));
+	memory = jx_int(jx_by_key(settings, "memory"));
+	dir = cacheDir(cache, touch);
 
 	/* Do we have new data? */
-	settings = jx_by_expr(jx_config, "plugin.cache", NULL);
 	if (data) {
 		/* Write the data to the cache */
-		if (jx_is_null(data))
+		if (jx_is_null(data)) {
 			unlink(filename);
-		else {
-			FILE *fp = jx_file_update(filename);
-			if (fp) {
-				char *tmp = jx_serialize(data, NULL);
-				fputs(tmp, fp);
-				free(tmp);
-				fclose(fp);
+			if ((item = findItem(dir, index, 0)) != NULL)
+				removeItem(item);
+		} else {
+			writeItem(filename, data, jx_is_true(jx_by_key(settings, "binary")));
+			if (stat(filename, &st) >= 0) {
+				item = findItem(dir, index, 1);
+				updateItem(item, st.st_size, now);
+				rememberValue(item, jx_copy(data), &st, memory);
 			}
 		}
 
-		/* If limiting the cache by size, then clean the cache */
-		if (jx_int(jx_by_key(settings, "bytes")) > 0)
+		/* If limiting the cache by size and it's too big, then clean
+		 * the cache.
+		 */
+		if (jx_int(jx_by_key(settings, "bytes")) > 0
+		 && dir->totbytes > jx_int(jx_by_key(settings, "bytes")))
 			jx_free(cleanCache(cache, NULL));
 
 		/* Make a copy of the data to return */
 		data = jx_copy(data);
 	} else {
 		/* If the file exists but is old, then clean the cache */
-		time(&now);
-		seconds = jx_int(jx_by_key(settings, "seconds"));
-		touch = jx_is_true(jx_by_key(settings, "touch"));
 		if (stat(filename, &st) >= 0
 		 && (touch ? st.st_atime : st.st_mtime) + seconds < now)
 			jx_free(cleanCache(cache, NULL));
 
-		/* Try to read the data from a file */
-		data = jx_parse_file(filename);
+		/* Use the in-memory copy if the file hasn't changed since it
+		 * was read.  Otherwise try to read the data from the file.
+		 */
+		item = findItem(dir, index, 0);
+		if (stat(filename, &st) < 0) {
+			if (item)
+				removeItem(item);
+			data = NULL;
+		} else {
+			if (!item)
+				item = findItem(dir, index, 1);
+			updateItem(item, st.st_size, touch ? now : st.st_mtime);
+			if (item->value
+			 && item->ino == st.st_ino
+			 && item->mtim.tv_sec == st.st_mtim.tv_sec
+			 && item->mtim.tv_nsec == st.st_mtim.tv_nsec) {
+				touchValue(item);
+				data = jx_copy(item->value);
+			} else {
+				data = readItem(filename);
+				if (data && !jx_is_null(data))
+					rememberValue(item, jx_copy(data), &st, memory);
+			}
+		}
 
 		/* If unreadable FOR ANY REASON, just return NULL */
 		if (!data)
@@ -320,6 +1006,9 @@ char *plugincache(void)
 	jx_config_set("plugin.cache", "dir", jd);
 	free(dir);
 
+	/* Save the manifests of any caches we change */
+	atexit(cacheExit);
+
 	/* Register the cache() function */
 	jx_calc_function_hook("cache", "cache:string, index?:string|object, data?:any", ":any", jfn_cache);
 
@@ -10,16 +10,36 @@ static char *csvsettings = "{"
 	"\"crlf\":false,"	/* Output \r\n as newlines, instead of \n */
 	"\"headless\":false,"	/* First row is data, not column headings */
 	"\"emptynull\":false,"	/* Parse empty/missing cells as null, not "" */
-	"\"pad\":false"		/* Pad short rows to full width of headings */
+	"\"pad\":false,"	/* Pad short rows to full width of headings */
+	"\"numbers\":true"	/* Parse numeric-looking cells as numbers */
 "}";
 
-/*****************************************************************************/
-/* CSV output                                                                */
-/*****************************************************************************/
-
+/* Options.  These are copied from jx_config whenever it changes. */
+static unsigned csvversion;
 static int backslash;
 static int crlf;
 static int headless;
+static int emptynull;
+static int pad;
+static int numbers;
+
+/* Refresh the options, if jx_config has changed */
+static void csvconfig(void)
+{
+	if (csvversion == jx_config_version)
+		return;
+	backslash = jx_is_true(jx_config_get("plugin.csv", "backslash"));
+	crlf = jx_is_true(jx_config_get("plugin.csv", "crlf"));
+	headless = jx_is_true(jx_config_get("plugin.csv", "headless"));
+	emptynull = jx_is_true(jx_config_get("plugin.csv", "emptynull"));
+	pad = jx_is_true(jx_config_get("plugin.csv", "pad"));
+	numbers = jx_is_true(jx_config_get("plugin.csv", "numbers"));
+	csvversion = jx_config_version;
+}
+
+/*****************************************************************************/
+/* CSV output                                                                */
+/*****************************************************************************/
 
 /* Output a single number, string, or symbol in CSV notation */
 static void csvsingle(jx_t *elem, jxformat_t *format)
@@ -35,7 +55,7 @@ static void csvsingle(jx_t *elem, jxformat_t *format)
 	case JX_NUMBER:
 		/* could be binary int or double, or it could be text */
 		if (elem->text[0] == '\0' && elem->text[1] == 'i')
-			fprintf(format->fp, "%d", JX_INT(elem));
+			fprintf(format->fp, "%lld", JX_INT(elem));
 		else if (elem->text[0] == '\0' && elem->text[1] == 'd')
 			fprintf(format->fp, "%.*g", format->digits, JX_DOUBLE(elem));
 		else
@@ -91,16 +111,10 @@ static void csvprint(jx_t *json, jxformat_t *format)
 	int	first;
 
 	/* Check options */
-	backslash = jx_is_true(jx_config_get("plugin.csv", "backslash"));
-	crlf = jx_is_true(jx_config_get("plugin.csv", "crlf"));
-	headless = jx_is_true(jx_config_get("plugin.csv", "headless"));
+	csvconfig();
 
 	/* Collect column names */
-	headers = jx_explain(NULL, json->first, 0);
-	if (!format->quick) {
-		for (row = json->first->next; row; row = row->next)
-			headers = jx_explain(headers, row, 0);
-	}
+	headers = jx_explain_table(json, 0, format->quick ? 1 : 0);
 
 	/* Output column names, unless headless */
 	if (!headless) {
@@ -148,8 +162,23 @@ static void csvprint(jx_t *json, jxformat_t *format)
 /*****************************************************************************/
 /* CSV Parser                                                                */
 
-static int emptynull;
-static int pad;
+/* This classifies characters for the cell scanning loops, so each byte
+ * costs a single table lookup instead of a series of comparisons.  It is
+ * initialized by plugincsv().
+ */
+#define CSV_ENDPLAIN	1	/* ends an unquoted cell: comma or control char */
+#define CSV_ENDQUOTED	2	/* special in a quoted cell: quote, backslash, NUL */
+static unsigned char csvclass[256];
+
+/* This is used to store the details of a deferred CSV table */
+typedef struct {
+	jxdef_t	basic;		/* normal stuff */
+	const char *buf;	/* start of the CSV text, with the heading row */
+	const char *start;	/* start of the next data row */
+	const char *end;	/* end of the CSV text */
+	jx_t	*columns;	/* column headings, only while scanning */
+	int	unique;		/* are the column headings unique? */
+} csvdef_t;
 
 /* Parse a single CSV cell and return it as JSON.  If refend isn't NULL, then
  * store the pointer to the comma or newline after the cell there.  If the
@@ -186,6 +215,8 @@ static jx_t *csvcell(const char *buf, size_t len, const char **refcursor)
 	if (*cursor == '"') {
 		/* Find the closing quote */
 		for (clen = 1; &cursor[clen] != &buf[len]; clen++) {
+			if (!(csvclass[cursor[clen] & 0xff] & CSV_ENDQUOTED))
+				continue;
 			if (cursor[clen] == '"' && cursor[clen + 1] != '"')
 				break;
 			else if (cursor[clen] == '"') /* && [clen + 1] == '"' */
@@ -240,7 +271,7 @@ static jx_t *csvcell(const char *buf, size_t len, const char **refcursor)
 	} else {
 		/* Count its length */
 		for (clen = 1; &cursor[clen] != &buf[len]; clen++) {
-			if (cursor[clen] == ',' || (cursor[clen] & 0xff) < ' ')
+			if (csvclass[cursor[clen] & 0xff] & CSV_ENDPLAIN)
 				break;
 		}
 
@@ -255,12 +286,22 @@ static jx_t *csvcell(const char *buf, size_t len, const char **refcursor)
 			j++;
 		for (; j < i && isdigit(cursor[j]); j++)
 			digits++;
-		if (cursor[j] == '.') {
+		if (j < i && cursor[j] == '.') {
 			j++;
 			for (; j < i && isdigit(cursor[j]); j++)
 				digits++;
 		}
-		if (digits && j == i) {
+		if (digits && j + 1 < i && (cursor[j] == 'e' || cursor[j] == 'E')) {
+			j++;
+			if (cursor[j] == '-' || cursor[j] == '+')
+				j++;
+			if (j < i && isdigit(cursor[j]))
+				while (j < i && isdigit(cursor[j]))
+					j++;
+			else
+				digits = 0;
+		}
+		if (numbers && digits && j == i) {
 			/* Yes, it's a number */
 			cell = jx_number(cursor, i);
 		} else {
@@ -291,23 +332,26 @@ static jx_t *csvcell(const char *buf, size_t len, const char **refcursor)
  *
  * The idea is that you'll call this first with NULL for columns to read the
  * column heading row as an array, and then pass that array as columns for the
- * remainder of the rows.
+ * remainder of the rows.  If "unique" is true then the column names are known
+ * to be unique, so members are linked directly onto the row instead of going
+ * through jx_append()'s check for duplicate names.
  */
-static jx_t *csvrow(const char *buf, size_t len, const char **refcursor, jx_t *columns)
+static jx_t *csvrow(const char *buf, size_t len, const char **refcursor, jx_t *columns, int unique)
 {
-	jx_t	*row, *col, *cell;
+	jx_t	*row, *col, *cell, *tail;
 
 	/* If end of data, then return NULL.  This can mean hitting the end of
 	 * buf, or encountering an empty line.
 	 */
 	while (*refcursor < &buf[len] && **refcursor == ' ')
 		(*refcursor)++;
-	while (*refcursor < &buf[len] && **refcursor == '\r' && (*refcursor)[1] == '\n')
+	while (*refcursor < &buf[len] && **refcursor == '\r' && (*refcursor + 1 == &buf[len] || (*refcursor)[1] == '\n'))
 		(*refcursor)++;
 	if (*refcursor == &buf[len] || !**refcursor || **refcursor == '\n')
 		return NULL;
 
 	/* Allocate the row */
+	tail = NULL;
 	if (columns) {
 		row = jx_object();
 		col = columns->first;
@@ -336,7 +380,15 @@ static jx_t *csvrow(const char *buf, size_t len, const char **refcursor, jx_t *c
 		}
 
 		/* Append it to the row */
-		if (columns) {
+		if (columns && unique) {
+			cell = jx_key(col->text, cell);
+			if (tail)
+				tail->next = cell; /* object */
+			else
+				row->first = cell;
+			tail = cell;
+			col = col->next;
+		} else if (columns) {
 			jx_append(row, jx_key(col->text, cell));
 			col = col->next;
 		} else
@@ -349,6 +401,9 @@ static jx_t *csvrow(const char *buf, size_t len, const char **refcursor, jx_t *c
 			(*refcursor)++;
 	}
 
+	if (tail)
+		JX_END_POINTER(row) = tail;
+
 	/* If this row is short, and we're supposed to pad short rows, do it */
 	while (pad && col) {
 		if (emptynull)
@@ -373,9 +428,17 @@ static int csvtest(const char *str, size_t len)
 	jx_t *columns, *data;
 	const char *cursor;
 
+	/* JSON arrays and objects often have commas on every line, but they
+	 * aren't CSV.
+	 */
+	for (cursor = str; cursor < &str[len] && isspace(*cursor); cursor++) {
+	}
+	if (cursor < &str[len] && (*cursor == '[' || *cursor == '{'))
+		return 0;
+
 	/* Read the column headings */
 	cursor = str;
-	columns = csvrow(str, len, &cursor, NULL);
+	columns = csvrow(str, len, &cursor, NULL, 0);
 
 	/* If malformed or no info, then it isn't CSV */
 	if (!columns || columns->type == JX_NULL || jx_length(columns) < 2) {
@@ -384,7 +447,7 @@ static int csvtest(const char *str, size_t len)
 	}
 
 	/* Read the first data row */
-	data = csvrow(str, len, &cursor, NULL);
+	data = csvrow(str, len, &cursor, NULL, 0);
 
 	/* If malformed, no info, or too many data cells, then it isn't CSV */
 	if (!data || data->type == JX_NULL || jx_length(columns) < jx_length(data)) {
@@ -399,6 +462,124 @@ static int csvtest(const char *str, size_t len)
 	return 1;
 }
 
+/* Return 1 if the column headings are all different, else 0 */
+static int csvunique(jx_t *columns)
+{
+	jx_t	*col, *scan;
+
+	for (col = columns->first; col; col = col->next) /* undeferred */
+		for (scan = col->next; scan; scan = scan->next) /* undeferred */
+			if (!strcmp(col->text, scan->text))
+				return 0;
+	return 1;
+}
+
+static jx_t *csvdef_first(jx_t *array);
+static jx_t *csvdef_next(jx_t *elem);
+static int csvdef_islast(const jx_t *elem);
+static void csvdef_free(jx_t *array_or_elem);
+
+static jxdeffns_t csvdeffns = {
+	sizeof(csvdef_t),	/* size */
+	"CSV",			/* desc */
+	csvdef_first,		/* first */
+	csvdef_next,		/* next */
+	csvdef_islast,		/* islast */
+	csvdef_free,		/* free */
+	NULL,			/* byindex */
+	NULL			/* bykey */
+};
+
+/* Parse the heading row and first data row of a deferred CSV table, and
+ * return the data row.  The column headings are stored in the element's
+ * JX_DEFER node for use by later rows, so the array itself only needs to
+ * store pointers into the CSV text.
+ */
+static jx_t *csvdef_first(jx_t *array)
+{
+	csvdef_t *def = (csvdef_t *)array->first;
+	csvdef_t *nextdef;
+	const char *cursor;
+	size_t	len = def->end - def->buf;
+	jx_t	*columns, *row;
+
+	/* Parse the heading row and the first data row */
+	cursor = def->buf;
+	columns = csvrow(def->buf, len, &cursor, NULL, 0);
+	row = csvrow(def->buf, len, &cursor, columns, def->unique);
+	if (!row) {
+		/* Should never happen -- we only defer if there's a row */
+		row = jx_error_null(0, "Unable to parse \"%s\" data", "csv");
+	}
+
+	/* Make its "->next" point to a new JX_DEFER node.  As with JSON
+	 * deferred arrays, the file reference is per array, not per element.
+	 */
+	row->next = jx_defer(&csvdeffns);
+	nextdef = (csvdef_t *)row->next;
+	nextdef->basic.fns = &csvdeffns;
+	nextdef->buf = def->buf;
+	nextdef->start = (row->type == JX_NULL) ? def->end : cursor;
+	nextdef->end = def->end;
+	nextdef->columns = columns;
+	nextdef->unique = def->unique;
+	return row;
+}
+
+/* Parse the next data row.  This frees the previous row but reuses its
+ * JX_DEFER node.  A malformed row is returned as an error null, and ends
+ * the scan.
+ */
+static jx_t *csvdef_next(jx_t *elem)
+{
+	csvdef_t *def = (csvdef_t *)elem->next;
+	const char *cursor = def->start;
+	jx_t	*row;
+
+	/* Parse the next row.  If none, return NULL and jx_next() will clean
+	 * up the JX_DEFER node.
+	 */
+	if (cursor >= def->end)
+		return NULL;
+	row = csvrow(def->buf, def->end - def->buf, &cursor, def->columns, def->unique);
+	if (!row)
+		return NULL;
+
+	/* Move the JX_DEFER node to the new row */
+	row->next = (jx_t *)def;
+	def->start = (row->type == JX_NULL) ? def->end : cursor;
+	elem->next = NULL;
+	jx_free(elem);
+	return row;
+}
+
+/* Test whether the current row is the last row.  This uses the same rules as
+ * csvrow() for detecting the end of the data.
+ */
+static int csvdef_islast(const jx_t *elem)
+{
+	csvdef_t *def = (csvdef_t *)elem->next;
+	const char *skip;
+
+	for (skip = def->start; skip < def->end && (*skip == ' ' || (*skip == '\r' && (skip + 1 == def->end || skip[1] == '\n'))); skip++) {
+	}
+	return skip >= def->end || !*skip || *skip == '\n';
+}
+
+/* Free the column headings when a scan ends.  The array itself has nothing
+ * extra to free.
+ */
+static void csvdef_free(jx_t *array_or_elem)
+{
+	csvdef_t *def;
+
+	if (!jx_is_deferred_element(array_or_elem))
+		return;
+	def = (csvdef_t *)array_or_elem->next;
+	jx_free(def->columns);
+	def->columns = NULL;
+}
+
 /* Parse "buf" and return its contents as a JSON table.  Store a pointer to
  * the end of the parsed text at "refend" unless "refend" is NULL.  If an error
  * is detected, store a pointer to the location of the error at "referr" (if
@@ -408,11 +589,12 @@ static jx_t *csvparse(const char *buf, size_t len, const char **refend, const ch
 {
 	jx_t *columns = NULL, *row, *table;
 	const char *cursor;
+	int	unique, defersize;
+	jxfile_t *jf;
+	csvdef_t *def;
 
 	/* Check options */
-	headless = jx_is_true(jx_config_get("plugin.csv", "headless"));
-	emptynull = jx_is_true(jx_config_get("plugin.csv", "emptynull"));
-	pad = jx_is_true(jx_config_get("plugin.csv", "pad"));
+	csvconfig();
 
 	/* If headless, then just parse each row as an array, and append the
 	 * row's array as an element to the document's array.  The result
@@ -422,7 +604,7 @@ static jx_t *csvparse(const char *buf, size_t len, const char **refend, const ch
 		table = jx_array();
 		cursor = buf;
 		while (cursor < &buf[len] && *cursor != '\n') {
-			row = csvrow(buf, len, &cursor, columns);
+			row = csvrow(buf, len, &cursor, columns, 0);
 			if (!row)
 				break;
 			jx_append(table, row);
@@ -432,7 +614,7 @@ static jx_t *csvparse(const char *buf, size_t len, const char **refend, const ch
 
 	/* Parse the heading row */
 	cursor = buf;
-	columns = csvrow(buf, len, &cursor, NULL);
+	columns = csvrow(buf, len, &cursor, NULL, 0);
 	if (!columns || columns->type == JX_NULL || jx_length(columns) < 2) {
 		/* Store the cursor position */
 		if (*refend)
@@ -449,10 +631,38 @@ static jx_t *csvparse(const char *buf, size_t len, const char **refend, const ch
 		return jx_error_null(0, "Unable to parse \"%s\" data", "csv");
 	}
 
+	unique = csvunique(columns);
+
+	/* If the text is big and comes from a file, then return a deferred
+	 * array so the rows are parsed as they're scanned, instead of all
+	 * being held in memory at once.  Don't bother if there are no data
+	 * rows though, since deferred arrays always have at least one element.
+	 */
+	defersize = jx_config_snapshot()->defersize;
+	if (defersize > 0
+	 && len >= (size_t)defersize
+	 && (jf = jx_file_containing(buf, NULL)) != NULL
+	 && (row = csvrow(buf, len, &cursor, columns, unique)) != NULL) {
+		jx_free(row);
+		jx_free(columns);
+		table = jx_array();
+		table->text[1] = 't';
+		table->first = jx_defer(&csvdeffns);
+		def = (csvdef_t *)table->first;
+		def->buf = buf;
+		def->start = def->end = &buf[len];
+		def->unique = unique;
+		def->basic.file = jf;
+		jf->refs++;
+		if (refend)
+			*refend = &buf[len];
+		return table;
+	}
+
 	/* Parse each data row, and collect as an array of objects */
 	table = jx_array();
 	while (cursor < &buf[len] && *cursor != '\n') {
-		row = csvrow(buf, len, &cursor, columns);
+		row = csvrow(buf, len, &cursor, columns, unique);
 		if (!row)
 			break;
 		if (row->type == JX_NULL && *row->text) {
@@ -477,6 +687,15 @@ static jx_t *csvparse(const char *buf, size_t len, const char **refend, const ch
 char *plugincsv()
 {
 	jx_t	*section, *settings;
+	int	i;
+
+	/* Classify characters for the cell scanning loops */
+	for (i = 0; i < ' '; i++)
+		csvclass[i] |= CSV_ENDPLAIN;
+	csvclass[','] |= CSV_ENDPLAIN;
+	csvclass['"'] |= CSV_ENDQUOTED;
+	csvclass['\\'] |= CSV_ENDQUOTED;
+	csvclass['\0'] |= CSV_ENDQUOTED;
 
 	/* Add options for CSV */
 	section = jx_by_key(jx_config, "plugin");
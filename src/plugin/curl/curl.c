@@ -14,7 +14,8 @@
 
 static char *settings = "{"
 	"\"buffer\":0,"
-	"\"cookiejar\":\"\""
+	"\"cookiejar\":\"\","
+	"\"parallel\":8,"
 	"\"warn\":{"
 		"\"badparse\":true"
 	"}"
@@ -35,7 +36,8 @@ typedef enum {
 	OPT_FOLLOWLOCATION,	/* Follow HTTP 3xx redirects */
 	OPT_RAW,		/* Don't try to parse the response content */
 	OPT_HEADERS,		/* Return response headers along with content */
-	OPT_DEBUGRCV		/* Enable extra debugging for received data */
+	OPT_DEBUGRCV,		/* Enable extra debugging for received data */
+	OPT_STREAM		/* Return a deferred array, parsed as it arrives */
 } opt_t;
 
 /* This data type is used as a read buffer */
@@ -88,12 +90,32 @@ static int receive_debug(CURL *handle, curl_infotype type, char *data, size_t si
 	return 0;
 }
  
+/* DNS lookups, open connections, and TLS sessions are shared by all requests
+ * via this handle, so a series of requests to the same server doesn't need
+ * to reconnect and renegotiate TLS every time.
+ */
+static CURLSH *share;
+
+/* Easy handles are reused too.  This is a stack of idle ones. */
+#define IDLE_MAX	8
+static CURL *idle[IDLE_MAX];
+static int nidle;
+
 /* This stores the name of a temporary cookie jar (file) */
 static char *tempcookiejar;
 
-/* When exiting, delete the temporary cookie jar (if any) */
+/* When exiting, free the shared handles and delete the temporary cookie jar
+ * (if any)
+ */
 static void curlcleanup(void)
 {
+	/* Free the idle handles and the shared cache */
+	while (nidle > 0)
+		curl_easy_cleanup(idle[--nidle]);
+	if (share)
+		curl_share_cleanup(share);
+	share = NULL;
+
 	/* Shut  down libcurl */
 	curl_global_cleanup();
 
@@ -101,6 +123,7 @@ static void curlcleanup(void)
 	if (tempcookiejar) {
 		unlink(tempcookiejar);
 		free(tempcookiejar);
+		tempcookiejar = NULL;
 	}
 }
 
@@ -169,7 +192,7 @@ static size_t urlencode(jx_t *data, char *buf, int component)
 		/* Convert to a string, and convert it recursively */
 		scan = jx_string("", 40);
 		if (data->text[1] == 'i')
-			snprintf(scan->text, 40, "%d", JX_INT(data));
+			snprintf(scan->text, 40, "%lld", JX_INT(data));
 		else
 			snprintf(scan->text, 40, "%g", JX_DOUBLE(data));
 		len = urlencode(scan, buf, 1);
@@ -232,6 +255,8 @@ typedef struct {
 	int	reqheaders;		/* Return the request headers too? */
 	int	reqcontent;		/* Return the request content too? */
 	int	headers;		/* Return the response headers too? */
+	int	cookies;		/* Cookies were enabled? */
+	int	stream;			/* Return a deferred array? */
 } curlflags_t;
 
 /* Parse a series of flags.  For each one, either set a curl option directly
@@ -331,7 +356,6 @@ static jx_t *doFlags(char *fn, CURL *curl, jx_t *data, curlflags_t *flags, recei
 				strcpy(tempcookiejar, str);
 				strcat(tempcookiejar, "cookiejar.XXXXXX");
 				close(mkstemp(tempcookiejar));
-				atexit(curlcleanup);
 				free(str);
 				str = tempcookiejar;
 			}
@@ -339,6 +363,7 @@ static jx_t *doFlags(char *fn, CURL *curl, jx_t *data, curlflags_t *flags, recei
 			/* Tell the cURL library to use it */
 			curl_easy_setopt(curl, CURLOPT_COOKIEFILE, str);
 			curl_easy_setopt(curl, CURLOPT_COOKIEJAR, str);
+			flags->cookies = 1;
 			break;
 		case OPT_FOLLOWLOCATION:
 			curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
@@ -352,6 +377,9 @@ static jx_t *doFlags(char *fn, CURL *curl, jx_t *data, curlflags_t *flags, recei
 		case OPT_DEBUGRCV:
 			rcv->debug = 1;
 			break;
+		case OPT_STREAM:
+			flags->stream = 1;
+			break;
 		default:
 			return jx_error_null(NULL, "Invalid option number %d passed to %s()", jx_int(more), fn);
 		}
@@ -360,37 +388,102 @@ static jx_t *doFlags(char *fn, CURL *curl, jx_t *data, curlflags_t *flags, recei
 	return NULL;
 }
 
-/* Construct a CURL request, send it, and receive the response.  "fn" is the
- * function name, for reporting purposes.  "request" is an HTTP verb -- usually
- * "GET" or "POST", but it could be "HEAD", "DELETE", or whatever.  "argsfirst"
- * is the first element of a JSON array of arguments.
+/* This stores everything about a single request, from the time it is set up
+ * until its response has been converted to a jx_t.
  */
-static jx_t *curlHelper(char *fn, char *request, jx_t *argsfirst)
+typedef struct {
+	CURL	*curl;		/* The easy handle doing the request */
+	char	*fn;		/* Function name, for error messages */
+	char	*url;		/* URL, possibly with query data appended */
+	char	*str;		/* Request content or query data, or NULL */
+	char	*mustfree;	/* Dynamically allocated string to free later */
+	char	*urlcopy;	/* Copy of the URL argument, or NULL */
+	curlflags_t flags;	/* Options affecting the request and response */
+	receiver_t rcv;		/* Response content */
+	receiver_t hdr;		/* Response headers */
+	receiver_t reqhdr;	/* Request headers */
+	CURLcode result;	/* Result code, after the request is done */
+} curlreq_t;
+
+/* Return an easy handle with default options, connected to the shared cache.
+ * Returns NULL if it can't allocate one.
+ */
+static CURL *curlhandle(void)
 {
 	CURL	*curl;
-	CURLcode result;
-	char	*url, *str, *mustfree;
-	jx_t	*data, *err;
-	curlflags_t flags = {NULL};
-	size_t	arglen;
-	receiver_t rcv = {0}, hdr = {0}, reqhdr = {0};
-	jx_t	*more, *scan, *response;
 
-	/* Allocate a CURL handle */
-	curl = curl_easy_init();
-	if (!curl)
-		return jx_error_null(NULL, "Failed to allocate a CURL handle in %s()", fn);
+	if (nidle > 0) {
+		curl = idle[--nidle];
+		curl_easy_reset(curl);
+	} else {
+		curl = curl_easy_init();
+		if (!curl)
+			return NULL;
+	}
+	if (share)
+		curl_easy_setopt(curl, CURLOPT_SHARE, share);
+	return curl;
+}
+
+/* Return an easy handle to the idle stack.  Handles that used cookies are
+ * cleaned up instead, because that's when libcurl writes the cookie jar.
+ */
+static void curlrelease(CURL *curl, int cookies)
+{
+	if (!cookies && nidle < IDLE_MAX)
+		idle[nidle++] = curl;
+	else
+		curl_easy_cleanup(curl);
+}
+
+/* Free everything allocated for a request, except the response */
+static void curlDiscard(curlreq_t *req)
+{
+	if (req->curl)
+		curlrelease(req->curl, req->flags.cookies);
+	curl_slist_free_all(req->flags.slist);
+	if (req->mustfree)
+		free(req->mustfree);
+	if (req->urlcopy)
+		free(req->urlcopy);
+	if (req->rcv.buf)
+		free(req->rcv.buf);
+	if (req->hdr.buf)
+		free(req->hdr.buf);
+	if (req->reqhdr.buf)
+		free(req->reqhdr.buf);
+	req->curl = NULL;
+	req->flags.slist = NULL;
+	req->mustfree = req->urlcopy = req->rcv.buf = req->hdr.buf = req->reqhdr.buf = NULL;
+}
+
+/* Construct a CURL request but don't send it yet.  "fn" is the function name,
+ * for reporting purposes.  "request" is an HTTP verb -- usually "GET" or
+ * "POST", but it could be "HEAD", "DELETE", or whatever.  "urlarg" is the URL
+ * argument and "more" is the optional data and flags that follow it.  Returns
+ * NULL on success, or an error on failure (after cleaning up).
+ */
+static jx_t *curlSetup(curlreq_t *req, char *fn, char *request, jx_t *urlarg, jx_t *more)
+{
+	jx_t	*data, *err, *scan;
+
+	memset(req, 0, sizeof *req);
+	req->fn = fn;
 
 	/* First argument must be URL */
-	if (!argsfirst || argsfirst->type != JX_STRING)
+	if (!urlarg || urlarg->type != JX_STRING)
 		return jx_error_null(NULL, "The %s() function requires a URL string", fn);
-	url = argsfirst->text;
+	req->url = urlarg->text;
+
+	/* Allocate a CURL handle */
+	req->curl = curlhandle();
+	if (!req->curl)
+		return jx_error_null(NULL, "Failed to allocate a CURL handle in %s()", fn);
 
 	/* If next arg isn't a number, then it must be data... except that if
 	 * it's null then there is no data.
 	 */
 	data = NULL;
-	more = argsfirst->next;
 	if (more && more->type == JX_NULL) {
 		more = more->next;
 		/* but leave data set to NULL */
@@ -403,21 +496,16 @@ static jx_t *curlHelper(char *fn, char *request, jx_t *argsfirst)
 	/* Scan the args for option numbers.  Some options are followed by
 	 * other data.
 	 */
-	flags.reqcontenttype = NULL;
-	flags.content = !strcmp(request, "POST");
-	flags.raw = flags.reqheaders = flags.reqcontent = flags.headers = 0;
-	flags.slist = NULL;
-	err = doFlags(fn, curl, data, &flags, &rcv, more);
+	req->flags.content = !strcmp(request, "POST");
+	err = doFlags(fn, req->curl, data, &req->flags, &req->rcv, more);
 	if (err) {
-		curl_easy_cleanup(curl);
-		curl_slist_free_all(flags.slist);
+		curlDiscard(req);
 		return err;
 	}
 
 	/* If we're supposed to send content but have no data, fail */
-	if (flags.content && !data) {
-		curl_easy_cleanup(curl);
-		curl_slist_free_all(flags.slist);
+	if (req->flags.content && !data) {
+		curlDiscard(req);
 		return jx_error_null(NULL, "The %s() function needs data to send", fn);
 	}
 
@@ -425,33 +513,31 @@ static jx_t *curlHelper(char *fn, char *request, jx_t *argsfirst)
 	 * convert the content to a string in an appropriate way.  This only
 	 * works for HTML form data or JSON.
 	 */
-	mustfree = str = NULL;
 	if (data) {
-		if (flags.reqcontenttype) {
+		if (req->flags.reqcontenttype) {
 			if (data->type == JX_STRING)
-				str = data->text;
-			else if (strstr(flags.reqcontenttype, "json") || strstr(flags.reqcontenttype, "JSON")) {
-				mustfree = str = jx_serialize(data, NULL);
-			} else if (strstr(flags.reqcontenttype, "form") || strstr(flags.reqcontenttype, "FORM")) {
+				req->str = data->text;
+			else if (strstr(req->flags.reqcontenttype, "json") || strstr(req->flags.reqcontenttype, "JSON")) {
+				req->mustfree = req->str = jx_serialize(data, NULL);
+			} else if (strstr(req->flags.reqcontenttype, "form") || strstr(req->flags.reqcontenttype, "FORM")) {
 				size_t arglen = urlencode(data, NULL, 1);
-				mustfree = str = (char *)malloc(arglen + 1);
-				urlencode(data, str, 1);
+				req->mustfree = req->str = (char *)malloc(arglen + 1);
+				urlencode(data, req->str, 1);
 			} else {
-				curl_easy_cleanup(curl);
-				curl_slist_free_all(flags.slist);
-				return jx_error_null(NULL, "The %s() function can't convert data to %s", fn, flags.reqcontenttype);
+				curlDiscard(req);
+				return jx_error_null(NULL, "The %s() function can't convert data to %s", fn, req->flags.reqcontenttype);
 			}
 		} else if (data->type == JX_STRING) {
 			switch (*data->text) {
 			case '{': /* } */
-			case '[': flags.reqcontenttype = "application/json";	break;
-			case '<': flags.reqcontenttype = "application/xml";	break;
-			default:  flags.reqcontenttype = "application/x-www-form-urlencoded";
+			case '[': req->flags.reqcontenttype = "application/json";	break;
+			case '<': req->flags.reqcontenttype = "application/xml";	break;
+			default:  req->flags.reqcontenttype = "application/x-www-form-urlencoded";
 			}
-			str = data->text;
+			req->str = data->text;
 		} else if (data->type == JX_ARRAY) {
-			flags.reqcontenttype = "application/json";
-			mustfree = str = jx_serialize(data, NULL);
+			req->flags.reqcontenttype = "application/json";
+			req->mustfree = req->str = jx_serialize(data, NULL);
 		} else if (data->type == JX_OBJECT) {
 			/* If all member values are strings or numbers, assume
 			 * HTML form otherwise assume JSON
@@ -462,84 +548,85 @@ static jx_t *curlHelper(char *fn, char *request, jx_t *argsfirst)
 			}
 			if (scan) {
 				/* complex values, can't be a form so assume JSON */
-				str = jx_serialize(data, NULL);
-				flags.reqcontenttype = "application/json";
+				req->mustfree = req->str = jx_serialize(data, NULL);
+				req->flags.reqcontenttype = "application/json";
 			} else {
 				/* simple values, it's probably form data */
 				size_t arglen = urlencode(data, NULL, 1);
-				str = (char *)malloc(arglen + 1);
-				urlencode(data, str, 1);
-				flags.reqcontenttype = "application/x-www-form-urlencoded";
+				req->mustfree = req->str = (char *)malloc(arglen + 1);
+				urlencode(data, req->str, 1);
+				req->flags.reqcontenttype = "application/x-www-form-urlencoded";
 			}
 		} else {
-			curl_easy_cleanup(curl);
-			curl_slist_free_all(flags.slist);
+			curlDiscard(req);
 			return jx_error_null(NULL, "The %s() function can't guess the content type", fn);
 		}
 	}
 
 	/* If we have data but aren't sending content, append it to the URL. */
-	if (str && !flags.content) {
-		char	*newurl = (char *)malloc(strlen(url) + 2 + strlen(str));
-		strcpy(newurl, url);
-		if (strchr(url, '?'))
+	if (req->str && !req->flags.content) {
+		char	*newurl = (char *)malloc(strlen(req->url) + 2 + strlen(req->str));
+		strcpy(newurl, req->url);
+		if (strchr(req->url, '?'))
 			strcat(newurl, "&");
 		else
 			strcat(newurl, "?");
-		strcat(newurl, str);
-		if (mustfree)
-			free(mustfree);
-		mustfree = url = newurl;
-		str = NULL;
+		strcat(newurl, req->str);
+		if (req->mustfree)
+			free(req->mustfree);
+		req->mustfree = req->url = newurl;
+		req->str = NULL;
 	}
 
 	/* If sending data as content, and we have a content-type, then add
 	 * it to the list of header lines.
 	 */
-	if (str && flags.content && flags.reqcontenttype)
+	if (req->str && req->flags.content && req->flags.reqcontenttype)
 	{
-		char	*tmp = (char *)malloc(15 + strlen(flags.reqcontenttype));
+		char	*tmp = (char *)malloc(15 + strlen(req->flags.reqcontenttype));
 		strcpy(tmp, "Content-Type: ");
-		strcat(tmp, flags.reqcontenttype);
-		flags.slist = curl_slist_append(flags.slist, tmp);
+		strcat(tmp, req->flags.reqcontenttype);
+		req->flags.slist = curl_slist_append(req->flags.slist, tmp);
 		free(tmp);
 	}
 
 	/* Almost there!  Set the last few options */
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, request);
-	curl_easy_setopt(curl, CURLOPT_URL, url);
-	if (flags.slist)
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, flags.slist);
-	if (str && flags.content)
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, str);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlreceive);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&rcv);
-	if (flags.reqheaders) {
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, receive_debug);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, (void *)&reqhdr);
-	}
-	if (flags.headers) {
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curlreceive);
-		curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&hdr);
-	}
-
-	/* Do it */
-	result = curl_easy_perform(curl);
-	if (rcv.debug)
-		fprintf(stderr, "curl_easy_perform() returned %d, rcv.used=%d\n", result, (int)rcv.used);
-	curl_easy_cleanup(curl);
-	curl_slist_free_all(flags.slist);
+	curl_easy_setopt(req->curl, CURLOPT_CUSTOMREQUEST, request);
+	curl_easy_setopt(req->curl, CURLOPT_URL, req->url);
+	if (req->flags.slist)
+		curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, req->flags.slist);
+	if (req->str && req->flags.content)
+		curl_easy_setopt(req->curl, CURLOPT_POSTFIELDS, req->str);
+	curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, curlreceive);
+	curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, (void *)&req->rcv);
+	if (req->flags.reqheaders) {
+		curl_easy_setopt(req->curl, CURLOPT_DEBUGFUNCTION, receive_debug);
+		curl_easy_setopt(req->curl, CURLOPT_DEBUGDATA, (void *)&req->reqhdr);
+	}
+	if (req->flags.headers) {
+		curl_easy_setopt(req->curl, CURLOPT_VERBOSE, 1L);
+		curl_easy_setopt(req->curl, CURLOPT_HEADERFUNCTION, curlreceive);
+		curl_easy_setopt(req->curl, CURLOPT_HEADERDATA, (void *)&req->hdr);
+	}
+	curl_easy_setopt(req->curl, CURLOPT_PRIVATE, (void *)req);
+	return NULL;
+}
+
+/* Convert the response of a completed request to a jx_t, and free the
+ * request's resources.  req->result should already be set.
+ */
+static jx_t *curlFinish(curlreq_t *req)
+{
+	jx_t	*response;
+
+	if (req->rcv.debug)
+		fprintf(stderr, "%s returned %d, rcv.used=%d\n", req->url, req->result, (int)req->rcv.used);
 
 	/* Detect errors */
-	if (result != CURLE_OK) {
-		if (rcv.buf)
-			free(rcv.buf);
-		if (hdr.buf)
-			free(hdr.buf);
-		if (mustfree)
-			free(mustfree);
-		return jx_error_null(NULL, "CURL error: %s", curl_easy_strerror(result));
+	if (req->result != CURLE_OK) {
+		response = jx_error_null(NULL, "CURL error: %s", curl_easy_strerror(req->result));
+		curlDiscard(req);
+		return response;
 	}
 
 	/* Maybe try to parse it; otherwise convert the returned data to a
@@ -547,54 +634,473 @@ static jx_t *curlHelper(char *fn, char *request, jx_t *argsfirst)
 	 * embarrassing.
 	 */
 	response = NULL;
-	if (!flags.raw && rcv.buf) {
+	if (!req->flags.raw && req->rcv.buf) {
 		/* Try to parse it.  If that returns an error, then maybe
 		 * display the error message as a warning and fall back on
 		 * returning the response as a string.
 		 */
-		response = jx_parse_string(rcv.buf);
+		response = jx_parse_string(req->rcv.buf);
 		if (jx_is_error(response)) {
 			if (jx_is_true(jx_by_expr(jx_config, "plugin.curl.warn.badparse", NULL)))
-				fprintf(stderr, "%s: %s\n", url, response->text);
+				fprintf(stderr, "%s: %s\n", req->url, response->text);
 			jx_free(response);
 			response = NULL;
 		}
 	}
 	if (!response)
-		response = jx_string(rcv.buf ? rcv.buf : "", rcv.used);
+		response = jx_string(req->rcv.buf ? req->rcv.buf : "", req->rcv.used);
 
 	/* If supposed to return headers, then build an object containing
 	 * both the headers and the response.
 	 */
-	if (flags.reqheaders || flags.reqcontent || flags.headers) {
+	if (req->flags.reqheaders || req->flags.reqcontent || req->flags.headers) {
 		jx_t *obj = jx_object();
-		if (flags.reqheaders)
-			jx_append(obj, jx_key("reqHeaders", headerArray(reqhdr.buf)));
-		if (flags.reqcontent) {
+		if (req->flags.reqheaders)
+			jx_append(obj, jx_key("reqHeaders", headerArray(req->reqhdr.buf)));
+		if (req->flags.reqcontent) {
 			jx_t *value;
-			if (str && flags.content)
-				value = jx_string(str, -1);
+			if (req->str && req->flags.content)
+				value = jx_string(req->str, -1);
 			else
 				value = jx_null();
 			jx_append(obj, jx_key("reqContent", value));
 		}
-		if (flags.headers)
-			jx_append(obj, jx_key("headers", headerArray(hdr.buf)));
+		if (req->flags.headers)
+			jx_append(obj, jx_key("headers", headerArray(req->hdr.buf)));
 		jx_append(obj, jx_key("response", response));
-		jx_append(obj, jx_key("responseLength", jx_from_int(rcv.used)));
+		jx_append(obj, jx_key("responseLength", jx_from_int(req->rcv.used)));
 		response = obj;
 	}
 
 	/* Return the response */
-	if (mustfree)
-		free(mustfree);
-	if (rcv.buf)
-		free(rcv.buf);
-	if (hdr.buf)
-		free(hdr.buf);
+	curlDiscard(req);
 	return response;
 }
 
+/* The following implement CURL.stream, which returns the response as a
+ * deferred array whose elements are parsed as they arrive.  The response may
+ * be either a JSON array or NDJSON (one value per line); anything else is
+ * treated as NDJSON, so a single JSON value becomes a one-element array.
+ *
+ * The first complete scan also copies the raw response into an unlinked
+ * temporary file, so later scans can parse that instead of resending the
+ * request.  A scan that starts before that, or after a scan was abandoned
+ * partway through, sends the request again.
+ */
+
+/* This is shared by all copies of a streamed array */
+typedef struct {
+	int	refs;		/* Number of arrays using this */
+	char	*fn;		/* Function name, for error messages */
+	char	*request;	/* HTTP verb */
+	jx_t	*args;		/* Array of URL, data, and flag arguments */
+	int	spool;		/* File descriptor of the full response, or -1 */
+} curlsource_t;
+
+/* This is the state of a single scan.  The response text is split into
+ * elements by jx_stream_element(), the same scanner that's used for pipes.
+ */
+typedef struct {
+	jxstreamscan_t basic;	/* The response text, and the scanner's state */
+	curlreq_t req;		/* Request, if reading from the network */
+	CURLM	*multi;		/* Multi handle driving the transfer */
+	FILE	*spool;		/* Copy of the response, being written */
+	int	spoolfd;	/* Copy of the response, being read, or -1 */
+	off_t	offset;		/* Read offset within spoolfd */
+	int	done;		/* No more data to read? */
+	jx_t	*pending;	/* The next element, or NULL at the end */
+} curlscan_t;
+
+/* This is the JX_DEFER node.  The array's node has a source, and the scan
+ * node of an element also has a scan.
+ */
+typedef struct {
+	jxdef_t	basic;		/* Normal stuff */
+	curlsource_t *source;	/* Request to send, and maybe its response */
+	curlscan_t *scan;	/* State of a scan, only for elements */
+} curldef_t;
+
+static jx_t *curldef_first(jx_t *array);
+static jx_t *curldef_next(jx_t *elem);
+static int curldef_islast(const jx_t *elem);
+static void curldef_free(jx_t *array_or_elem);
+static void curldef_copy(jx_t *array);
+
+static jxdeffns_t curldeffns = {
+	sizeof(curldef_t),	/* size */
+	"cURL stream",		/* desc */
+	curldef_first,		/* first */
+	curldef_next,		/* next */
+	curldef_islast,		/* islast */
+	curldef_free,		/* free */
+	NULL,			/* byindex */
+	NULL,			/* bykey */
+	curldef_copy		/* copy */
+};
+
+/* This is a callback function for CURL to send us streamed data.  It's like
+ * curlreceive() except that it adds the data to the scanner's buffer, and
+ * also copies it to the spool file.
+ */
+static size_t curlstreamreceive(char *data, size_t size, size_t nmemb, void *clientp)
+{
+	curlscan_t *cs = (curlscan_t *)clientp;
+	size_t	len = size * nmemb;
+
+	if (cs->spool && fwrite(data, size, nmemb, cs->spool) != nmemb) {
+		fclose(cs->spool);
+		cs->spool = NULL;
+	}
+	memcpy(jx_stream_room(&cs->basic, len), data, len);
+	cs->basic.used += len;
+	cs->basic.buf[cs->basic.used] = '\0';
+	return len;
+}
+
+/* Add more data to the scan's buffer, either from the spool file or from the
+ * network.  Returns 1 if data was added, or 0 at the end.
+ */
+static int curlstreamfill(jxstreamscan_t *scan)
+{
+	curlscan_t *cs = (curlscan_t *)scan;
+	size_t	before;
+	char	*room;
+	ssize_t	got;
+	CURLMsg	*msg;
+	int	running, left;
+
+	if (cs->done)
+		return 0;
+
+	/* Discard text that has already been parsed.  Doing it now means
+	 * curlstreamreceive() won't move text while the transfer runs.
+	 */
+	room = jx_stream_room(scan, 16384);
+	before = scan->used;
+
+	/* Reading from the spool file? */
+	if (cs->spoolfd >= 0) {
+		got = pread(cs->spoolfd, room, 16384, cs->offset);
+		if (got <= 0) {
+			cs->done = 1;
+			return 0;
+		}
+		cs->offset += got;
+		scan->used += got;
+		scan->buf[scan->used] = '\0';
+		return 1;
+	}
+
+	/* Run the transfer until more data arrives, or it finishes */
+	while (scan->used == before && !cs->done) {
+		curl_multi_perform(cs->multi, &running);
+		while ((msg = curl_multi_info_read(cs->multi, &left)) != NULL) {
+			if (msg->msg == CURLMSG_DONE) {
+				cs->req.result = msg->data.result;
+				cs->done = 1;
+			}
+		}
+		if (running == 0)
+			cs->done = 1;
+		else if (scan->used == before)
+			curl_multi_poll(cs->multi, NULL, 0, 1000, NULL);
+	}
+	return scan->used > before;
+}
+
+/* Return the next element of a scan, reading more data as needed.  Returns
+ * NULL at the end.
+ */
+static jx_t *curlstreamelement(curlscan_t *cs)
+{
+	jx_t	*elem;
+
+	elem = jx_stream_element(&cs->basic);
+	if (elem)
+		return elem;
+
+	/* Finish the transfer, so the spool file is complete */
+	while (cs->spoolfd < 0) {
+		cs->basic.start = cs->basic.scanned = cs->basic.used;
+		if (!curlstreamfill(&cs->basic))
+			break;
+	}
+
+	/* Report transfer errors as an error null at the end */
+	if (cs->spoolfd < 0 && cs->req.result != CURLE_OK) {
+		elem = jx_error_null(NULL, "CURL error: %s", curl_easy_strerror(cs->req.result));
+		cs->req.result = CURLE_OK;
+		return elem;
+	}
+	return NULL;
+}
+
+/* Free a scan.  If it read the whole response from the network, then keep the
+ * spool file so later scans can use it.
+ */
+static void curlscanfree(curlscan_t *cs, curlsource_t *source)
+{
+	if (cs->multi) {
+		curl_multi_remove_handle(cs->multi, cs->req.curl);
+		curl_multi_cleanup(cs->multi);
+	}
+	if (cs->spool) {
+		if (cs->done && cs->req.result == CURLE_OK && source->spool < 0 && fflush(cs->spool) == 0)
+			source->spool = dup(fileno(cs->spool));
+		fclose(cs->spool);
+	}
+	curlDiscard(&cs->req);
+	free(cs->basic.buf);
+	jx_free(cs->pending);
+	free(cs);
+}
+
+/* Start a scan, and return the first element */
+static jx_t *curldef_first(jx_t *array)
+{
+	curldef_t *def = (curldef_t *)array->first;
+	curlsource_t *source = def->source;
+	curlscan_t *cs;
+	curldef_t *scandef;
+	jx_t	*elem, *err;
+
+	/* Start reading, either from the spool or the network */
+	cs = (curlscan_t *)calloc(1, sizeof(curlscan_t));
+	cs->basic.fill = curlstreamfill;
+	cs->spoolfd = source->spool;
+	if (cs->spoolfd < 0) {
+		err = curlSetup(&cs->req, source->fn, source->request, source->args->first, source->args->first->next);
+		if (err) {
+			free(cs);
+			return err;
+		}
+		curl_easy_setopt(cs->req.curl, CURLOPT_WRITEFUNCTION, curlstreamreceive);
+		curl_easy_setopt(cs->req.curl, CURLOPT_WRITEDATA, (void *)cs);
+		cs->spool = tmpfile();
+		cs->multi = curl_multi_init();
+		curl_multi_add_handle(cs->multi, cs->req.curl);
+	}
+
+	/* Get the first element, and the one after that */
+	elem = curlstreamelement(cs);
+	if (!elem) {
+		curlscanfree(cs, source);
+		return NULL;
+	}
+	cs->pending = curlstreamelement(cs);
+
+	/* Make its "->next" point to a new JX_DEFER node */
+	elem->next = jx_defer(&curldeffns);
+	scandef = (curldef_t *)elem->next;
+	scandef->source = source;
+	scandef->scan = cs;
+	return elem;
+}
+
+/* Move to the next element.  This frees the previous one, but reuses its
+ * JX_DEFER node.
+ */
+static jx_t *curldef_next(jx_t *elem)
+{
+	curldef_t *def = (curldef_t *)elem->next;
+	curlscan_t *cs = def->scan;
+	jx_t	*next;
+
+	/* If no more elements, return NULL and jx_next() will clean up */
+	if (!cs->pending)
+		return NULL;
+
+	/* Move the JX_DEFER node to the new element, and read ahead */
+	next = cs->pending;
+	next->next = (jx_t *)def;
+	elem->next = NULL;
+	jx_free(elem);
+	cs->pending = curlstreamelement(cs);
+	return next;
+}
+
+/* Test whether the current element is the last one */
+static int curldef_islast(const jx_t *elem)
+{
+	return ((curldef_t *)elem->next)->scan->pending == NULL;
+}
+
+/* Free a scan when it ends, or the source when the array is freed */
+static void curldef_free(jx_t *array_or_elem)
+{
+	curldef_t *def;
+	curlsource_t *source;
+	if (jx_is_deferred_element(array_or_elem)) {
+		def = (curldef_t *)array_or_elem->next;
+		if (def->scan)
+			curlscanfree(def->scan, def->source);
+		def->scan = NULL;
+		return;
+	}
+
+	def = (curldef_t *)array_or_elem->first;
+	source = def->source;
+	if (!source || --source->refs > 0)
+		return;
+	jx_free(source->args);
+	free(source->request);
+	if (source->spool >= 0)
+		close(source->spool);
+	free(source);
+	def->source = NULL;
+}
+
+/* When a streamed array is copied, the copy shares its source */
+static void curldef_copy(jx_t *array)
+{
+	((curldef_t *)array->first)->source->refs++;
+}
+
+/* Return a deferred array for a streamed request.  The request has already
+ * been set up once, to check the arguments, but it isn't sent until the
+ * array is scanned.
+ */
+static jx_t *curlStream(curlreq_t *req, char *request, jx_t *argsfirst)
+{
+	curlsource_t *source;
+	curldef_t *def;
+	jx_t	*array, *scan;
+
+	/* Some flags would return an object instead of an array */
+	if (req->flags.raw || req->flags.headers || req->flags.reqheaders || req->flags.reqcontent) {
+		curlDiscard(req);
+		return jx_error_null(NULL, "In %s(), CURL.stream can't be combined with CURL.raw, CURL.headers, CURL.reqHeaders, or CURL.reqContent", req->fn);
+	}
+
+	/* Save the arguments, so the request can be sent when scanned */
+	source = (curlsource_t *)calloc(1, sizeof(curlsource_t));
+	source->refs = 1;
+	source->fn = req->fn;
+	source->request = strdup(request);
+	source->args = jx_array();
+	for (scan = argsfirst; scan; scan = scan->next)
+		jx_append(source->args, jx_copy(scan));
+	source->spool = -1;
+	curlDiscard(req);
+
+	/* Build the deferred array */
+	array = jx_array();
+	array->first = jx_defer(&curldeffns);
+	def = (curldef_t *)array->first;
+	def->source = source;
+	return array;
+}
+
+/* Construct a CURL request, send it, and receive the response.  "fn" is the
+ * function name, for reporting purposes.  "request" is an HTTP verb -- usually
+ * "GET" or "POST", but it could be "HEAD", "DELETE", or whatever.  "argsfirst"
+ * is the first element of a JSON array of arguments.
+ */
+static jx_t *curlHelper(char *fn, char *request, jx_t *argsfirst)
+{
+	curlreq_t req;
+	jx_t	*err;
+
+	err = curlSetup(&req, fn, request, argsfirst, argsfirst ? argsfirst->next : NULL);
+	if (err)
+		return err;
+	if (req.flags.stream)
+		return curlStream(&req, request, argsfirst);
+	req.result = curl_easy_perform(req.curl);
+	return curlFinish(&req);
+}
+
+/* Send a "GET" request for each URL in an array, several at a time, and
+ * return an array of the responses in the same order as the URLs.  The
+ * number of simultaneous requests is limited by the "parallel" setting.
+ */
+static jx_t *curlHelperAll(char *fn, jx_t *urls, jx_t *more)
+{
+	curlreq_t *reqs;
+	CURLM	*multi;
+	CURLMsg	*msg;
+	curlreq_t *req;
+	jx_t	*scan, *err, *result;
+	int	n, size, i, next, active, running, left, parallel;
+
+	/* Set up all of the requests first, so bad flags are detected before
+	 * anything is sent.  The URLs array may be deferred, so its elements
+	 * might not outlive the scan; copy any URL that's still borrowed.
+	 * The array's length isn't trusted for sizing reqs, since a deferred
+	 * array's scan is the only reliable count.
+	 */
+	reqs = NULL;
+	size = 0;
+	for (n = 0, scan = jx_first(urls); scan; n++, scan = jx_next(scan)) {
+		if (n >= size) {
+			size = size ? size * 2 : 16;
+			reqs = (curlreq_t *)realloc(reqs, size * sizeof(curlreq_t));
+		}
+		err = curlSetup(&reqs[n], fn, "GET", scan, more);
+		if (err) {
+			jx_break(scan);
+			while (--n >= 0)
+				curlDiscard(&reqs[n]);
+			free(reqs);
+			return err;
+		}
+		if (reqs[n].url == scan->text)
+			reqs[n].url = reqs[n].urlcopy = strdup(scan->text);
+	}
+	if (n == 0) {
+		free(reqs);
+		return jx_array();
+	}
+	if (reqs[0].flags.stream) {
+		for (i = 0; i < n; i++)
+			curlDiscard(&reqs[i]);
+		free(reqs);
+		return jx_error_null(NULL, "The %s() function doesn't support CURL.stream", fn);
+	}
+
+	/* How many at a time? */
+	parallel = jx_int(jx_config_get("plugin.curl", "parallel"));
+	if (parallel < 1)
+		parallel = 1;
+
+	/* Start the first batch */
+	multi = curl_multi_init();
+	for (next = 0; next < n && next < parallel; next++)
+		curl_multi_add_handle(multi, reqs[next].curl);
+	active = next;
+
+	/* Keep going until all requests are done.  Each time one finishes,
+	 * start another.  "active" counts the handles that have been added
+	 * but haven't finished yet; curl_multi_perform()'s "running" count
+	 * doesn't include handles that were added since it last ran.
+	 */
+	while (active > 0) {
+		curl_multi_perform(multi, &running);
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&req);
+			req->result = msg->data.result;
+			curl_multi_remove_handle(multi, msg->easy_handle);
+			active--;
+			if (next < n) {
+				curl_multi_add_handle(multi, reqs[next++].curl);
+				active++;
+			}
+		}
+		if (active > 0 && running > 0)
+			curl_multi_poll(multi, NULL, 0, 1000, NULL);
+	}
+	curl_multi_cleanup(multi);
+
+	/* Collect the responses in order */
+	result = jx_array();
+	for (i = 0; i < n; i++)
+		jx_append(result, curlFinish(&reqs[i]));
+	free(reqs);
+	return result;
+}
+
 /* curlGet(url:string, data?:string|object, flags?:number|string|array,...):any
  * Read a URL using HTTP "GET"
  */
@@ -603,6 +1109,16 @@ static jx_t *jfn_curlGet(jx_t *args, void *agdata)
 	return curlHelper("curlGet", "GET", args->first);
 }
 
+/* curlGetAll(urls:string[], data?:string|object, flags?:number|string|array,...):any[]
+ * Read several URLs using HTTP "GET", concurrently
+ */
+static jx_t *jfn_curlGetAll(jx_t *args, void *agdata)
+{
+	if (args->first->type != JX_ARRAY)
+		return jx_error_null(NULL, "The %s() function requires an array of URL strings", "curlGetAll");
+	return curlHelperAll("curlGetAll", args->first, args->first->next);
+}
+
 /* curlPost(url:string, data:any|null, flags?:number|string|array,...):any
  * Send data via an HTTP "POST" request, and return the response string.
  */
@@ -920,6 +1436,7 @@ char *plugincurl()
 	jx_append(curl, jx_key("raw", jx_from_int(OPT_RAW)));
 	jx_append(curl, jx_key("headers", jx_from_int(OPT_HEADERS)));
 	jx_append(curl, jx_key("debugrcv", jx_from_int(OPT_DEBUGRCV)));
+	jx_append(curl, jx_key("stream", jx_from_int(OPT_STREAM)));
 	jx_append(jx_system, jx_key("CURL", curl));
 
 	/* Initialize CURL */
@@ -927,9 +1444,19 @@ char *plugincurl()
 		fprintf(stderr, "The cURL library failed to initialize\n");
 		exit(1);
 	}
+	atexit(curlcleanup);
+
+	/* Share DNS, connections, and TLS sessions between requests */
+	share = curl_share_init();
+	if (share) {
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	}
 
 	/* Register the functions */
 	jx_calc_function_hook("curlGet", "url:string, data?:string|object, ...", "string | any", jfn_curlGet);
+	jx_calc_function_hook("curlGetAll", "urls:string[], data?:string|object, ...", "array", jfn_curlGetAll);
 	jx_calc_function_hook("curlPost", "url:string, data:any, ...", "string | any", jfn_curlPost);
 	jx_calc_function_hook("curlOther", "verb:string, url:string, data?:any, ...", "string | any", jfn_curlOther);
 	jx_calc_function_hook("encodeURI",  "data:object|string|number|boolean", "string", jfn_encodeURI);
@@ -1,13 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <errno.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
 #include <glob.h>
+#include <limits.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <jx.h>
 
 /* These are the default settings.  They are added to jx_config by the
@@ -31,6 +36,8 @@ static char *config = "{"
 	"\"line\":false,"
 	"\"detail\":9,"
 	"\"flush\":true,"
+	"\"async\":false,"
+	"\"interval\":200,"
 "}";
 
 
@@ -43,32 +50,83 @@ static jxcmdname_t *jcn_log;
  */
 static char *defaultname;
 
-/* Get a boolean config */
-static int getbool(char *key)
-{
-	return jx_is_true(jx_config_get("plugin.log", key));
-}
-
-/* Generate the name of a log file.  This incorporates directory name and
- * file extension from config, and optionally a version suffix.  The returned
- * name in a buffer that gets reused, so you may need to make a local copy.
+/* Frequently-used options.  These are copied from jx_config whenever it
+ * changes, so each log command doesn't need to look them up.  The
+ * asynchronous writer thread also uses these, so they're only changed
+ * while that thread is stopped.
  */
-static char *mkfilename(const char *logname, int ver)
+static unsigned logversion;
+typedef enum {ROLL_NEVER, ROLL_DAILY, ROLL_SIZE} roll_t;
+static struct {
+	int	detail;
+	int	date, time, pid, file, line, utc, flush;
+	int	async, interval;
+	roll_t	roll;
+	off_t	bytes;
+	int	keep;
+	char	*dir, *ext;
+} opt;
+
+static void logstop(void);
+
+/* Refresh the options, if jx_config has changed */
+static void logconfig(void)
 {
-	jx_t	*dir, *ext;
-	char	*dirstr, *extstr, verstr[20];
-	size_t	len;
-	static size_t	alloclen;
-	static char	*buf = NULL;
+	jx_t	*val;
 
+	if (logversion == jx_config_version)
+		return;
 
-	/* Get the directory, defaulting to "." */
-	dir = jx_config_get("plugin.log", "dir");
-	dirstr = dir ? dir->text : ".";
+	/* If the writer thread is running, let it finish with the old options
+	 * before we change them.
+	 */
+	logstop();
+
+	opt.detail = jx_int(jx_config_get("plugin.log", "detail"));
+	opt.date = jx_is_true(jx_config_get("plugin.log", "date"));
+	opt.time = jx_is_true(jx_config_get("plugin.log", "time"));
+	opt.pid = jx_is_true(jx_config_get("plugin.log", "pid"));
+	opt.file = jx_is_true(jx_config_get("plugin.log", "file"));
+	opt.line = jx_is_true(jx_config_get("plugin.log", "line"));
+	opt.utc = jx_is_true(jx_config_get("plugin.log", "utc"));
+	opt.flush = jx_is_true(jx_config_get("plugin.log", "flush"));
+	opt.async = jx_is_true(jx_config_get("plugin.log", "async"));
+	val = jx_config_get("plugin.log", "interval");
+	opt.interval = (val && val->type == JX_NUMBER) ? jx_int(val) : 200;
+	if (opt.interval < 1)
+		opt.interval = 1;
+
+	/* Rollover options */
+	val = jx_config_get("plugin.log", "rollover");
+	opt.roll = ROLL_NEVER;
+	if (val && val->type == JX_STRING && !strcmp(val->text, "daily"))
+		opt.roll = ROLL_DAILY;
+	else if (val && val->type == JX_STRING && !strcmp(val->text, "size"))
+		opt.roll = ROLL_SIZE;
+	val = jx_config_get("plugin.log", "bytes");
+	opt.bytes = (val && val->type == JX_NUMBER) ? jx_int(val) : 100000;
+	val = jx_config_get("plugin.log", "keep");
+	opt.keep = (val && val->type == JX_NUMBER) ? jx_int(val) : 0;
+
+	/* File name options.  The directory defaults to ".". */
+	free(opt.dir);
+	free(opt.ext);
+	val = jx_config_get("plugin.log", "dir");
+	opt.dir = strdup(val && val->type == JX_STRING && *val->text ? val->text : ".");
+	val = jx_config_get("plugin.log", "ext");
+	opt.ext = strdup(val && val->type == JX_STRING ? val->text : ".log");
+
+	logversion = jx_config_version;
+}
 
-	/* Get the extension */
-	ext = jx_config_get("plugin.log", "ext");
-	extstr = ext ? ext->text : "log";
+/* Generate the name of a log file in buf, which must be PATH_MAX bytes.
+ * This incorporates directory name and file extension from config, and
+ * optionally a version suffix.  Callers supply their own buffers because the
+ * async writer thread builds names at the same time as log commands do.
+ */
+static char *mkfilename(char *buf, const char *logname, int ver)
+{
+	char	verstr[20];
 
 	/* Convert the version number to a string */
 	if (ver > 0)
@@ -78,29 +136,8 @@ static char *mkfilename(const char *logname, int ver)
 	else
 		*verstr = '\0';
 
-	/* Compute the size needed for this name */
-	len = strlen(dirstr) + 1 + strlen(logname);
-	if (*extstr)
-		len += strlen(extstr);
-	if (*verstr)
-		len += strlen(verstr);
-	len++; /* for the terminating '\0' */
-
-	/* If necessary, reallocate the buffer */
-	if (!buf || alloclen < len) {
-		alloclen = len;
-		buf = (char *)realloc(buf, alloclen);
-	}
-
 	/* Combine all of the pieces together */
-	sprintf(buf, "%s/%s", dirstr, logname);
-	if (*extstr) {
-		strcat(buf, extstr);
-	}
-	if (*verstr)
-		strcat(buf, verstr);
-
-	/* Return it */
+	snprintf(buf, PATH_MAX, "%s/%s%s%s", opt.dir, logname, opt.ext, verstr);
 	return buf;
 }
 
@@ -113,7 +150,7 @@ static void datedelta(char buf[12], int days)
 
 	/* get the current time */
 	time(&now);
-	utc = getbool("utc");
+	utc = opt.utc;
 	if (utc)
 		gmtime_r(&now, &tm);
 	else
@@ -139,10 +176,7 @@ static void datedelta(char buf[12], int days)
 /* Return the number of days/logs to keep */
 static int keep()
 {
-	jx_t *val = jx_config_get("plugin.log", "keep");
-	if (val && val->type == JX_NUMBER)
-		return jx_int(val);
-	return 0;
+	return opt.keep;
 }
 
 
@@ -153,7 +187,7 @@ static void rolldaily(const char *logname)
 	time_t	now;
 	struct tm tm;
 	int	utc;
-	char	*logfile, *oldlog;
+	char	logfile[PATH_MAX], *oldlog;
 	int	fd;
 	char	today[12], logdate[12];
 	glob_t	globbuf;
@@ -163,7 +197,7 @@ static void rolldaily(const char *logname)
 	/* Lock the file, so that if anybody else is already rolling it,
 	 * we'll wait until they're done.
 	 */
-	logfile = mkfilename(logname, 0);
+	mkfilename(logfile, logname, 0);
 	fd = open(logfile, O_RDWR);
 	if (fd < 0)
 		return; /* No log to rollover */
@@ -184,8 +218,10 @@ static void rolldaily(const char *logname)
 	logdate[10] = '\0';
 
 	/* If they're the same or the log is newer, then don't rollover */
-	if (strcmp(today, logdate) <= 0)
+	if (strcmp(today, logdate) <= 0) {
+		close(fd);
 		return;
+	}
 
 	/* WE WILL ROLLOVER! Generate the name of the newest version to delete */
 	len = strlen(logfile);
@@ -195,7 +231,7 @@ static void rolldaily(const char *logname)
 	datedelta(oldlog + len + 1, keep());
 
 	/* Scan for old versions */
-	logfile = mkfilename(logname, -1);
+	mkfilename(logfile, logname, -1);
 	if (0 == glob(logfile, GLOB_NOSORT|GLOB_NOESCAPE, NULL, &globbuf)) {
 		/* For each match... */
 		for (i = 0; i < globbuf.gl_pathc; i++) {
@@ -219,24 +255,26 @@ static void rolldaily(const char *logname)
 	 * keep>0 then we'll always keep the outgoing log even if its date
 	 * is too old.
 	 */
-	logfile = mkfilename(logname, 0);
+	mkfilename(logfile, logname, 0);
 	if (keep() > 0) {
 		strcpy(oldlog + len + 1, logdate);
 		rename(logfile, oldlog);
 	} else {
 		unlink(logfile);
 	}
+	free(oldlog);
+
+	/* Done!  Close the file and free the lock */
+	close(fd);
 }
 
 
 /* Do file rollover by size */
 static void rollsize(const char *logname)
 {
-	char *filename = mkfilename(logname, 0);
-	char *incrname;
+	char	filename[PATH_MAX], incrname[PATH_MAX];
 	size_t	len;
 	struct stat st;
-	jx_t	*val;
 	off_t	bytes;
 	int	keeplogs, ver, highver;
 	int	fd;
@@ -246,16 +284,13 @@ static void rollsize(const char *logname)
 	/* Lock the file, so that if anybody else is already rolling it,
 	 * we'll wait until they're done.
 	 */
-	fd = open(filename, O_RDWR);
+	fd = open(mkfilename(filename, logname, 0), O_RDWR);
 	if (fd < 0)
 		return;
 	lockf(fd, F_LOCK, (off_t)0);
 
 	/* Get the size limit */
-	bytes = 100000;
-	val = jx_config_get("plugin.log", "bytes");
-	if (val && val->type == JX_NUMBER)
-		bytes = jx_int(val);
+	bytes = opt.bytes;
 
 	/* Check the size of the log file */
 	if (fstat(fd, &st) < 0 || st.st_size < bytes) {
@@ -268,11 +303,11 @@ static void rollsize(const char *logname)
 	keeplogs = keep();
 
 	/* Delete any old versions */
-	filename = mkfilename(logname, -1);
+	mkfilename(filename, logname, -1);
 	highver = 0;
 	if (0 == glob(filename, GLOB_NOSORT|GLOB_NOESCAPE, NULL, &globbuf)) {
 		/* For each match... */
-		filename = mkfilename(logname, 0);
+		mkfilename(filename, logname, 0);
 		len = strlen(filename);
 		for (i = 0; i < globbuf.gl_pathc; i++) {
 			/* Skip if doesn't start with logname.  This could
@@ -296,26 +331,51 @@ static void rollsize(const char *logname)
 	globfree(&globbuf);
 
 	/* Rename all old logs to increment their version number */
-	incrname = strdup(mkfilename(logname, highver + 1));
+	mkfilename(incrname, logname, highver + 1);
 	for (i = highver; i >= 0; i--) {
-		filename = mkfilename(logname, i);
+		mkfilename(filename, logname, i);
 		rename(filename, incrname);
-		strcpy(incrname, filename); /* yes, it will fit */
+		strcpy(incrname, filename);
 	}
-	free(incrname);
 
 	/* Done!  Close the file and free the lock */
 	close(fd);
 }
 
 
+/* Write the first line of a new log file into buf.  This describes the
+ * rollover method, and starts with the date which rolldaily() depends on.
+ */
+static void logheader(char buf[60])
+{
+	char	today[12];
+
+	datedelta(today, 0);
+	if (opt.roll == ROLL_DAILY)
+		sprintf(buf, "%s daily %d\n", today, keep());
+	else if (opt.roll == ROLL_SIZE)
+		sprintf(buf, "%s size(%dK) %d\n", today, (int)(opt.bytes / 1024), keep());
+	else
+		sprintf(buf, "%s never\n", today);
+}
+
+/* Do the rollover thing, using whichever method is configured */
+static void rollover(const char *logname)
+{
+	if (opt.roll == ROLL_DAILY)
+		rolldaily(logname);
+	else if (opt.roll == ROLL_SIZE)
+		rollsize(logname);
+}
+
+/* This is the log file used by synchronous log commands */
+static FILE *prevfp;
+static char *prevname;
+
 /* Perform log rollover, if necessary, and then open a new log */
 static FILE *switchfile(const char *logname)
 {
-	static FILE *prevfp;
-	static char *prevname;
-	char	*filename;
-	jx_t	*roll;
+	char	filename[PATH_MAX];
 
 	/* If same name, just keep using it */
 	if (prevfp && prevname && !strcmp(prevname, logname))
@@ -326,16 +386,14 @@ static FILE *switchfile(const char *logname)
 		fclose(prevfp);
 	if (prevname)
 		free(prevname);
+	prevfp = NULL;
+	prevname = NULL;
 
 	/* Do the rollover thing. */
-	roll = jx_config_get("plugin.log", "rollover");
-	if (roll && roll->type == JX_STRING && !strcmp(roll->text, "daily"))
-		rolldaily(logname);
-	else if (roll && roll->type == JX_STRING && !strcmp(roll->text, "size"))
-		rollsize(logname);
+	rollover(logname);
 
 	/* Open the file.  If we can't open it, use stderr. */
-	prevfp = fopen(mkfilename(logname, 0), "a");
+	prevfp = fopen(mkfilename(filename, logname, 0), "a");
 	if (!prevfp)
 		return stderr;
 	prevname = strdup(logname);
@@ -344,17 +402,9 @@ static FILE *switchfile(const char *logname)
 	 * the start date and other info.
 	 */
 	if (ftell(prevfp) == 0) {
-		char today[12];
-		jx_t *bytes = jx_config_get("plugin.log", "bytes");
-		datedelta(today, 0);
-		if (roll && roll->type != JX_STRING)
-			fprintf(prevfp, "%s never\n", today);
-		else if (roll && !strcmp(roll->text, "daily"))
-			fprintf(prevfp, "%s daily %d", today, keep());
-		else if (roll && !strcmp(roll->text, "size"))
-			fprintf(prevfp, "%s size(%dK) %d", today, jx_int(bytes) / 1024, keep());
-		else
-			fprintf(prevfp, "%s never\n", today);
+		char header[60];
+		logheader(header);
+		fputs(header, prevfp);
 	}
 
 	/* Return the file handle */
@@ -363,6 +413,296 @@ static FILE *switchfile(const char *logname)
 
 /*****************************************************************************/
 
+/* In "async" mode, log commands only format the line and add it to a queue.
+ * A writer thread collects the queued lines every "interval" milliseconds,
+ * or sooner if many lines are waiting, and writes them in batches via
+ * writev().  The writer thread also handles rollover, so a log command
+ * never waits for the disk.
+ */
+typedef struct logline_s {
+	struct logline_s *next;
+	size_t	len;		/* length of the text */
+	char	*text;		/* the text, stored after the name */
+	char	name[1];	/* log name; allocated bigger to hold text too */
+} logline_t;
+
+#define LOGBATCH 1024	/* wake the writer early if this many lines wait */
+#define LOGIOV	256	/* max lines per writev() call */
+
+static logline_t *queue;	/* newest first; pushed without locking */
+static int	queued;		/* number of lines in the queue */
+static int	running;	/* boolean: is the writer thread running? */
+static int	stopping;	/* boolean: should the writer thread exit? */
+static pthread_t writer;
+static pthread_mutex_t wakelock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+
+/* These are used only by the writer thread */
+static int	wfd = -1;	/* file descriptor of the current log */
+static char	*wname;		/* name of the current log */
+static off_t	wsize;		/* size of the current log file */
+static char	wdate[12];	/* date when the current log was opened */
+
+/* Add a line to the queue.  This is lock-free, except when the writer needs
+ * to be woken early.
+ */
+static void logqueue(const char *logname, const char *text, size_t len)
+{
+	size_t	namelen = strlen(logname);
+	logline_t *line;
+
+	line = (logline_t *)malloc(sizeof(logline_t) + namelen + len);
+	memcpy(line->name, logname, namelen + 1);
+	line->text = line->name + namelen + 1;
+	memcpy(line->text, text, len);
+	line->len = len;
+
+	/* Push it onto the queue */
+	line->next = __atomic_load_n(&queue, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&queue, &line->next, line, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+	}
+
+	/* If a lot of lines are waiting, then don't wait for the interval */
+	if (__atomic_add_fetch(&queued, 1, __ATOMIC_RELAXED) == LOGBATCH) {
+		pthread_mutex_lock(&wakelock);
+		pthread_cond_signal(&wakeup);
+		pthread_mutex_unlock(&wakelock);
+	}
+}
+
+/* Open a log for the writer thread, doing rollover first if necessary */
+static void writeropen(const char *logname)
+{
+	struct stat st;
+	char	header[60], filename[PATH_MAX];
+
+	/* Close the previous log */
+	if (wfd > 2)
+		close(wfd);
+	free(wname);
+
+	/* Rollover, and then open the log.  If we can't, use stderr. */
+	rollover(logname);
+	wname = strdup(logname);
+	datedelta(wdate, 0);
+	wfd = open(mkfilename(filename, logname, 0), O_WRONLY|O_APPEND|O_CREAT, 0666);
+	if (wfd < 0) {
+		wfd = 2;
+		wsize = 0;
+		return;
+	}
+
+	/* If it's a new log, then write the header line */
+	wsize = fstat(wfd, &st) == 0 ? st.st_size : 0;
+	if (wsize == 0) {
+		logheader(header);
+		if (write(wfd, header, strlen(header)) > 0)
+			wsize = strlen(header);
+	}
+}
+
+/* Write a batch of lines to the writer's log, handling partial writes */
+static void writeall(struct iovec *iov, int n)
+{
+	ssize_t	did;
+
+	while (n > 0) {
+		did = writev(wfd, iov, n);
+		if (did < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		/* Skip past whatever was written */
+		while (n > 0 && did >= (ssize_t)iov->iov_len) {
+			did -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + did;
+			iov->iov_len -= did;
+		}
+	}
+}
+
+/* Write a list of lines, switching logs and doing rollover as needed */
+static void writebatch(logline_t *lines)
+{
+	struct iovec iov[LOGIOV];
+	char	today[12];
+	int	n;
+
+	if (opt.roll == ROLL_DAILY)
+		datedelta(today, 0);
+	for (n = 0; lines; lines = lines->next) {
+		/* Switch logs if the name changed or it's time to rollover */
+		if (!wname
+		 || strcmp(wname, lines->name)
+		 || (opt.roll == ROLL_SIZE && wsize >= opt.bytes)
+		 || (opt.roll == ROLL_DAILY && strcmp(today, wdate))) {
+			writeall(iov, n);
+			n = 0;
+			writeropen(lines->name);
+		}
+
+		/* Add this line to the batch.  wsize includes lines that are
+		 * batched but not written yet, so a big batch still triggers
+		 * size rollover.
+		 */
+		iov[n].iov_base = lines->text;
+		iov[n].iov_len = lines->len;
+		wsize += lines->len;
+		if (++n == LOGIOV) {
+			writeall(iov, n);
+			n = 0;
+		}
+	}
+	writeall(iov, n);
+}
+
+/* This is the writer thread */
+static void *writermain(void *unused)
+{
+	logline_t *lines, *line, *ordered;
+	struct timespec ts;
+	int	n, done;
+
+	do {
+		/* Wait for the interval to expire, or for an early wakeup */
+		pthread_mutex_lock(&wakelock);
+		if (!stopping && __atomic_load_n(&queued, __ATOMIC_RELAXED) < LOGBATCH) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += opt.interval / 1000;
+			ts.tv_nsec += (opt.interval % 1000) * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&wakeup, &wakelock, &ts);
+		}
+		done = stopping;
+		pthread_mutex_unlock(&wakelock);
+
+		/* Take all queued lines, and reverse them to get oldest first */
+		lines = __atomic_exchange_n(&queue, NULL, __ATOMIC_ACQUIRE);
+		for (ordered = NULL, n = 0; lines; n++) {
+			line = lines;
+			lines = line->next;
+			line->next = ordered;
+			ordered = line;
+		}
+		__atomic_sub_fetch(&queued, n, __ATOMIC_RELAXED);
+
+		/* Write them, and free them */
+		writebatch(ordered);
+		while (ordered) {
+			line = ordered;
+			ordered = line->next;
+			free(line);
+		}
+	} while (!done);
+
+	/* Close the log */
+	if (wfd > 2)
+		close(wfd);
+	wfd = -1;
+	free(wname);
+	wname = NULL;
+	return NULL;
+}
+
+/* Stop the writer thread, after it has written everything in the queue.
+ * This is called at exit, and before changing options.
+ */
+static void logstop(void)
+{
+	if (!running)
+		return;
+	pthread_mutex_lock(&wakelock);
+	stopping = 1;
+	pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&wakelock);
+	pthread_join(writer, NULL);
+	running = stopping = 0;
+}
+
+/* In a child process, the writer thread doesn't exist and the parent's
+ * queued lines aren't ours to write.
+ */
+static void logforked(void)
+{
+	logline_t *line;
+
+	while (queue) {
+		line = queue;
+		queue = line->next;
+		free(line);
+	}
+	queued = 0;
+	running = stopping = 0;
+	pthread_mutex_init(&wakelock, NULL);
+	pthread_cond_init(&wakeup, NULL);
+}
+
+/* Start the writer thread, if it isn't running already.  Returns 1 if it's
+ * running, or 0 if it couldn't be started.
+ */
+static int logstart(void)
+{
+	static int registered;
+
+	if (running)
+		return 1;
+	if (!registered) {
+		atexit(logstop);
+		pthread_atfork(NULL, NULL, logforked);
+		registered = 1;
+	}
+
+	/* Anything written synchronously must come before queued lines */
+	if (prevfp)
+		fflush(prevfp);
+
+	if (pthread_create(&writer, NULL, writermain, NULL) == 0)
+		running = 1;
+	return running;
+}
+
+/*****************************************************************************/
+
+/* Log lines are formatted into this buffer before being written or queued */
+static char	*linebuf;
+static size_t	linesize, linelen;
+
+/* Append text to linebuf */
+static void lineput(const char *text, size_t len)
+{
+	if (linelen + len >= linesize) {
+		linesize = ((linelen + len) | 0x3ff) + 1;
+		linebuf = (char *)realloc(linebuf, linesize);
+	}
+	memcpy(linebuf + linelen, text, len);
+	linelen += len;
+	linebuf[linelen] = '\0';
+}
+
+/* Append printf-style formatted text to linebuf */
+static void lineprintf(const char *fmt, ...)
+{
+	char	buf[100];
+	int	len;
+	va_list	ap;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+	lineput(buf, len < sizeof buf ? len : sizeof buf - 1);
+}
+
+/*****************************************************************************/
+
 /* Parse a logset command.  Mostly this just sets the default output for any
  * following log commands.
  */
@@ -501,62 +841,51 @@ static jxcmd_t *log_parse(jxsrc_t *src, jxcmdout_t **referr)
 static jxcmdout_t *log_run(jxcmd_t *cmd, jxcontext_t **refcontext)
 {
 	jx_t *list, *scan;
-	int	showdate, showtime, showpid, showfile, showline;
 	int	lastchar;
 	jxformat_t tweaked;
 
 	/* If this detail level is too high, skip it */
-	scan = jx_config_get("plugin.log", "detail");
-	if (cmd->var - '0' > jx_int(scan))
+	logconfig();
+	if (cmd->var - '0' > opt.detail)
 		return NULL;
 
-	/* Decide where to log */
-	tweaked = jx_format_default;
-	tweaked.fp = NULL;
-	if (strcmp("tty", cmd->key)) {
-		tweaked.fp = switchfile(cmd->key);
-	}
-
 	/* Write any line info */
-	showdate = getbool("date");
-	showtime = getbool("time");
-	showpid = getbool("pid");
-	showfile = getbool("file");
-	showline = getbool("line");
-	if (showdate || showtime) {
+	linelen = 0;
+	lineput("", 0);
+	if (opt.date || opt.time) {
 		time_t now;
 		struct tm tm;
-		int utc = getbool("utc");
+		int utc = opt.utc;
 		time(&now);
 		if (utc)
 			gmtime_r(&now, &tm);
 		else
 			localtime_r(&now, &tm);
-		if (showdate && showtime)
-			jx_user_printf(&tweaked, "log", "%4d-%02d-%02dT%02d:%02d:%02d%s ",
+		if (opt.date && opt.time)
+			lineprintf("%4d-%02d-%02dT%02d:%02d:%02d%s ",
 				tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
 				tm.tm_hour, tm.tm_min, tm.tm_sec, utc ? "Z" : "");
-		else if (showdate)
-			jx_user_printf(&tweaked, "log", "%4d-%02d-%02d ",
+		else if (opt.date)
+			lineprintf("%4d-%02d-%02d ",
 				tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
 		else
-			jx_user_printf(&tweaked, "log", "%02d:%02d:%02d%s ",
+			lineprintf("%02d:%02d:%02d%s ",
 				tm.tm_hour, tm.tm_min, tm.tm_sec, utc ? "Z" : "");
 	}
-	if (showpid) {
-		jx_user_printf(&tweaked, "log", "[%5d] ", (int)getpid());
+	if (opt.pid) {
+		lineprintf("[%5d] ", (int)getpid());
 	}
-	if (showfile || showline) {
+	if (opt.file || opt.line) {
 		int lineno;
 		jxfile_t *jf = jx_file_containing(cmd->where, &lineno);
 		if (jf) { 
-			if (showfile)
-				jx_user_printf(&tweaked, "log", "%s", jf->filename);
-			if (showfile && showline)
-				jx_user_ch(':');
-			if (showline)
-				jx_user_printf(&tweaked, "log", "%d", lineno);
-			jx_user_ch(' ');
+			if (opt.file)
+				lineput(jf->filename, strlen(jf->filename));
+			if (opt.file && opt.line)
+				lineput(":", 1);
+			if (opt.line)
+				lineprintf("%d", lineno);
+			lineput(" ", 1);
 		}
 	}
 
@@ -565,40 +894,59 @@ static jxcmdout_t *log_run(jxcmd_t *cmd, jxcontext_t **refcontext)
 
 	/* If it's an error then log the error instead of the expression */
 	if (jx_is_null(list) && *list->text) {
-		jx_user_printf(&tweaked, "log", "Expression error: %s\n", list->text);
+		lineput("Expression error: ", 18);
+		lineput(list->text, strlen(list->text));
+		lastchar = 'x';
 	} else {
 		/* Output each expression with a space delimiter */
 		lastchar = '\n';
 		for (scan = list->first; scan; scan = scan->next) {
 			/* Space between items */
 			if (scan != list->first)
-				jx_user_ch(' ');
+				lineput(" ", 1);
 
 			/* Output strings plainly (no quotes), but convert
 			 * anything else to a JSON string.
 			 */
 			if (scan->type == JX_STRING) {
-				jx_user_printf(&tweaked, "log", "%s", scan->text);
-				if (*scan->text)
-					lastchar = scan->text[strlen(scan->text) - 1];
+				size_t len = strlen(scan->text);
+				lineput(scan->text, len);
+				if (len > 0)
+					lastchar = scan->text[len - 1];
 			} else {
 				char *tmp = jx_serialize(scan, NULL);
-				jx_user_printf(&tweaked, "log", "%s", tmp);
+				lineput(tmp, strlen(tmp));
 				free(tmp);
 				lastchar = 'x'; /* Never empty, never '\n' */
 			}
 		}
-
-		/* If the last character wasn't a newline, then add a newline */
-		if (lastchar != '\n')
-			jx_user_ch('\n');
 	}
 
+	/* If the last character wasn't a newline, then add a newline */
+	if (lastchar != '\n')
+		lineput("\n", 1);
+
 	/* Clean up */
 	jx_free(list);
 
+	/* Decide where to log.  In async mode, lines for log files are
+	 * just queued for the writer thread.
+	 */
+	tweaked = jx_format_default;
+	tweaked.fp = NULL;
+	if (strcmp("tty", cmd->key)) {
+		if (opt.async && logstart()) {
+			logqueue(cmd->key, linebuf, linelen);
+			return NULL;
+		}
+		tweaked.fp = switchfile(cmd->key);
+	}
+
+	/* Write it */
+	jx_user_printf(&tweaked, "log", "%s", linebuf);
+
 	/* If supposed to flush, then do that */
-	if (tweaked.fp && getbool("flush"))
+	if (tweaked.fp && opt.flush)
 		fflush(tweaked.fp);
 
 	/* Success! */
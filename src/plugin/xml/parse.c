@@ -350,8 +350,6 @@ static xml_parse_tag_t xml_parse_tag(xml_parse_state_t *state)
 		}
 		return ret;
 	}
-{char *tmp = jx_serialize(ret.content,0); fprintf(stderr, "%s=%s\n", state->name, tmp); free(tmp); }
-{char *tmp = ret.attributes ? jx_serialize(ret.attributes,0) : strdup("null"); fprintf(stderr, "%s=%s\n", state->attrname, tmp); free(tmp); }
 
 	/* We expect to be at a closing tag.  If not, either that's an error. */
 	if (*state->cursor != '<' || state->cursor[1] != '/') {
@@ -457,9 +455,14 @@ static jx_t *xml_parse_helper(xml_parse_state_t *state)
 					} while (isdigit(*n));
 					if (!*n) {
 						/* Yes, it looks like a number!
-						 * Convert to number.
+						 * Convert to number.  We need a
+						 * new node for this, since
+						 * numbers have extra space for
+						 * caching the binary value.
 						 */
-						parsed->type = JX_NUMBER;
+						jx_t *number = jx_number(parsed->text, -1);
+						jx_free(parsed);
+						parsed = number;
 					}
 				}
 			}
@@ -485,7 +488,6 @@ static jx_t *xml_parse_helper(xml_parse_state_t *state)
 	/* We found a nested tag.  Parse it and its content. May be repeated. */
 	parsed = jx_object();
 	do {
-{char *tmp = jx_serialize(parsed,0); fprintf(stderr, "%s\n", tmp); free(tmp); }
 		/* Parse a tag */
 		tag = xml_parse_tag(state);
 
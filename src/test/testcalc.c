@@ -27,9 +27,11 @@ void usage()
         puts("       -Jflags Debug: +/-/= a:abort c:jx_calc_parse e:jx_by_expr t:trace");
         puts("This reads a series of tests from a file, and writes any inconsistencies to");
         puts("stdout. Input lines starting with # are section headers. Lines starting with");
-        puts("name= define data to be used in tests later in the file. Lines that don't");
-        puts("start with #, name=, or = are tests. Lines starting with = are the expected");
-        puts("result of the preceding test.");
+        puts("name= define data to be used in tests later in the file. Lines starting with");
+        puts("!name= change a setting for later tests. Lines starting with $ are shell");
+        puts("commands, tested by their output, and may be continued by ending lines with");
+        puts("\\. Lines that don't start with #, name=, !, $, or = are tests. Lines");
+        puts("starting with = are the expected result of the preceding test.");
         exit(0);
 }
 
@@ -76,12 +78,43 @@ char *test(char *str, jx_t *names)
         return resultstr;
 }
 
+/* Run a shell command as a test.  This is for testing the jx program itself,
+ * with its command-line flags.  The output is returned as a single line, with
+ * any newlines except the last converted to spaces.
+ */
+char *command(char *str)
+{
+	FILE	*fp;
+	char	*resultstr;
+	size_t	len, size;
+	int	ch;
+
+	fflush(stdout);
+	fp = popen(str, "r");
+	if (!fp)
+		return NULL;
+	size = 100;
+	resultstr = (char *)malloc(size);
+	for (len = 0; (ch = getc(fp)) != EOF; len++) {
+		if (len + 1 >= size) {
+			size *= 2;
+			resultstr = (char *)realloc(resultstr, size);
+		}
+		resultstr[len] = (ch == '\n' ? ' ' : ch);
+	}
+	if (len > 0 && resultstr[len - 1] == ' ')
+		len--;
+	resultstr[len] = '\0';
+	pclose(fp);
+	return resultstr;
+}
+
 /* Read a series of tests, and run them */
 void testfile(FILE *in, count_t *counts)
 {
-        char    buf[1000];
+        char    buf[4000];
         char	section[1000];
-	char	expression[1000];
+	char	expression[4000];
 	char	*resultstr = NULL;
         char    *tmp;
         jx_t  *names;
@@ -96,10 +129,19 @@ void testfile(FILE *in, count_t *counts)
 
         /* For each line ... */
         while (fgets(buf, sizeof buf, in)) {
-                /* Strip off the newline */
+                /* Strip off the newline.  A line ending with \ continues
+                 * on the next line, which keeps long $command tests readable.
+                 */
                 tmp = strchr(buf, '\n');
                 if (tmp)
                         *tmp = '\0';
+		while ((tmp = strchr(buf, '\0')) > buf && tmp[-1] == '\\'
+		    && fgets(tmp, sizeof buf - (tmp - buf), in)) {
+			tmp[-1] = '\n';
+			tmp = strchr(tmp, '\n');
+			if (tmp)
+				*tmp = '\0';
+		}
 
 		/* Skip blank lines */
 		if (!buf[0])
@@ -126,6 +168,16 @@ void testfile(FILE *in, count_t *counts)
 			continue;
 		}
 
+                /* If !name=value then change a setting */
+                if (buf[0] == '!') {
+                        tmp = strchr(buf, '=');
+                        if (tmp) {
+                                *tmp++ = '\0';
+                                jx_config_set(NULL, buf + 1, jx_parse_string(tmp));
+                        }
+                        continue;
+                }
+
                 /* If name=value then parse it and store it */
                 if (isalpha(buf[0])) {
                         for (tmp = buf; isalnum(*tmp); tmp++) {
@@ -147,7 +199,10 @@ void testfile(FILE *in, count_t *counts)
 		strcpy(expression, buf);
 		if (resultstr)
 			free(resultstr);
-                resultstr = test(buf, names);
+		if (buf[0] == '$')
+			resultstr = command(buf + 1);
+		else
+			resultstr = test(buf, names);
                 counts->tests++;
         }
 
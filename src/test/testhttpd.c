@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* This is a tiny HTTP/1.1 server that stands in for a real one when testing
+ * the curl plugin.  It listens on an unused port of 127.0.0.1, writes the
+ * port number to stdout, and then runs in the background.  It understands
+ * these requests:
+ *
+ *   GET /n/digits	Wait 100ms, then respond with [digits]
+ *   GET /stats		Respond with the number of connections accepted,
+ *			/n requests handled, and the most /n requests in
+ *			progress at once since the last /stats, and then
+ *			reset those counts.
+ *   GET /quit		Respond with null, and then exit.
+ *
+ * Connections are kept alive, so tests can check that clients reuse them.
+ * The server also exits if it's left running for 60 seconds.
+ */
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int connections, requests, inflight, peak;
+
+/* Send a response with a JSON body */
+static int respond(int fd, const char *body)
+{
+	char	buf[1000];
+	int	len;
+
+	len = snprintf(buf, sizeof buf,
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: application/json\r\n"
+		"Content-Length: %d\r\n"
+		"\r\n"
+		"%s", (int)strlen(body), body);
+	return write(fd, buf, len) == len;
+}
+
+/* Handle one request.  Return 1 to keep the connection, or 0 to close it */
+static int request(int fd, char *line)
+{
+	char	body[200];
+	char	*path, *end;
+
+	/* We only care about the path of a GET request */
+	if (strncmp(line, "GET /", 5))
+		return 0;
+	path = line + 4;
+	end = strchr(path, ' ');
+	if (end)
+		*end = '\0';
+
+	if (!strncmp(path, "/n/", 3)) {
+		pthread_mutex_lock(&mutex);
+		requests++;
+		if (++inflight > peak)
+			peak = inflight;
+		pthread_mutex_unlock(&mutex);
+		usleep(100000);
+		pthread_mutex_lock(&mutex);
+		inflight--;
+		pthread_mutex_unlock(&mutex);
+		snprintf(body, sizeof body, "[%.100s]", path + 3);
+		return respond(fd, body);
+	}
+	if (!strcmp(path, "/stats")) {
+		pthread_mutex_lock(&mutex);
+		snprintf(body, sizeof body,
+			"{\"connections\":%d,\"requests\":%d,\"peak\":%d}",
+			connections, requests, peak);
+		connections = requests = peak = 0;
+		pthread_mutex_unlock(&mutex);
+		return respond(fd, body);
+	}
+	if (!strcmp(path, "/quit")) {
+		respond(fd, "null");
+		exit(0);
+	}
+	return 0;
+}
+
+/* Read requests from a connection until the client closes it */
+static void *connection(void *arg)
+{
+	int	fd = (int)(long)arg;
+	char	buf[4000];
+	size_t	used = 0;
+	ssize_t	got;
+	char	*end;
+
+	for (;;) {
+		/* Read until we have a complete request header */
+		buf[used] = '\0';
+		while (!(end = strstr(buf, "\r\n\r\n"))) {
+			if (used + 1 >= sizeof buf)
+				goto Close;
+			got = read(fd, buf + used, sizeof buf - used - 1);
+			if (got <= 0)
+				goto Close;
+			used += got;
+			buf[used] = '\0';
+		}
+
+		/* Handle it, and then discard it from the buffer */
+		end += 4;
+		end[-4] = '\0';
+		if (!request(fd, buf))
+			goto Close;
+		used -= end - buf;
+		memmove(buf, end, used);
+	}
+Close:
+	close(fd);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof addr;
+	pthread_t thread;
+	int	sock, fd;
+
+	/* Listen on any unused port */
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (sock < 0
+	 || bind(sock, (struct sockaddr *)&addr, sizeof addr) < 0
+	 || listen(sock, 20) < 0
+	 || getsockname(sock, (struct sockaddr *)&addr, &addrlen) < 0) {
+		perror("testhttpd");
+		return 1;
+	}
+
+	/* Report the port, and then continue in the background */
+	printf("%d\n", ntohs(addr.sin_port));
+	fflush(stdout);
+	if (fork() != 0)
+		return 0;
+	fd = open("/dev/null", O_RDWR);
+	dup2(fd, 0);
+	dup2(fd, 1);
+	close(fd);
+	signal(SIGPIPE, SIG_IGN);
+	alarm(60);
+
+	/* Handle each connection in a separate thread */
+	while ((fd = accept(sock, NULL, NULL)) >= 0) {
+		pthread_mutex_lock(&mutex);
+		connections++;
+		pthread_mutex_unlock(&mutex);
+		pthread_create(&thread, NULL, connection, (void *)(long)fd);
+		pthread_detach(thread);
+	}
+	return 0;
+}